@@ -0,0 +1,99 @@
+/**
+ * AES ciphers - prepared EVP contexts for the secure build.
+ *
+ * AesCipher is the AES-CBC of the secure payload message. The key schedule is set up once when
+ * constructed; each call only resets the IV, so a packet pays for the cipher alone. Goes
+ * through the EVP interface, which picks the AES-NI implementation when the CPU has it. Input
+ * is whole blocks without padding; the caller pads with zeros, which gives the same bytes as
+ * AES_cbc_encrypt().
+ *
+ * AesGcmCipher seals whole datagrams with AES-GCM (see UdpWrapper): encrypted and
+ * authenticated under a nonce that must never repeat for the key.
+ *
+ * Not thread-safe; each thread keeps its own (see Payload and UdpWrapper).
+ */
+
+#ifndef JAM_AES_CIPHER_H
+#define JAM_AES_CIPHER_H
+
+#include <cstdint>
+
+#include <openssl/evp.h>
+
+class AesCipher {
+public:
+    /**
+     * @param key           256-bit key
+     * @param encrypt       TRUE to encrypt, FALSE to decrypt
+     */
+    AesCipher(const unsigned char *key, bool encrypt);
+
+    ~AesCipher();
+
+    AesCipher(const AesCipher &) = delete;
+    AesCipher &operator=(const AesCipher &) = delete;
+
+    /**
+     * Encrypt or decrypt with a zero IV
+     *
+     * @param in            input bytes
+     * @param out           output bytes, may be the same as in
+     * @param length        multiple of AES_BLOCK_SIZE
+     *
+     * @return              TRUE on success, FALSE otherwise
+     */
+    bool Process(const uint8_t *in, uint8_t *out, uint32_t length);
+
+private:
+    EVP_CIPHER_CTX *ctx_;
+    bool ready_;                    // Key schedule set up
+};
+
+class AesGcmCipher {
+public:
+    enum {
+        NONCE_LENGTH = 12,
+        TAG_LENGTH = 16
+    };
+
+    /**
+     * @param key           256-bit key
+     */
+    AesGcmCipher(const unsigned char *key);
+
+    ~AesGcmCipher();
+
+    AesGcmCipher(const AesGcmCipher &) = delete;
+    AesGcmCipher &operator=(const AesGcmCipher &) = delete;
+
+    /**
+     * Encrypt in place and compute the tag
+     *
+     * @param nonce         NONCE_LENGTH bytes, never used before with this key
+     * @param data          bytes to encrypt
+     * @param length        any length
+     * @param tag           returned TAG_LENGTH bytes
+     *
+     * @return              TRUE on success, FALSE otherwise
+     */
+    bool Seal(const uint8_t *nonce, uint8_t *data, uint32_t length, uint8_t *tag);
+
+    /**
+     * Decrypt in place and verify the tag
+     *
+     * @param nonce         NONCE_LENGTH bytes the data was sealed with
+     * @param data          bytes to decrypt, not to be used if verification fails
+     * @param length        any length
+     * @param tag           TAG_LENGTH bytes the data was sealed with
+     *
+     * @return              TRUE if authentic, FALSE otherwise
+     */
+    bool Open(const uint8_t *nonce, uint8_t *data, uint32_t length, const uint8_t *tag);
+
+private:
+    EVP_CIPHER_CTX *seal_ctx_;
+    EVP_CIPHER_CTX *open_ctx_;
+    bool ready_;                    // Key schedule set up
+};
+
+#endif //JAM_AES_CIPHER_H
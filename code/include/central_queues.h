@@ -1,6 +1,7 @@
 /**
  * Central Queues is used for inter-communication between modules in JAM.
- * It has multiple thread-safe queues with a single condition variable to wake up JAM.
+ * It has multiple thread-safe queues behind one mailbox: a bitmask of queues that may have
+ * data and a single EventNotifier to wake up JAM.
  *
  * @author: Hung Nguyen
  * @version 1.0 04/07/16
@@ -16,7 +17,11 @@
 #endif
 
 #include "concurrent_queue.h"
+#include "event_notifier.h"
+#include "mpsc_queue.h"
 
+#include <atomic>
+#include <vector>
 #include <sys/socket.h>
 #include "boost/variant.hpp"
 
@@ -63,14 +68,40 @@ public:
     void push(QueueType type, QueueParam const &in);
 
     /**
-     * Check if queue is empty
+     * Wait until a queue may have data or terminate is signaled
      *
      * @param time      time to wait if no data in miliseconds
      *
-     * @return          TRUE if queue is there is data, FALSE otherwise
+     * @return          TRUE if there may be data (or terminate), FALSE on timeout
      */
     bool wait_for_data(uint32_t time);
 
+    /**
+     * Check without waiting if a queue may have data or terminate is signaled
+     *
+     * @return          TRUE if there may be data (or terminate), FALSE otherwise
+     */
+    bool has_data();
+
+    /**
+     * Take and clear the set of queues that may have data
+     *
+     * A queue pushed to after this call shows up in the next one, so draining every returned
+     * queue never misses an element. A returned queue may turn out to be empty.
+     *
+     * @return          bitmask of queue_bit() values
+     */
+    uint32_t take_ready();
+
+    /**
+     * Get mailbox bit of a queue
+     *
+     * @param type      queue selected
+     *
+     * @return          bit of the queue in take_ready() result
+     */
+    static uint32_t queue_bit(QueueType type);
+
     /**
      * Get element from queue if not empty
      * (need to have separate function for each queue as compiler requirements)
@@ -89,6 +120,25 @@ public:
 
     bool try_pop_history_request(int32_t &out);
 
+    /**
+     * Move up to max elements from queue with a single synchronization
+     * (queue stays marked as ready if max was reached)
+     *
+     * @param out       list to be appended to
+     * @param max       maximum number of elements
+     *
+     * @return          TRUE if has data returned, FALSE otherwise
+     */
+    bool drain_user_out(std::vector<Payload> &out, size_t max);
+
+    bool drain_udp_in(std::vector<Payload> &out, size_t max);
+
+    bool drain_udp_crash(std::vector<sockaddr_in> &out, size_t max);
+
+    bool drain_leader_out(std::vector<Payload> &out, size_t max);
+
+    bool drain_history_request(std::vector<int32_t> &out, size_t max);
+
     /**
      * Set terminate flag to TRUE
      */
@@ -97,20 +147,30 @@ public:
     bool is_terminate();
 
 private:
-    ConcurrentQueue<Payload> user_out_queue_;           // Thread-safe outgoing message payload queue from UserHandler
+    SingleConsumerQueue<Payload> user_out_queue_;       // Thread-safe outgoing message payload queue from UserHandler
 
-    ConcurrentQueue<Payload> udp_in_queue_;             // Thread-safe incoming payload queue for processing
-    ConcurrentQueue<sockaddr_in> udp_crash_queue;       // Thread-safe crash notification queue from UdpHandler
+    SingleConsumerQueue<Payload> udp_in_queue_;         // Thread-safe incoming payload queue for processing
+    SingleConsumerQueue<sockaddr_in> udp_crash_queue;   // Thread-safe crash notification queue from UdpHandler
 
+    // JAM pushes to these while handling them, so they stay unbounded
     ConcurrentQueue<Payload> leader_out_queue_;         // Thread-safe outgoing payload queue for processing
 
     ConcurrentQueue<int32_t> history_request_queue_;    // Thread-safe queue for HoldQueue to request missing payload
 
-    mutable boost::mutex m_cond_;                       // mutex just for condition variable
-    mutable boost::mutex m_exit_;                       // mutex for exit_
-    boost::condition_variable cond_variable_;           // To notify change happens in one of the queues
+    std::atomic<uint32_t> ready_;                       // Bit per queue that may have data
+    EventNotifier notifier_;                            // To wake up JAM when a queue becomes ready
+
+    std::atomic<bool> exit_;                            // Signal to terminate the chat
+
+    /**
+     * Mark queue as ready and wake up JAM
+     *
+     * @param type      queue selected
+     */
+    void MarkReady(QueueType type);
 
-    bool exit_;                                         // Signal to terminate the chat
+    template<typename Queue, typename Container>
+    bool Drain(QueueType type, Queue &queue, Container &out, size_t max);
 };
 
 #endif //JAM_CENTRAL_QUEUES_H
@@ -13,8 +13,16 @@
 
 class ClientInfo {
 public:
+    // Bits of the encoded flags byte
+    enum {
+        LEADER_FLAG = 0x01,
+        MULTICAST_FLAG = 0x02,      // Client receives the leader's multicast group
+        COMPACT_FLAG = 0x04         // Client decodes the compact payload header
+    };
+
     ClientInfo(sockaddr_in client);
-    ClientInfo(sockaddr_in client, const std::string& username, bool is_Leader = false);
+    ClientInfo(sockaddr_in client, const std::string& username, bool is_Leader = false, bool is_multicast = false,
+               bool is_compact = false);
 
     sockaddr_in get_sock_address();
     static uint32_t get_packet_size();
@@ -24,6 +32,14 @@ public:
     std::string get_username();
     bool is_leader();
     void set_leader(bool val);
+    bool is_multicast();
+    void set_multicast(bool val);
+    bool is_compact();
+    void set_compact(bool val);
+
+    // Session user id sent in place of the user name in compact payload headers
+    uint16_t get_user_id();
+    static uint16_t UserIdOf(const std::string& username);
 
     void print_client();
 
@@ -34,6 +50,8 @@ private:
     sockaddr_in client_;
     std::string username_;
     bool isLeader_;
+    bool isMulticast_;
+    bool isCompact_;
 
     int ip_address_[4];
     int port_;
@@ -9,6 +9,12 @@
 #include "client_info.h"
 #include "config.h"
 
+#ifdef SECURE
+#include "payload_secure.h"
+#else
+#include "payload.h"
+#endif
+
 //TODO: client list is a vector of clients (which includes username, ip_address, client_port)?
 
 class ClientManager {
@@ -24,6 +30,14 @@ public:                    // begin public section
 
     std::vector<sockaddr_in> GetAllClientSockAddress();
 
+    // Return clients that do not receive the multicast group
+    std::vector<sockaddr_in> GetUnicastClientSockAddress();
+
+    // Return the clients a node relays ordered messages to. The leader is the root; every other
+    // client sits in address order in a heap of the given degree, so each client derives the
+    // same tree from its own list.
+    std::vector<sockaddr_in> GetRelayChildren(sockaddr_in node, uint32_t degree);
+
     long get_client_count();
 
     // Return a list of higher order clients for election
@@ -32,13 +46,24 @@ public:                    // begin public section
     std::vector<ClientInfo> GetHigherOrderClients(ClientInfo client);
 
     bool AddClient(ClientInfo client);
-    bool AddClient(sockaddr_in client, const std::string &username, bool isLeader);
+    bool AddClient(sockaddr_in client, const std::string &username, bool isLeader, bool isMulticast = false,
+                   bool isCompact = false);
 
     bool RemoveClient(sockaddr_in client, std::string *username);
     bool RemoveClient(ClientInfo client, std::string *username);
 
     void RemoveAllClients();
 
+    // Return the compact header if every client decodes it, the fixed one otherwise
+    HeaderVersion GetHeaderVersion();
+
+    // Return the session user id of a user name, 0 if no client has that name or another client
+    // has the same id
+    uint16_t GetUserId(const std::string &username);
+
+    // Find the user name of a session user id, FALSE if unknown or shared by several clients
+    bool GetUsername(uint16_t id, std::string *username);
+
     static std::string StringifyClient(sockaddr_in client);
     void PrintClients();
 
@@ -63,7 +88,7 @@ public:                    // begin public section
 private:
     sockaddr_in self_addr_;
 
-    uint8_t encoded_data_[MAX_CLIENT_BUFFER_LENGTH];
+    std::vector<uint8_t> encoded_data_;     // Grows with the list, sent in fragments when long
     uint32_t encoded_data_size_;
     std::vector<ClientInfo> client_list_;
 };
@@ -1,6 +1,9 @@
 /**
  * Thread-safe blocking queue template
  *
+ * Elements live in a ring that doubles when full and never shrinks, so a queue that reached its
+ * working size pushes and pops without touching the heap.
+ *
  * @author: Hung Nguyen
  * @version 1.0 04/03/16
  */
@@ -8,18 +11,52 @@
 #ifndef JAM_CONCURRENT_QUEUE_H
 #define JAM_CONCURRENT_QUEUE_H
 
-#include <queue>
+#include <cstdint>
+#include <utility>
+#include <vector>
 #include "boost/thread/mutex.hpp"
 #include "boost/thread/condition_variable.hpp"
 
 template<typename T>
 class ConcurrentQueue {
 private:
-    std::queue<T> queue_;
+    enum {
+        MIN_CAPACITY = 16                           // Ring size of the first push
+    };
+
+    std::vector<T> ring_;                           // Capacity is a power of 2
+    size_t head_;                                   // Index of the front element
+    size_t count_;                                  // Elements in the ring
     mutable boost::mutex m_queue_;
     boost::condition_variable cond_variable_;
 
+    // Caller holds m_queue_
+    template<typename U>
+    void Enqueue(U &&t) {
+        if (count_ == ring_.size()) {
+            std::vector<T> grown(ring_.empty() ? (size_t) MIN_CAPACITY : ring_.size() * 2);
+            for (size_t i = 0; i < count_; ++i) {
+                grown[i] = std::move(ring_[(head_ + i) & (ring_.size() - 1)]);
+            }
+            ring_.swap(grown);
+            head_ = 0;
+        }
+        ring_[(head_ + count_) & (ring_.size() - 1)] = std::forward<U>(t);
+        count_++;
+    }
+
+    // Caller holds m_queue_ and checked the ring is not empty
+    void Dequeue(T &t) {
+        t = std::move(ring_[head_]);
+        ring_[head_] = T();                         // Let go of whatever the moved-from element still holds
+        head_ = (head_ + 1) & (ring_.size() - 1);
+        count_--;
+    }
+
 public:
+    ConcurrentQueue() : head_(0), count_(0) {
+    }
+
     /**
      * Get queue size
      *
@@ -27,7 +64,7 @@ public:
      */
     size_t size() {
         boost::mutex::scoped_lock lock(m_queue_);
-        return queue_.size();
+        return count_;
     }
 
     /**
@@ -37,7 +74,7 @@ public:
      */
     bool is_empty() {
         boost::mutex::scoped_lock lock(m_queue_);
-        return queue_.empty();
+        return count_ == 0;
     }
 
     /**
@@ -47,12 +84,37 @@ public:
      */
     void push(T const &t) {
         boost::mutex::scoped_lock lock(m_queue_);
-        queue_.push(t);
+        Enqueue(t);
+        lock.unlock();
+        cond_variable_.notify_all();
+    }
+
+    void push(T &&t) {
+        boost::mutex::scoped_lock lock(m_queue_);
+        Enqueue(std::move(t));
         lock.unlock();
         cond_variable_.notify_all();
     }
 
-    // TODO: implement multiple push with single lock
+    /**
+     * Insert range of elements into queue with a single lock and notification
+     *
+     * @param first     first element to be inserted (elements are moved from)
+     * @param last      end of range
+     */
+    template<typename InputIt>
+    void push_many(InputIt first, InputIt last) {
+        if (first == last) {
+            return;
+        }
+
+        boost::mutex::scoped_lock lock(m_queue_);
+        for (; first != last; ++first) {
+            Enqueue(std::move(*first));
+        }
+        lock.unlock();
+        cond_variable_.notify_all();
+    }
 
     /**
      * Get element from queue if not empty (no wait)
@@ -63,15 +125,52 @@ public:
      */
     bool try_pop(T &t) {
         boost::mutex::scoped_lock lock(m_queue_);
-        if (queue_.empty()) {
+        if (count_ == 0) {
             return false;
         }
 
-        t = queue_.front();
-        queue_.pop();
+        Dequeue(t);
         return true;
     }
 
+    /**
+     * Get up to max elements from queue with a single lock (no wait)
+     *
+     * @param out       elements to be assigned values
+     * @param max       maximum number of elements
+     *
+     * @return          number of elements returned
+     */
+    size_t try_pop_many(T *out, size_t max) {
+        boost::mutex::scoped_lock lock(m_queue_);
+        size_t count = 0;
+        while (count < max && count_ != 0) {
+            Dequeue(out[count++]);
+        }
+        return count;
+    }
+
+    /**
+     * Move up to max elements from queue to the end of a container with a single lock (no wait)
+     *
+     * @param out       container to be appended to
+     * @param max       maximum number of elements
+     *
+     * @return          number of elements appended
+     */
+    template<typename Container>
+    size_t drain_into(Container &out, size_t max = SIZE_MAX) {
+        boost::mutex::scoped_lock lock(m_queue_);
+        size_t count = 0;
+        while (count < max && count_ != 0) {
+            T t;
+            Dequeue(t);
+            out.push_back(std::move(t));
+            count++;
+        }
+        return count;
+    }
+
     /**
      * Get element from queue
      *
@@ -79,12 +178,33 @@ public:
      */
     void pop(T &t) {
         boost::mutex::scoped_lock lock(m_queue_);
-        while (queue_.empty()) {
+        while (count_ == 0) {
             cond_variable_.wait(lock);
         }
 
-        t = queue_.front();
-        queue_.pop();
+        Dequeue(t);
+    }
+
+    /**
+     * Get element from queue, waiting at most time if empty
+     *
+     * @param t         element to be assigned value
+     * @param time      time to wait in miliseconds
+     *
+     * @return          TRUE if has data returned, FALSE on timeout
+     */
+    bool pop_for(T &t, uint32_t time) {
+        boost::mutex::scoped_lock lock(m_queue_);
+        boost::chrono::steady_clock::time_point until =
+                boost::chrono::steady_clock::now() + boost::chrono::milliseconds(time);
+        while (count_ == 0) {
+            if (cond_variable_.wait_until(lock, until) == boost::cv_status::timeout && count_ == 0) {
+                return false;
+            }
+        }
+
+        Dequeue(t);
+        return true;
     }
 };
 
@@ -8,6 +8,10 @@
 #ifndef JAM_CONFIG_H
 #define JAM_CONFIG_H
 
+#include <cerrno>
+#include <cstdio>
+#include <iostream>
+
 #ifdef SPECLAB
 #define DEFAULT_INTERFACE           "em1"   // Default UDP interface
 #else
@@ -20,23 +24,64 @@
 #define MAX_UDP_BIND_RETRIES        20      // Number of retries for different UDP port to bind
 
 #define MAX_MESSAGE_LENGTH          256     // Maximum message length per payload
+#define MAX_FRAGMENTED_LENGTH       8192    // Maximum message length, from MAX_MESSAGE_LENGTH on it is sent in fragments
+#define FRAGMENT_LENGTH             240     // Message bytes per fragment (multiple of 16 for SECURE builds)
+#define MAX_REASSEMBLY_BUFFERS      16      // Partly received fragmented messages kept per reader (oldest dropped)
+#define REASSEMBLY_TIMEOUT          10000   // Time a partly received message waits for missing fragments in miliseconds
 #define MAX_USER_NAME_LENGTH        20      // Maximum displayed user name length
 #define MAX_BUFFER_LENGTH           512     // Maximum UDP socket buffer length
+#define PAYLOAD_HEADER_VERSION      1       // Payload header advertised on join (0 fixed only, 1 also compact)
 #define DEFAULT_NO_ORDER            -1      // Default value for payload
 #define DEFAULT_FIRST_ORDER         0       // Default order for the first message
 
 #define MAX_HOLDBACK_QUEUE_LENGTH   100     // Maximum length of hold back and history queue
 #define NUM_MISSING_ORDER           5       // Number of tries for missing
+#define MAX_MISSING_RANGES          8       // Maximum gaps in order reported per recovery round
+
+#define MAX_CLIENT_BUFFER_LENGTH    MAX_FRAGMENTED_LENGTH   // Maximum client list encoded length
+
+#define UDP_RECEIVE_WINDOW          1024    // Number of payload uids kept track per sender to prevent duplicate
+#define RECEIVE_WINDOW_SHARDS       16      // Independently locked parts of the received history
+#define NUM_UDP_RETRIES             2       // Minimum number of UDP resend before notify crash
+#define UDP_TIMEOUT                 1000    // Resend timeout for a peer without RTT sample in miliseconds
+#define UDP_MIN_TIMEOUT             100     // Lower bound of the RTT based resend timeout in miliseconds
+#define UDP_MAX_TIMEOUT             8000    // Upper bound of the resend timeout and its backoff in miliseconds
+#define UDP_MIN_CRASH_TIMEOUT       3000    // Minimum time without ACK before notify crash in miliseconds
+#define RETRANSMIT_TICK             1       // Retransmission timer granularity in miliseconds
+#define RETRANSMIT_WHEEL_SLOTS      4096    // Number of timing wheel buckets (one lap = slots * tick)
+#define UDP_BATCH_SIZE              16      // Maximum datagrams per recvmmsg/sendmmsg call (1 disables batching)
+#define UDP_READERS                 1       // Sockets sharing the port (SO_REUSEPORT), each with its own reader thread
+#define UDP_READER_TIMEOUT          200     // Wake-up of readers sharing the port to check for termination in miliseconds
+#define MAX_SACK_RANGES             8       // Maximum selective ACK ranges carried by one ACK payload
+#define ACK_DELAY                   5       // Time an ACK waits for a payload to piggyback on in miliseconds (0 sends at once)
+#define ACK_COALESCE_THRESHOLD      16      // Number of payloads from one sender that flushes its delayed ACK
+#define SEAL_DATAGRAMS              1       // SECURE builds seal every datagram with AES-256-GCM (0 sends them as encoded)
+#define CRYPTO_WORKERS              2       // Threads helping to seal, open and decode datagram batches in SECURE builds (up to spare cores)
+#define CRYPTO_MIN_BATCH            4       // Smaller batches are handled inline, cheaper than a hand-off
+
+#ifdef MULTICAST
+#define MULTICAST_GROUP             "239.255.46.1"  // Group the leader sends ordered chat messages to
+#else
+#define MULTICAST_GROUP             ""      // No group, leader sends every ordered chat message by unicast
+#endif
+#define MULTICAST_PORT              "9345"  // Multicast group port
+#define MULTICAST_TTL               1       // Hops a group datagram may take (1 stays on the local network)
+#define MULTICAST_READ_TIMEOUT      200     // Multicast reader wake-up to check for termination in miliseconds
+#define RELAY_DEGREE                0       // Clients the leader and each relay send an ordered message to (0 sends to all directly)
 
-#define MAX_CLIENT_BUFFER_LENGTH    256     // Maximum client list encoded length
-
-#define UDP_RECEIVER_QUEUE_SIZE     100     // Number of payload receiving kept track by receiver to prevent duplicate
-#define NUM_UDP_RETRIES             2       // Default number of UDP resend before notify crash
-#define UDP_TIMEOUT                 2000    // Timeout before trying resend UDP payload in miliseconds
-#define ACK_MONITOR_INTERVAL        1       // Ack check interval in seconds
+#define PAYLOAD_POOL_CAPACITY       2048    // Payload byte buffers per pool slab (a slab is added when all are in use)
+#define RETRANSMIT_WHEEL_CAPACITY   1024    // Retransmission tickets per slab (a slab is added when all are armed)
+#define PENDING_ACK_CAPACITY        256     // Delayed ACK entries per slab, one per sender (a slab is added when all are used)
+#define MPSC_QUEUE_CAPACITY         1024    // Slots per lock-free queue (LOCKFREE_QUEUE builds); producers wait when full
 
 #define JAM_CENTRAL_TIMEOUT         1000    // Timeout for main jam waiting internal communication in miliseconds
+#define JAM_DRAIN_BATCH             64      // Maximum incoming payloads handled per pass before checking other queues
+#define SEQUENCER_BATCH_SIZE        8       // Chat messages the leader packs into one ordered datagram (1 disables batching)
+#define SEQUENCER_BATCH_WINDOW      0       // Time a chat message waits for others to share its datagram in miliseconds (0 packs only those already queued)
 #define JOIN_TIMEOUT                10000   // Timeout to join chat group in miliseconds
+#define REACTOR_RECEIVE_BATCHES     4       // Batches read from a ready socket before other events are handled (REACTOR builds)
+#define REACTOR_MAX_EVENTS          8       // Events taken per epoll_wait (REACTOR builds)
+#define GATEWAY_SHARDS              0       // Pinned threads sharing a gateway's groups, 0 for one per core
 
 #define LIST_MESSAGE                "LIST"  // For print out current client list
 #define TERMINATE_MESSAGE           "EXIT"  // For terminating using chat message
@@ -79,6 +124,7 @@ enum JamStatus {
     UDP_GET_FD_ERROR                    = MK_ERROR(0x3002),
     UDP_BIND_ERROR                      = MK_ERROR(0x3003),
     UDP_NOT_INIT_ERROR                  = MK_ERROR(0x3004),
+    UDP_MULTICAST_ERROR                 = MK_ERROR(0x3005),
 
     UDP_INVALID_PAYLOAD_ERROR           = MK_ERROR(0x4001),
     UDP_SEND_ERROR                      = MK_ERROR(0x4002),
@@ -86,6 +132,8 @@ enum JamStatus {
 
     CLIENT_EXCEED_MAXIMUM               = MK_ERROR(0x5001),
     CLIENT_BUFFER_INVALID_LENGTH        = MK_ERROR(0x5002),
+
+    HOLD_QUEUE_INVALID_RANGES           = MK_ERROR(0x6001),
 };
 
 #endif //JAM_CONFIG_H
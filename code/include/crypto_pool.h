@@ -0,0 +1,85 @@
+/**
+ * Crypto pool - a few threads sharing the per-datagram crypto of a batch.
+ *
+ * A batch is split by index: every worker and the calling thread take the next index until none
+ * is left, and Run() returns once all are done. Results stay in the caller's arrays, so the
+ * caller goes on with them in index order (the order they were received or queued) whatever
+ * order the workers finished in.
+ *
+ * One batch runs at a time. A caller finding the workers busy with another batch (the reader
+ * while the writer seals) runs its own batch inline rather than waiting.
+ */
+
+#ifndef JAM_CRYPTO_POOL_H
+#define JAM_CRYPTO_POOL_H
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include "boost/thread/thread.hpp"
+#include "boost/thread/mutex.hpp"
+#include "boost/thread/condition_variable.hpp"
+
+class CryptoPool {
+public:
+    /**
+     * @param workers   threads besides the caller, 0 runs every batch inline
+     * @param min_batch smallest batch worth a hand-off; smaller ones run inline
+     */
+    CryptoPool(uint32_t workers, uint32_t min_batch);
+
+    ~CryptoPool();
+
+    CryptoPool(const CryptoPool &) = delete;
+    CryptoPool &operator=(const CryptoPool &) = delete;
+
+    /**
+     * Call task once for every index below count and wait for all of them
+     *
+     * @param count     number of indexes
+     * @param task      called with each index, from any thread of the pool
+     */
+    void Run(uint32_t count, const std::function<void(uint32_t)> &task);
+
+    /**
+     * @return          number of worker threads
+     */
+    uint32_t size() const;
+
+    /**
+     * @return          number of batches shared with the workers so far
+     */
+    uint64_t get_batches() const;
+
+private:
+    boost::thread_group threads_;
+    uint32_t min_batch_;
+
+    boost::mutex m_run_;                            // Held by the caller of the running batch
+    boost::mutex m_state_;                          // Guards the batch below
+    boost::condition_variable cv_start_;
+    boost::condition_variable cv_done_;
+    const std::function<void(uint32_t)> *task_;     // Running batch, NULL between batches
+    uint32_t count_;
+    std::atomic<uint32_t> next_;                    // Next index to take
+    uint32_t done_;                                 // Indexes finished
+    uint32_t busy_;                                 // Workers inside the batch
+    uint64_t generation_;                           // Batches started
+    bool stop_;
+
+    std::atomic<uint64_t> batches_;
+
+    /**
+     * Wait for batches and help with each one until stopped
+     */
+    void RunWorker();
+
+    /**
+     * Take indexes of the running batch until none is left
+     *
+     * @return          number of indexes this thread finished
+     */
+    uint32_t Work(const std::function<void(uint32_t)> &task, uint32_t count);
+};
+
+#endif //JAM_CRYPTO_POOL_H
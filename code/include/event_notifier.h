@@ -0,0 +1,107 @@
+/**
+ * Wake-up channel for a single waiting thread
+ *
+ * The waiter sleeps on an eventfd (a condition variable elsewhere) only after re-checking its
+ * ready condition, and notifiers only make a system call when the waiter is actually sleeping,
+ * so a busy consumer costs its producers a fence and an atomic load.
+ */
+
+#ifndef JAM_EVENT_NOTIFIER_H
+#define JAM_EVENT_NOTIFIER_H
+
+#include <atomic>
+#include <cstdint>
+
+#ifdef __linux__
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+#else
+#include "boost/thread/mutex.hpp"
+#include "boost/thread/condition_variable.hpp"
+#endif
+
+class EventNotifier {
+private:
+    std::atomic<bool> sleeping_;                    // Waiter is blocked or about to block
+
+#ifdef __linux__
+    int eventfd_;
+#else
+    boost::mutex m_sleep_;
+    boost::condition_variable cond_variable_;
+#endif
+
+public:
+    EventNotifier() : sleeping_(false) {
+#ifdef __linux__
+        eventfd_ = eventfd(0, EFD_NONBLOCK);
+#endif
+    }
+
+    ~EventNotifier() {
+#ifdef __linux__
+        close(eventfd_);
+#endif
+    }
+
+    EventNotifier(const EventNotifier &) = delete;
+
+    EventNotifier &operator=(const EventNotifier &) = delete;
+
+    /**
+     * Block until notified or timeout expires, unless ready() already holds
+     *
+     * Producers must publish their data before calling Notify() for ready() to see it.
+     *
+     * @param ready     condition checked after announcing the sleep
+     * @param timeout   time to wait in miliseconds, -1 to wait forever
+     */
+    template<typename Predicate>
+    void Wait(Predicate ready, int timeout) {
+        sleeping_.store(true, std::memory_order_relaxed);
+        // Pairs with the fence in Notify() so either we see the data or the notifier sees us sleeping
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+
+        if (!ready()) {
+#ifdef __linux__
+            pollfd fd = {eventfd_, POLLIN, 0};
+            uint64_t value;
+            if (poll(&fd, 1, timeout) > 0) {
+                ssize_t ret = read(eventfd_, &value, sizeof(value));
+                (void) ret;
+            }
+#else
+            boost::mutex::scoped_lock lock(m_sleep_);
+            if (!ready()) {
+                if (timeout < 0) {
+                    cond_variable_.wait(lock);
+                } else {
+                    cond_variable_.wait_for(lock, boost::chrono::milliseconds(timeout));
+                }
+            }
+#endif
+        }
+
+        sleeping_.store(false, std::memory_order_relaxed);
+    }
+
+    /**
+     * Wake the waiter if it is sleeping
+     */
+    void Notify() {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (sleeping_.load(std::memory_order_relaxed)) {
+#ifdef __linux__
+            uint64_t value = 1;
+            ssize_t ret = write(eventfd_, &value, sizeof(value));
+            (void) ret;
+#else
+            boost::mutex::scoped_lock lock(m_sleep_);
+            cond_variable_.notify_one();
+#endif
+        }
+    }
+};
+
+#endif //JAM_EVENT_NOTIFIER_H
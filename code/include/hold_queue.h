@@ -12,35 +12,77 @@
 #endif
 
 #include "stream_communicator.h"
+#include "serializer_helper.h"
 #include "central_queues.h"
+#include "sequencer_batch.h"
+#include "user_handler.h"
 
-#include <queue>
+#include <algorithm>
+#include <vector>
 
+// Range of missing chat orders [start, end)
+struct OrderRange {
+    int32_t start;
+    int32_t end;
+};
+
+// Hold back and history are rings of MAX_HOLDBACK_QUEUE_LENGTH slots indexed by order, so insert,
+// duplicate check, in-order release and history lookup are O(1). A slot holds a payload only
+// while its GetOrder() matches the order mapped to it.
 class HoldQueue {
 
 public:                    // begin public section
     HoldQueue(CentralQueues* queues);
     ~HoldQueue();
 
-    void AddMessageToQueue(Payload payload);
+    // Returns false if the payload was delivered or held already
+    bool AddMessageToQueue(Payload payload);
+
+    // Hold every message of a batch before delivering any, returns false if all were delivered
+    // or held already. last_order is set to the order of the last message in the batch.
+    bool AddBatchToQueue(Payload payload, int32_t* last_order);
     void ProcessPayloads();
 
     bool GetPayloadInHistory(int32_t value, Payload* payload);
 
-    void SetUserHandlerPipe(int pipeId);
+    // Record the latest order the leader has sent (carried by its ping) and request every gap
+    // up to it at once, so a lost tail of multicast messages is not waited for forever
+    void NoteLatestOrder(int32_t order);
+
+    // Fill up to max gaps between the next expected order and the highest order seen
+    // (limited to the hold back window), returns number of ranges
+    size_t GetMissingRanges(OrderRange* ranges, size_t max);
+
+    // Collect every payload in history that falls into the ranges, returns number found
+    size_t GetPayloadsInHistory(const OrderRange* ranges, size_t count, std::vector<Payload>* payloads);
+
+    // Serialize ranges to a NACK message buffer, returns encoded length
+    static uint32_t EncodeRanges(uint8_t* buffer, const OrderRange* ranges, size_t count);
+
+    // Parse NACK message buffer into at most max ranges
+    static JamStatus DecodeRanges(uint8_t* buffer, uint32_t length, OrderRange* ranges, size_t max,
+                                  size_t* count);
+
+    void SetUserHandler(UserHandler* user_handler);
 
     void ClearQueue();
 
 private:
     CentralQueues* queues_;
-    std::deque<Payload> history_queue_;
-    std::vector<Payload> delivery_queue_;
+    std::vector<Payload> history_queue_;        // Delivered payloads, slot = order % length
+    std::vector<Payload> holdback_queue_;       // Payloads waiting for delivery, slot = order % length
 
-    int user_handler_pipe_;
+    UserHandler* user_handler_;                 // Prints the delivered messages
     int expected_order_;
+    int highest_order_;                         // Highest order seen, may be beyond the hold back window
     int recovery_counter_;
 
     bool first_payload_;
+
+    static size_t Slot(int32_t order);
+
+    // Hold a chat message without delivering, returns false if delivered or held already
+    bool Insert(Payload& payload);
 };
 
 #endif //JAM_HOLD_QUEUE_H
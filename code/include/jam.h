@@ -14,6 +14,7 @@
 #include "client_manager.h"
 #include "leader_manager.h"
 #include "hold_queue.h"
+#include "sequencer_batch.h"
 
 class JAM {
 public:
@@ -51,11 +52,90 @@ public:
                        const char *addr,
                        const char *port);
 
+    /**
+     * Set multicast group for the leader's ordered chat messages
+     *
+     * Must be called before starting. Clients that cannot join the group keep receiving them
+     * by unicast.
+     *
+     * @param group             group address, empty to use unicast only
+     * @param port              group port
+     */
+    void set_multicast_group(const char *group, const char *port);
+
+    /**
+     * Set relay tree degree for the leader's ordered chat messages
+     *
+     * The leader sends each message to degree clients, which pass it on to their own children
+     * (see ClientManager::GetRelayChildren). Not used while the leader sends to a multicast group.
+     *
+     * @param degree            children per node, 0 to send to every client directly
+     */
+    void set_relay_degree(uint8_t degree);
+
     /**
      * Main running loop
+     *
+     * REACTOR builds run every module on this thread: each round waits for the sockets, user
+     * input or a timer, handles them, drains the central queues and sends what that produced.
      */
     void Main();
 
+    /**
+     * Set up a new group as its leader without running it
+     *
+     * Like StartAsLeader(), but returns instead of exiting on failure. Run the group with Main(),
+     * or with RunRound() in REACTOR builds.
+     *
+     * @param user_name         user's name
+     * @param user_interface    user's selected interface
+     * @param user_port         user's port
+     *
+     * @return                  TRUE on success, FALSE otherwise
+     */
+    bool InitLeader(const char *user_name,
+                    const char *user_interface,
+                    const char *user_port);
+
+    /**
+     * Set whether the user types messages on stdin
+     *
+     * Must be called before starting. Without input the node still orders, relays and prints the
+     * messages of the others.
+     *
+     * @param enabled           FALSE to leave stdin alone
+     */
+    void set_user_input(bool enabled);
+
+    /**
+     * Ask the node to leave its group: Main() returns, RunRound() returns FALSE
+     */
+    void Terminate();
+
+    /**
+     * @return                  address the node listens on
+     */
+    sockaddr_in get_self_address();
+
+#ifdef REACTOR
+    /**
+     * Handle whatever is pending without waiting, as one pass of Main()
+     *
+     * For running many nodes on one thread: call it whenever get_event_fd() is readable. Leaves
+     * the group once terminated.
+     *
+     * @return                  TRUE while running, FALSE once the node left its group
+     */
+    bool RunRound();
+
+    /**
+     * Get the epoll instance that turns readable whenever the node has something to do
+     *
+     * @return                  file descriptor
+     */
+    int get_event_fd();
+#endif
+
 private:
     const char *user_name_;
     CentralQueues queues_;
@@ -69,6 +149,124 @@ private:
     int32_t order_;                         // Order kept track as leader
     int32_t last_witness_order_;            // Order kept track for leader recovery
 
+    const char *multicast_group_;           // Multicast group address, empty for unicast only
+    const char *multicast_port_;
+    uint8_t relay_degree_;                  // Relay tree degree for ordered messages, 0 for direct
+    SequencerBatch sequencer_batch_;        // Chat messages waiting for an order as leader
+    bool user_input_;                       // User types messages on stdin
+
+    uint32_t deferred_;                     // Queues held back until there is a leader
+    std::vector<Payload> payload_batch_;    // Drained by HandleQueues(), kept to reuse their memory
+    std::vector<sockaddr_in> crash_batch_;
+    std::vector<int32_t> history_batch_;
+    std::vector<Payload> history_payloads_;
+
+#ifdef REACTOR
+    int epoll_fd_;                          // Sockets, user input and timer_fd_
+    int timer_fd_;                          // Fires at the next retransmit, delayed ACK, heartbeat or timeout
+    std::chrono::milliseconds next_ping_;   // Steady clock time of the next heartbeat
+    bool read_stdin_;                       // Stdin is a file epoll cannot watch; read a line every round
+
+    /**
+     * Set up the epoll instance and timer, and register the UDP sockets
+     */
+    void InitReactor();
+
+    /**
+     * Add a readable file descriptor to the reactor
+     *
+     * @param fd        file descriptor
+     *
+     * @return          TRUE on success, FALSE otherwise
+     */
+    bool AddToReactor(int fd);
+
+    /**
+     * Wait for I/O or a timer and handle it like the module threads would
+     *
+     * Received payloads and user input land in the central queues as usual.
+     *
+     * @param timeout   time to wait at most in miliseconds
+     */
+    void RunReactor(uint32_t timeout);
+
+    /**
+     * Make timer_fd_ fire at a steady clock time
+     *
+     * @param due       steady clock time
+     *
+     * @return          TRUE on success, FALSE otherwise
+     */
+    bool ArmTimer(std::chrono::milliseconds due);
+#endif
+
+    /**
+     * Start user input and the leader heartbeat
+     */
+    void StartModules();
+
+    /**
+     * Wait until a central queue may have data
+     *
+     * @param timeout   time to wait if no data in miliseconds
+     *
+     * @return          TRUE if there may be data (or terminate), FALSE on timeout
+     */
+    bool WaitForData(uint32_t timeout);
+
+    /**
+     * Drain the central queues once and act on what they hold
+     *
+     * @return          TRUE while running, FALSE once terminate is signaled
+     */
+    bool HandleQueues();
+
+    /**
+     * Tell the group we leave and stop the modules
+     */
+    void Leave();
+
+    /**
+     * Give the waiting chat messages their orders and send them in one payload
+     *
+     * Dropped if this client is no longer the leader; their senders resend to the new one.
+     */
+    void FlushSequencerBatch();
+
+    /**
+     * Send an ordered chat message or batch as leader
+     *
+     * Goes to the multicast group if joined, else down the relay tree, else to every client.
+     *
+     * @param payload   payload with its order set
+     */
+    void SendOrdered(Payload &payload);
+
+    /**
+     * Pass an ordered chat message or batch seen for the first time down our relay subtree
+     *
+     * @param payload   received payload
+     */
+    void RelayOrdered(Payload &payload);
+
+    /**
+     * Put the user name back in place of the session user id of a received chat message
+     *
+     * @param payload   received payload
+     *
+     * @return          TRUE if it has its user name now; FALSE if the id is unknown to our client list
+     */
+    bool ResolveUsername(Payload &payload);
+
+    /**
+     * Join the multicast group if one is set
+     *
+     * @param addr      address of the selected interface
+     *
+     * @return          TRUE if joined; FALSE otherwise
+     */
+    bool StartMulticast(const sockaddr_in *addr);
+
     /**
      * Construct string of ip address and port for network interfaces
      *
@@ -22,6 +22,7 @@ public:
 
     void StartLeaderHeartbeat();
     void StopLeaderHeartBeat();
+    void Heartbeat(); // One beat; REACTOR builds call it every PING_INTERVAL instead of a thread
 
     void HandleElectionMessage(Payload msg);
     void ReceivedPing(Payload ping);
@@ -0,0 +1,246 @@
+/**
+ * Bounded lock-free multi-producer/single-consumer queue template
+ *
+ * Producers claim a slot with one CAS and publish it with a per-slot sequence number, so
+ * neither side takes a lock while the queue has data. The consumer only blocks (on an
+ * EventNotifier) once the queue is empty, and producers only signal it when it does.
+ * Producers wait for space when the queue is full.
+ *
+ * Only one thread may pop; any number of threads may push.
+ */
+
+#ifndef JAM_MPSC_QUEUE_H
+#define JAM_MPSC_QUEUE_H
+
+#include "config.h"
+#include "concurrent_queue.h"
+
+#include "event_notifier.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <thread>
+
+template<typename T>
+class MpscQueue {
+private:
+    struct Cell {
+        std::atomic<size_t> sequence;               // pos + 1 when readable, pos + capacity when writable
+        T data;
+    };
+
+    size_t mask_;                                   // Capacity - 1
+    std::unique_ptr<Cell[]> cells_;
+    std::atomic<size_t> tail_;                      // Next position claimed by producers
+    std::atomic<size_t> head_;                      // Next position taken by the consumer
+    EventNotifier notifier_;                        // Wakes the consumer when it sleeps on an empty queue
+
+    template<typename U>
+    void Emplace(U &&t, bool signal = true) {
+        size_t pos = tail_.load(std::memory_order_relaxed);
+        Cell *cell;
+
+        for (; ;) {
+            cell = &cells_[pos & mask_];
+            size_t sequence = cell->sequence.load(std::memory_order_acquire);
+            intptr_t diff = (intptr_t) sequence - (intptr_t) pos;
+            if (diff == 0) {
+                if (tail_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    break;
+                }
+            } else if (diff < 0) {
+                // Full; make sure the consumer is awake (push_many defers the signal) and wait for a slot
+                notifier_.Notify();
+                std::this_thread::yield();
+                pos = tail_.load(std::memory_order_relaxed);
+            } else {
+                pos = tail_.load(std::memory_order_relaxed);
+            }
+        }
+
+        cell->data = std::forward<U>(t);
+        cell->sequence.store(pos + 1, std::memory_order_release);
+
+        if (signal) {
+            notifier_.Notify();
+        }
+    }
+
+    bool IsReady() {
+        size_t pos = head_.load(std::memory_order_relaxed);
+        return cells_[pos & mask_].sequence.load(std::memory_order_acquire) == pos + 1;
+    }
+
+public:
+    /**
+     * @param capacity  number of slots (rounded up to a power of 2)
+     */
+    MpscQueue(size_t capacity = MPSC_QUEUE_CAPACITY)
+            : tail_(0), head_(0) {
+        size_t size = 2;
+        while (size < capacity) {
+            size <<= 1;
+        }
+        mask_ = size - 1;
+        cells_.reset(new Cell[size]);
+        for (size_t i = 0; i < size; ++i) {
+            cells_[i].sequence.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    MpscQueue(const MpscQueue &) = delete;
+
+    MpscQueue &operator=(const MpscQueue &) = delete;
+
+    /**
+     * Get queue size (may be stale while other threads push)
+     *
+     * @return          queue size
+     */
+    size_t size() {
+        return tail_.load(std::memory_order_acquire) - head_.load(std::memory_order_acquire);
+    }
+
+    /**
+     * Check if queue is empty
+     *
+     * @return          TRUE if queue is empty, FALSE otherwise
+     */
+    bool is_empty() {
+        return size() == 0;
+    }
+
+    /**
+     * Insert element into queue, waiting for space if full
+     *
+     * @param t         element to be inserted
+     */
+    void push(T const &t) {
+        Emplace(t);
+    }
+
+    void push(T &&t) {
+        Emplace(std::move(t));
+    }
+
+    /**
+     * Insert range of elements into queue with a single wake-up of the consumer
+     *
+     * @param first     first element to be inserted (elements are moved from)
+     * @param last      end of range
+     */
+    template<typename InputIt>
+    void push_many(InputIt first, InputIt last) {
+        if (first == last) {
+            return;
+        }
+
+        for (; first != last; ++first) {
+            Emplace(std::move(*first), false);
+        }
+        notifier_.Notify();
+    }
+
+    /**
+     * Get element from queue if not empty (no wait)
+     *
+     * @param t         element to be assigned value
+     *
+     * @return          TRUE if has data returned, FALSE otherwise
+     */
+    bool try_pop(T &t) {
+        size_t pos = head_.load(std::memory_order_relaxed);
+        Cell &cell = cells_[pos & mask_];
+        if (cell.sequence.load(std::memory_order_acquire) != pos + 1) {
+            return false;
+        }
+
+        t = std::move(cell.data);
+        cell.sequence.store(pos + mask_ + 1, std::memory_order_release);
+        head_.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+
+    /**
+     * Get up to max elements from queue (no wait)
+     *
+     * @param out       elements to be assigned values
+     * @param max       maximum number of elements
+     *
+     * @return          number of elements returned
+     */
+    size_t try_pop_many(T *out, size_t max) {
+        size_t count = 0;
+        while (count < max && try_pop(out[count])) {
+            count++;
+        }
+        return count;
+    }
+
+    /**
+     * Move up to max elements from queue to the end of a container (no wait)
+     *
+     * @param out       container to be appended to
+     * @param max       maximum number of elements
+     *
+     * @return          number of elements appended
+     */
+    template<typename Container>
+    size_t drain_into(Container &out, size_t max = SIZE_MAX) {
+        size_t count = 0;
+        T t;
+        while (count < max && try_pop(t)) {
+            out.push_back(std::move(t));
+            count++;
+        }
+        return count;
+    }
+
+    /**
+     * Get element from queue
+     *
+     * @param t         element to be assigned value
+     */
+    void pop(T &t) {
+        while (!try_pop(t)) {
+            notifier_.Wait([this]() { return IsReady(); }, -1);
+        }
+    }
+
+    /**
+     * Get element from queue, waiting at most time if empty
+     *
+     * @param t         element to be assigned value
+     * @param time      time to wait in miliseconds
+     *
+     * @return          TRUE if has data returned, FALSE on timeout
+     */
+    bool pop_for(T &t, uint32_t time) {
+        std::chrono::steady_clock::time_point until = std::chrono::steady_clock::now() + std::chrono::milliseconds(time);
+        while (!try_pop(t)) {
+            auto left = std::chrono::duration_cast<std::chrono::milliseconds>(until - std::chrono::steady_clock::now());
+            if (left.count() <= 0) {
+                return false;
+            }
+            notifier_.Wait([this]() { return IsReady(); }, (int) left.count());
+        }
+        return true;
+    }
+};
+
+/**
+ * Queue for hand-offs whose only consumer never pushes to the same queue (a bounded queue
+ * would deadlock that thread once full). Build with -DLOCKFREE_QUEUE=ON for MpscQueue.
+ * REACTOR builds push and pop on one thread, so they keep the unbounded queue.
+ */
+#if defined(LOCKFREE_QUEUE) && !defined(REACTOR)
+template<typename T>
+using SingleConsumerQueue = MpscQueue<T>;
+#else
+template<typename T>
+using SingleConsumerQueue = ConcurrentQueue<T>;
+#endif
+
+#endif //JAM_MPSC_QUEUE_H
@@ -0,0 +1,100 @@
+/**
+ * Reference counted datagram buffer shared by payload copies.
+ *
+ * Blocks of MAX_BUFFER_LENGTH bytes come from a slab pool of the calling thread
+ * (PAYLOAD_POOL_CAPACITY blocks per slab) and go back to it when the last handle lets go, so
+ * copying a handle only bumps a counter and a steady stream of payloads never reaches the heap.
+ * Threads take blocks without a lock; a block let go by another thread is pushed onto the return
+ * list of its pool, which the owner takes back on its next Acquire(). A block may be read by
+ * every handle at the same time; a handle must call MakeUnique() before writing (copy-on-write).
+ */
+
+#ifndef JAM_PAYLOAD_BUFFER_H
+#define JAM_PAYLOAD_BUFFER_H
+
+#include "config.h"
+#include "slab_allocator.h"
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+class PayloadBuffer {
+public:
+    PayloadBuffer();
+
+    PayloadBuffer(const PayloadBuffer &other);
+
+    PayloadBuffer(PayloadBuffer &&other) noexcept;
+
+    PayloadBuffer &operator=(const PayloadBuffer &other);
+
+    PayloadBuffer &operator=(PayloadBuffer &&other) noexcept;
+
+    ~PayloadBuffer();
+
+    /**
+     * Get bytes for reading
+     *
+     * @return          block bytes, NULL if no block is held
+     */
+    const uint8_t *data() const;
+
+    /**
+     * Check if another handle holds the same block
+     *
+     * @return          TRUE if shared, FALSE otherwise
+     */
+    bool is_shared() const;
+
+    /**
+     * Get bytes for writing, taking a block of our own first if it is shared or missing
+     *
+     * @param keep      number of leading bytes copied over when moving to a new block
+     *
+     * @return          block bytes, at least capacity() of them
+     */
+    uint8_t *MakeUnique(size_t keep);
+
+    /**
+     * Let go of the block
+     */
+    void reset();
+
+    /**
+     * Get block size
+     *
+     * @return          bytes per block
+     */
+    static size_t capacity();
+
+    /**
+     * Get free-list statistics of the calling thread's pool, after taking back returned blocks
+     *
+     * @return          snapshot of pool counters
+     */
+    static SlabStats GetPoolStats();
+
+private:
+    struct Pool;
+
+    struct Block {
+        std::atomic<uint32_t> refs;                 // Handles holding the block
+        uint32_t handle;                            // Slab handle to give the block back
+        Pool *pool;                                 // Pool the block belongs to
+        Block *next;                                // Link in the return list of the pool
+        uint8_t data[MAX_BUFFER_LENGTH];
+    };
+
+    Block *block_;
+
+    static thread_local Pool *local_pool_;          // Pool of the calling thread, NULL until used
+
+    static Pool &GetPool();
+
+    static Block *Acquire();
+
+    static void Release(Block *block);
+};
+
+#endif //JAM_PAYLOAD_BUFFER_H
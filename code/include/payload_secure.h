@@ -3,9 +3,21 @@
  *
  * There are 3 different payloads:
  *  + Normal communication payload
- *  + ACK payload
+ *  + ACK payload (may also be piggybacked on a normal payload)
  *  + Self-terminate payload (bound back to terminate threads)
  *
+ * Header fields live in the object, the encoded header and body live in a pooled PayloadBuffer
+ * shared by every copy. Copies only differ in uid, address and piggybacked ACK, which the
+ * writer sends as separate segments around the shared bytes, so a fan-out or a retransmit
+ * ticket never copies the body.
+ *
+ * A message of MAX_MESSAGE_LENGTH or more is kept aside instead and sent as fragments, each a
+ * payload of its own with the fragment id, index and count after the message.
+ *
+ * Normal payloads use the fixed header unless set to the compact one, which packs uid, order
+ * and lengths as varints and may carry the sender's session user id instead of its name. A
+ * type bit tells them apart, so both are always decoded.
+ *
  * @author: Hung Nguyen
  * @version 1.0 04/23/16
  */
@@ -14,13 +26,17 @@
 #define JAM_PAYLOAD_H
 
 #include "config.h"
+#include "payload_buffer.h"
+#include <algorithm>
 #include <cstdint>
 #include <cstdlib>
 #include <cstring>
+#include <memory>
 #include <string>
 #include <vector>
 
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <netdb.h>
 #include <openssl/aes.h>
 
@@ -31,7 +47,7 @@ const static unsigned char aes_key[] = {0x00, 0x11, 0x22, 0x33, 0x44, 0x55, 0x66
                                         0xAA, 0xBB, 0xCC, 0xDD, 0xEE, 0xFF};
 
 enum MessageType : uint8_t {
-    CHAT_MSG, STATUS_MSG, ELECTION_MSG, RECOVER_MSG, ACK_MSG, NA
+    CHAT_MSG, STATUS_MSG, ELECTION_MSG, RECOVER_MSG, ACK_MSG, BATCH_MSG, NA
 };
 
 enum Status : uint8_t {
@@ -44,25 +60,41 @@ enum ElectionCommand : uint8_t {
 };
 
 enum RecoverCommand : uint8_t {
-    MSG_LOST
+    MSG_LOST,
+    MSG_NACK                // Message carries missing order ranges
+};
+
+enum HeaderVersion : uint8_t {
+    FIXED_HEADER,           // 18-byte header every client decodes
+    COMPACT_HEADER          // Varint fields, user name may be replaced by a session user id
 };
 
-enum AckStatus : uint8_t {
-    ACK_OK, ACK_ERROR
+// Range of uids received by the ACK sender (inclusive on both ends)
+struct AckRange {
+    uint32_t start;
+    uint32_t end;
 };
 
 class Payload {
 public:
+    enum {
+        MAX_SEGMENTS = 3            // Maximum iovec entries used by GetIovec()
+    };
+
     Payload();
 
     // Init Payload with ACK type and encoded byte stream
-    Payload(uint32_t uid, AckStatus ack);
+    Payload(uint32_t next, const AckRange *ranges, uint8_t count);
 
-    // Copy constructor
-    Payload(const Payload &payload);
+    // Copies share the encoded bytes
+    Payload(const Payload &payload) = default;
+
+    Payload(Payload &&payload) = default;
 
     // operators
-    void operator=(const Payload &payload);
+    Payload &operator=(const Payload &payload) = default;
+
+    Payload &operator=(Payload &&payload) = default;
 
     bool operator==(const Payload &other);
 
@@ -71,6 +103,7 @@ public:
     ~Payload();
 
     sockaddr_in *GetAddress();
+    const sockaddr_in *GetAddress() const;
 
     void SetAddress(const sockaddr_in *address);
 
@@ -82,9 +115,13 @@ public:
 
     void SetUid(uint32_t uid);
 
-    AckStatus GetAck() const;
+    bool HasAck() const;
+
+    uint32_t GetAckNext() const;
+
+    uint8_t GetAckRangeCount() const;
 
-    void SetAck(AckStatus ack);
+    const AckRange *GetAckRanges() const;
 
     int32_t GetOrder() const;
 
@@ -102,6 +139,14 @@ public:
 
     void SetRecoverCommand(RecoverCommand command);
 
+    // Children per node of the relay tree an ordered chat message or batch travels down (0 for direct)
+    uint8_t GetRelayDegree() const;
+    void SetRelayDegree(uint8_t degree);
+
+    // Header to encode with; a decoded payload keeps the one it arrived with
+    HeaderVersion GetHeaderVersion() const;
+    void SetHeaderVersion(HeaderVersion version);
+
     std::size_t GetLength() const;
 
     void SetLength(uint32_t length);
@@ -114,15 +159,64 @@ public:
 
     JamStatus SetUsername(std::string username);
 
+    // Session user id sent instead of the user name in the compact header (0 if the name is inline).
+    // Setting one drops the name; SetUsername() clears it.
+    uint16_t GetUserId() const;
+    void SetUserId(uint16_t id);
+
     std::string GetMessage();
 
     JamStatus SetMessage(std::string message);
 
     JamStatus SetMessage(uint8_t *in, uint32_t length);
 
-    const uint8_t *payload() const;
+    // Fragment fields of a fragment payload (count is 0 for a whole message)
+    uint16_t GetFragmentId() const;
+    uint8_t GetFragmentIndex() const;
+    uint8_t GetFragmentCount() const;
+    void SetFragment(uint16_t id, uint8_t index, uint8_t count);
+
+    /**
+     * Check if the message is too long for one datagram
+     *
+     * Such a message (up to MAX_FRAGMENTED_LENGTH) stays out of the shared bytes and is sent as
+     * the fragments from Fragment().
+     *
+     * @return          TRUE if message length is MAX_MESSAGE_LENGTH or more, FALSE otherwise
+     */
+    bool NeedsFragments() const;
+
+    /**
+     * Split the message into encoded fragments of FRAGMENT_LENGTH message bytes
+     *
+     * Every fragment carries the header fields and user name of this payload.
+     *
+     * @param id        fragment id, unique among the sender's messages in flight
+     * @param fragments returned fragments in index order
+     *
+     * @return          SUCCESS on normal operation, other JamStatus errors otherwise
+     */
+    JamStatus Fragment(uint16_t id, std::vector<Payload> *fragments);
+
+    std::size_t GetCapacity() const;
+
+    /**
+     * Get bytes to receive a datagram into, detached from every other copy
+     *
+     * Set the received length with SetLength() before DecodePayload().
+     *
+     * @return          writable bytes, GetCapacity() of them
+     */
+    uint8_t *GetReceiveBuffer();
 
-    uint8_t *payload();
+    /**
+     * Describe the datagram as segments for sendmsg/sendmmsg without copying the shared bytes
+     *
+     * @param iov       at least MAX_SEGMENTS entries to fill
+     *
+     * @return          number of entries used
+     */
+    int GetIovec(iovec *iov);
 
     /**
      * Computes byte stream payload from private variables
@@ -134,9 +228,30 @@ public:
     /**
      * Computes byte stream ack payload without prior private variables
      *
+     * Every uid below next is acknowledged cumulatively; ranges acknowledge uids received
+     * out of order above it. Ranges beyond MAX_SACK_RANGES are dropped.
+     *
+     * @param next      lowest uid not received yet (also stored as uid)
+     * @param ranges    selective ACK ranges above next
+     * @param count     number of ranges
+     *
      * @return          SUCCESS on normal operation, other JamStatus errors otherwise
      */
-    JamStatus EncodeAckPayload(uint32_t uid, AckStatus ack);
+    JamStatus EncodeAckPayload(uint32_t next, const AckRange *ranges, uint8_t count);
+
+    /**
+     * Appends ACK to the byte stream of an encoded normal payload (piggyback)
+     *
+     * Must be called after EncodePayload(); encoding again drops the ACK. The ACK belongs to
+     * this copy only.
+     *
+     * @param next      lowest uid not received yet
+     * @param ranges    selective ACK ranges above next
+     * @param count     number of ranges
+     *
+     * @return          SUCCESS on normal operation, other JamStatus errors otherwise
+     */
+    JamStatus AttachAck(uint32_t next, const AckRange *ranges, uint8_t count);
 
     /**
      * Computes byte stream self-terminate payload
@@ -148,6 +263,8 @@ public:
     /**
      * Extracts private variables from byte stream payload
      *
+     * User name and message stay in the received bytes until asked for.
+     *
      * @return          SUCCESS on normal operation, other JamStatus errors otherwise
      */
     JamStatus DecodePayload();
@@ -156,35 +273,75 @@ public:
 
 private:
     enum {
-        ACK_MSG_LENGTH = 5,         // byte stream length for ACK message
-        HEADER_LENGTH = 18          // header byte stream length for normal message
+        ACK_MSG_LENGTH = 6,         // byte stream length for ACK message without ranges
+        ACK_RANGE_LENGTH = 8,       // byte stream length for each selective ACK range
+        MAX_ACK_LENGTH = ACK_MSG_LENGTH + MAX_SACK_RANGES * ACK_RANGE_LENGTH,
+        ACK_FLAG = 0x80,            // type bit set when an ACK is piggybacked after the body
+        FRAGMENT_FLAG = 0x40,       // type bit set when fragment fields follow the message
+        COMPACT_FLAG = 0x20,        // type bit set when the compact header follows
+        MAX_VARINT_LENGTH = 5,      // 7 bits of a uint32 per byte
+        MAX_COMPACT_HEADER_LENGTH = 11, // order, code, user name length or id, message length
+        FRAGMENT_HEADER_LENGTH = 4, // byte stream length for fragment id, index and count
+        UID_HEADER_LENGTH = 5,      // type and uid, written per copy when sending
+        HEADER_LENGTH = 18          // header byte stream length for normal message (code byte always sent)
     };
 
     sockaddr_in address_;           // Sender/Receiver address (IPv4 only)
-    uint8_t username_[MAX_USER_NAME_LENGTH];
-    uint8_t message_[MAX_MESSAGE_LENGTH];
 
     // The following variables are encoded in header in the same order
     MessageType type_;              // Payload type
     uint32_t uid_;                  // Unique sequence ID for each client
 
-    // -- If ACK payload
-    AckStatus ack_;                 // ACK status
+    // -- If ACK payload or ACK piggybacked after the body of a normal payload
+    bool has_ack_;
+    uint32_t ack_next_;             // Cumulative ACK (also uid_ of an ACK payload)
+    uint8_t ack_count_;             // Number of selective ACK ranges
+    AckRange ack_ranges_[MAX_SACK_RANGES];
     // -- If normal payload
     int32_t order_;                 // -1 for no total-ordering
     union {                         // Payload code for each message type
         Status status;
         ElectionCommand election;
         RecoverCommand recover;
+        uint8_t relay;              // Relay degree of a chat message or batch
     } code_;
+    HeaderVersion header_version_;
     uint32_t username_length_;      // User name string length in payload
+    uint16_t user_id_;              // Session user id in place of the user name, 0 if none
     uint32_t message_length_;       // Message string length in payload
-
-    // Actual payload in byte stream
-    uint8_t payload_[HEADER_LENGTH + MAX_USER_NAME_LENGTH + MAX_MESSAGE_LENGTH];
+    // -- If fragment of a long message
+    uint16_t fragment_id_;
+    uint8_t fragment_index_;
+    uint8_t fragment_count_;        // 0 if not a fragment
+
+    std::shared_ptr<const std::string> long_message_;  // Message too long for one datagram, not in buffer_
+
+    // Actual payload in byte stream: header at 0, user name at HEADER_LENGTH, message right after.
+    // Bytes before UID_HEADER_LENGTH are not used; head_ is sent instead. A compact header is
+    // shorter and ends at HEADER_LENGTH, so it starts at body_start_.
+    PayloadBuffer buffer_;
+    uint8_t head_[1 + MAX_VARINT_LENGTH];   // Type and uid of this copy
+    uint8_t trailer_[MAX_ACK_LENGTH];   // ACK of this copy (whole ACK or terminate payload has no body)
+    uint32_t trailer_length_;
     uint32_t length_;
+    uint32_t body_start_;           // Offset of the encoded bytes sent after head_
+    uint32_t body_length_;          // Encoded length up to where a piggybacked ACK goes
+    bool dirty_;                    // Fields changed since buffer_ was encoded
 
     // Helper functions
+    // -- Shared bytes for writing (copied first if another payload holds them)
+    uint8_t *MutableBytes();
+
+    // -- Type and uid bytes of a copy with this uid
+    uint32_t HeadLength(uint32_t uid) const;
+
+    // -- Code byte of the message type
+    uint8_t GetCode() const;
+    void SetCode(uint8_t code);
+
+    // -- Bytes taken by the encrypted message in the byte stream (whole AES blocks)
+    uint32_t MessageBytes() const;
+
     // -- Validate functions
     JamStatus ValidateForEncode();
 
@@ -197,18 +354,26 @@ private:
 
     uint32_t packu32(uint8_t *&buf, uint32_t i);
 
+    uint32_t packu16(uint8_t *&buf, uint16_t i);
+
     uint8_t unpacku8(uint8_t *&buf);
 
     int32_t unpacki32(uint8_t *&buf);
 
     uint32_t unpacku32(uint8_t *&buf);
 
-    // -- Cryptography functions
-    unsigned char iv_[AES_BLOCK_SIZE];       // This must be set to random in production
-    AES_KEY enc_key_;
-    AES_KEY dec_key_;
-    uint8_t enc_buffer_[MAX_MESSAGE_LENGTH];
-    uint32_t enc_length_;
+    uint16_t unpacku16(uint8_t *&buf);
+
+    // -- Varints of the compact header (unpacking stops at end, FALSE if truncated)
+    uint32_t packvarint(uint8_t *&buf, uint32_t i);
+
+    bool unpackvarint(uint8_t *&buf, const uint8_t *end, uint32_t *i);
+
+    // -- ACK fields shared by ACK payload and piggybacked ACK (DECODE_ERROR if truncated at end or a range is reversed)
+    void PackAck(uint8_t *&buf);
+
+    JamStatus UnpackAck(uint8_t *&buf, const uint8_t *end);
+
 };
 
 #endif //JAM_PAYLOAD_H
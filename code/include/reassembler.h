@@ -0,0 +1,83 @@
+/**
+ * Reassembler - puts messages sent as fragments back together.
+ *
+ * Fragments are matched by sender and fragment id and may arrive in any order or more than
+ * once. At most max_messages partly received messages are kept; a new one drops the oldest,
+ * and a message whose fragments stopped coming is dropped after the timeout. Receivers mark and
+ * acknowledge fragment uids only once their message is whole, so a dropped message is resent.
+ *
+ * Not thread-safe; the owner serializes access.
+ */
+
+#ifndef JAM_REASSEMBLER_H
+#define JAM_REASSEMBLER_H
+
+#ifdef SECURE
+#include "payload_secure.h"
+#else
+#include "payload.h"
+#endif
+
+#include <chrono>
+#include <vector>
+#include <netinet/in.h>
+
+class Reassembler {
+public:
+    /**
+     * @param max_messages  most partly received messages kept at once
+     * @param timeout       time a partly received message is kept in miliseconds
+     */
+    Reassembler(uint32_t max_messages, uint32_t timeout);
+
+    /**
+     * Add a received fragment
+     *
+     * Invalid and duplicate fragments are ignored.
+     *
+     * @param fragment      decoded fragment with the sender's address
+     * @param message       returned whole message once its last missing fragment arrived
+     * @param uids          returned uids of the message's fragments by index once complete (may be NULL)
+     *
+     * @return              TRUE if message is complete, FALSE otherwise
+     */
+    bool Add(Payload &fragment, Payload *message, std::vector<uint32_t> *uids = NULL);
+
+    /**
+     * Get number of messages waiting for fragments
+     *
+     * @return              partly received messages
+     */
+    uint32_t size() const;
+
+    /**
+     * Get number of messages given up on, either timed out or dropped for a newer one
+     *
+     * @return              dropped messages
+     */
+    uint64_t get_dropped() const;
+
+private:
+    /**
+     * Message waiting for fragments
+     */
+    struct Partial {
+        sockaddr_in addr;                               // Sender
+        uint16_t id;                                    // Fragment id of the sender
+        uint8_t count;                                  // Fragments of the message
+        uint8_t received;                               // Distinct fragments arrived
+        uint32_t length;                                // Message length, known once the last fragment arrived
+        std::vector<bool> have;                         // Arrived fragments by index
+        std::vector<uint32_t> uids;                     // Uids of arrived fragments by index
+        std::vector<uint8_t> data;                      // Message bytes at index * FRAGMENT_LENGTH
+        Payload first;                                  // Fragment the header fields are taken from
+        std::chrono::steady_clock::time_point started;  // Arrival of the first fragment
+    };
+
+    uint32_t max_messages_;
+    std::chrono::milliseconds timeout_;
+    std::vector<Partial> partials_;                     // Oldest first
+    uint64_t dropped_;
+};
+
+#endif //JAM_REASSEMBLER_H
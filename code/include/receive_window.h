@@ -0,0 +1,149 @@
+/**
+ * Thread-safe per-peer sliding window of received payload uids used to drop duplicates.
+ *
+ * Each peer keeps the lowest uid not received yet, the highest uid seen and a bitmap of the last
+ * window uids, so checking a payload and forgetting a peer are O(1) no matter how many peers send
+ * at the same time.
+ * Peers are spread over RECEIVE_WINDOW_SHARDS shards by address, each with its own lock, so
+ * readers of different sockets rarely wait for each other; one peer always uses one shard.
+ */
+
+#ifndef JAM_RECEIVE_WINDOW_H
+#define JAM_RECEIVE_WINDOW_H
+
+#ifdef SECURE
+#include "payload_secure.h"
+#else
+#include "payload.h"
+#endif
+
+#include "config.h"
+
+#include <cstdint>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+#include <netinet/in.h>
+#include "boost/thread/mutex.hpp"
+
+class ReceiveWindow {
+public:
+    /**
+     * @param window    number of uids remembered per peer (rounded up to a power of 2, at least 64)
+     */
+    ReceiveWindow(uint32_t window);
+
+    ~ReceiveWindow();
+
+    /**
+     * Get number of uids remembered per peer
+     *
+     * @return          window size
+     */
+    uint32_t get_window();
+
+    /**
+     * Set number of uids remembered per peer; clears all history
+     *
+     * Not to be called while payloads are checked.
+     *
+     * @param window    window size
+     */
+    void set_window(uint32_t window);
+
+    /**
+     * Check if payload was already received from peer and record it otherwise
+     *
+     * Senders start each receiver's uids at a random multiple of the window and keep less than a
+     * window outstanding. Uids below the first missing one, or marked within the window, are
+     * duplicates. The window follows the newest uid, taking the first missing one along. A uid
+     * more than a window below the first missing one starts the peer's history over: the peer
+     * restarted on the same address.
+     *
+     * @param ip        peer's ip address
+     * @param port      peer's port
+     * @param uid       payload uid
+     *
+     * @return          TRUE if duplicate, FALSE if first time received
+     */
+    bool CheckAndMark(in_addr_t ip, in_port_t port, uint32_t uid);
+
+    /**
+     * Check if payload was already received from peer without recording it
+     *
+     * @param ip        peer's ip address
+     * @param port      peer's port
+     * @param uid       payload uid
+     *
+     * @return          TRUE if duplicate as CheckAndMark() would report it, FALSE otherwise
+     */
+    bool Check(in_addr_t ip, in_port_t port, uint32_t uid);
+
+    /**
+     * Summarize what was received from peer as a cumulative ACK plus selective ranges
+     *
+     * The cumulative uid never moves past one that was not received, and ranges cover the uids
+     * received above it.
+     *
+     * @param ip        peer's ip address
+     * @param port      peer's port
+     * @param next      lowest uid not received yet
+     * @param ranges    uid ranges received above next, in ascending order
+     * @param count     capacity of ranges; set to number of ranges written
+     *
+     * @return          TRUE if peer is known, FALSE otherwise
+     */
+    bool BuildAck(in_addr_t ip, in_port_t port, uint32_t *next, AckRange *ranges, uint8_t *count);
+
+    /**
+     * Forget everything received from peer
+     *
+     * @param ip        peer's ip address
+     * @param port      peer's port
+     */
+    void Clear(in_addr_t ip, in_port_t port);
+
+private:
+    struct Peer {
+        uint32_t next;                              // Lowest uid not received, all below it were
+        uint32_t high;                              // Highest uid received
+        std::vector<uint64_t> bits;                 // Received bitmap indexed by uid % window
+    };
+
+    struct Shard {
+        std::unordered_map<uint64_t, Peer> peers;
+        boost::mutex m_peers;
+    };
+
+    uint32_t window_;                               // Set before use, see set_window()
+    std::unique_ptr<Shard[]> shards_;
+
+    static uint64_t PeerKey(in_addr_t ip, in_port_t port);
+
+    Shard &GetShard(uint64_t key);
+
+    bool TestBit(const Peer &peer, uint32_t uid);
+
+    void SetBit(Peer &peer, uint32_t uid);
+
+    void ClearBit(Peer &peer, uint32_t uid);
+
+    /**
+     * Check if uid belongs to a new run of the peer's uids, too far below next for a retransmit
+     */
+    bool Restarted(const Peer &peer, uint32_t uid);
+
+    /**
+     * Move next over the received uids that follow it
+     */
+    void Advance(Peer &peer);
+
+    /**
+     * Find first uid from start (inclusive) whose bit equals value
+     *
+     * @return          offset from start, or limit if not found within limit uids
+     */
+    uint32_t FindBit(const Peer &peer, uint32_t start, uint32_t limit, bool value);
+};
+
+#endif //JAM_RECEIVE_WINDOW_H
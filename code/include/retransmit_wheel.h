@@ -0,0 +1,253 @@
+/**
+ * Thread-safe hashed timing wheel for retransmission deadlines.
+ *
+ * Tickets are stored once in a slab and referenced by handle from the wheel buckets and from a
+ * (peer, uid) hash index, so arming, cancelling and firing are O(1), no payload is copied while
+ * waiting for the next deadline, and a steady send/ACK cycle does not touch the heap. Each peer
+ * also keeps its tickets in uid order so one cumulative/selective ACK retires every ticket it
+ * covers in a single pass. A peer's outstanding uids never span more than a receive window: a
+ * newer ticket is held unsent until older ones are acknowledged, so the receiver's cumulative ACK
+ * can always keep up.
+ */
+
+#ifndef JAM_RETRANSMIT_WHEEL_H
+#define JAM_RETRANSMIT_WHEEL_H
+
+#ifdef SECURE
+#include "payload_secure.h"
+#else
+#include "payload.h"
+#endif
+
+#include "config.h"
+#include "slab_allocator.h"
+
+#include <chrono>
+#include <unordered_map>
+#include <vector>
+#include "boost/function.hpp"
+#include "boost/thread/mutex.hpp"
+#include "boost/thread/condition_variable.hpp"
+
+class RetransmitWheel {
+public:
+    /**
+     * Outstanding payload waiting for ACK
+     */
+    struct Ticket {
+        uint32_t uid;                               // Payload uid
+        uint8_t retries;                            // Remaining number of resends
+        uint8_t resends;                            // Number of resends so far
+        bool unsent;                                // Held back for older tickets, fires to be sent first
+        std::chrono::milliseconds sent;             // Steady clock time of the first send
+        std::chrono::milliseconds deadline;         // Steady clock time to fire
+        Payload payload;                            // Encoded payload to resend
+    };
+
+    /**
+     * Called for every expired ticket while the wheel is locked.
+     * Update deadline and return TRUE to re-arm the ticket, FALSE to release it.
+     */
+    typedef boost::function<bool(Ticket &)> ExpireHandler;
+
+    /**
+     * @param tick      wheel granularity in milliseconds
+     * @param slots     number of buckets (rounded up to a power of 2)
+     * @param capacity  tickets per slab (rounded up to a power of 2)
+     */
+    RetransmitWheel(uint32_t tick, uint32_t slots, uint32_t capacity = RETRANSMIT_WHEEL_CAPACITY);
+
+    ~RetransmitWheel();
+
+    /**
+     * Get current steady clock time used for deadlines
+     *
+     * @return          milliseconds since steady clock epoch
+     */
+    static std::chrono::milliseconds Now();
+
+    /**
+     * Get number of armed tickets
+     *
+     * @return          number of tickets
+     */
+    size_t size();
+
+    /**
+     * Check if no ticket is armed
+     *
+     * @return          TRUE if empty, FALSE otherwise
+     */
+    bool is_empty();
+
+    /**
+     * Set the most uids a peer may have outstanding, from the oldest ticket on
+     *
+     * @param span      receive window of the peers
+     */
+    void set_span(uint32_t span);
+
+    /**
+     * Get ticket slab free-list statistics
+     *
+     * @return          snapshot of slab counters
+     */
+    SlabStats GetStats();
+
+    /**
+     * Arm ticket for payload if its receiver has no ticket with the same uid
+     *
+     * A payload a span or more past the receiver's oldest ticket is held when held is given: the
+     * caller must not send it. It fires as unsent once the older tickets are gone.
+     *
+     * @param uid       payload uid
+     * @param retries   number of resends before giving up
+     * @param deadline  steady clock time to fire
+     * @param payload   encoded payload with receiver's address
+     * @param held      if not NULL, set to TRUE if the ticket is held, FALSE if the payload is to be sent
+     *
+     * @return          TRUE if armed, FALSE if uid is already armed
+     */
+    bool Arm(uint32_t uid, uint8_t retries, std::chrono::milliseconds deadline, const Payload &payload,
+             bool *held = NULL);
+
+    /**
+     * Remove ticket with uid sent to addr
+     *
+     * @param addr      receiver's address
+     * @param uid       payload uid
+     *
+     * @return          TRUE if found and removed, FALSE otherwise
+     */
+    bool Cancel(const sockaddr_in *addr, uint32_t uid);
+
+    /**
+     * Remove every ticket sent to addr that is covered by an ACK
+     *
+     * @param addr      receiver's address
+     * @param next      cumulative ACK; every uid before it is retired
+     * @param ranges    selective ACK ranges in ascending order
+     * @param count     number of ranges
+     * @param sent      if not NULL, set to the first send time of the newest removed ticket that was
+     *                  never resent (zero if none), for measuring round trips as in Karn's algorithm
+     *
+     * @return          number of tickets removed
+     */
+    uint32_t Retire(const sockaddr_in *addr, uint32_t next, const AckRange *ranges, uint8_t count,
+                    std::chrono::milliseconds *sent);
+
+    /**
+     * Fire every ticket whose deadline has passed
+     *
+     * @param now       current steady clock time
+     * @param handler   decides whether each expired ticket is re-armed
+     */
+    void Advance(std::chrono::milliseconds now, ExpireHandler handler);
+
+    /**
+     * Block until a ticket may have expired
+     *
+     * @return          TRUE if Advance() should be called, FALSE once stopped
+     */
+    bool Wait();
+
+    /**
+     * Get the time a ticket may expire next, for callers keeping their own timer instead of Wait()
+     *
+     * @return          steady clock time to call Advance() at, milliseconds::max() if none is armed
+     */
+    std::chrono::milliseconds NextDeadline();
+
+    /**
+     * Wake up and terminate Wait()
+     */
+    void Stop();
+
+private:
+    enum : uint32_t {
+        NIL = 0xFFFFFFFF                            // Empty link
+    };
+
+    struct Entry {
+        Ticket ticket;
+        uint64_t peer;                              // Receiver key
+        uint64_t tick;                              // Absolute tick the ticket fires at
+        uint32_t prev;                              // Bucket links
+        uint32_t next;
+        uint32_t peer_prev;                         // Per-peer links in uid order
+        uint32_t peer_next;
+        uint32_t index_next;                        // Next ticket in the same index chain
+        bool in_use;
+        bool held;                                  // Not in a bucket until older tickets are gone
+    };
+
+    // Kept after the last ticket is gone so a peer costs no allocation per message
+    struct Peer {
+        uint32_t head = NIL;                        // Oldest outstanding uid
+        uint32_t tail = NIL;                        // Newest outstanding uid
+        uint32_t held = NIL;                        // Oldest held ticket, all after it are held too
+    };
+
+    uint32_t tick_;                                 // Tick length in milliseconds
+    uint32_t mask_;                                 // Number of buckets - 1
+    uint64_t current_tick_;                         // Last tick processed by Advance()
+    uint32_t span_;                                 // Most uids outstanding per peer
+
+    SlabAllocator<Entry> entries_;                  // Ticket storage addressed by handle
+    std::vector<uint32_t> index_;                   // Head handle of each (peer, uid) hash chain
+    uint32_t index_mask_;                           // Number of index chains - 1
+    std::vector<uint32_t> buckets_;                 // Head handle of each bucket
+    std::vector<uint64_t> occupied_;                // Bitmap of non-empty buckets
+    std::unordered_map<uint64_t, Peer> peers_;      // Outstanding tickets per receiver
+    size_t count_;                                  // Number of armed tickets
+
+    std::chrono::milliseconds wake_;                // Time Wait() is sleeping until
+    bool stopped_;
+
+    mutable boost::mutex m_wheel_;
+    boost::condition_variable cond_variable_;
+
+    void Link(uint32_t handle);
+
+    void Unlink(uint32_t handle);
+
+    /**
+     * Insert ticket into its peer's uid ordered list (newest uids are appended at the tail)
+     */
+    void LinkPeer(Peer &peer, uint32_t handle);
+
+    /**
+     * Remove ticket from its peer and free the handle; the ticket must be unlinked from its bucket
+     */
+    void Release(uint32_t handle);
+
+    /**
+     * Put held tickets now within span of the peer's oldest one into the bucket of tick
+     *
+     * @return          TRUE if any ticket was released
+     */
+    bool Unhold(Peer &peer, uint64_t tick);
+
+    /**
+     * Find handle of the ticket with uid sent to peer
+     *
+     * @return          handle, NIL if not armed
+     */
+    uint32_t Find(uint64_t peer, uint32_t uid);
+
+    uint32_t &IndexChain(uint64_t peer, uint32_t uid);
+
+    static uint64_t PeerKey(const sockaddr_in *addr);
+
+    /**
+     * Serial number comparison so uids keep their order when they wrap around
+     */
+    static bool Before(uint32_t a, uint32_t b);
+
+    /**
+     * Find the first tick after current_tick_ whose bucket is not empty
+     */
+    uint64_t NextOccupiedTick();
+};
+
+#endif //JAM_RETRANSMIT_WHEEL_H
@@ -0,0 +1,95 @@
+/**
+ * Thread-safe per-peer round trip time estimator (Jacobson/Karels).
+ *
+ * Keeps a smoothed RTT and its mean deviation for each receiver and derives the retransmission
+ * timeout from them, so a fast LAN peer is retried quickly while a slow link is not declared
+ * crashed by a timeout tuned for someone else.
+ */
+
+#ifndef JAM_RTT_ESTIMATOR_H
+#define JAM_RTT_ESTIMATOR_H
+
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+#include <netinet/in.h>
+#include "boost/thread/mutex.hpp"
+
+class RttEstimator {
+public:
+    /**
+     * Current estimate for one peer
+     */
+    struct PeerStats {
+        sockaddr_in addr;                           // Peer's address
+        uint32_t srtt;                              // Smoothed RTT in miliseconds
+        uint32_t rttvar;                            // RTT mean deviation in miliseconds
+        uint32_t rto;                               // Retransmission timeout in miliseconds
+        uint64_t samples;                           // Number of RTT samples taken
+    };
+
+    /**
+     * @param initial   timeout used before the first sample of a peer in miliseconds
+     * @param min       lower bound of the timeout in miliseconds
+     * @param max       upper bound of the timeout (and of its backoff) in miliseconds
+     */
+    RttEstimator(uint32_t initial, uint32_t min, uint32_t max);
+
+    ~RttEstimator();
+
+    /**
+     * Add a round trip measured for a payload that was sent only once
+     *
+     * @param addr      peer's address
+     * @param rtt       round trip time in miliseconds
+     */
+    void Sample(const sockaddr_in *addr, uint32_t rtt);
+
+    /**
+     * Get retransmission timeout for a peer after a number of resends
+     *
+     * The timeout doubles with every resend (exponential backoff) up to the upper bound.
+     *
+     * @param addr      peer's address
+     * @param resends   number of times the payload was already resent
+     *
+     * @return          timeout in miliseconds
+     */
+    uint32_t GetRto(const sockaddr_in *addr, uint32_t resends);
+
+    /**
+     * Forget the estimate of a peer
+     *
+     * @param addr      peer's address
+     */
+    void Clear(const sockaddr_in *addr);
+
+    /**
+     * Get current estimate of every peer with at least one sample
+     *
+     * @return          list of peer estimates
+     */
+    std::vector<PeerStats> GetStats();
+
+private:
+    enum {
+        CLOCK_GRANULARITY = 1                       // Timer granularity in miliseconds (G in RFC 6298)
+    };
+
+    uint32_t initial_;
+    uint32_t min_;
+    uint32_t max_;
+
+    struct Peer {
+        PeerStats stats;
+        uint32_t srtt8;                             // SRTT * 8 so the 1/8 gain keeps its precision
+        uint32_t rttvar4;                           // RTTVAR * 4
+    };
+
+    std::unordered_map<uint64_t, Peer> peers_;
+    mutable boost::mutex m_peers_;
+
+    static uint64_t PeerKey(const sockaddr_in *addr);
+};
+
+#endif //JAM_RTT_ESTIMATOR_H
@@ -0,0 +1,96 @@
+/**
+ * Sequencer batch - chat messages the leader packs into one ordered datagram.
+ *
+ * The leader adds each chat message that needs an order; once the batch is full or its window
+ * has passed it is taken as a single payload carrying a contiguous range of orders, starting at
+ * the payload's order. A batch of one message goes out as a plain CHAT_MSG. The message of a
+ * BATCH_MSG holds, per chat message, a user name length byte, the user name, a message length
+ * byte and the message.
+ *
+ * Not thread-safe; the owner serializes access.
+ */
+
+#ifndef JAM_SEQUENCER_BATCH_H
+#define JAM_SEQUENCER_BATCH_H
+
+#ifdef SECURE
+#include "payload_secure.h"
+#else
+#include "payload.h"
+#endif
+
+#include <chrono>
+#include <vector>
+
+class SequencerBatch {
+public:
+    /**
+     * @param max_count     most chat messages per batch (1 sends every message on its own)
+     * @param window        time the first message waits for others in miliseconds (0 packs only
+     *                      what arrives before the next Due() check)
+     */
+    SequencerBatch(uint32_t max_count, uint32_t window);
+
+    /**
+     * Add a chat message to the batch
+     *
+     * @param payload       chat message without order
+     *
+     * @return              FALSE if the batch is full; take it and add again
+     */
+    bool Add(Payload &payload);
+
+    /**
+     * Check whether the batch should be taken now
+     *
+     * @return              TRUE if not empty and full or its window has passed
+     */
+    bool Due() const;
+
+    /**
+     * Get time until the batch is due
+     *
+     * @param max           returned if the batch is empty
+     *
+     * @return              wait in miliseconds, at most max
+     */
+    uint32_t GetTimeout(uint32_t max) const;
+
+    /**
+     * Build the payload of the batch and empty it
+     *
+     * @param first_order   order of the first message, the others follow
+     * @param payload       returned CHAT_MSG or BATCH_MSG
+     *
+     * @return              number of orders used
+     */
+    uint32_t Take(int32_t first_order, Payload *payload);
+
+    void clear();
+
+    bool empty() const;
+
+    uint32_t size() const;
+
+    /**
+     * Unpack a BATCH_MSG into its chat messages
+     *
+     * @param batch         received batch
+     * @param payloads      chat messages with their orders and the sender's address appended
+     *
+     * @return              SUCCESS or DECODE_VALIDATION_FAILED if the message is malformed
+     */
+    static JamStatus Unpack(Payload &batch, std::vector<Payload> *payloads);
+
+private:
+    uint32_t max_count_;
+    std::chrono::milliseconds window_;
+    std::chrono::steady_clock::time_point due_;     // Window end of the first message
+    uint32_t count_;
+    Payload first_;                                 // Sent on its own if nothing joins it
+    uint8_t buffer_[MAX_MESSAGE_LENGTH];            // Packed messages
+    uint32_t length_;
+    bool full_;                                     // A message did not fit, or max_count_ reached
+};
+
+#endif //JAM_SEQUENCER_BATCH_H
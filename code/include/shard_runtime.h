@@ -0,0 +1,150 @@
+/**
+ * Shard runtime - many chat groups in one process, one pinned thread per core.
+ *
+ * Gateways lead many groups at once. Groups are spread over shards in the order they are added
+ * (group i goes to shard i % shards), and each shard is a single thread pinned to its own core.
+ * A shard creates the JAM of every group it hosts on its thread, so each group keeps its own
+ * socket, central queues, hold queue and client list, touched by that thread only: shards share
+ * nothing and take no lock of another shard while running.
+ *
+ * Every group runs as in a REACTOR build, with its own epoll instance over its socket and
+ * timer. A shard waits on those epoll instances together and runs a round of whichever group
+ * has something to do. Groups hosted here take no user input and do not join a multicast group;
+ * their leaders order and relay the messages of the clients that join them.
+ */
+
+#ifndef JAM_SHARD_RUNTIME_H
+#define JAM_SHARD_RUNTIME_H
+
+#ifndef REACTOR
+#error "ShardRuntime needs a REACTOR build"
+#endif
+
+#include <string>
+#include <vector>
+#include "boost/thread/thread.hpp"
+#include "boost/thread/mutex.hpp"
+#include "boost/thread/condition_variable.hpp"
+
+#include "jam.h"
+
+class ShardRuntime {
+public:
+    enum {
+        UNPINNED = -1                               // Core of a shard left to the scheduler
+    };
+
+    /**
+     * @param shards    number of shards, 0 for one per core
+     */
+    ShardRuntime(uint32_t shards);
+
+    ~ShardRuntime();
+
+    ShardRuntime(const ShardRuntime &) = delete;
+    ShardRuntime &operator=(const ShardRuntime &) = delete;
+
+    /**
+     * Set the core each shard is pinned to
+     *
+     * Shard i runs on cores[i % cores.size()]; UNPINNED leaves it to the scheduler. By default
+     * shard i runs on core i, going round the cores again if there are more shards. Must be
+     * called before Start().
+     *
+     * @param cores     core numbers, empty to pin no shard
+     */
+    void set_cores(const std::vector<int> &cores);
+
+    /**
+     * Add a group this process leads
+     *
+     * Must be called before Start().
+     *
+     * @param user_name         leader's name in the group
+     * @param user_interface    interface to listen on
+     * @param user_port         first port to try, the next free one is taken if busy
+     *
+     * @return                  shard hosting the group
+     */
+    uint32_t AddGroup(const std::string &user_name, const std::string &user_interface,
+                      const std::string &user_port);
+
+    /**
+     * Start every shard and wait until each has set up its groups
+     *
+     * @return          number of groups started
+     */
+    uint32_t Start();
+
+    /**
+     * Make every group leave and its shard return
+     *
+     * Safe to call from any thread, and from a signal handler.
+     */
+    void Stop();
+
+    /**
+     * Wait for every shard to return
+     */
+    void Join();
+
+    /**
+     * @return          number of shards
+     */
+    uint32_t size() const;
+
+    /**
+     * Get where a started group listens
+     *
+     * @param group     group in the order added
+     * @param addr      group leader's address
+     *
+     * @return          TRUE if the group started, FALSE otherwise
+     */
+    bool get_group_address(uint32_t group, sockaddr_in *addr);
+
+    /**
+     * @param shard     shard number
+     *
+     * @return          TRUE if the shard runs pinned to its core, FALSE otherwise
+     */
+    bool is_pinned(uint32_t shard);
+
+private:
+    struct Group {
+        std::string user_name;
+        std::string user_interface;
+        std::string user_port;
+        sockaddr_in addr;                           // Set by the shard once started
+        bool started;
+    };
+
+    struct Shard {
+        int core;
+        int stop_fd;                                // Eventfd waking the shard to stop
+        bool pinned;
+        std::vector<uint32_t> groups;               // Indexes into groups_
+    };
+
+    std::vector<Group> groups_;
+    std::vector<Shard> shards_;
+    boost::thread_group threads_;
+
+    boost::mutex m_start_;                          // Guards what shards report at start-up
+    boost::condition_variable cv_started_;
+    uint32_t shards_ready_;
+
+    /**
+     * Pin the calling thread, set up the groups of a shard and run them until stopped
+     *
+     * @param index     shard number
+     */
+    void RunShard(uint32_t index);
+
+    /**
+     * Count a shard as set up, waking Start() with the last one
+     */
+    void MarkReady();
+};
+
+#endif //JAM_SHARD_RUNTIME_H
@@ -0,0 +1,124 @@
+/**
+ * Fixed-capacity slab allocator template
+ *
+ * Objects live in slabs allocated up front and are addressed by a 32 bit handle, so taking and
+ * returning one is a free-list push/pop without touching the heap. When every object is in use
+ * another slab of the same size is added; the statistics show when the configured capacity is
+ * too small. Objects keep their address until the allocator is destroyed and are not
+ * destroyed on Free().
+ *
+ * Not thread-safe; the owner serializes access.
+ */
+
+#ifndef JAM_SLAB_ALLOCATOR_H
+#define JAM_SLAB_ALLOCATOR_H
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+/**
+ * Free-list statistics of a slab allocator
+ */
+struct SlabStats {
+    size_t capacity;                                // Objects in all slabs
+    size_t in_use;                                  // Objects handed out
+    size_t free;                                    // Objects in the free list
+    size_t high_water;                              // Most objects ever in use at once
+    size_t slabs;                                   // Number of slabs (more than 1 means capacity was exceeded)
+};
+
+template<typename T>
+class SlabAllocator {
+private:
+    enum {
+        MAX_SLABS = 64                              // Slab table size reserved up front
+    };
+
+    uint32_t shift_;                                // log2 of objects per slab
+    uint32_t mask_;                                 // Objects per slab - 1
+    std::vector<std::unique_ptr<T[]>> slabs_;
+    std::vector<uint32_t> free_;                    // Free handles, most recently freed last
+    size_t high_water_;
+
+    void AddSlab() {
+        uint32_t base = (uint32_t) slabs_.size() << shift_;
+        slabs_.emplace_back(new T[mask_ + 1]);
+        free_.reserve(slabs_.size() << shift_);
+        // Lowest handles on top so a fresh allocator hands them out in order
+        for (uint32_t i = mask_ + 1; i > 0; --i) {
+            free_.push_back(base + i - 1);
+        }
+    }
+
+public:
+    /**
+     * @param capacity  objects per slab (rounded up to a power of 2)
+     */
+    explicit SlabAllocator(uint32_t capacity) : shift_(0), high_water_(0) {
+        while (((uint32_t) 1 << shift_) < capacity) {
+            shift_++;
+        }
+        mask_ = ((uint32_t) 1 << shift_) - 1;
+        slabs_.reserve(MAX_SLABS);
+        AddSlab();
+    }
+
+    SlabAllocator(const SlabAllocator &) = delete;
+
+    SlabAllocator &operator=(const SlabAllocator &) = delete;
+
+    /**
+     * Take an object from the free list, adding a slab if it is empty
+     *
+     * @return          handle of the object
+     */
+    uint32_t Allocate() {
+        if (free_.empty()) {
+            AddSlab();
+        }
+        uint32_t handle = free_.back();
+        free_.pop_back();
+
+        size_t in_use = (slabs_.size() << shift_) - free_.size();
+        if (in_use > high_water_) {
+            high_water_ = in_use;
+        }
+        return handle;
+    }
+
+    /**
+     * Return an object to the free list
+     *
+     * @param handle    handle from Allocate()
+     */
+    void Free(uint32_t handle) {
+        free_.push_back(handle);
+    }
+
+    T &operator[](uint32_t handle) {
+        return slabs_[handle >> shift_][handle & mask_];
+    }
+
+    const T &operator[](uint32_t handle) const {
+        return slabs_[handle >> shift_][handle & mask_];
+    }
+
+    /**
+     * Get free-list statistics
+     *
+     * @return          snapshot of counters
+     */
+    SlabStats GetStats() const {
+        SlabStats stats;
+        stats.capacity = slabs_.size() << shift_;
+        stats.free = free_.size();
+        stats.in_use = stats.capacity - stats.free;
+        stats.high_water = high_water_;
+        stats.slabs = slabs_.size();
+        return stats;
+    }
+};
+
+#endif //JAM_SLAB_ALLOCATOR_H
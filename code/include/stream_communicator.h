@@ -56,7 +56,14 @@ public:
         dataLength = ntohl(dataLength);
 
         std::vector<char> receiveBuffer = std::vector<char>(dataLength);
-        ssize_t receivedLength = read(fd, receiveBuffer.data(), dataLength);
+        ssize_t receivedLength = 0;
+        ssize_t n;
+
+        // A long message may take more than one read
+        while (receivedLength < dataLength &&
+               (n = read(fd, receiveBuffer.data() + receivedLength, dataLength - receivedLength)) > 0) {
+            receivedLength += n;
+        }
 
         std::string receivedData;
         receivedData.assign(receiveBuffer.data(), receiveBuffer.size());
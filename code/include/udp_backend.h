@@ -0,0 +1,121 @@
+/**
+ * UDP backend - the system calls moving datagrams in and out of a socket.
+ *
+ * UdpWrapper's readers and writer each keep a backend and hand it whole batches. By default it
+ * blocks in recvmmsg/sendmmsg (recvmsg/sendmsg for a single datagram). Builds with liburing 2.4
+ * or later (-DIO_URING=ON, defines HAVE_LIBURING) go through io_uring instead: one multishot
+ * receive keeps filling buffers the ring provides, so a busy socket is drained without a system
+ * call per batch, and a batch of sends is a single submission. When io_uring cannot be set up at
+ * run time the backend falls back to the blocking calls, and so do receives on kernels without
+ * multishot receive.
+ *
+ * Both ways honour SO_RCVTIMEO of the socket, so readers that time out to check for termination
+ * keep doing so. On a non-blocking socket Receive() fails with EAGAIN once the socket is drained.
+ * Not thread-safe; each thread keeps its own.
+ */
+
+#ifndef JAM_UDP_BACKEND_H
+#define JAM_UDP_BACKEND_H
+
+#include <cstdint>
+#include <vector>
+#include <sys/socket.h>
+
+#ifdef HAVE_LIBURING
+#include <liburing.h>
+#endif
+
+class UdpBackend {
+public:
+    enum {
+        MAX_BATCH_SIZE = 64                         // Most datagrams moved by one call
+    };
+
+    /**
+     * @param fd        socket to receive from and send on
+     * @param uring     FALSE to keep to socket calls, e.g. for a socket polled for readiness elsewhere
+     */
+    UdpBackend(int fd, bool uring = true);
+
+    ~UdpBackend();
+
+    UdpBackend(const UdpBackend &) = delete;
+    UdpBackend &operator=(const UdpBackend &) = delete;
+
+    /**
+     * Receive up to count datagrams, blocking until at least one arrives
+     *
+     * Every message describes one datagram: a sockaddr_in name and a single iovec.
+     *
+     * @param msgs      messages to receive into, msg_namelen updated
+     * @param sizes     received datagram sizes
+     * @param count     maximum number of datagrams
+     *
+     * @return          number of datagrams received, -1 on error (errno EAGAIN on timeout)
+     */
+    int Receive(msghdr *msgs, int *sizes, uint32_t count);
+
+    /**
+     * Send datagrams in order; messages without iovec are skipped
+     *
+     * @param msgs      messages to send
+     * @param sent      set to TRUE for every datagram handed to the kernel
+     * @param count     number of messages, at most MAX_BATCH_SIZE
+     *
+     * @return          number of system calls made
+     */
+    uint32_t Send(msghdr *msgs, bool *sent, uint32_t count);
+
+    /**
+     * Check which system calls are used
+     *
+     * @return          TRUE if sending through io_uring, FALSE for blocking socket calls
+     */
+    bool is_uring() const;
+
+private:
+    int fd_;
+
+    int ReceiveSocket(msghdr *msgs, int *sizes, uint32_t count);
+
+    uint32_t SendSocket(msghdr *msgs, bool *sent, uint32_t count);
+
+#ifdef HAVE_LIBURING
+    enum {
+        NUM_BUFFERS = 256,                          // Provided receive buffers, a power of 2
+        BUFFER_GROUP = 0
+    };
+
+    io_uring send_ring_;
+    io_uring recv_ring_;                            // Set up on the first Receive()
+    bool uring_;                                    // Send ring set up
+    bool recv_uring_;                               // Receive ring and its buffers set up
+    bool recv_fallback_;                            // Receive with recvmsg instead
+    bool armed_;                                    // Multishot receive in flight
+    __kernel_timespec timeout_;                     // SO_RCVTIMEO of the socket, zero blocks
+    io_uring_buf_ring *buf_ring_;
+    std::vector<uint8_t> buffers_;
+    uint32_t buffer_size_;                          // recvmsg header, name and datagram
+    msghdr recv_msg_;                               // Layout of every received buffer
+
+    int ReceiveUring(msghdr *msgs, int *sizes, uint32_t count);
+
+    uint32_t SendUring(msghdr *msgs, bool *sent, uint32_t count);
+
+    /**
+     * Set up the receive ring and hand it all buffers
+     *
+     * @return          TRUE on success, FALSE to receive with recvmsg
+     */
+    bool InitReceive();
+
+    /**
+     * Submit the multishot receive
+     *
+     * @return          TRUE on success, FALSE otherwise
+     */
+    bool Arm();
+#endif
+};
+
+#endif //JAM_UDP_BACKEND_H
@@ -11,23 +11,56 @@
 
 #ifdef SECURE
 #include "payload_secure.h"
+#include "aes_cipher.h"
+#include "crypto_pool.h"
 #else
 #include "payload.h"
 #endif
 
 #include "config.h"
-#include "concurrent_queue.h"
-#include "concurrent_ticket.h"
+#include "mpsc_queue.h"
 #include "central_queues.h"
+#include "receive_window.h"
+#include "retransmit_wheel.h"
+#include "rtt_estimator.h"
+#include "reassembler.h"
+#include "slab_allocator.h"
+#include "udp_backend.h"
 
 #include <boost/thread/thread.hpp>
+#include <arpa/inet.h>
+#include <algorithm>
+#include <atomic>
 #include <string.h>
 #include <sstream>
 #include <iomanip>
 #include <chrono>
+#include <functional>
+#include <memory>
+#include <random>
+#include <unordered_map>
 
 class UdpWrapper {
 public:
+    /**
+     * System call counters for measuring batched I/O savings
+     */
+    struct UdpStats {
+        uint64_t recv_calls;                        // recvfrom/recvmmsg calls returning data
+        uint64_t packets_received;                  // Datagrams returned by those calls
+        uint64_t send_calls;                        // sendto/sendmmsg calls
+        uint64_t packets_sent;                      // Datagrams handed to the kernel
+        uint64_t acks_sent;                         // ACK datagrams among packets_sent
+        uint64_t acks_piggybacked;                  // ACKs carried by outgoing payloads instead
+        uint64_t multicast_sent;                    // Group datagrams among packets_sent
+        uint64_t multicast_received;                // Group datagrams among packets_received
+        uint64_t fragments_sent;                    // Fragment payloads queued, one per fragment and receiver
+        uint64_t fragments_received;                // Fragment payloads passed to reassembly
+        uint64_t auth_failures;                     // Datagrams dropped for failing verification
+        uint64_t crypto_batches;                    // Batches shared with the crypto workers
+        uint64_t tickets_pending;                   // Payloads sent and waiting for an ACK
+    };
+
     UdpWrapper(CentralQueues *queues);
 
     ~UdpWrapper();
@@ -42,17 +75,82 @@ public:
      */
     JamStatus Start(const char *port, uint16_t *bport);
 
+    /**
+     * Join a multicast group and start listening on it
+     *
+     * Must be called after Start(). Group datagrams are sent from the main socket, so receivers
+     * see this client's unicast address as sender. They are not acknowledged; receivers find
+     * lost ones from gaps in the order and ask for them by unicast.
+     *
+     * @param group     group address
+     * @param port      group port
+     * @param iface     address of the interface to send and receive group datagrams on
+     *
+     * @return          SUCCESS on normal operation, other JamStatus errors otherwise
+     */
+    JamStatus StartMulticast(const char *group, const char *port, const sockaddr_in *iface);
+
+    /**
+     * Check if the multicast group is joined
+     *
+     * @return          TRUE if StartMulticast() succeeded, FALSE otherwise
+     */
+    bool is_multicast_ready();
+
     // TODO: implement start as client
 
     /**
      * Terminate all working threads and exit
      *
+     * REACTOR builds have no threads; payloads still queued are sent first.
+     *
      * @return          SUCCESS on normal operation, other JamStatus errors otherwise
      */
     JamStatus Stop();
 
     void Join();
 
+#ifdef REACTOR
+    /**
+     * Get the sockets to poll for incoming datagrams (REACTOR builds)
+     *
+     * Sockets are non-blocking. The list changes when the multicast group is joined.
+     *
+     * @return          main socket, then the multicast socket if joined
+     */
+    std::vector<int> get_fds();
+
+    /**
+     * Handle the datagrams waiting on a socket reported readable, as a reader thread would
+     *
+     * Reads at most REACTOR_RECEIVE_BATCHES batches so other events get their turn; a socket left
+     * with datagrams stays readable.
+     *
+     * @param fd        socket from get_fds()
+     */
+    void Receive(int fd);
+
+    /**
+     * Send every queued payload, then the delayed ACKs that are due, as the writer thread would
+     */
+    void Send();
+
+    /**
+     * Resend or give up on payloads whose ACK timed out, as the monitor thread would
+     *
+     * Resent payloads are queued for the next Send().
+     */
+    void RunTimers();
+
+    /**
+     * Get the time RunTimers() or Send() must be called next
+     *
+     * @return          steady clock time of the next retransmit or delayed ACK, milliseconds::max()
+     *                  if none is waiting
+     */
+    std::chrono::milliseconds NextDeadline();
+#endif
+
     /**
      * Put payload to a single receiver to queue
      *
@@ -90,6 +188,31 @@ public:
      */
     JamStatus SendPayloadList(Payload payload, std::vector<sockaddr_in> *list);
 
+    /**
+     * Put payload to the multicast group to queue
+     *
+     * One datagram reaches every member. No retransmit ticket is kept for it.
+     * Address will be encoded by UdpWrapper.
+     *
+     * @param payload   encoded payload (to ensure caller validate encoding)
+     *
+     * @return          SUCCESS on normal operation, other JamStatus errors otherwise
+     */
+    JamStatus SendPayloadMulticast(Payload payload);
+
+    /**
+     * Put list of payloads to a single receiver to queue at once
+     *
+     * UDP socket must be init before this function can be used.
+     * Uid and address will be encoded by UdpWrapper; the writer sends them in batched datagrams.
+     *
+     * @param payloads  payloads to be sent
+     * @param addr      receiver's address
+     *
+     * @return          SUCCESS on normal operation, other JamStatus errors otherwise
+     */
+    JamStatus SendPayloadBatch(std::vector<Payload> *payloads, const sockaddr_in *addr);
+
     /**
      * Convert IP address and port to sockaddr_in type
      *
@@ -117,9 +240,87 @@ public:
      */
     void ClearReceivedHistory(const sockaddr_in *addr);
 
+    /**
+     * Set maximum number of datagrams moved per system call
+     *
+     * Must be called before Start(). A size of 1 falls back to recvfrom/sendto.
+     * Size is capped at MAX_UDP_BATCH_SIZE.
+     *
+     * @param size      batch size
+     */
+    void set_batch_size(uint32_t size);
+
+    /**
+     * Set number of sockets bound to the port with SO_REUSEPORT, each read by its own thread
+     *
+     * The kernel hashes each sender to one socket, so a sender's payloads stay with one reader
+     * and its duplicates are still caught. Every reader feeds the same UDP_IN queue. Must be
+     * called before Start(). A count of 1 keeps a single socket; count is capped at
+     * MAX_UDP_READERS. REACTOR builds keep a single socket.
+     *
+     * @param count     number of reader threads
+     */
+    void set_reader_count(uint32_t count);
+
+    /**
+     * Set number of payload uids remembered per sender for duplicate detection
+     *
+     * Receivers are assumed to remember as many, so no more uids are outstanding per receiver.
+     * Must be called before Start().
+     *
+     * @param window    window size
+     */
+    void set_receive_window(uint32_t window);
+
+    /**
+     * Set how long an ACK may wait for an outgoing payload to the same sender to piggyback on
+     *
+     * Delayed ACKs are sent by the writer so the reader never blocks on them. A delay of 0
+     * makes the reader send one ACK per sender right after each received batch.
+     * Must be called before Start().
+     *
+     * @param delay     delay in miliseconds
+     */
+    void set_ack_delay(uint32_t delay);
+
+    /**
+     * Set number of payloads received from a sender that flushes its delayed ACK at once
+     *
+     * Must be called before Start().
+     *
+     * @param count     number of unacknowledged payloads
+     */
+    void set_ack_threshold(uint32_t count);
+
+    /**
+     * Get current I/O counters
+     *
+     * @return          snapshot of system call and packet counters
+     */
+    UdpStats GetStats();
+
+    /**
+     * Get round trip estimates of every peer that acknowledged a payload
+     *
+     * @return          SRTT, RTTVAR and resend timeout per peer
+     */
+    std::vector<RttEstimator::PeerStats> GetRttStats();
+
 private:
     enum {
-        NUM_UDP_TERMINATE_RETRIES = 10              // Terminate flag for monitor thread
+        MAX_UDP_BATCH_SIZE = UdpBackend::MAX_BATCH_SIZE,   // Upper bound for set_batch_size()
+        MAX_UDP_READERS = 16,                       // Upper bound for set_reader_count()
+        NOT_OWED = 0xFFFFFFFF                       // PendingAck::position of a sender owed nothing
+    };
+
+    /**
+     * ACK owed to a sender while waiting to be piggybacked or flushed
+     */
+    struct PendingAck {
+        sockaddr_in addr;                           // Sender to acknowledge
+        uint32_t count;                             // Payloads received since last ACK
+        std::chrono::milliseconds due;              // Steady clock time to send it alone
+        uint32_t position;                          // Index in acks_owed_, NOT_OWED if none
     };
 
     CentralQueues *queues_;                         // Central queues for inter-communication
@@ -127,23 +328,68 @@ private:
     bool is_ready_;                                 // UDP socket ready for communication
     int sockfd_;                                    // Main socket file descriptor
     sockaddr_in this_addr_;                         // This client's address
-    uint32_t uid_;                                  // UID counter
-
-    ConcurrentQueue<Payload> out_queue_;            // Thread-safe outgoing payload queue for distributing
-    // TODO: optimize monitor algorithm to reduce payload overhead
-    ConcurrentTicket<uint32_t, uint8_t,
-            std::chrono::milliseconds,
-            Payload> ack_tickets_;                  // Thread-safe outgoing payload ticket monitoring
-
-    ConcurrentQueue<Payload> leader_failed_queue_;  // Thread-safe queue for payload to leader failed to send
+    int mcast_fd_;                                  // Multicast group socket file descriptor, -1 if not joined
+    sockaddr_in mcast_addr_;                        // Multicast group address
+    std::atomic<bool> mcast_stop_;                  // Signal for multicast reader to exit
+    std::unordered_map<uint64_t, uint32_t> next_uid_;   // Next uid per receiver
+    std::mt19937 uid_random_;                       // Picks where a receiver's uids start
+    boost::mutex m_next_uid_;
+    uint32_t batch_size_;                           // Maximum datagrams per recvmmsg/sendmmsg call
+    uint32_t reader_count_;                         // Sockets sharing the port, one reader each
+    std::vector<int> reader_fds_;                   // Sockets read besides sockfd_
+    std::atomic<bool> readers_stop_;                // Signal for readers sharing the port to exit
+    uint32_t ack_delay_;                            // Delayed ACK timeout in miliseconds (0 disables)
+    uint32_t ack_threshold_;                        // Payloads per sender that flush a delayed ACK
+
+    std::atomic<uint64_t> recv_calls_;              // I/O counters reported by GetStats()
+    std::atomic<uint64_t> packets_received_;
+    std::atomic<uint64_t> send_calls_;
+    std::atomic<uint64_t> packets_sent_;
+    std::atomic<uint64_t> acks_sent_;
+    std::atomic<uint64_t> acks_piggybacked_;
+    std::atomic<uint64_t> multicast_sent_;
+    std::atomic<uint64_t> multicast_received_;
+    std::atomic<uint64_t> fragments_sent_;
+    std::atomic<uint64_t> fragments_received_;
+    std::atomic<uint16_t> next_fragment_id_;        // Fragment id of the next long message
+    std::atomic<uint64_t> auth_failures_;
+#ifdef SECURE
+    uint32_t seal_salt_;                            // Random nonce prefix of this wrapper's sealed datagrams
+    std::atomic<uint64_t> seal_counter_;            // Rest of the nonce, taken once per datagram
+    CryptoPool crypto_pool_;                        // Workers sealing, opening and decoding batches
+#endif
 
-    boost::thread t_reader_;                        // Reader thread for RunReader()
+    SingleConsumerQueue<Payload> out_queue_;        // Thread-safe outgoing payload queue for distributing
+    RetransmitWheel ack_wheel_;                     // Thread-safe outgoing payload ticket monitoring
+    RttEstimator rtt_;                              // Thread-safe round trip estimate per receiver
+
+    SingleConsumerQueue<Payload> leader_failed_queue_;  // Thread-safe queue for payload to leader failed to send
+
+#ifdef REACTOR
+    std::unique_ptr<UdpBackend> io_;                // Main socket, for Receive() and Send()
+    std::unique_ptr<UdpBackend> mcast_io_;          // Multicast socket once joined
+    Reassembler reassembler_;                       // Long messages on the main socket
+    std::vector<Payload> in_payloads_;              // Batch buffers of Receive() and Send()
+    std::vector<Payload> out_payloads_;
+    std::vector<Payload> ack_payloads_;
+    std::vector<sockaddr_in> addrs_;
+    std::vector<int> sizes_;
+#else
+    boost::thread t_reader_;                        // Reader thread for RunReader() on sockfd_
+    std::vector<boost::thread> t_readers_;          // Reader threads for RunReader() on reader_fds_
     boost::thread t_writer_;                        // Writer thread for RunWriter()
     boost::thread t_monitor_;                       // Monitor thread for RunMonitor()
+    boost::thread t_mcast_reader_;                  // Multicast reader thread for RunMulticastReader()
+#endif
 
-    // Thread-safe queue for history of received payload
-    std::deque<std::tuple<in_addr_t, in_port_t, uint32_t>> received_queue_;
-    mutable boost::mutex m_received_queue_;
+    ReceiveWindow received_window_;                 // Thread-safe history of received payload per sender
+    Reassembler mcast_reassembler_;                 // Long messages from the group (multicast reader only)
+
+    // Delayed ACKs: one slab entry per sender, kept once known, and the handles of those owed one
+    SlabAllocator<PendingAck> pending_acks_;
+    std::unordered_map<uint64_t, uint32_t> pending_index_;      // Sender to pending_acks_ handle
+    std::vector<uint32_t> acks_owed_;
+    boost::mutex m_pending_acks_;
 
     /**
      * Initialize listening UDP socket (bind to specific port)
@@ -156,9 +402,45 @@ private:
     JamStatus InitUdpSocket(const char *port, uint16_t *bport);
 
     /**
-     * Start reader thread to listen for incoming packets.
+     * Open the sockets sharing the port for the extra readers
+     *
+     * Readers sharing the port time out now and then to see if one of them was told to stop.
+     * Fewer sockets are used if some cannot be opened.
+     */
+    void InitReaderSockets();
+
+    /**
+     * Initialize multicast group socket and set the main socket up to send to the group
+     *
+     * @param group     group address
+     * @param port      group port
+     * @param iface     address of the interface to use
+     *
+     * @returns         SUCCESS if joined normally, other JamStatus errors otherwise
      */
-    void RunReader();
+    JamStatus InitMulticastSocket(const char *group, const char *port, const sockaddr_in *iface);
+
+    /**
+     * Stop owing an ACK to a sender, moving the last owed one into its place
+     *
+     * Caller holds m_pending_acks_.
+     *
+     * @param handle    pending_acks_ handle of an owed sender
+     */
+    void Unowe(uint32_t handle);
+
+#ifndef REACTOR
+    /**
+     * Start reader thread to listen for incoming packets on one socket.
+     *
+     * @param fd        socket to read
+     */
+    void RunReader(int fd);
+
+    /**
+     * Start multicast reader thread to listen for group datagrams.
+     */
+    void RunMulticastReader();
 
     /**
      * Start writer thread to distribute packets.
@@ -170,14 +452,240 @@ private:
      */
     void RunMonitor();
 
+    /**
+     * Writer's wait for the next outgoing payload, bounded by the earliest delayed ACK
+     *
+     * @param payload   payload taken from out_queue_
+     *
+     * @return          TRUE if payload was taken, FALSE if a delayed ACK is due first
+     */
+    bool WaitForPayload(Payload &payload);
+#endif
+
+    /**
+     * Handle a received batch: pass its payloads to JAM and acknowledge them
+     *
+     * @param io            backend the batch came from, to send ACKs without delay on
+     * @param in_payloads   received payloads
+     * @param addrs         senders' addresses
+     * @param sizes         received datagram sizes
+     * @param count         number of datagrams
+     * @param reassembler   long messages of the calling reader
+     * @param ack_payloads  scratch payloads, at least count of them
+     *
+     * @return              TRUE if the self-terminate payload was among them, FALSE otherwise
+     */
+    bool HandleDatagrams(UdpBackend &io, Payload *in_payloads, sockaddr_in *addrs, const int *sizes, uint32_t count,
+                         Reassembler &reassembler, Payload *ack_payloads);
+
+    /**
+     * Handle a batch received from the multicast group
+     *
+     * @param in_payloads   received payloads
+     * @param addrs         senders' addresses
+     * @param sizes         received datagram sizes
+     * @param count         number of datagrams
+     */
+    void HandleMulticastDatagrams(Payload *in_payloads, sockaddr_in *addrs, const int *sizes, uint32_t count);
+
+    /**
+     * Arm tickets for a batch of outgoing payloads, attach delayed ACKs and send it
+     *
+     * Payloads a receive window ahead of their receiver's oldest unacknowledged one are held by
+     * ack_wheel_ and sent when it fires them.
+     *
+     * @param io        backend of the calling thread
+     * @param payloads  encoded payloads, at most batch_size_ (reordered)
+     * @param count     number of payloads
+     */
+    void SendPayloads(UdpBackend &io, Payload *payloads, uint32_t count);
+
+    /**
+     * Fire expired tickets: queue resends and report receivers that never acknowledged
+     *
+     * @param resend    scratch list, left empty
+     * @param failed    scratch list, left empty
+     */
+    void ExpireTickets(std::vector<Payload> &resend, std::vector<Payload> &failed);
+
+    /**
+     * Receive up to count datagrams, blocking until at least one arrives
+     *
+     * @param io        backend of the calling reader
+     * @param payloads  payloads to receive into
+     * @param addrs     senders' addresses
+     * @param sizes     received datagram sizes
+     * @param count     maximum number of datagrams
+     *
+     * @return          number of datagrams received, -1 on error
+     */
+    int ReceiveDatagrams(UdpBackend &io, Payload *payloads, sockaddr_in *addrs, int *sizes, uint32_t count);
+
+    /**
+     * Send encoded payloads to their encoded addresses with as few system calls as possible
+     *
+     * @param io        backend of the calling thread
+     * @param payloads  encoded payloads
+     * @param sent      set to TRUE for every payload handed to the kernel
+     * @param count     number of payloads
+     */
+    void SendDatagrams(UdpBackend &io, Payload *payloads, bool *sent, uint32_t count);
+
+    /**
+     * Describe a datagram for sendmsg/sendmmsg
+     *
+     * In sealed SECURE builds the whole payload is encrypted and authenticated into a buffer of
+     * the calling thread: nonce, ciphertext, then tag. The self-terminate payload stays as is.
+     *
+     * @param payload   encoded payload
+     * @param iov       at least Payload::MAX_SEGMENTS entries to fill
+     * @param buffer    MAX_BUFFER_LENGTH bytes for the sealed datagram, kept until it is sent
+     *
+     * @return          number of entries used, 0 if it could not be sealed
+     */
+    int GetDatagramIovec(Payload &payload, iovec *iov, uint8_t *buffer);
+
+    /**
+     * Verify and decrypt a received sealed datagram in place (sealed SECURE builds only)
+     *
+     * @param in_payload    received payload
+     * @param size          received length, returned payload length
+     *
+     * @return              TRUE if authentic or not sealed, FALSE if it must be dropped
+     */
+    bool OpenDatagram(Payload &in_payload, int *size);
+
+    /**
+     * Call task for every datagram of a batch, shared with the crypto workers in SECURE builds
+     *
+     * Returns once every call is done, so the caller reads the results back in batch order.
+     * Pass the lambda with std::ref() so std::function holds it without a heap allocation.
+     *
+     * @param count     number of datagrams
+     * @param task      called with each index
+     */
+    void RunCrypto(uint32_t count, const std::function<void(uint32_t)> &task);
+
+    /**
+     * Open and decode a received batch, leaving the self-terminate payload alone
+     *
+     * @param in_payloads   received payloads
+     * @param sizes         received lengths
+     * @param decoded       returned TRUE for each payload decoded
+     * @param count         number of payloads
+     */
+    void DecodeDatagrams(Payload *in_payloads, const int *sizes, bool *decoded, uint32_t count);
+
+    /**
+     * Pass a decoded datagram to JAM if it is not a duplicate
+     *
+     * Fragments are held back until the whole message is there; each is acknowledged on its own.
+     *
+     * @param in_payload    decoded payload
+     * @param addr          sender's address
+     * @param reassembler   long messages of the calling reader
+     *
+     * @return              TRUE if sender must be acknowledged, FALSE otherwise
+     */
+    bool ProcessDatagram(Payload &in_payload, sockaddr_in *addr, Reassembler &reassembler);
+
+    /**
+     * Pass a decoded group datagram to JAM
+     *
+     * There is no uid window or ACK for group datagrams; JAM drops duplicates by order.
+     * Fragments are held back until the whole message is there.
+     *
+     * @param in_payload    decoded payload
+     * @param addr          sender's address
+     */
+    void ProcessMulticastDatagram(Payload &in_payload, sockaddr_in *addr);
+
+    /**
+     * Split a payload whose message is too long for one datagram into fragments for receivers
+     *
+     * Every receiver gets all fragments under one fragment id, each with its own uid.
+     *
+     * @param payload   payload with a long message
+     * @param addrs     receivers' addresses
+     * @param count     number of receivers
+     * @param out       fragments appended in sending order
+     *
+     * @return          SUCCESS on normal operation, ENCODE_VALIDATION_FAILED otherwise
+     */
+    JamStatus AddFragments(Payload &payload, const sockaddr_in *addrs, size_t count, std::vector<Payload> *out);
+
+    /**
+     * Take next uid in the sequence space of a receiver
+     *
+     * Each receiver sees consecutive uids so it can acknowledge them cumulatively. They start at a
+     * random multiple of the receive window, so a receiver tells our uids from those of an earlier
+     * run on the same address.
+     *
+     * @param addr      receiver's address
+     *
+     * @return          uid for the next payload to addr
+     */
+    uint32_t NextUid(const sockaddr_in *addr);
+
+    /**
+     * Build and send one ACK for each sender describing everything received from it
+     *
+     * @param io            backend of the calling thread
+     * @param addrs         senders' addresses
+     * @param count         number of senders
+     * @param ack_payloads  scratch payloads, at least count of them
+     */
+    void SendAcks(UdpBackend &io, const sockaddr_in *addrs, uint32_t count, Payload *ack_payloads);
+
+    /**
+     * Record that payloads from a sender must be acknowledged (delayed ACK mode)
+     *
+     * Wakes the writer when its next deadline moves earlier.
+     * REACTOR builds look at NextDeadline() instead.
+     *
+     * @param addr      sender's address
+     * @param count     number of payloads received
+     */
+    void ScheduleAck(const sockaddr_in *addr, uint32_t count);
+
+    /**
+     * Attach the delayed ACK owed to the payload's receiver, if any
+     *
+     * @param payload   encoded payload about to be sent
+     */
+    void Piggyback(Payload &payload);
+
+    /**
+     * Send every delayed ACK whose deadline has passed
+     *
+     * @param io            backend of the writer
+     * @param ack_payloads  scratch payloads, at least batch_size_ of them
+     */
+    void FlushAcks(UdpBackend &io, Payload *ack_payloads);
+
+    /**
+     * Get the earliest deadline of the delayed ACKs
+     *
+     * @return          steady clock time, milliseconds::max() if none is owed
+     */
+    std::chrono::milliseconds NextAckDue();
+
+    /**
+     * Resend or give up on a payload whose ACK timed out, or send a held one (called by ack_wheel_)
+     *
+     * @param ticket    expired ticket
+     * @param resend    payloads to be queued again for sending
+     * @param failed    payloads whose receiver is considered crashed
+     *
+     * @return          TRUE if ticket is re-armed, FALSE otherwise
+     */
+    bool HandleAckTimeout(RetransmitWheel::Ticket &ticket, std::vector<Payload> *resend,
+                          std::vector<Payload> *failed);
+
     // -- Helper functions
     std::string u16_to_string(uint16_t in);
 
     std::string u32_to_string(uint32_t in);
-
-    bool payload_already_received(in_addr_t ip,
-                                  in_port_t port,
-                                  uint32_t uid);
 };
 
 #endif //JAM_UDP_WRAPPER_H
@@ -7,6 +7,9 @@
 
 #include <boost/thread.hpp>
 #include <string>
+#include <utility>
+#include <vector>
+#include <poll.h>
 #include <sys/select.h>
 #include <sys/types.h>
 #include <unistd.h>
@@ -19,9 +22,22 @@ public:
     ~UserHandler();
 
     void Start();
-    int get_write_pipe();
 
+    // FALSE leaves stdin alone, for a node nobody types into; call before Start()
+    void set_input(bool enabled);
+
+    // Hand over a delivered message to print; REACTOR builds keep it until HandleIncoming()
+    void Deliver(const std::string &sender, const std::string &message);
+
+#ifndef REACTOR
     void HandleInput();
+#endif
+
+    // Read one line of user input; FALSE once the user exits (REACTOR builds call it when stdin is readable)
+    bool HandleUserInput();
+
+    // Print every message delivered so far (REACTOR builds call it after each pass over the queues)
+    void HandleIncoming();
 
     void WaitOnEnd(); // Testing only
 private:
@@ -32,7 +48,12 @@ private:
     fd_set activeFdSet_;
     fd_set readFdSet_;
 
+#ifdef REACTOR
+    // Delivered on the one thread that prints them too, so a pipe could fill up and block it
+    std::vector<std::pair<std::string, std::string>> incoming_;
+#else
     int incomingFd_[2];
+#endif
 
     // Helper functions
     void PrintMessage(const std::string &sender, const std::string &message);
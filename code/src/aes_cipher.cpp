@@ -0,0 +1,68 @@
+/**
+ * AES ciphers - prepared EVP contexts for the secure build.
+ */
+
+#include "../include/aes_cipher.h"
+#include "../include/config.h"
+
+#include <openssl/aes.h>
+
+AesCipher::AesCipher(const unsigned char *key, bool encrypt)
+        : ctx_(EVP_CIPHER_CTX_new()),
+          ready_(false) {
+    // Padding is ours, the message is zero padded to whole blocks
+    ready_ = ctx_ != NULL && EVP_CipherInit_ex(ctx_, EVP_aes_256_cbc(), NULL, key, NULL, encrypt ? 1 : 0) == 1 &&
+             EVP_CIPHER_CTX_set_padding(ctx_, 0) == 1;
+    if (!ready_) {
+        DCERR("ERROR: AesCipher - Failed to set up cipher context");
+    }
+}
+
+AesCipher::~AesCipher() {
+    EVP_CIPHER_CTX_free(ctx_);
+}
+
+bool AesCipher::Process(const uint8_t *in, uint8_t *out, uint32_t length) {
+    unsigned char iv[AES_BLOCK_SIZE] = {};  // This must be set to random in production
+    int out_length = 0;
+
+    // Only the IV is reset, the key schedule stays
+    return ready_ && length % AES_BLOCK_SIZE == 0 && EVP_CipherInit_ex(ctx_, NULL, NULL, NULL, iv, -1) == 1 &&
+           EVP_CipherUpdate(ctx_, out, &out_length, in, (int) length) == 1 && out_length == (int) length;
+}
+
+AesGcmCipher::AesGcmCipher(const unsigned char *key)
+        : seal_ctx_(EVP_CIPHER_CTX_new()),
+          open_ctx_(EVP_CIPHER_CTX_new()),
+          ready_(false) {
+    ready_ = seal_ctx_ != NULL && open_ctx_ != NULL &&
+             EVP_EncryptInit_ex(seal_ctx_, EVP_aes_256_gcm(), NULL, key, NULL) == 1 &&
+             EVP_DecryptInit_ex(open_ctx_, EVP_aes_256_gcm(), NULL, key, NULL) == 1;
+    if (!ready_) {
+        DCERR("ERROR: AesGcmCipher - Failed to set up cipher contexts");
+    }
+}
+
+AesGcmCipher::~AesGcmCipher() {
+    EVP_CIPHER_CTX_free(seal_ctx_);
+    EVP_CIPHER_CTX_free(open_ctx_);
+}
+
+bool AesGcmCipher::Seal(const uint8_t *nonce, uint8_t *data, uint32_t length, uint8_t *tag) {
+    int out_length = 0, final_length = 0;
+
+    return ready_ && EVP_EncryptInit_ex(seal_ctx_, NULL, NULL, NULL, nonce) == 1 &&
+           EVP_EncryptUpdate(seal_ctx_, data, &out_length, data, (int) length) == 1 &&
+           EVP_EncryptFinal_ex(seal_ctx_, data + out_length, &final_length) == 1 &&
+           EVP_CIPHER_CTX_ctrl(seal_ctx_, EVP_CTRL_GCM_GET_TAG, TAG_LENGTH, tag) == 1;
+}
+
+bool AesGcmCipher::Open(const uint8_t *nonce, uint8_t *data, uint32_t length, const uint8_t *tag) {
+    int out_length = 0, final_length = 0;
+
+    // Final fails unless the tag matches
+    return ready_ && EVP_DecryptInit_ex(open_ctx_, NULL, NULL, NULL, nonce) == 1 &&
+           EVP_DecryptUpdate(open_ctx_, data, &out_length, data, (int) length) == 1 &&
+           EVP_CIPHER_CTX_ctrl(open_ctx_, EVP_CTRL_GCM_SET_TAG, TAG_LENGTH, (void *) tag) == 1 &&
+           EVP_DecryptFinal_ex(open_ctx_, data + out_length, &final_length) == 1;
+}
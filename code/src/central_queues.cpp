@@ -9,7 +9,7 @@
 #include "../include/central_queues.h"
 
 CentralQueues::CentralQueues() :
-        exit_(false) {
+        ready_(0), exit_(false) {
 
 }
 
@@ -65,25 +65,30 @@ void CentralQueues::push(QueueType type, QueueParam const &in) {
             history_request_queue_.push(boost::get<int32_t>(in));
             break;
     }
-    cond_variable_.notify_all();
+    MarkReady(type);
 }
 
 bool CentralQueues::wait_for_data(uint32_t time) {
-    boost::mutex::scoped_lock lock(m_cond_);
-    while (user_out_queue_.is_empty() &&
-           udp_in_queue_.is_empty() &&
-           udp_crash_queue.is_empty() &&
-           leader_out_queue_.is_empty() &&
-           history_request_queue_.is_empty()) {
-        cond_variable_.timed_wait(lock, boost::posix_time::milliseconds(time));
+    auto ready = [this]() {
+        return has_data();
+    };
+
+    if (!ready()) {
+        notifier_.Wait(ready, (int) time);
     }
+    return ready();
+}
+
+bool CentralQueues::has_data() {
+    return ready_.load(std::memory_order_acquire) != 0 || exit_.load(std::memory_order_acquire);
+}
+
+uint32_t CentralQueues::take_ready() {
+    return ready_.exchange(0, std::memory_order_acq_rel);
+}
 
-    return (!user_out_queue_.is_empty() ||
-            !udp_in_queue_.is_empty() ||
-            !udp_crash_queue.is_empty() ||
-            !leader_out_queue_.is_empty() ||
-            !history_request_queue_.is_empty() ||
-            exit_);
+uint32_t CentralQueues::queue_bit(QueueType type) {
+    return 1u << type;
 }
 
 bool CentralQueues::try_pop_user_out(Payload &out) {
@@ -106,14 +111,46 @@ bool CentralQueues::try_pop_history_request(int32_t &out) {
     return history_request_queue_.try_pop(out);
 }
 
+bool CentralQueues::drain_user_out(std::vector<Payload> &out, size_t max) {
+    return Drain(USER_OUT, user_out_queue_, out, max);
+}
+
+bool CentralQueues::drain_udp_in(std::vector<Payload> &out, size_t max) {
+    return Drain(UDP_IN, udp_in_queue_, out, max);
+}
+
+bool CentralQueues::drain_udp_crash(std::vector<sockaddr_in> &out, size_t max) {
+    return Drain(UDP_CRASH, udp_crash_queue, out, max);
+}
+
+bool CentralQueues::drain_leader_out(std::vector<Payload> &out, size_t max) {
+    return Drain(LEADER_OUT, leader_out_queue_, out, max);
+}
+
+bool CentralQueues::drain_history_request(std::vector<int32_t> &out, size_t max) {
+    return Drain(HISTORY_REQUEST, history_request_queue_, out, max);
+}
+
 void CentralQueues::signal_terminate() {
-    boost::mutex::scoped_lock lock(m_exit_);
-    exit_ = true;
-    lock.unlock();
-    cond_variable_.notify_all();
+    exit_.store(true, std::memory_order_release);
+    notifier_.Notify();
 }
 
 bool CentralQueues::is_terminate() {
-    boost::mutex::scoped_lock lock(m_exit_);
-    return exit_;
-}
\ No newline at end of file
+    return exit_.load(std::memory_order_acquire);
+}
+
+void CentralQueues::MarkReady(QueueType type) {
+    ready_.fetch_or(queue_bit(type), std::memory_order_release);
+    notifier_.Notify();
+}
+
+template<typename Queue, typename Container>
+bool CentralQueues::Drain(QueueType type, Queue &queue, Container &out, size_t max) {
+    size_t count = queue.drain_into(out, max);
+    if (count == max) {
+        // Possibly more left behind, keep the queue in the next take_ready()
+        MarkReady(type);
+    }
+    return count > 0;
+}
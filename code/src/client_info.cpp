@@ -9,12 +9,14 @@
 #include <cstring>
 
 ClientInfo::ClientInfo(sockaddr_in client) :
-    client_(client) {
+    client_(client), isLeader_(false), isMulticast_(false), isCompact_(false) {
 
 }
 
-ClientInfo::ClientInfo(sockaddr_in client, const std::string &username, bool isLeader) :
-        client_(client), username_(username), isLeader_(isLeader) {
+ClientInfo::ClientInfo(sockaddr_in client, const std::string &username, bool isLeader, bool isMulticast,
+                       bool isCompact) :
+        client_(client), username_(username), isLeader_(isLeader), isMulticast_(isMulticast),
+        isCompact_(isCompact) {
     char ipstr[INET_ADDRSTRLEN];
 
     inet_ntop(AF_INET, &(client_.sin_addr), ipstr, sizeof ipstr);
@@ -47,6 +49,36 @@ void ClientInfo::set_leader(bool val) {
     isLeader_ = val;
 }
 
+bool ClientInfo::is_multicast() {
+    return isMulticast_;
+}
+
+void ClientInfo::set_multicast(bool val) {
+    isMulticast_ = val;
+}
+
+bool ClientInfo::is_compact() {
+    return isCompact_;
+}
+
+void ClientInfo::set_compact(bool val) {
+    isCompact_ = val;
+}
+
+uint16_t ClientInfo::get_user_id() {
+    return UserIdOf(username_);
+}
+
+uint16_t ClientInfo::UserIdOf(const std::string &username) {
+    // FNV-1a folded to 16 bits, every client derives the same id from the name alone
+    uint32_t hash = 2166136261u;
+    for (char c : username) {
+        hash = (hash ^ (uint8_t) c) * 16777619u;
+    }
+    uint16_t id = (uint16_t) ((hash >> 16) ^ hash);
+    return id > 0 ? id : (uint16_t) 1;
+}
+
 void ClientInfo::print_client() {
     std::cout << username_
         << " " << inet_ntoa(client_.sin_addr) << ":" << ntohs(client_.sin_port)
@@ -73,7 +105,7 @@ bool ClientInfo::operator==(const ClientInfo& other) const {
 
 
 uint32_t ClientInfo::get_packet_size() {
-    //Sum of sizes of username, ip_address, port, boolean(isLeader)
+    //Sum of sizes of username, ip_address, port, flags(isLeader, isMulticast, isCompact)
     uint32_t L = (sizeof(uint32_t) + MAX_USER_NAME_LENGTH + sizeof(uint32_t) + sizeof(uint16_t) + sizeof(uint8_t));
     return L;
 }
@@ -91,7 +123,9 @@ uint32_t ClientInfo::EncodeClientInBuffer(ClientInfo client, uint8_t *&buffer) {
 
     size += SerializerHelper::packu32(buffer, client.get_sock_address().sin_addr.s_addr);
     size += SerializerHelper::packu16(buffer, client.get_sock_address().sin_port);
-    size += SerializerHelper::packu8(buffer, client.is_leader() ? (uint8_t) 1 : (uint8_t) 0);
+    size += SerializerHelper::packu8(buffer, (uint8_t) ((client.is_leader() ? LEADER_FLAG : 0) |
+                                                        (client.is_multicast() ? MULTICAST_FLAG : 0) |
+                                                        (client.is_compact() ? COMPACT_FLAG : 0)));
 
     return size;
 }
\ No newline at end of file
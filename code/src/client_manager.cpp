@@ -2,6 +2,7 @@
 // Author: Bipeen Acharya
 // Created: 03/30/16
 //
+#include <algorithm>
 #include <iostream>
 #include <vector>
 
@@ -56,6 +57,45 @@ std::vector<sockaddr_in> ClientManager::GetAllClientSockAddress() {
     return vectorOfSockAddress;
 }
 
+std::vector<sockaddr_in> ClientManager::GetUnicastClientSockAddress() {
+    std::vector<sockaddr_in> vectorOfSockAddress;
+    for (int i = 0; i < client_list_.size(); i++) {
+        if (!client_list_[i].is_multicast()) {
+            vectorOfSockAddress.push_back(client_list_[i].get_sock_address());
+        }
+    }
+    return vectorOfSockAddress;
+}
+
+std::vector<sockaddr_in> ClientManager::GetRelayChildren(sockaddr_in node, uint32_t degree) {
+    std::vector<sockaddr_in> vectorOfSockAddress;
+    std::vector<ClientInfo> members;
+    ClientInfo info(node);
+    size_t first = 0;
+
+    for (int i = 0; i < client_list_.size(); i++) {
+        if (!client_list_[i].is_leader()) {
+            members.push_back(client_list_[i]);
+        }
+    }
+    std::sort(members.begin(), members.end());
+
+    // Children of member i are members (i + 1) * degree onwards, children of the leader start at 0
+    ClientInfo *leader = get_current_leader();
+    if (leader == nullptr || !(*leader == info)) {
+        auto search = std::find(members.begin(), members.end(), info);
+        if (search == members.end()) {
+            return vectorOfSockAddress;
+        }
+        first = (size_t) (search - members.begin() + 1) * degree;
+    }
+
+    for (size_t i = first; i < first + degree && i < members.size(); i++) {
+        vectorOfSockAddress.push_back(members[i].get_sock_address());
+    }
+    return vectorOfSockAddress;
+}
+
 long ClientManager::get_client_count() {
     return client_list_.size();
 }
@@ -80,8 +120,9 @@ vector<ClientInfo> ClientManager::GetHigherOrderClients() {
     return GetHigherOrderClients(self_addr_);
 }
 
-bool ClientManager::AddClient(sockaddr_in client, const std::string &username, bool isLeader) {
-    bool ret = AddClient(ClientInfo(client, username, isLeader));
+bool ClientManager::AddClient(sockaddr_in client, const std::string &username, bool isLeader, bool isMulticast,
+                              bool isCompact) {
+    bool ret = AddClient(ClientInfo(client, username, isLeader, isMulticast, isCompact));
     return ret;
 }
 
@@ -138,10 +179,51 @@ void ClientManager::RemoveAllClients() {
     encoded_data_size_ = 0;
 }
 
+HeaderVersion ClientManager::GetHeaderVersion() {
+    for (int i = 0; i < client_list_.size(); i++) {
+        if (!client_list_[i].is_compact()) {
+            return FIXED_HEADER;
+        }
+    }
+    return COMPACT_HEADER;
+}
+
+uint16_t ClientManager::GetUserId(const std::string &username) {
+    uint16_t id = ClientInfo::UserIdOf(username);
+    bool found = false;
+
+    for (int i = 0; i < client_list_.size(); i++) {
+        if (client_list_[i].get_user_id() == id) {
+            if (found || client_list_[i].get_username() != username) {
+                return 0;
+            }
+            found = true;
+        }
+    }
+    return found ? id : (uint16_t) 0;
+}
+
+bool ClientManager::GetUsername(uint16_t id, std::string *username) {
+    bool found = false;
+
+    for (int i = 0; i < client_list_.size(); i++) {
+        if (client_list_[i].get_user_id() == id) {
+            if (found) {
+                return false;
+            }
+            *username = client_list_[i].get_username();
+            found = true;
+        }
+    }
+    return found;
+}
+
 JamStatus ClientManager::EncodeClientList() {
     JamStatus ret = SUCCESS;
 
-    uint8_t *buffer = encoded_data_;
+    // Room for the longest user name of every client
+    encoded_data_.resize(client_list_.size() * ClientInfo::get_packet_size());
+    uint8_t *buffer = encoded_data_.data();
     encoded_data_size_ = 0;
 
     for (int i = 0; i < client_list_.size(); i++) {
@@ -181,10 +263,14 @@ JamStatus ClientManager::DecodeBufferToClientList(uint8_t *payload, uint32_t len
             addr.sin_addr.s_addr = SerializerHelper::unpacku32(buffer);
             addr.sin_port = SerializerHelper::unpacku16(buffer);
 
-            bool isLeader = SerializerHelper::unpacku8(buffer);
-            client_list_.push_back(ClientInfo(addr, username, isLeader));
+            uint8_t flags = SerializerHelper::unpacku8(buffer);
+            client_list_.push_back(ClientInfo(addr, username, (flags & ClientInfo::LEADER_FLAG) != 0,
+                                              (flags & ClientInfo::MULTICAST_FLAG) != 0,
+                                              (flags & ClientInfo::COMPACT_FLAG) != 0));
             count += 4 + username_length + 4 + 2 + 1;
         }
+        // Keep our own encoding in step in case we hand the list out as leader later
+        EncodeClientList();
     }
 
     return ret;
@@ -238,7 +324,7 @@ ClientInfo* ClientManager::get_current_leader() {
 }
 
 uint8_t *ClientManager::GetPayload() {
-    return encoded_data_;
+    return encoded_data_.data();
 }
 
 uint32_t ClientManager::GetPayloadSize() {
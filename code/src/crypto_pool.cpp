@@ -0,0 +1,108 @@
+/**
+ * Crypto pool - a few threads sharing the per-datagram crypto of a batch.
+ */
+
+#include "../include/crypto_pool.h"
+
+CryptoPool::CryptoPool(uint32_t workers, uint32_t min_batch)
+        : min_batch_(min_batch > 1 ? min_batch : 2),
+          task_(NULL),
+          count_(0),
+          next_(0),
+          done_(0),
+          busy_(0),
+          generation_(0),
+          stop_(false),
+          batches_(0) {
+    for (uint32_t i = 0; i < workers; ++i) {
+        threads_.create_thread(boost::bind(&CryptoPool::RunWorker, this));
+    }
+}
+
+CryptoPool::~CryptoPool() {
+    {
+        boost::mutex::scoped_lock lock(m_state_);
+        stop_ = true;
+    }
+    cv_start_.notify_all();
+    threads_.join_all();
+}
+
+void CryptoPool::Run(uint32_t count, const std::function<void(uint32_t)> &task) {
+    boost::mutex::scoped_lock run(m_run_, boost::try_to_lock);
+
+    if (count < min_batch_ || threads_.size() == 0 || !run.owns_lock()) {
+        for (uint32_t i = 0; i < count; ++i) {
+            task(i);
+        }
+        return;
+    }
+
+    {
+        boost::mutex::scoped_lock lock(m_state_);
+        task_ = &task;
+        count_ = count;
+        next_ = 0;
+        done_ = 0;
+        generation_++;
+    }
+    cv_start_.notify_all();
+    batches_++;
+
+    uint32_t finished = Work(task, count);
+
+    // A worker may only join while the batch is published, so none is left holding the task
+    boost::mutex::scoped_lock lock(m_state_);
+    done_ += finished;
+    while (done_ < count_ || busy_ > 0) {
+        cv_done_.wait(lock);
+    }
+    task_ = NULL;
+    count_ = 0;
+}
+
+uint32_t CryptoPool::size() const {
+    return (uint32_t) threads_.size();
+}
+
+uint64_t CryptoPool::get_batches() const {
+    return batches_;
+}
+
+void CryptoPool::RunWorker() {
+    uint64_t seen = 0;
+    boost::mutex::scoped_lock lock(m_state_);
+
+    while (true) {
+        while (!stop_ && (generation_ == seen || task_ == NULL)) {
+            cv_start_.wait(lock);
+        }
+        if (stop_) {
+            break;
+        }
+        seen = generation_;
+        const std::function<void(uint32_t)> &task = *task_;
+        uint32_t count = count_;
+        busy_++;
+
+        lock.unlock();
+        uint32_t finished = Work(task, count);
+        lock.lock();
+
+        busy_--;
+        done_ += finished;
+        if (done_ == count_ && busy_ == 0) {
+            cv_done_.notify_all();
+        }
+    }
+}
+
+uint32_t CryptoPool::Work(const std::function<void(uint32_t)> &task, uint32_t count) {
+    uint32_t finished = 0;
+
+    for (uint32_t i = next_++; i < count; i = next_++) {
+        task(i);
+        finished++;
+    }
+    return finished;
+}
@@ -0,0 +1,72 @@
+/**
+ * Gateway - leads many chat groups from one process, sharded over pinned cores.
+ *
+ * Usage: dchatg <name> <groups> [shards] [cores]
+ *
+ * Group i is led by <name>i. Shards default to GATEWAY_SHARDS; cores is a comma separated list
+ * such as "0,2,4" (shard i runs on the (i % count)-th) or "none" to pin no shard. The gateway
+ * runs until EXIT is typed or stdin is closed.
+ */
+
+#include "../include/shard_runtime.h"
+
+#include <sstream>
+
+using namespace std;
+
+// Parse a comma separated core list, "none" for no pinning
+static bool ParseCores(const string &list, vector<int> *cores) {
+    istringstream stream(list);
+    string core;
+
+    cores->clear();
+    if (list == "none") {
+        return true;
+    }
+    while (getline(stream, core, ',')) {
+        if (core.empty() || core.find_first_not_of("0123456789") != string::npos) {
+            return false;
+        }
+        cores->push_back(atoi(core.c_str()));
+    }
+    return !cores->empty();
+}
+
+int main(int argc, char *argv[])
+{
+    int groups = argc >= 3 ? atoi(argv[2]) : 0;
+    int shards = argc >= 4 ? atoi(argv[3]) : GATEWAY_SHARDS;
+    vector<int> cores;
+
+    // Parse arguments
+    if (argc < 3 || argc > 5 || groups <= 0 || shards < 0 || (argc == 5 && !ParseCores(argv[4], &cores))) {
+        cerr << "Invalid arguments!" << endl;
+        exit(1);
+    }
+
+    ShardRuntime runtime((uint32_t) shards);
+    if (argc == 5) {
+        runtime.set_cores(cores);
+    }
+    for (int i = 1; i <= groups; ++i) {
+        runtime.AddGroup(argv[1] + to_string(i), DEFAULT_INTERFACE, DEFAULT_PORT);
+    }
+
+    uint32_t started = runtime.Start();
+    cout << "Leading " << started << " of " << groups << " chat groups on " << runtime.size() << " shards." <<
+    endl;
+    if (started == 0) {
+        runtime.Stop();
+        runtime.Join();
+        exit(1);
+    }
+
+    // Groups live on the shards; this thread only waits for the operator
+    string line;
+    while (getline(cin, line) && line != TERMINATE_MESSAGE) {
+    }
+
+    runtime.Stop();
+    runtime.Join();
+    cout << "Bye." << endl;
+}
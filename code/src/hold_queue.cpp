@@ -6,87 +6,213 @@
 
 HoldQueue::HoldQueue(CentralQueues *queues) :
         queues_(queues),
-        user_handler_pipe_(-1),
+        history_queue_(MAX_HOLDBACK_QUEUE_LENGTH),
+        holdback_queue_(MAX_HOLDBACK_QUEUE_LENGTH),
+        user_handler_(NULL),
         expected_order_(DEFAULT_FIRST_ORDER),
+        highest_order_(DEFAULT_FIRST_ORDER - 1),
         recovery_counter_(0),
         first_payload_(true) {
-    delivery_queue_.reserve(MAX_HOLDBACK_QUEUE_LENGTH);
+    ClearQueue();
 }
 
 HoldQueue::~HoldQueue() {
 }
 
-void HoldQueue::AddMessageToQueue(Payload payload) {
+bool HoldQueue::AddMessageToQueue(Payload payload) {
+    if (!Insert(payload)) {
+        return false;
+    }
 
-    if (payload.GetType() == CHAT_MSG && payload.GetOrder() != DEFAULT_NO_ORDER) {
+    ProcessPayloads();
+    return true;
+}
 
-        //prevent duplicate sending so goes through history queue
-        // and returns without doing anything
-        // if the payload has already been sent (duplicate)
-        std::deque<Payload>::iterator it = history_queue_.begin();
-        while (it != history_queue_.end()) {
-            if (payload.GetOrder() == it->GetOrder()) {
-                DCOUT("WARNING: HoldQueue - Trying to send duplicate message-ignored");
-                return;
-            }
-            ++it;
-        }
+bool HoldQueue::AddBatchToQueue(Payload payload, int32_t *last_order) {
+    std::vector<Payload> payloads;
+    bool added = false;
+
+    if (SequencerBatch::Unpack(payload, &payloads) != SUCCESS) {
+        DCERR(("ERROR: HoldQueue - Failed to unpack batch of order = " + std::to_string(payload.GetOrder())).c_str());
+        return false;
+    }
+
+    // The batch counts as one arrival towards requesting missing messages
+    int recovery_counter = recovery_counter_;
+    for (Payload &message : payloads) {
+        added |= Insert(message);
+    }
+    recovery_counter_ = added ? recovery_counter + 1 : recovery_counter;
+    *last_order = payloads.back().GetOrder();
+
+    ProcessPayloads();
+    return added;
+}
+
+bool HoldQueue::Insert(Payload &payload) {
+
+    if (payload.GetType() == CHAT_MSG && payload.GetOrder() > DEFAULT_NO_ORDER) {
+        int32_t order = payload.GetOrder();
 
         if (first_payload_) {
-            expected_order_ = payload.GetOrder();
+            expected_order_ = order;
+            highest_order_ = order - 1;
             first_payload_ = false;
         }
 
-        delivery_queue_.push_back(payload);
-        std::sort(delivery_queue_.begin(), delivery_queue_.end());
+        //prevent duplicate sending: anything below the expected order was already delivered
+        // and anything already in its slot is waiting for delivery
+        if (order < expected_order_ || holdback_queue_[Slot(order)].GetOrder() == order) {
+            DCOUT("WARNING: HoldQueue - Trying to send duplicate message-ignored");
+            return false;
+        }
+
+        if (order > highest_order_) {
+            highest_order_ = order;
+        }
+
+        if (order - expected_order_ < MAX_HOLDBACK_QUEUE_LENGTH) {
+            holdback_queue_[Slot(order)] = payload;
+        } else {
+            // No slot until the window moves; it is requested again as missing once it does
+            DCOUT("WARNING: HoldQueue - Message beyond hold back window-ignored order = " + std::to_string(order));
+        }
         recovery_counter_++;
-        ProcessPayloads();
+        return true;
     }
 
-
+    return false;
 }
 
 void HoldQueue::ProcessPayloads() {
 
-    while (delivery_queue_.size() > 0 && delivery_queue_[0].GetOrder() <= expected_order_) {
-        Payload payload = delivery_queue_[0];
+    for (; ;) {
+        Payload &payload = holdback_queue_[Slot(expected_order_)];
+        if (payload.GetOrder() != expected_order_) {
+            break;
+        }
 
-        StreamCommunicator::SendMessage(user_handler_pipe_,
-                                        payload.GetUsername(),
-                                        payload.GetMessage());
+        user_handler_->Deliver(payload.GetUsername(), payload.GetMessage());
         recovery_counter_ = 0;
-        history_queue_.push_back(payload); //add sent payload to history queue
-        delivery_queue_.erase(delivery_queue_.begin()); //remove sent message from delivery queue
+        history_queue_[Slot(expected_order_)] = payload; //add sent payload to history queue
+        payload.SetOrder(DEFAULT_NO_ORDER); //free the hold back slot
         expected_order_ += 1; //increase the expected order of the next message
     }
 
     if (recovery_counter_ >= NUM_MISSING_ORDER) {
-        DCOUT("WARNING: HoldQueue - Requesting history message order = " + std::to_string(expected_order_));
+        // JAM asks for every gap from GetMissingRanges() in one NACK
+        DCOUT("WARNING: HoldQueue - Requesting history message from order = " + std::to_string(expected_order_));
         queues_->push(CentralQueues::HISTORY_REQUEST, expected_order_);
         recovery_counter_ = 0;
     }
 }
 
 bool HoldQueue::GetPayloadInHistory(int32_t order, Payload *payload) {
-    for (std::deque<Payload>::iterator it = history_queue_.begin(); it != history_queue_.end(); ++it) {
-        if (order == it->GetOrder()) {
-            *payload = *it;
-            return true;
+    if (order <= DEFAULT_NO_ORDER || history_queue_[Slot(order)].GetOrder() != order) {
+        return false;
+    }
+
+    *payload = history_queue_[Slot(order)];
+    return true;
+}
+
+void HoldQueue::NoteLatestOrder(int32_t order) {
+    // A new client starts with the first message it receives; nothing before it is missing
+    if (first_payload_ || order < expected_order_) {
+        return;
+    }
+
+    if (order > highest_order_) {
+        highest_order_ = order;
+    }
+    DCOUT("WARNING: HoldQueue - Leader is ahead, requesting history message from order = " +
+          std::to_string(expected_order_));
+    queues_->push(CentralQueues::HISTORY_REQUEST, expected_order_);
+    recovery_counter_ = 0;
+}
+
+size_t HoldQueue::GetMissingRanges(OrderRange *ranges, size_t max) {
+    int32_t last = std::min(highest_order_, expected_order_ + MAX_HOLDBACK_QUEUE_LENGTH - 1);
+    size_t count = 0;
+
+    for (int32_t order = expected_order_; order <= last && count < max; ++order) {
+        if (holdback_queue_[Slot(order)].GetOrder() == order) {
+            continue;
+        }
+
+        // Extend the gap up to the next held payload
+        ranges[count].start = order;
+        while (order <= last && holdback_queue_[Slot(order)].GetOrder() != order) {
+            order++;
         }
+        ranges[count++].end = order;
     }
 
-    return false;
+    return count;
 }
 
-void HoldQueue::SetUserHandlerPipe(int pipeId) {
-    user_handler_pipe_ = pipeId;
+size_t HoldQueue::GetPayloadsInHistory(const OrderRange *ranges, size_t count, std::vector<Payload> *payloads) {
+    size_t found = 0;
+
+    for (size_t i = 0; i < count; ++i) {
+        // Only the last MAX_HOLDBACK_QUEUE_LENGTH orders can still be in history
+        int32_t start = std::max(ranges[i].start, expected_order_ - MAX_HOLDBACK_QUEUE_LENGTH);
+        int32_t end = std::min(ranges[i].end, expected_order_);
+        for (int32_t order = std::max(start, 0); order < end; ++order) {
+            if (history_queue_[Slot(order)].GetOrder() == order) {
+                payloads->push_back(history_queue_[Slot(order)]);
+                found++;
+            }
+        }
+    }
+
+    return found;
 }
 
-void HoldQueue::ClearQueue() {
-    delivery_queue_.clear();
-    history_queue_.clear();
-    expected_order_ = DEFAULT_FIRST_ORDER;
+uint32_t HoldQueue::EncodeRanges(uint8_t *buffer, const OrderRange *ranges, size_t count) {
+    uint32_t size = 0;
+
+    size += SerializerHelper::packu8(buffer, (uint8_t) count);
+    for (size_t i = 0; i < count; ++i) {
+        size += SerializerHelper::packi32(buffer, ranges[i].start);
+        size += SerializerHelper::packi32(buffer, ranges[i].end);
+    }
+
+    return size;
 }
 
+JamStatus HoldQueue::DecodeRanges(uint8_t *buffer, uint32_t length, OrderRange *ranges, size_t max,
+                                  size_t *count) {
+    if (length < 1) {
+        return HOLD_QUEUE_INVALID_RANGES;
+    }
+
+    *count = SerializerHelper::unpacku8(buffer);
+    if (*count > max || length != 1 + *count * 8) {
+        return HOLD_QUEUE_INVALID_RANGES;
+    }
+
+    for (size_t i = 0; i < *count; ++i) {
+        ranges[i].start = SerializerHelper::unpacki32(buffer);
+        ranges[i].end = SerializerHelper::unpacki32(buffer);
+    }
+
+    return SUCCESS;
+}
 
+void HoldQueue::SetUserHandler(UserHandler* user_handler) {
+    user_handler_ = user_handler;
+}
 
+void HoldQueue::ClearQueue() {
+    for (size_t i = 0; i < MAX_HOLDBACK_QUEUE_LENGTH; ++i) {
+        holdback_queue_[i].SetOrder(DEFAULT_NO_ORDER);
+        history_queue_[i].SetOrder(DEFAULT_NO_ORDER);
+    }
+    expected_order_ = DEFAULT_FIRST_ORDER;
+    highest_order_ = DEFAULT_FIRST_ORDER - 1;
+}
+
+size_t HoldQueue::Slot(int32_t order) {
+    return (uint32_t) order % MAX_HOLDBACK_QUEUE_LENGTH;
+}
@@ -15,6 +15,11 @@
 #include <ifaddrs.h>
 #include <arpa/inet.h>
 
+#ifdef REACTOR
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#endif
+
 using namespace std;
 
 JAM::JAM()
@@ -23,17 +28,45 @@ JAM::JAM()
           leaderManager_(&queues_, &clientManager_),
           holdQueue_(&queues_),
           order_(DEFAULT_FIRST_ORDER),
-          last_witness_order_(DEFAULT_FIRST_ORDER - 1) {
-    holdQueue_.SetUserHandlerPipe(userHandler_.get_write_pipe());
+          last_witness_order_(DEFAULT_FIRST_ORDER - 1),
+          multicast_group_(""),
+          multicast_port_(MULTICAST_PORT),
+          relay_degree_(RELAY_DEGREE),
+          sequencer_batch_(SEQUENCER_BATCH_SIZE, SEQUENCER_BATCH_WINDOW),
+          user_input_(true),
+          deferred_(0)
+#ifdef REACTOR
+          , epoll_fd_(-1),
+          timer_fd_(-1),
+          next_ping_(chrono::milliseconds::max()),
+          read_stdin_(false)
+#endif
+{
+    holdQueue_.SetUserHandler(&userHandler_);
 }
 
 JAM::~JAM() {
-
+#ifdef REACTOR
+    if (epoll_fd_ >= 0)
+        close(epoll_fd_);
+    if (timer_fd_ >= 0)
+        close(timer_fd_);
+#endif
 }
 
 void JAM::StartAsLeader(const char *user_name,
                         const char *user_interface,
                         const char *user_port) {
+    if (!InitLeader(user_name, user_interface, user_port)) {
+        exit(1);
+    }
+
+    Main();
+}
+
+bool JAM::InitLeader(const char *user_name,
+                     const char *user_interface,
+                     const char *user_port) {
     // INFO
     cout << user_name << " is starting a new chat group!" << endl;
     user_name_ = user_name;
@@ -45,11 +78,13 @@ void JAM::StartAsLeader(const char *user_name,
         // Detect interface address
         if (GetInterfaceAddress(user_interface, bind_port, &servaddr)) {
             // Add creator as leader
-            clientManager_.AddClient(servaddr, user_name, true);
+            clientManager_.AddClient(servaddr, user_name, true, StartMulticast(&servaddr),
+                                     PAYLOAD_HEADER_VERSION >= COMPACT_HEADER);
             clientManager_.set_self_address(servaddr);
         } else {
             cerr << "Failed to detect network interface!" << endl;
-            exit(1);
+            udpWrapper_.Stop();
+            return false;
         }
 
         cout << "Succeeded, listening on " << clientManager_.StringifyClient(servaddr) <<
@@ -57,17 +92,18 @@ void JAM::StartAsLeader(const char *user_name,
         clientManager_.PrintClients();
     } else {
         cerr << "Failed to start new chat group!" << endl;
-        exit(1);
+        return false;
     }
+#ifdef REACTOR
+    InitReactor();
+#endif
 
     // Start all other modules
-    userHandler_.Start();
-    leaderManager_.StartLeaderHeartbeat();
+    StartModules();
 
     // Start-up completed
     cout << "Waiting for others to join..." << endl;
-
-    Main();
+    return true;
 }
 
 void JAM::StartAsClient(const char *user_name,
@@ -82,10 +118,12 @@ void JAM::StartAsClient(const char *user_name,
     // Start UDP Wrapper
     uint16_t bind_port;
     sockaddr_in client_addr;
+    bool multicast = false;
     if (udpWrapper_.Start(user_port, &bind_port) == SUCCESS) {
         // Detect interface address
         if (GetInterfaceAddress(user_interface, bind_port, &client_addr)) {
             clientManager_.set_self_address(client_addr);
+            multicast = StartMulticast(&client_addr);
         } else {
             cerr << "Failed to detect network interface!" << endl;
             exit(1);
@@ -96,6 +134,9 @@ void JAM::StartAsClient(const char *user_name,
         cerr << "Failed to start UDP service!" << endl;
         exit(1);
     }
+#ifdef REACTOR
+    InitReactor();
+#endif
 
     // Initiate hand-shake
     Payload payload;
@@ -117,14 +158,15 @@ void JAM::StartAsClient(const char *user_name,
         exit(1);
     }
 
-    if (queues_.wait_for_data(JOIN_TIMEOUT)) {
+    if (WaitForData(JOIN_TIMEOUT)) {
         // Only check incoming UDP queue
         if (queues_.try_pop_udp_in(payload)) {
             if (payload.GetType() == STATUS_MSG && payload.GetStatus() == CLIENT_JOIN_ACK) {
                 if (clientManager_.DecodeBufferToClientList((uint8_t *) payload.GetMessage().c_str(),
                                                             payload.GetMessageLength()) == SUCCESS) {
                     // Add self
-                    clientManager_.AddClient(client_addr, user_name, false);
+                    clientManager_.AddClient(client_addr, user_name, false, multicast,
+                                             PAYLOAD_HEADER_VERSION >= COMPACT_HEADER);
                     goto next;
                 } else {
                     cerr << "Failed to hand-shake with server!" << endl;
@@ -148,18 +190,21 @@ void JAM::StartAsClient(const char *user_name,
 
     next:
     // Start all other modules
-    userHandler_.Start();
-    leaderManager_.StartLeaderHeartbeat();
+    StartModules();
 
     // Start-up completed
     cout << "Succeeded. Current users:" << endl;
     clientManager_.PrintClients();
 
-    // Notify all other clients
+    // Notify all other clients, order tells whether we receive the multicast group and the
+    // message byte which payload header we decode (clients without it only know the fixed one)
     payload.clear();
     payload.SetType(STATUS_MSG);
     payload.SetStatus(CLIENT_JOIN_MULTICAST);
     payload.SetUsername(user_name);
+    payload.SetOrder(multicast ? DEFAULT_FIRST_ORDER : DEFAULT_NO_ORDER);
+    uint8_t version = PAYLOAD_HEADER_VERSION;
+    payload.SetMessage(&version, 1);
 
     vector<sockaddr_in> list = clientManager_.GetAllClientSockAddressWithoutMe();
     udpWrapper_.SendPayloadList(payload, &list);
@@ -168,248 +213,362 @@ void JAM::StartAsClient(const char *user_name,
 }
 
 void JAM::Main() {
+#ifdef STRESS
+    StressTester stressTester(&queues_, STRESS_TEST_INTERVAL, "test_messages.txt");
+#endif
+
+    // Infinite loop to monitor central communication
+    do {
+        WaitForData(sequencer_batch_.GetTimeout(JAM_CENTRAL_TIMEOUT));
+    } while (HandleQueues());
+
+    Leave();
+}
+
+bool JAM::HandleQueues() {
     Payload payload;
+    Payload delivered;
     sockaddr_in addr;
     int32_t history_request;
     vector<sockaddr_in> multicast_list;
+    OrderRange missing_ranges[MAX_MISSING_RANGES];
+    size_t count;
+    uint32_t ready;
     string username;
     string message;
     uint8_t buffer[MAX_MESSAGE_LENGTH];
     uint32_t length;
 
-#ifdef STRESS
-    StressTester stressTester(&queues_, STRESS_TEST_INTERVAL, "test_messages.txt");
-#endif
+    if (queues_.is_terminate()) {
+        DCOUT("INFO: JAM - Received terminate signal");
+        return false;   // Only exit loop if receive terminate signal
+    }
 
-    // Infinite loop to monitor central communication
-    for (; ;) {
-        if (queues_.wait_for_data(JAM_CENTRAL_TIMEOUT)) {
-            if (queues_.is_terminate()) {
-                DCOUT("INFO: JAM - Received terminate signal");
-                break;          // Only exit loop if receive terminate signal
+    // Drain ready queues in priority order: crashes and leader traffic first, then incoming
+    // payloads, then requests that need a leader. Those are deferred while there is none and
+    // retried on the next wake-up or timeout.
+    ready = deferred_ | queues_.take_ready();
+    deferred_ = 0;
+    while (ready != 0) {
+        if (ready & CentralQueues::queue_bit(CentralQueues::QueueType::UDP_CRASH)) {
+            crash_batch_.clear();
+            queues_.drain_udp_crash(crash_batch_, JAM_DRAIN_BATCH);
+            for (sockaddr_in &addr : crash_batch_) {
+                if (clientManager_.RemoveClient(addr, &username)) {
+                    DCOUT("INFO: JAM - Client unreachable at " +
+                          ClientManager::StringifyClient(addr));
+                    cout << "NOTICE - " << username << " crashed." << endl;
+
+                    // Clear history
+                    udpWrapper_.ClearReceivedHistory(&addr);
+
+                    // Rebuild payload to notify all
+                    payload.clear();
+                    payload.SetType(STATUS_MSG);
+                    payload.SetStatus(CLIENT_CRASH);
+                    length = ClientManager::EncodeSingleAddress(buffer, &addr);
+                    payload.SetMessage(buffer, length);
+
+                    multicast_list = clientManager_.GetAllClientSockAddressWithoutMe();
+                    udpWrapper_.SendPayloadList(payload, &multicast_list);
+                }
+                leaderManager_.UdpCrashDetected(addr);
             }
+        }
 
-            // Go through each queue and handle data if available
-            bool has_data;
-            do {
-                has_data = false;
-                if (!queues_.is_empty(CentralQueues::QueueType::USER_OUT) &&
-                    !leaderManager_.is_election_happening() &&
-                    leaderManager_.GetLeaderAddress(&addr)) {
-                    // These conditions are for reducing computation overhead in case no leader
-                    if (queues_.try_pop_user_out(payload)) {
-                        has_data = true;
-                        // Leader recover first
-                        udpWrapper_.LeaderRecover(&addr);
-
-                        if (payload.GetMessage() == LIST_MESSAGE) {
-                            PrintClientList();
-                        } else {
-                            payload.SetType(CHAT_MSG);
-                            payload.SetUsername(user_name_);
-                            if (payload.EncodePayload() == SUCCESS) {
+        if (ready & CentralQueues::queue_bit(CentralQueues::QueueType::LEADER_OUT)) {
+            payload_batch_.clear();
+            queues_.drain_leader_out(payload_batch_, JAM_DRAIN_BATCH);
+            for (Payload &payload : payload_batch_) {
+                switch (payload.GetType()) {
+                    case STATUS_MSG:
+                        if (payload.GetStatus() == PING) {
+                            if (leaderManager_.is_curr_client_leader()) {
+                                // This client is the leader, need to ping all other clients.
+                                // Ping carries the last order so lost multicast messages are noticed.
+                                payload.SetOrder(order_ - 1);
+                                multicast_list = clientManager_.GetAllClientSockAddressWithoutMe();
+                                udpWrapper_.SendPayloadList(payload, &multicast_list);
+                                udpWrapper_.LeaderRecover();
+                            } else if (leaderManager_.GetLeaderAddress(&addr)) {
+                                // This client is not the leader, need to ping the leader
                                 udpWrapper_.SendPayloadSingle(payload, &addr);
+                                udpWrapper_.LeaderRecover(&addr);
                             }
+                        } else if (payload.GetStatus() == PING_TARGET) {
+                            // Handle targeted ping
+                            multicast_list = leaderManager_.GetHigherOrderPingTargets();
+                            udpWrapper_.SendPayloadList(payload, &multicast_list);
                         }
-                    }
-                }
-
-                if (queues_.try_pop_udp_crash(addr)) {
-                    has_data = true;
-                    if (clientManager_.RemoveClient(addr, &username)) {
-                        DCOUT("INFO: JAM - Client unreachable at " +
-                              ClientManager::StringifyClient(addr));
-                        cout << "NOTICE - " << username << " crashed." << endl;
-
-                        // Clear history
-                        udpWrapper_.ClearReceivedHistory(&addr);
-
-                        // Rebuild payload to notify all
-                        payload.clear();
-                        payload.SetType(STATUS_MSG);
-                        payload.SetStatus(CLIENT_CRASH);
-                        length = ClientManager::EncodeSingleAddress(buffer, &addr);
-                        payload.SetMessage(buffer, length);
-
-                        multicast_list = clientManager_.GetAllClientSockAddressWithoutMe();
-                        udpWrapper_.SendPayloadList(payload, &multicast_list);
-                    }
-                    leaderManager_.UdpCrashDetected(addr);
+                        break;
+                    case ELECTION_MSG:
+                        if (payload.GetElectionCommand() == ELECT_WIN) {
+                            // Distribute to all
+                            multicast_list = clientManager_.GetAllClientSockAddressWithoutMe();
+                            udpWrapper_.SendPayloadList(payload, &multicast_list);
+                            // Do recovery
+                            order_ = last_witness_order_ + 1;
+                            addr = clientManager_.get_self_address();
+                            udpWrapper_.LeaderRecover(&addr);
+                        } else {
+                            // Targeted payload
+                            udpWrapper_.SendPayloadSingle(payload, payload.GetAddress());
+                        }
+                        break;
+                    default:
+                        break;
                 }
+            }
+        }
 
-                if (queues_.try_pop_udp_in(payload)) {
-                    // TODO: implement handler for all types of payload
-                    has_data = true;
-                    switch (payload.GetType()) {
-                        case CHAT_MSG:
-                            if (payload.GetOrder() == DEFAULT_NO_ORDER && leaderManager_.is_curr_client_leader()) {
-                                // Need to handle ordering
-                                payload.SetOrder(order_);
-                                multicast_list = clientManager_.GetAllClientSockAddress();
-                                udpWrapper_.SendPayloadList(payload, &multicast_list);
-                                order_++;
-                            } else {
-                                last_witness_order_ = payload.GetOrder();
-                                holdQueue_.AddMessageToQueue(payload);
+        if (ready & CentralQueues::queue_bit(CentralQueues::QueueType::UDP_IN)) {
+            payload_batch_.clear();
+            queues_.drain_udp_in(payload_batch_, JAM_DRAIN_BATCH);
+            for (Payload &payload : payload_batch_) {
+                // TODO: implement handler for all types of payload
+                switch (payload.GetType()) {
+                    case CHAT_MSG:
+                        if (payload.GetOrder() == DEFAULT_NO_ORDER && leaderManager_.is_curr_client_leader()) {
+                            // Need to handle ordering, a full batch goes out first
+                            if (!sequencer_batch_.Add(payload)) {
+                                FlushSequencerBatch();
+                                sequencer_batch_.Add(payload);
+                            }
+                        } else {
+                            last_witness_order_ = payload.GetOrder();
+                            // A relay passes the message down its subtree the first time it sees it,
+                            // with the session user id as received
+                            delivered = payload;
+                            if (!ResolveUsername(delivered)) {
+                                // Leader's history has it with the user name
+                                holdQueue_.NoteLatestOrder(payload.GetOrder());
+                            } else if (holdQueue_.AddMessageToQueue(delivered)) {
+                                RelayOrdered(payload);
                             }
-                            break;
-
-                        case STATUS_MSG:
-                            switch (payload.GetStatus()) {
-                                case CLIENT_JOIN:
-                                    if (leaderManager_.is_election_happening()) {
-                                        // There is an election going on, need to defer this client
-                                        joinQueue_.push(payload);
-                                    } else {
-                                        // Rebuild payload to acknowledge
+                        }
+                        break;
+
+                    case BATCH_MSG:
+                        if (holdQueue_.AddBatchToQueue(payload, &last_witness_order_)) {
+                            RelayOrdered(payload);
+                        }
+                        break;
+
+                    case STATUS_MSG:
+                        switch (payload.GetStatus()) {
+                            case CLIENT_JOIN:
+                                if (leaderManager_.is_election_happening()) {
+                                    // There is an election going on, need to defer this client
+                                    joinQueue_.push(payload);
+                                } else {
+                                    // Rebuild payload to acknowledge
+                                    payload.clear();
+                                    payload.SetType(STATUS_MSG);
+                                    payload.SetStatus(CLIENT_JOIN_ACK);
+                                    payload.SetMessage(clientManager_.GetPayload(),
+                                                       clientManager_.GetPayloadSize());
+
+                                    addr = *payload.GetAddress();
+                                    udpWrapper_.SendPayloadSingle(payload, &addr);
+                                }
+                                break;
+                            case CLIENT_JOIN_MULTICAST:
+                                addr = *payload.GetAddress();
+                                message = payload.GetMessage();
+                                if (clientManager_.AddClient(addr, payload.GetUsername(), false,
+                                                             payload.GetOrder() > DEFAULT_NO_ORDER,
+                                                             !message.empty() &&
+                                                             (uint8_t) message[0] >= COMPACT_HEADER)) {
+                                    cout << "NOTICE - " << payload.GetUsername() << " joined on " <<
+                                    clientManager_.StringifyClient(addr) << "." << endl;
+
+                                    if (leaderManager_.is_curr_client_leader()) {
+                                        // Clients joining at the same time miss each other's
+                                        // announcement; our list settles it so relay trees agree
                                         payload.clear();
                                         payload.SetType(STATUS_MSG);
                                         payload.SetStatus(CLIENT_JOIN_ACK);
                                         payload.SetMessage(clientManager_.GetPayload(),
                                                            clientManager_.GetPayloadSize());
 
-                                        addr = *payload.GetAddress();
-                                        udpWrapper_.SendPayloadSingle(payload, &addr);
-                                    }
-                                    break;
-                                case CLIENT_JOIN_MULTICAST:
-                                    addr = *payload.GetAddress();
-                                    if (clientManager_.AddClient(addr, payload.GetUsername(), false)) {
-                                        cout << "NOTICE - " << payload.GetUsername() << " joined on " <<
-                                        clientManager_.StringifyClient(addr) << "." << endl;
-                                    }
-                                    break;
-                                case CLIENT_LEAVE:
-                                    addr = *payload.GetAddress();
-                                    if (clientManager_.RemoveClient(addr, &username)) {
-                                        cout << "NOTICE - " << username << " left the chat." << endl;
-                                    }
-                                    udpWrapper_.ClearReceivedHistory(&addr);
-                                    break;
-                                case CLIENT_CRASH:
-                                    if (ClientManager::DecodeSingleAddress((uint8_t *) payload.GetMessage().c_str(),
-                                                                           payload.GetMessageLength(),
-                                                                           &addr) == SUCCESS) {
-                                        if (clientManager_.RemoveClient(addr, &username)) {
-                                            cout << "NOTICE - " << username << " crashed." << endl;
-                                        }
-                                        udpWrapper_.ClearReceivedHistory(&addr);
-                                    } else {
-                                        DCERR("ERROR: JAM - Failed to decode sockaddr_in of crash info.");
+                                        multicast_list = clientManager_.GetAllClientSockAddressWithoutMe();
+                                        udpWrapper_.SendPayloadList(payload, &multicast_list);
                                     }
-                                    break;
-                                case LEADER_LEAVE:
-                                    addr = *payload.GetAddress();
+                                }
+                                break;
+                            case CLIENT_JOIN_ACK:
+                                // Leader's list after a join replaces ours
+                                if (leaderManager_.is_leader(*payload.GetAddress()) &&
+                                    clientManager_.DecodeBufferToClientList(
+                                            (uint8_t *) payload.GetMessage().c_str(),
+                                            payload.GetMessageLength()) != SUCCESS) {
+                                    DCERR("ERROR: JAM - Failed to decode client list.");
+                                }
+                                break;
+                            case PING:
+                                if (leaderManager_.is_leader(*payload.GetAddress())) {
+                                    holdQueue_.NoteLatestOrder(payload.GetOrder());
+                                }
+                                break;
+                            case CLIENT_LEAVE:
+                                addr = *payload.GetAddress();
+                                if (clientManager_.RemoveClient(addr, &username)) {
+                                    cout << "NOTICE - " << username << " left the chat." << endl;
+                                }
+                                udpWrapper_.ClearReceivedHistory(&addr);
+                                break;
+                            case CLIENT_CRASH:
+                                if (ClientManager::DecodeSingleAddress((uint8_t *) payload.GetMessage().c_str(),
+                                                                       payload.GetMessageLength(),
+                                                                       &addr) == SUCCESS) {
                                     if (clientManager_.RemoveClient(addr, &username)) {
-                                        cout << "NOTICE - " << username << " left the chat." << endl;
+                                        cout << "NOTICE - " << username << " crashed." << endl;
                                     }
-                                    leaderManager_.UdpCrashDetected(addr);
                                     udpWrapper_.ClearReceivedHistory(&addr);
-                                    break;
-                                default:
-                                    break;
-                            }
-                            break;
-
-                        case ELECTION_MSG:
-                            leaderManager_.HandleElectionMessage(payload);
-                            if (payload.GetElectionCommand() == ELECT_WIN) {
+                                } else {
+                                    DCERR("ERROR: JAM - Failed to decode sockaddr_in of crash info.");
+                                }
+                                break;
+                            case LEADER_LEAVE:
                                 addr = *payload.GetAddress();
-                                udpWrapper_.LeaderRecover(&addr);
+                                if (clientManager_.RemoveClient(addr, &username)) {
+                                    cout << "NOTICE - " << username << " left the chat." << endl;
+                                }
+                                leaderManager_.UdpCrashDetected(addr);
+                                udpWrapper_.ClearReceivedHistory(&addr);
+                                break;
+                            default:
+                                break;
+                        }
+                        break;
+
+                    case ELECTION_MSG:
+                        leaderManager_.HandleElectionMessage(payload);
+                        if (payload.GetElectionCommand() == ELECT_WIN) {
+                            addr = *payload.GetAddress();
+                            udpWrapper_.LeaderRecover(&addr);
+
+                            // Handle deferred joining client
+                            while (joinQueue_.try_pop(payload)) {
+                                // Rebuild payload to acknowledge
+                                payload.clear();
+                                payload.SetType(STATUS_MSG);
+                                payload.SetStatus(CLIENT_JOIN_ACK);
+                                payload.SetMessage(clientManager_.GetPayload(),
+                                                   clientManager_.GetPayloadSize());
 
-                                // Handle deferred joining client
-                                while (joinQueue_.try_pop(payload)) {
-                                    // Rebuild payload to acknowledge
-                                    payload.clear();
-                                    payload.SetType(STATUS_MSG);
-                                    payload.SetStatus(CLIENT_JOIN_ACK);
-                                    payload.SetMessage(clientManager_.GetPayload(),
-                                                       clientManager_.GetPayloadSize());
+                                addr = *payload.GetAddress();
+                                udpWrapper_.SendPayloadSingle(payload, &addr);
+                            }
+                        }
+                        break;
 
-                                    addr = *payload.GetAddress();
+                    case RECOVER_MSG:
+                        switch (payload.GetRecoverCommand()) {
+                            case MSG_LOST:
+                                addr = *payload.GetAddress();
+                                history_request = payload.GetOrder();
+                                if (holdQueue_.GetPayloadInHistory(history_request, &payload)) {
                                     udpWrapper_.SendPayloadSingle(payload, &addr);
                                 }
-                            }
-                            break;
-
-                        case RECOVER_MSG:
-                            switch (payload.GetRecoverCommand()) {
-                                case MSG_LOST:
-                                    addr = *payload.GetAddress();
-                                    history_request = payload.GetOrder();
-                                    if (holdQueue_.GetPayloadInHistory(history_request, &payload)) {
-                                        udpWrapper_.SendPayloadSingle(payload, &addr);
+                                break;
+                            case MSG_NACK:
+                                // Stream back everything still in history for the requested ranges
+                                addr = *payload.GetAddress();
+                                if (HoldQueue::DecodeRanges((uint8_t *) payload.GetMessage().c_str(),
+                                                            payload.GetMessageLength(), missing_ranges,
+                                                            MAX_MISSING_RANGES, &count) == SUCCESS) {
+                                    history_payloads_.clear();
+                                    if (holdQueue_.GetPayloadsInHistory(missing_ranges, count,
+                                                                        &history_payloads_) > 0) {
+                                        udpWrapper_.SendPayloadBatch(&history_payloads_, &addr);
                                     }
-                                    break;
-                            }
-                            break;
+                                } else {
+                                    DCERR("ERROR: JAM - Failed to decode missing ranges of NACK.");
+                                }
+                                break;
+                        }
+                        break;
 
-                        default:
-                            break;
-                    }
+                    default:
+                        break;
                 }
+            }
+        }
 
-                if (queues_.try_pop_leader_out(payload)) {
-                    has_data = true;
-                    switch (payload.GetType()) {
-                        case STATUS_MSG:
-                            if (payload.GetStatus() == PING) {
-                                if (leaderManager_.is_curr_client_leader()) {
-                                    // This client is the leader, need to ping all other clients
-                                    multicast_list = clientManager_.GetAllClientSockAddressWithoutMe();
-                                    udpWrapper_.SendPayloadList(payload, &multicast_list);
-                                    udpWrapper_.LeaderRecover();
-                                } else if (leaderManager_.GetLeaderAddress(&addr)) {
-                                    // This client is not the leader, need to ping the leader
-                                    udpWrapper_.SendPayloadSingle(payload, &addr);
-                                    udpWrapper_.LeaderRecover(&addr);
-                                }
-                            } else if (payload.GetStatus() == PING_TARGET) {
-                                // Handle targeted ping
-                                multicast_list = leaderManager_.GetHigherOrderPingTargets();
-                                udpWrapper_.SendPayloadList(payload, &multicast_list);
-                            }
-                            break;
-                        case ELECTION_MSG:
-                            if (payload.GetElectionCommand() == ELECT_WIN) {
-                                // Distribute to all
-                                multicast_list = clientManager_.GetAllClientSockAddressWithoutMe();
-                                udpWrapper_.SendPayloadList(payload, &multicast_list);
-                                // Do recovery
-                                order_ = last_witness_order_ + 1;
-                                addr = clientManager_.get_self_address();
-                                udpWrapper_.LeaderRecover(&addr);
-                            } else {
-                                // Targeted payload
-                                udpWrapper_.SendPayloadSingle(payload, payload.GetAddress());
-                            }
-                            break;
-                        default:
-                            break;
+        if (ready & CentralQueues::queue_bit(CentralQueues::QueueType::HISTORY_REQUEST)) {
+            if (!leaderManager_.is_election_happening() && leaderManager_.GetLeaderAddress(&addr)) {
+                // Any number of requests collapses into one NACK for every gap still open
+                history_batch_.clear();
+                queues_.drain_history_request(history_batch_, JAM_DRAIN_BATCH);
+                count = holdQueue_.GetMissingRanges(missing_ranges, MAX_MISSING_RANGES);
+                if (count > 0) {
+                    payload.clear();
+                    payload.SetType(RECOVER_MSG);
+                    payload.SetRecoverCommand(MSG_NACK);
+                    payload.SetOrder(missing_ranges[0].start);
+                    length = HoldQueue::EncodeRanges(buffer, missing_ranges, count);
+                    payload.SetMessage(buffer, length);
+                    if (payload.EncodePayload() == SUCCESS) {
+                        udpWrapper_.SendPayloadSingle(payload, &addr);
                     }
                 }
+            } else {
+                deferred_ |= CentralQueues::queue_bit(CentralQueues::QueueType::HISTORY_REQUEST);
+            }
+        }
 
-                if (!queues_.is_empty(CentralQueues::QueueType::HISTORY_REQUEST) &&
-                    !leaderManager_.is_election_happening() &&
-                    leaderManager_.GetLeaderAddress(&addr)) {
-                    // These conditions are for reducing computation overhead in case no leader
-                    if (queues_.try_pop_history_request(history_request)) {
-                        has_data = true;
-                        payload.SetType(RECOVER_MSG);
-                        payload.SetRecoverCommand(MSG_LOST);
-                        payload.SetOrder(history_request);
+        if (ready & CentralQueues::queue_bit(CentralQueues::QueueType::USER_OUT)) {
+            if (!leaderManager_.is_election_happening() && leaderManager_.GetLeaderAddress(&addr)) {
+                payload_batch_.clear();
+                queues_.drain_user_out(payload_batch_, JAM_DRAIN_BATCH);
+                for (Payload &payload : payload_batch_) {
+                    // Leader recover first
+                    udpWrapper_.LeaderRecover(&addr);
+
+                    if (payload.GetMessage() == LIST_MESSAGE) {
+                        PrintClientList();
+                    } else {
+                        payload.SetType(CHAT_MSG);
+                        payload.SetUsername(user_name_);
+                        payload.SetHeaderVersion(clientManager_.GetHeaderVersion());
                         if (payload.EncodePayload() == SUCCESS) {
                             udpWrapper_.SendPayloadSingle(payload, &addr);
                         }
                     }
                 }
+            } else {
+                deferred_ |= CentralQueues::queue_bit(CentralQueues::QueueType::USER_OUT);
+            }
+        }
 
-            } while (has_data);
+        // Whatever arrived in this pass shares a datagram
+        if (sequencer_batch_.Due()) {
+            FlushSequencerBatch();
         }
+
+#ifdef REACTOR
+        // Nothing else runs meanwhile: print and send what this pass produced before the next one
+        userHandler_.HandleIncoming();
+        udpWrapper_.Send();
+#endif
+
+        ready = queues_.take_ready();
     }
 
-    // Terminating
-    payload.clear();
+    if (sequencer_batch_.Due()) {
+        FlushSequencerBatch();
+    }
+    return true;
+}
+
+void JAM::Leave() {
+    Payload payload;
+    vector<sockaddr_in> multicast_list;
+
+    if (!sequencer_batch_.empty()) {
+        FlushSequencerBatch();
+    }
     payload.SetType(STATUS_MSG);
     if (leaderManager_.is_curr_client_leader()) {
         payload.SetStatus(LEADER_LEAVE);
@@ -425,6 +584,245 @@ void JAM::Main() {
     cout << "Bye." << endl;
 }
 
+void JAM::StartModules() {
+    userHandler_.set_input(user_input_);
+    userHandler_.Start();
+    leaderManager_.StartLeaderHeartbeat();
+#ifdef REACTOR
+    // Epoll refuses regular files and /dev/null, which never block anyway
+    read_stdin_ = user_input_ && !AddToReactor(STDIN_FILENO);
+    next_ping_ = RetransmitWheel::Now() + chrono::milliseconds(PING_INTERVAL);
+#endif
+}
+
+bool JAM::WaitForData(uint32_t timeout) {
+#ifdef REACTOR
+    // No module thread fills the queues; send what is queued and handle events until one has data
+    chrono::milliseconds end = RetransmitWheel::Now() + chrono::milliseconds(timeout);
+    for (; ;) {
+        udpWrapper_.Send();
+        chrono::milliseconds now = RetransmitWheel::Now();
+        if (queues_.has_data() || now >= end) {
+            return queues_.has_data();
+        }
+        RunReactor((uint32_t) (end - now).count());
+    }
+#else
+    return queues_.wait_for_data(timeout);
+#endif
+}
+
+#ifdef REACTOR
+void JAM::InitReactor() {
+    epoll_fd_ = epoll_create1(0);
+    timer_fd_ = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+    if (epoll_fd_ < 0 || timer_fd_ < 0) {
+        cerr << "Failed to start event loop!" << endl;
+        exit(1);
+    }
+
+    AddToReactor(timer_fd_);
+    for (int fd : udpWrapper_.get_fds()) {
+        AddToReactor(fd);
+    }
+}
+
+bool JAM::AddToReactor(int fd) {
+    epoll_event event = {};
+    event.events = EPOLLIN;
+    event.data.fd = fd;
+
+    if (epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, fd, &event) != 0) {
+        DCERR("ERROR: JAM - Failed to add file descriptor to event loop");
+        return false;
+    }
+    return true;
+}
+
+void JAM::RunReactor(uint32_t timeout) {
+    epoll_event events[REACTOR_MAX_EVENTS];
+    chrono::milliseconds now = RetransmitWheel::Now();
+    chrono::milliseconds due = min(min(udpWrapper_.NextDeadline(), next_ping_), now + chrono::milliseconds(timeout));
+    int wait = 0;
+
+    // Steady clock is CLOCK_MONOTONIC, so one absolute expiry covers retransmits, delayed ACKs,
+    // the heartbeat and the caller's timeout
+    if (due > now && !read_stdin_) {
+        wait = ArmTimer(due) ? -1 : (int) (due - now).count();
+    }
+
+    int count = epoll_wait(epoll_fd_, events, REACTOR_MAX_EVENTS, wait);
+    if (count < 0 && errno != EINTR) {
+        DCERR("ERROR: JAM - Failed to wait for events");
+    }
+    if (read_stdin_) {
+        read_stdin_ = userHandler_.HandleUserInput();
+    }
+    for (int i = 0; i < count; ++i) {
+        int fd = events[i].data.fd;
+        if (fd == timer_fd_) {
+            uint64_t expirations;
+            ssize_t ret = read(timer_fd_, &expirations, sizeof(expirations));
+            (void) ret;
+        } else if (fd == STDIN_FILENO) {
+            if (!userHandler_.HandleUserInput()) {
+                epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, STDIN_FILENO, NULL);
+            }
+        } else {
+            udpWrapper_.Receive(fd);
+        }
+    }
+
+    // Timers act only once due, whatever woke us up
+    udpWrapper_.RunTimers();
+    now = RetransmitWheel::Now();
+    if (now >= next_ping_) {
+        leaderManager_.Heartbeat();
+        next_ping_ = now + chrono::milliseconds(PING_INTERVAL);
+    }
+}
+
+bool JAM::ArmTimer(chrono::milliseconds due) {
+    itimerspec timer = {};
+
+    timer.it_value.tv_sec = due.count() / 1000;
+    timer.it_value.tv_nsec = (due.count() % 1000) * 1000000;
+    if (timerfd_settime(timer_fd_, TFD_TIMER_ABSTIME, &timer, NULL) != 0) {
+        DCERR("ERROR: JAM - Failed to arm timer");
+        return false;
+    }
+    return true;
+}
+
+bool JAM::RunRound() {
+    RunReactor(0);
+    if (!HandleQueues()) {
+        Leave();
+        return false;
+    }
+    udpWrapper_.Send();
+
+    // Whoever waits on epoll_fd_ is woken for the next deadline, or the sequencer's timeout at latest
+    chrono::milliseconds now = RetransmitWheel::Now();
+    ArmTimer(min(min(udpWrapper_.NextDeadline(), next_ping_),
+                 now + chrono::milliseconds(sequencer_batch_.GetTimeout(JAM_CENTRAL_TIMEOUT))));
+    return true;
+}
+
+int JAM::get_event_fd() {
+    return epoll_fd_;
+}
+#endif
+
+void JAM::FlushSequencerBatch() {
+    Payload payload;
+
+    if (!leaderManager_.is_curr_client_leader()) {
+        DCERR(("ERROR: JAM - No longer leader, dropping " + to_string(sequencer_batch_.size()) +
+               " chat messages.").c_str());
+        sequencer_batch_.clear();
+        return;
+    }
+
+    uint32_t count = sequencer_batch_.Take(order_, &payload);
+    SendOrdered(payload);
+    order_ += count;
+}
+
+void JAM::SendOrdered(Payload &payload) {
+    vector<sockaddr_in> list;
+    uint16_t user_id;
+
+    // Once every client decodes the compact header, a chat message carries its sender's session
+    // user id instead of the name
+    if (clientManager_.GetHeaderVersion() == COMPACT_HEADER) {
+        payload.SetHeaderVersion(COMPACT_HEADER);
+        if (payload.GetType() == CHAT_MSG && (user_id = clientManager_.GetUserId(payload.GetUsername())) > 0) {
+            payload.SetUserId(user_id);
+        }
+    }
+
+    // Encode here while the bytes are only ours
+    payload.SetRelayDegree(udpWrapper_.is_multicast_ready() ? 0 : relay_degree_);
+    payload.EncodePayload();
+    if (udpWrapper_.is_multicast_ready()) {
+        // One datagram for every group member, unicast for the rest
+        list = clientManager_.GetUnicastClientSockAddress();
+        if (list.size() < clientManager_.get_client_count()) {
+            udpWrapper_.SendPayloadMulticast(payload);
+        }
+    } else if (relay_degree_ > 0) {
+        // Top of the relay tree and self, relays pass it down
+        list = clientManager_.GetRelayChildren(clientManager_.get_self_address(), relay_degree_);
+        list.push_back(clientManager_.get_self_address());
+    } else {
+        list = clientManager_.GetAllClientSockAddress();
+    }
+    udpWrapper_.SendPayloadList(payload, &list);
+}
+
+void JAM::RelayOrdered(Payload &payload) {
+    if (payload.GetRelayDegree() == 0 || leaderManager_.is_curr_client_leader()) {
+        return;
+    }
+
+    vector<sockaddr_in> children = clientManager_.GetRelayChildren(clientManager_.get_self_address(),
+                                                                   payload.GetRelayDegree());
+    if (!children.empty()) {
+        udpWrapper_.SendPayloadList(payload, &children);
+    }
+}
+
+bool JAM::ResolveUsername(Payload &payload) {
+    string username;
+
+    if (payload.GetUserId() == 0) {
+        return true;
+    }
+    if (!clientManager_.GetUsername(payload.GetUserId(), &username)) {
+        DCOUT("WARNING: JAM - Unknown session user id " + to_string(payload.GetUserId()) + " of order " +
+              to_string(payload.GetOrder()));
+        return false;
+    }
+    payload.SetUsername(username);
+    return true;
+}
+
+void JAM::set_multicast_group(const char *group, const char *port) {
+    multicast_group_ = group;
+    multicast_port_ = port;
+}
+
+void JAM::set_relay_degree(uint8_t degree) {
+    relay_degree_ = degree;
+}
+
+void JAM::set_user_input(bool enabled) {
+    user_input_ = enabled;
+}
+
+void JAM::Terminate() {
+    queues_.signal_terminate();
+}
+
+sockaddr_in JAM::get_self_address() {
+    return clientManager_.get_self_address();
+}
+
+bool JAM::StartMulticast(const sockaddr_in *addr) {
+    if (*multicast_group_ == '\0') {
+        return false;
+    }
+
+    if (udpWrapper_.StartMulticast(multicast_group_, multicast_port_, addr) != SUCCESS) {
+        cout << "NOTICE - Multicast group " << multicast_group_ << ":" << multicast_port_ <<
+        " unavailable, receiving by unicast." << endl;
+        return false;
+    }
+
+    return true;
+}
+
 string JAM::GetInterfaceAddressStr(const char *port) {
     stringstream ss;
     ifaddrs *ifap, *ifa;
@@ -432,9 +830,11 @@ string JAM::GetInterfaceAddressStr(const char *port) {
     char *name, *addr;
     const char *sep = "";
 
-    getifaddrs(&ifap);
+    if (getifaddrs(&ifap) != 0) {
+        return "";
+    }
     for (ifa = ifap; ifa; ifa = ifa->ifa_next) {
-        if (ifa->ifa_addr->sa_family == AF_INET) {
+        if (ifa->ifa_addr != NULL && ifa->ifa_addr->sa_family == AF_INET) {
             name = ifa->ifa_name;
             if (strcmp(name, "lo0") != 0) {     // Ignore loop-back interface
                 sa = (sockaddr_in *) ifa->ifa_addr;
@@ -444,6 +844,7 @@ string JAM::GetInterfaceAddressStr(const char *port) {
             }
         }
     }
+    freeifaddrs(ifap);
 
     return ss.str();
 }
@@ -455,9 +856,11 @@ string JAM::GetInterfaceAddressStr(const char *interface, const char *port) {
     char *name, *addr;
     const char *sep = "";
 
-    getifaddrs(&ifap);
+    if (getifaddrs(&ifap) != 0) {
+        return "";
+    }
     for (ifa = ifap; ifa; ifa = ifa->ifa_next) {
-        if (ifa->ifa_addr->sa_family == AF_INET) {
+        if (ifa->ifa_addr != NULL && ifa->ifa_addr->sa_family == AF_INET) {
             name = ifa->ifa_name;
             if (strcmp(name, interface) == 0) {     // Only select this interface
                 sa = (sockaddr_in *) ifa->ifa_addr;
@@ -467,6 +870,7 @@ string JAM::GetInterfaceAddressStr(const char *interface, const char *port) {
             }
         }
     }
+    freeifaddrs(ifap);
 
     return ss.str();
 }
@@ -476,9 +880,11 @@ bool JAM::GetInterfaceAddress(const char *interface, uint16_t port, sockaddr_in
     ifaddrs *ifap, *ifa;
     char *name;
 
-    getifaddrs(&ifap);
+    if (getifaddrs(&ifap) != 0) {
+        return false;
+    }
     for (ifa = ifap; ifa; ifa = ifa->ifa_next) {
-        if (ifa->ifa_addr->sa_family == AF_INET) {
+        if (ifa->ifa_addr != NULL && ifa->ifa_addr->sa_family == AF_INET) {
             name = ifa->ifa_name;
             if (strcmp(name, interface) == 0) {     // Only select this interface
                 ret = true;
@@ -487,6 +893,7 @@ bool JAM::GetInterfaceAddress(const char *interface, uint16_t port, sockaddr_in
             }
         }
     }
+    freeifaddrs(ifap);
 
     return ret;
 }
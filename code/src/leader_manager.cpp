@@ -5,7 +5,7 @@
 #include "../include/leader_manager.h"
 
 LeaderManager::LeaderManager(CentralQueues *queues, ClientManager *clientManager) :
-        queues_(queues), clientManager_(clientManager) {
+        heartbeatThread_(nullptr), queues_(queues), clientManager_(clientManager) {
 }
 
 bool LeaderManager::GetLeaderAddress(sockaddr_in *addr) {
@@ -34,7 +34,9 @@ bool LeaderManager::is_leader(const sockaddr_in &addr) {
 void LeaderManager::StartLeaderHeartbeat() {
     DCOUT("INFO: LM - Heartbeat started");
 
+#ifndef REACTOR
     heartbeatThread_ = new boost::thread(boost::bind(&LeaderManager::HeartBeatPing, this));
+#endif
 }
 
 bool LeaderManager::is_election_happening() {
@@ -172,24 +174,28 @@ void LeaderManager::StartElection() {
     }
 }
 
-void LeaderManager::HeartBeatPing() {
-    while (true) {
-        boost::this_thread::sleep(boost::posix_time::milliseconds(PING_INTERVAL));
-        if (electionInProgress_ == false) {
-            Payload payload;
-            payload.SetType(MessageType::STATUS_MSG);
-            payload.SetStatus(Status::PING);
+void LeaderManager::Heartbeat() {
+    if (electionInProgress_ == false) {
+        Payload payload;
+        payload.SetType(MessageType::STATUS_MSG);
+        payload.SetStatus(Status::PING);
 
-            queues_->push(CentralQueues::QueueType::LEADER_OUT, payload);
-        }
+        queues_->push(CentralQueues::QueueType::LEADER_OUT, payload);
+    }
 
-        if (electionInProgress_ && cancelledElection_) {
-            Payload payload;
-            payload.SetType(MessageType::STATUS_MSG);
-            payload.SetStatus(Status::PING_TARGET);
+    if (electionInProgress_ && cancelledElection_) {
+        Payload payload;
+        payload.SetType(MessageType::STATUS_MSG);
+        payload.SetStatus(Status::PING_TARGET);
 
-            queues_->push(CentralQueues::QueueType::LEADER_OUT, payload);
-        }
+        queues_->push(CentralQueues::QueueType::LEADER_OUT, payload);
+    }
+}
+
+void LeaderManager::HeartBeatPing() {
+    while (true) {
+        boost::this_thread::sleep(boost::posix_time::milliseconds(PING_INTERVAL));
+        Heartbeat();
     }
 }
 
@@ -12,6 +12,8 @@ int main(int argc, char *argv[])
     const char *user_interface = DEFAULT_INTERFACE;
     const char *user_port = DEFAULT_PORT;
 
+    jam.set_multicast_group(MULTICAST_GROUP, MULTICAST_PORT);
+
     // Parse arguments
     if (argc == 2) {
         user_name = argv[1];
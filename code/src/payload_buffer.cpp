@@ -0,0 +1,187 @@
+/**
+ * Reference counted datagram buffer shared by payload copies.
+ *
+ * Every thread takes blocks from a SlabAllocator of its own without a lock. Blocks let go by other
+ * threads come back through a lock-free list the owner empties in one exchange. A pool outlives
+ * its thread, since blocks may still be out; an exiting thread leaves it for the next new one.
+ */
+
+#include "../include/payload_buffer.h"
+
+#include <algorithm>
+#include <cstring>
+#include <vector>
+#include "boost/thread/mutex.hpp"
+
+// Pool of one thread
+struct PayloadBuffer::Pool {
+    SlabAllocator<Block> slab;                      // Owning thread only
+    std::atomic<Block *> returned;                  // Blocks let go by other threads
+
+    Pool() : slab(PAYLOAD_POOL_CAPACITY), returned(NULL) {
+    }
+
+    /**
+     * Give the blocks on the return list back to the slab, owning thread only
+     */
+    void Reclaim() {
+        Block *block = returned.exchange(NULL, std::memory_order_acquire);
+        while (block != NULL) {
+            Block *next = block->next;
+            slab.Free(block->handle);
+            block = next;
+        }
+    }
+
+    /**
+     * Push a block onto the return list, from any thread
+     */
+    void Return(Block *block) {
+        Block *head = returned.load(std::memory_order_relaxed);
+        do {
+            block->next = head;
+        } while (!returned.compare_exchange_weak(head, block, std::memory_order_release,
+                                                 std::memory_order_relaxed));
+    }
+
+    // Pools of exited threads, handed to new threads instead of growing another
+    struct Idle {
+        boost::mutex m_pools;
+        std::vector<Pool *> pools;
+    };
+
+    static Idle &GetIdle() {
+        // Never destroyed, threads may exit during static destruction
+        static Idle *idle = new Idle();
+        return *idle;
+    }
+};
+
+thread_local PayloadBuffer::Pool *PayloadBuffer::local_pool_ = NULL;
+
+PayloadBuffer::PayloadBuffer() : block_(NULL) {
+}
+
+PayloadBuffer::PayloadBuffer(const PayloadBuffer &other) : block_(other.block_) {
+    if (block_ != NULL) {
+        block_->refs.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+PayloadBuffer::PayloadBuffer(PayloadBuffer &&other) noexcept : block_(other.block_) {
+    other.block_ = NULL;
+}
+
+PayloadBuffer &PayloadBuffer::operator=(const PayloadBuffer &other) {
+    if (block_ != other.block_) {
+        if (other.block_ != NULL) {
+            other.block_->refs.fetch_add(1, std::memory_order_relaxed);
+        }
+        reset();
+        block_ = other.block_;
+    }
+    return *this;
+}
+
+PayloadBuffer &PayloadBuffer::operator=(PayloadBuffer &&other) noexcept {
+    if (this != &other) {
+        reset();
+        block_ = other.block_;
+        other.block_ = NULL;
+    }
+    return *this;
+}
+
+PayloadBuffer::~PayloadBuffer() {
+    reset();
+}
+
+const uint8_t *PayloadBuffer::data() const {
+    return block_ != NULL ? block_->data : NULL;
+}
+
+bool PayloadBuffer::is_shared() const {
+    // Acquire pairs with the release in reset() so writes by a dropped handle are visible
+    return block_ != NULL && block_->refs.load(std::memory_order_acquire) > 1;
+}
+
+uint8_t *PayloadBuffer::MakeUnique(size_t keep) {
+    if (block_ == NULL) {
+        block_ = Acquire();
+    } else if (is_shared()) {
+        // Nobody can gain a reference through us meanwhile, so a count of 1 stays ours
+        Block *block = Acquire();
+        memcpy(block->data, block_->data, std::min(keep, sizeof(block->data)));
+        reset();
+        block_ = block;
+    }
+    return block_->data;
+}
+
+void PayloadBuffer::reset() {
+    if (block_ != NULL) {
+        if (block_->refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            Release(block_);
+        }
+        block_ = NULL;
+    }
+}
+
+size_t PayloadBuffer::capacity() {
+    return MAX_BUFFER_LENGTH;
+}
+
+PayloadBuffer::Pool &PayloadBuffer::GetPool() {
+    // Leaves the pool to the next thread on exit
+    struct Owner {
+        ~Owner() {
+            Pool::Idle &idle = Pool::GetIdle();
+            boost::mutex::scoped_lock lock(idle.m_pools);
+            idle.pools.push_back(local_pool_);
+            local_pool_ = NULL;
+        }
+    };
+
+    if (local_pool_ == NULL) {
+        static thread_local Owner owner;
+        (void) owner;
+
+        Pool::Idle &idle = Pool::GetIdle();
+        boost::mutex::scoped_lock lock(idle.m_pools);
+        if (idle.pools.empty()) {
+            local_pool_ = new Pool();
+        } else {
+            local_pool_ = idle.pools.back();
+            idle.pools.pop_back();
+        }
+    }
+    return *local_pool_;
+}
+
+SlabStats PayloadBuffer::GetPoolStats() {
+    Pool &pool = GetPool();
+    pool.Reclaim();
+    return pool.slab.GetStats();
+}
+
+PayloadBuffer::Block *PayloadBuffer::Acquire() {
+    Pool &pool = GetPool();
+    if (pool.returned.load(std::memory_order_relaxed) != NULL) {
+        pool.Reclaim();
+    }
+
+    uint32_t handle = pool.slab.Allocate();
+    Block *block = &pool.slab[handle];
+    block->handle = handle;
+    block->pool = &pool;
+    block->refs.store(1, std::memory_order_relaxed);
+    return block;
+}
+
+void PayloadBuffer::Release(Block *block) {
+    if (block->pool == local_pool_) {
+        block->pool->slab.Free(block->handle);
+    } else {
+        block->pool->Return(block);
+    }
+}
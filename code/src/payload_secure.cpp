@@ -3,7 +3,7 @@
  *
  * There are 3 different payloads:
  *  + Normal communication payload
- *  + ACK payload
+ *  + ACK payload (may also be piggybacked on a normal payload)
  *  + Self-terminate payload (bound back to terminate threads)
  *
  * @author: Hung Nguyen
@@ -11,60 +11,58 @@
  */
 
 #include "../include/payload_secure.h"
+#include "../include/aes_cipher.h"
 #include <iostream>
 
 using namespace std;
 
-Payload::Payload()
-        : type_(NA),
-          order_(DEFAULT_NO_ORDER),
-          username_length_(0),
-          message_length_(0),
-          enc_length_(0) {
+// Cipher contexts are set up once per thread, not per payload
+static AesCipher &Encryptor() {
+    static thread_local AesCipher cipher(aes_key, true);
+    return cipher;
 }
 
-Payload::Payload(uint32_t uid, AckStatus ack) {
-    EncodeAckPayload(uid, ack);
+static AesCipher &Decryptor() {
+    static thread_local AesCipher cipher(aes_key, false);
+    return cipher;
 }
 
-Payload::Payload(const Payload &payload) {
-    memcpy(&address_, &(payload.address_), sizeof(address_));
-    memcpy(username_, payload.username_, MAX_USER_NAME_LENGTH);
-    memcpy(message_, payload.message_, MAX_MESSAGE_LENGTH);
-
-    type_ = payload.type_;
-    uid_ = payload.uid_;
-    ack_ = payload.ack_;
-    order_ = payload.order_;
-    code_ = payload.code_;
-
-    username_length_ = payload.username_length_;
-    message_length_ = payload.message_length_;
-    memcpy(payload_, payload.payload_, HEADER_LENGTH + MAX_USER_NAME_LENGTH + MAX_MESSAGE_LENGTH);
-    length_ = payload.length_;
-
-    enc_length_ = payload.enc_length_;
-    memcpy(enc_buffer_, payload.enc_buffer_, MAX_MESSAGE_LENGTH);
+// Whole blocks holding a message of this length
+static uint32_t CipherBytes(uint32_t length) {
+    return (length + AES_BLOCK_SIZE - 1) / AES_BLOCK_SIZE * AES_BLOCK_SIZE;
 }
 
-void Payload::operator=(const Payload &payload) {
-    memcpy(&address_, &(payload.address_), sizeof(address_));
-    memcpy(username_, payload.username_, MAX_USER_NAME_LENGTH);
-    memcpy(message_, payload.message_, MAX_MESSAGE_LENGTH);
-
-    type_ = payload.type_;
-    uid_ = payload.uid_;
-    ack_ = payload.ack_;
-    order_ = payload.order_;
-    code_ = payload.code_;
-
-    username_length_ = payload.username_length_;
-    message_length_ = payload.message_length_;
-    memcpy(payload_, payload.payload_, HEADER_LENGTH + MAX_USER_NAME_LENGTH + MAX_MESSAGE_LENGTH);
-    length_ = payload.length_;
-
-    enc_length_ = payload.enc_length_;
-    memcpy(enc_buffer_, payload.enc_buffer_, MAX_MESSAGE_LENGTH);
+Payload::Payload()
+        : type_(NA),
+          uid_(0),
+          has_ack_(false),
+          ack_next_(0),
+          ack_count_(0),
+          order_(DEFAULT_NO_ORDER),
+          header_version_(FIXED_HEADER),
+          username_length_(0),
+          user_id_(0),
+          message_length_(0),
+          fragment_id_(0),
+          fragment_index_(0),
+          fragment_count_(0),
+          trailer_length_(0),
+          length_(0),
+          body_start_(UID_HEADER_LENGTH),
+          body_length_(0),
+          dirty_(true) {
+    static_assert(HEADER_LENGTH + MAX_USER_NAME_LENGTH + MAX_MESSAGE_LENGTH + FRAGMENT_HEADER_LENGTH +
+                  MAX_ACK_LENGTH <= MAX_BUFFER_LENGTH, "Payload must fit in a PayloadBuffer");
+    static_assert(FRAGMENT_LENGTH < MAX_MESSAGE_LENGTH &&
+                  (MAX_FRAGMENTED_LENGTH + FRAGMENT_LENGTH - 1) / FRAGMENT_LENGTH <= UINT8_MAX,
+                  "Fragment must fit a payload and the count must fit its field");
+    static_assert(UID_HEADER_LENGTH + MAX_COMPACT_HEADER_LENGTH <= HEADER_LENGTH,
+                  "Compact header must fit before the user name");
+    code_.status = CLIENT_JOIN;
+}
+
+Payload::Payload(uint32_t next, const AckRange *ranges, uint8_t count) : Payload() {
+    EncodeAckPayload(next, ranges, count);
 }
 
 bool Payload::operator==(const Payload &other) {
@@ -83,6 +81,10 @@ sockaddr_in *Payload::GetAddress() {
     return &address_;
 }
 
+const sockaddr_in *Payload::GetAddress() const {
+    return &address_;
+}
+
 void Payload::SetAddress(const sockaddr_in *address) {
     memcpy(&address_, address, sizeof(address_));
 }
@@ -93,10 +95,11 @@ MessageType Payload::GetType() const {
 
 void Payload::SetType(MessageType type) {
     type_ = type;
+    dirty_ = true;
     if (type_ == ACK_MSG) {
-        length_ = ACK_MSG_LENGTH;
+        length_ = ACK_MSG_LENGTH + ack_count_ * ACK_RANGE_LENGTH;
     } else if (type_ != NA) {
-        length_ = HEADER_LENGTH + username_length_ + message_length_;
+        length_ = HEADER_LENGTH + username_length_ + MessageBytes();
     }
 }
 
@@ -105,15 +108,27 @@ uint32_t Payload::GetUid() const {
 }
 
 void Payload::SetUid(uint32_t uid) {
+    // The compact header packs the uid as a varint, so the length of an encoded copy follows it
+    if (body_length_ > 0) {
+        length_ = length_ - HeadLength(uid_) + HeadLength(uid);
+    }
     uid_ = uid;
 }
 
-AckStatus Payload::GetAck() const {
-    return ack_;
+bool Payload::HasAck() const {
+    return has_ack_;
+}
+
+uint32_t Payload::GetAckNext() const {
+    return ack_next_;
 }
 
-void Payload::SetAck(AckStatus ack) {
-    Payload::ack_ = ack;
+uint8_t Payload::GetAckRangeCount() const {
+    return ack_count_;
+}
+
+const AckRange *Payload::GetAckRanges() const {
+    return ack_ranges_;
 }
 
 int32_t Payload::GetOrder() const {
@@ -122,6 +137,7 @@ int32_t Payload::GetOrder() const {
 
 void Payload::SetOrder(int32_t order) {
     order_ = order;
+    dirty_ = true;
 }
 
 Status Payload::GetStatus() const {
@@ -130,6 +146,7 @@ Status Payload::GetStatus() const {
 
 void Payload::SetStatus(Status status) {
     code_.status = status;
+    dirty_ = true;
 }
 
 ElectionCommand Payload::GetElectionCommand() const {
@@ -138,6 +155,7 @@ ElectionCommand Payload::GetElectionCommand() const {
 
 void Payload::SetElectionCommand(ElectionCommand command) {
     code_.election = command;
+    dirty_ = true;
 }
 
 RecoverCommand Payload::GetRecoverCommand() const {
@@ -146,6 +164,27 @@ RecoverCommand Payload::GetRecoverCommand() const {
 
 void Payload::SetRecoverCommand(RecoverCommand command) {
     code_.recover = command;
+    dirty_ = true;
+}
+
+uint8_t Payload::GetRelayDegree() const {
+    return code_.relay;
+}
+
+void Payload::SetRelayDegree(uint8_t degree) {
+    code_.relay = degree;
+    dirty_ = true;
+}
+
+HeaderVersion Payload::GetHeaderVersion() const {
+    return header_version_;
+}
+
+void Payload::SetHeaderVersion(HeaderVersion version) {
+    if (version != header_version_) {
+        header_version_ = version;
+        dirty_ = true;
+    }
 }
 
 size_t Payload::GetLength() const {
@@ -166,21 +205,28 @@ uint32_t Payload::GetMessageLength() const {
 }
 
 string Payload::GetUsername() {
-    return string(username_, username_ + username_length_);
+    if (username_length_ == 0) {
+        return string();
+    }
+    const uint8_t *username = buffer_.data() + HEADER_LENGTH;
+    return string(username, username + username_length_);
 };
 
 JamStatus Payload::SetUsername(string username) {
     JamStatus ret = SUCCESS;
 
     if (username.size() < MAX_USER_NAME_LENGTH) {
-        username_length_ = (uint32_t) username.size();
-        uint32_t i = 0;
-        for (i = 0; i < username_length_; ++i) {
-            username_[i] = (uint8_t) username[i];
+        uint32_t length = (uint32_t) username.size();
+        uint8_t *bytes = MutableBytes();
+        // Message follows the user name in the byte stream
+        if (length != username_length_ && message_length_ > 0) {
+            memmove(bytes + HEADER_LENGTH + length, bytes + HEADER_LENGTH + username_length_, MessageBytes());
         }
-        username_[i] = '\0';
-
-        length_ = HEADER_LENGTH + username_length_ + enc_length_;
+        memcpy(bytes + HEADER_LENGTH, username.data(), length);
+        username_length_ = length;
+        user_id_ = 0;
+        length_ = HEADER_LENGTH + username_length_ + MessageBytes();
+        dirty_ = true;
     } else {
         ret = ERROR_INVALID_PARAMETERS;
     }
@@ -188,28 +234,67 @@ JamStatus Payload::SetUsername(string username) {
     return ret;
 };
 
+uint16_t Payload::GetUserId() const {
+    return user_id_;
+}
+
+void Payload::SetUserId(uint16_t id) {
+    if (id > 0 && username_length_ > 0) {
+        // The id goes in place of the name
+        SetUsername(string());
+    }
+    user_id_ = id;
+    dirty_ = true;
+}
+
 string Payload::GetMessage() {
-    return string(message_, message_ + message_length_);
+    if (message_length_ == 0) {
+        return string();
+    }
+    if (long_message_) {
+        return *long_message_;
+    }
+
+    // Decryption (message stays encrypted in the shared bytes)
+    uint8_t message[MAX_MESSAGE_LENGTH];
+    if (!Decryptor().Process(buffer_.data() + HEADER_LENGTH + username_length_, message,
+                             CipherBytes(message_length_))) {
+        return string();
+    }
+    return string(message, message + message_length_);
 }
 
 JamStatus Payload::SetMessage(string message) {
+    return SetMessage((uint8_t *) message.data(), (uint32_t) message.size());
+};
+
+JamStatus Payload::SetMessage(uint8_t *in, uint32_t length) {
     JamStatus ret = SUCCESS;
 
-    if (message.size() < MAX_MESSAGE_LENGTH) {
-        message_length_ = (uint32_t) message.size();
-        enc_length_ = ((message_length_ + AES_BLOCK_SIZE) / AES_BLOCK_SIZE) * AES_BLOCK_SIZE;
-        uint32_t i = 0;
-        for (i = 0; i < message_length_; ++i) {
-            message_[i] = (uint8_t) message[i];
+    if (length < MAX_MESSAGE_LENGTH) {
+        if (long_message_) {
+            // No message in the bytes to keep
+            long_message_.reset();
+            message_length_ = 0;
         }
-        message_[i] = '\0';
-        length_ = HEADER_LENGTH + username_length_ + enc_length_;
-
-        // Encryption
-        AES_set_encrypt_key(aes_key, sizeof(aes_key) * 8, &enc_key_);
-        memset(iv_, 0, AES_BLOCK_SIZE);
-        memset(enc_buffer_, 0, MAX_MESSAGE_LENGTH);
-        AES_cbc_encrypt(message_, enc_buffer_, message_length_, &enc_key_, iv_, AES_ENCRYPT);
+        uint8_t *bytes = MutableBytes();
+        message_length_ = length;
+        length_ = HEADER_LENGTH + username_length_ + MessageBytes();
+        dirty_ = true;
+
+        // Encryption straight into the byte stream, zero padded to whole blocks
+        uint8_t *out = bytes + HEADER_LENGTH + username_length_;
+        memset(out, 0, MessageBytes());
+        memcpy(out, in, length);
+        if (!Encryptor().Process(out, out, CipherBytes(length))) {
+            ret = ENCODE_ERROR;
+        }
+    } else if (length <= MAX_FRAGMENTED_LENGTH) {
+        // Kept as is until sent in fragments, which encrypt their own part
+        long_message_ = std::make_shared<const string>(in, in + length);
+        message_length_ = length;
+        length_ = HEADER_LENGTH + username_length_;
+        dirty_ = true;
     } else {
         ret = ERROR_INVALID_PARAMETERS;
     }
@@ -217,68 +302,149 @@ JamStatus Payload::SetMessage(string message) {
     return ret;
 };
 
-JamStatus Payload::SetMessage(uint8_t *in, uint32_t length) {
+uint16_t Payload::GetFragmentId() const {
+    return fragment_id_;
+}
+
+uint8_t Payload::GetFragmentIndex() const {
+    return fragment_index_;
+}
+
+uint8_t Payload::GetFragmentCount() const {
+    return fragment_count_;
+}
+
+void Payload::SetFragment(uint16_t id, uint8_t index, uint8_t count) {
+    fragment_id_ = id;
+    fragment_index_ = index;
+    fragment_count_ = count;
+    dirty_ = true;
+}
+
+bool Payload::NeedsFragments() const {
+    return long_message_ != nullptr;
+}
+
+JamStatus Payload::Fragment(uint16_t id, vector<Payload> *fragments) {
     JamStatus ret = SUCCESS;
 
-    if (length < MAX_MESSAGE_LENGTH) {
-        message_length_ = length;
-        enc_length_ = ((message_length_ + AES_BLOCK_SIZE) / AES_BLOCK_SIZE) * AES_BLOCK_SIZE;
-        memcpy(message_, in, length);
-        length_ = HEADER_LENGTH + username_length_ + enc_length_;
-
-        // Encryption
-        AES_set_encrypt_key(aes_key, sizeof(aes_key) * 8, &enc_key_);
-        memset(iv_, 0, AES_BLOCK_SIZE);
-        memset(enc_buffer_, 0, MAX_MESSAGE_LENGTH);
-        AES_cbc_encrypt(message_, enc_buffer_, message_length_, &enc_key_, iv_, AES_ENCRYPT);
+    if (long_message_ && ValidateForEncode() == SUCCESS) {
+        string username = GetUsername();
+        uint8_t *message = (uint8_t *) long_message_->data();
+        uint8_t count = (uint8_t) ((message_length_ + FRAGMENT_LENGTH - 1) / FRAGMENT_LENGTH);
+
+        for (uint8_t index = 0; index < count && ret == SUCCESS; ++index) {
+            uint32_t offset = (uint32_t) index * FRAGMENT_LENGTH;
+            Payload fragment;
+            fragment.type_ = type_;
+            fragment.order_ = order_;
+            fragment.code_ = code_;
+            fragment.address_ = address_;
+            fragment.SetUsername(username);
+            fragment.header_version_ = header_version_;
+            fragment.user_id_ = user_id_;
+            fragment.SetMessage(message + offset, std::min((uint32_t) FRAGMENT_LENGTH, message_length_ - offset));
+            fragment.SetFragment(id, index, count);
+            ret = fragment.EncodePayload();
+            fragments->push_back(fragment);
+        }
     } else {
-        ret = ERROR_INVALID_PARAMETERS;
+        ret = ENCODE_VALIDATION_FAILED;
     }
 
     return ret;
-};
+}
 
-const uint8_t *Payload::payload() const {
-    return payload_;
-};
+size_t Payload::GetCapacity() const {
+    return PayloadBuffer::capacity();
+}
 
-uint8_t *Payload::payload() {
-    return payload_;
-};
+uint8_t *Payload::GetReceiveBuffer() {
+    return buffer_.MakeUnique(0);
+}
+
+int Payload::GetIovec(iovec *iov) {
+    int count = 0;
+    uint8_t *buffer = head_;
+
+    if (type_ == ACK_MSG) {
+        packu8(buffer, type_);
+    } else if (type_ != NA) {
+        // Flag the type byte so the receiver knows the header and looks for the fragment fields and
+        // ACK after the message
+        packu8(buffer, (uint8_t) (type_ | (header_version_ == COMPACT_HEADER ? COMPACT_FLAG : 0) |
+                                  (fragment_count_ > 0 ? FRAGMENT_FLAG : 0) | (trailer_length_ > 0 ? ACK_FLAG : 0)));
+        if (header_version_ == COMPACT_HEADER) {
+            packvarint(buffer, uid_);
+        } else {
+            packu32(buffer, uid_);
+        }
+    }
+
+    if (buffer > head_) {
+        iov[count].iov_base = head_;
+        iov[count++].iov_len = (size_t) (buffer - head_);
+    }
+    if (body_length_ > body_start_) {
+        iov[count].iov_base = (void *) (buffer_.data() + body_start_);
+        iov[count++].iov_len = body_length_ - body_start_;
+    }
+    if (trailer_length_ > 0) {
+        iov[count].iov_base = trailer_;
+        iov[count++].iov_len = trailer_length_;
+    }
+
+    return count;
+}
 
 JamStatus Payload::EncodePayload() {
     JamStatus ret = SUCCESS;
-    uint8_t *buffer = payload_;
 
     if (ValidateForEncode() == SUCCESS) {
-        try {
-            packu8(buffer, type_);
-            packu32(buffer, uid_);
-            packi32(buffer, order_);
-            switch (type_) {
-                case STATUS_MSG:
-                    packu8(buffer, code_.status);
-                    break;
-                case ELECTION_MSG:
-                    packu8(buffer, code_.election);
-                    break;
-                case RECOVER_MSG:
-                    packu8(buffer, code_.recover);
-                    break;
-                default:
-                    // no encode
-                    break;
+        // Bytes encoded before are still valid for every copy unless a field changed since
+        if (long_message_) {
+            // Nothing to send as is, see Fragment()
+            body_length_ = 0;
+        } else if (dirty_ || body_length_ == 0) {
+            uint8_t *bytes = MutableBytes();
+            uint8_t *buffer;
+            try {
+                if (header_version_ == COMPACT_HEADER) {
+                    // Written to end where the user name starts, so name and message stay in place.
+                    // Order is zigzag encoded so no order (-1) takes one byte; the low bit of the
+                    // user field tells a session user id from a name length.
+                    uint8_t header[MAX_COMPACT_HEADER_LENGTH];
+                    buffer = header;
+                    packvarint(buffer, ((uint32_t) order_ << 1) ^ (uint32_t) (order_ >> 31));
+                    packu8(buffer, GetCode());
+                    packvarint(buffer, user_id_ > 0 ? ((uint32_t) user_id_ << 1) | 1 : username_length_ << 1);
+                    packvarint(buffer, message_length_);
+                    body_start_ = HEADER_LENGTH - (uint32_t) (buffer - header);
+                    memcpy(bytes + body_start_, header, buffer - header);
+                } else {
+                    buffer = bytes + UID_HEADER_LENGTH;
+                    packi32(buffer, order_);
+                    packu8(buffer, GetCode());
+                    packu32(buffer, username_length_);
+                    packu32(buffer, message_length_);
+                    body_start_ = UID_HEADER_LENGTH;
+                }
+                body_length_ = HEADER_LENGTH + username_length_ + MessageBytes();
+                if (fragment_count_ > 0) {
+                    buffer = bytes + body_length_;
+                    packu16(buffer, fragment_id_);
+                    packu8(buffer, fragment_index_);
+                    packu8(buffer, fragment_count_);
+                    body_length_ += FRAGMENT_HEADER_LENGTH;
+                }
+                dirty_ = false;
+            } catch (...) {
+                ret = ENCODE_ERROR;
             }
-
-            packu32(buffer, username_length_);
-            packu32(buffer, message_length_);
-            memcpy(buffer, username_, username_length_);
-            buffer += username_length_;
-            memcpy(buffer, enc_buffer_, enc_length_);
-        } catch (...) {
-            ret = ENCODE_ERROR;
         }
-
+        has_ack_ = false;
+        trailer_length_ = 0;
+        length_ = body_length_ > 0 ? HeadLength(uid_) + body_length_ - body_start_ : 0;
     } else {
         ret = ENCODE_VALIDATION_FAILED;
     }
@@ -286,21 +452,26 @@ JamStatus Payload::EncodePayload() {
     return ret;
 }
 
-JamStatus Payload::EncodeAckPayload(uint32_t uid, AckStatus ack) {
+JamStatus Payload::EncodeAckPayload(uint32_t next, const AckRange *ranges, uint8_t count) {
     JamStatus ret = SUCCESS;
-    uint8_t *buffer = payload_;
+    uint8_t *buffer = trailer_;
 
     try {
         // Set private variables accordingly
         type_ = ACK_MSG;
-        uid_ = uid;
-        ack_ = ack;
-        length_ = ACK_MSG_LENGTH;
-
-        // Computes payload
-        packu8(buffer, type_);
-        packu32(buffer, uid_);
-        packu8(buffer, ack_);
+        uid_ = next;
+        has_ack_ = true;
+        ack_next_ = next;
+        ack_count_ = std::min(count, (uint8_t) MAX_SACK_RANGES);
+        std::copy(ranges, ranges + ack_count_, ack_ranges_);
+        length_ = ACK_MSG_LENGTH + ack_count_ * ACK_RANGE_LENGTH;
+
+        // Computes payload: type byte goes in the head, no body
+        buffer_.reset();
+        body_length_ = 0;
+        dirty_ = true;
+        PackAck(buffer);
+        trailer_length_ = (uint32_t) (buffer - trailer_);
     } catch (...) {
         ret = ENCODE_ERROR;
     }
@@ -308,12 +479,40 @@ JamStatus Payload::EncodeAckPayload(uint32_t uid, AckStatus ack) {
     return ret;
 }
 
+JamStatus Payload::AttachAck(uint32_t next, const AckRange *ranges, uint8_t count) {
+    JamStatus ret = SUCCESS;
+    uint8_t *buffer = trailer_;
+
+    if (type_ != ACK_MSG && type_ != NA && body_length_ > 0) {
+        try {
+            has_ack_ = true;
+            ack_next_ = next;
+            ack_count_ = std::min(count, (uint8_t) MAX_SACK_RANGES);
+            std::copy(ranges, ranges + ack_count_, ack_ranges_);
+
+            PackAck(buffer);
+            trailer_length_ = (uint32_t) (buffer - trailer_);
+            length_ = HeadLength(uid_) + body_length_ - body_start_ + trailer_length_;
+        } catch (...) {
+            ret = ENCODE_ERROR;
+        }
+    } else {
+        ret = ENCODE_VALIDATION_FAILED;
+    }
+
+    return ret;
+}
+
 JamStatus Payload::EncodeTerminatePayload() {
     JamStatus ret = SUCCESS;
 
+    buffer_.reset();
+    body_length_ = 0;
+    has_ack_ = false;
     for (int i = 0; i < QUIT_MSG_LENGTH; ++i) {
-        payload_[i] = '0';
+        trailer_[i] = '0';
     }
+    trailer_length_ = QUIT_MSG_LENGTH;
     length_ = QUIT_MSG_LENGTH;
     type_ = NA;
 
@@ -322,48 +521,84 @@ JamStatus Payload::EncodeTerminatePayload() {
 
 JamStatus Payload::DecodePayload() {
     JamStatus ret = SUCCESS;
-    uint8_t *buffer = payload_;
 
     if (ValidateForDecode() == SUCCESS) {
+        uint8_t *bytes = const_cast<uint8_t *>(buffer_.data());
+        uint8_t *buffer = bytes;
         try {
-            type_ = (MessageType) unpacku8(buffer);
-            uid_ = unpacku32(buffer);
+            uint8_t type = unpacku8(buffer);
+            type_ = (MessageType) (type & ~(ACK_FLAG | FRAGMENT_FLAG | COMPACT_FLAG));
+            has_ack_ = (type_ == ACK_MSG || (type & ACK_FLAG));
+            uint32_t fragment_length = (type & FRAGMENT_FLAG) ? FRAGMENT_HEADER_LENGTH : 0;
+            trailer_length_ = 0;
+            long_message_.reset();
+            header_version_ = (type & COMPACT_FLAG) ? COMPACT_HEADER : FIXED_HEADER;
+            user_id_ = 0;
             if (type_ == ACK_MSG) {
-                ack_ = (AckStatus) unpacku8(buffer);
+                ret = UnpackAck(buffer, bytes + length_);
+                uid_ = ack_next_;
+                body_length_ = 0;
             } else {
-                order_ = unpacki32(buffer);
-                switch (type_) {
-                    case STATUS_MSG:
-                        code_.status = (Status) unpacku8(buffer);
-                        break;
-                    case ELECTION_MSG:
-                        code_.election = (ElectionCommand) unpacku8(buffer);
-                        break;
-                    case RECOVER_MSG:
-                        code_.recover = (RecoverCommand) unpacku8(buffer);
-                        break;
-                    default:
-                        break;
+                uint8_t *header = buffer;
+                bool valid = true;
+                if (header_version_ == COMPACT_HEADER) {
+                    const uint8_t *end = bytes + length_;
+                    uint32_t order, user;
+                    valid = unpackvarint(buffer, end, &uid_);
+                    header = buffer;
+                    valid = valid && unpackvarint(buffer, end, &order) && buffer < end;
+                    SetCode(valid ? unpacku8(buffer) : (uint8_t) 0);
+                    valid = valid && unpackvarint(buffer, end, &user) && unpackvarint(buffer, end, &message_length_) &&
+                            (user >> 1) <= UINT16_MAX;
+                    order_ = (int32_t) ((order >> 1) ^ (~(order & 1) + 1));
+                    user_id_ = (user & 1) ? (uint16_t) (user >> 1) : (uint16_t) 0;
+                    username_length_ = (user & 1) ? 0 : user >> 1;
+                } else {
+                    uid_ = unpacku32(buffer);
+                    order_ = unpacki32(buffer);
+                    SetCode(unpacku8(buffer));
+                    username_length_ = unpacku32(buffer);
+                    message_length_ = unpacku32(buffer);
                 }
-                if ((username_length_ = unpacku32(buffer)) < MAX_USER_NAME_LENGTH &&
-                    ((message_length_ = unpacku32(buffer)) < MAX_MESSAGE_LENGTH)) {
-                    memcpy(username_, buffer, username_length_);
-                    buffer += username_length_;
-                    // Decryption
-                    AES_set_decrypt_key(aes_key, sizeof(aes_key) * 8, &dec_key_);
-                    memset(iv_, 0, AES_BLOCK_SIZE);
-                    memset(enc_buffer_, 0, MAX_MESSAGE_LENGTH);
-                    enc_length_ = ((message_length_ + AES_BLOCK_SIZE) / AES_BLOCK_SIZE) * AES_BLOCK_SIZE;
-                    memcpy(enc_buffer_, buffer, enc_length_);
-                    AES_cbc_encrypt(enc_buffer_, message_, enc_length_, &dec_key_, iv_, AES_DECRYPT);
-                    message_[message_length_] = '\0';
+                // User name and message are read from the bytes only when asked for
+                uint32_t name_start = (uint32_t) (buffer - bytes);
+                if (valid && username_length_ < MAX_USER_NAME_LENGTH && message_length_ < MAX_MESSAGE_LENGTH &&
+                    name_start + username_length_ + MessageBytes() + fragment_length <= length_ &&
+                    HEADER_LENGTH + username_length_ + MessageBytes() + fragment_length <= GetCapacity()) {
+                    uint32_t tail_length = username_length_ + MessageBytes() + fragment_length;
+                    buffer = bytes + name_start + username_length_ + MessageBytes();
+                    fragment_id_ = fragment_length > 0 ? unpacku16(buffer) : (uint16_t) 0;
+                    fragment_index_ = fragment_length > 0 ? unpacku8(buffer) : (uint8_t) 0;
+                    fragment_count_ = fragment_length > 0 ? unpacku8(buffer) : (uint8_t) 0;
+                    dirty_ = false;
+                    if (fragment_length > 0 && fragment_index_ >= fragment_count_) {
+                        ret = DECODE_ERROR;
+                    } else if (has_ack_) {
+                        ret = UnpackAck(buffer, bytes + length_);
+                    }
+                    if (header_version_ == COMPACT_HEADER) {
+                        // Move the user name to HEADER_LENGTH as in every other payload and keep the
+                        // header right before it, so the bytes can still be relayed as received
+                        uint32_t header_length = name_start - (uint32_t) (header - bytes);
+                        memmove(bytes + HEADER_LENGTH, bytes + name_start, tail_length);
+                        memmove(bytes + HEADER_LENGTH - header_length, header, header_length);
+                        body_start_ = HEADER_LENGTH - header_length;
+                    } else {
+                        body_start_ = UID_HEADER_LENGTH;
+                    }
+                    body_length_ = HEADER_LENGTH + tail_length;
                     // Info
                     if (order_ != DEFAULT_NO_ORDER) {
                         cout << "AES: Encrypted: " <<
-                        string(enc_buffer_, enc_buffer_ + enc_length_) <<
-                        endl << "AES: Decrypted: " << string(message_, message_ + message_length_) << endl;
+                        string(bytes + HEADER_LENGTH + username_length_,
+                               bytes + HEADER_LENGTH + username_length_ + MessageBytes()) <<
+                        endl << "AES: Decrypted: " << GetMessage() << endl;
                     }
                 } else {
+                    username_length_ = 0;
+                    user_id_ = 0;
+                    message_length_ = 0;
+                    body_length_ = 0;
                     ret = DECODE_ERROR;
                 }
             }
@@ -383,10 +618,17 @@ JamStatus Payload::ValidateForEncode() {
     // Validation logic:
     // + Message type must be set to other than ACK_MSG and NA
     // + If type is Chat Message then it must contain an username length & message length > 0
+    //   (a session user id may stand for the user name in the compact header)
+    // + If type is Batch Message then it must contain a message length > 0
 
     switch (type_) {
         case CHAT_MSG:
-            if (username_length_ == 0 || message_length_ == 0)
+            if ((username_length_ == 0 && (user_id_ == 0 || header_version_ != COMPACT_HEADER)) ||
+                message_length_ == 0)
+                ret = ENCODE_VALIDATION_FAILED;
+            break;
+        case BATCH_MSG:
+            if (message_length_ == 0)
                 ret = ENCODE_VALIDATION_FAILED;
             break;
         case ACK_MSG:
@@ -405,16 +647,96 @@ JamStatus Payload::ValidateForEncode() {
 JamStatus Payload::ValidateForDecode() {
     JamStatus ret = SUCCESS;
 
-    // TODO: implement decoding validation algorithm
+    // Validation logic:
+    // + Bytes must have been received with GetReceiveBuffer() and their length set
+    // + Length must fit the buffer
+
+    if (buffer_.data() == NULL || length_ == 0 || length_ > GetCapacity()) {
+        ret = DECODE_VALIDATION_FAILED;
+    }
+
     return ret;
 }
 
 void Payload::clear() {
     type_ = NA;
     uid_ = 0;
+    has_ack_ = false;
     order_ = 0;
+    code_.status = CLIENT_JOIN;
+    header_version_ = FIXED_HEADER;
     username_length_ = 0;
+    user_id_ = 0;
     message_length_ = 0;
+    fragment_id_ = 0;
+    fragment_index_ = 0;
+    fragment_count_ = 0;
+    long_message_.reset();
+    buffer_.reset();
+    trailer_length_ = 0;
+    length_ = 0;
+    body_start_ = UID_HEADER_LENGTH;
+    body_length_ = 0;
+    dirty_ = true;
+}
+
+uint8_t *Payload::MutableBytes() {
+    return buffer_.MakeUnique(HEADER_LENGTH + username_length_ + MessageBytes());
+}
+
+uint32_t Payload::MessageBytes() const {
+    if (message_length_ == 0 || long_message_) {
+        return 0;
+    }
+    return ((message_length_ + AES_BLOCK_SIZE) / AES_BLOCK_SIZE) * AES_BLOCK_SIZE;
+}
+
+uint32_t Payload::HeadLength(uint32_t uid) const {
+    if (header_version_ != COMPACT_HEADER) {
+        return UID_HEADER_LENGTH;
+    }
+
+    uint32_t length = 2;
+    for (; uid >= 0x80; uid >>= 7) {
+        length++;
+    }
+    return length;
+}
+
+uint8_t Payload::GetCode() const {
+    switch (type_) {
+        case CHAT_MSG:
+        case BATCH_MSG:
+            return code_.relay;
+        case STATUS_MSG:
+            return code_.status;
+        case ELECTION_MSG:
+            return code_.election;
+        case RECOVER_MSG:
+            return code_.recover;
+        default:
+            return 0;
+    }
+}
+
+void Payload::SetCode(uint8_t code) {
+    switch (type_) {
+        case CHAT_MSG:
+        case BATCH_MSG:
+            code_.relay = code;
+            break;
+        case STATUS_MSG:
+            code_.status = (Status) code;
+            break;
+        case ELECTION_MSG:
+            code_.election = (ElectionCommand) code;
+            break;
+        case RECOVER_MSG:
+            code_.recover = (RecoverCommand) code;
+            break;
+        default:
+            break;
+    }
 }
 
 uint32_t Payload::packu8(uint8_t *&buf, uint8_t i) {
@@ -440,6 +762,12 @@ uint32_t Payload::packu32(uint8_t *&buf, uint32_t i) {
     return 4;
 }
 
+uint32_t Payload::packu16(uint8_t *&buf, uint16_t i) {
+    *buf++ = (uint8_t) (i >> 8);
+    *buf++ = (uint8_t) i;
+    return 2;
+}
+
 uint8_t Payload::unpacku8(uint8_t *&buf) {
     return *buf++;
 }
@@ -467,4 +795,67 @@ uint32_t Payload::unpacku32(uint8_t *&buf) {
     buf += 4;
     uint32_t un = ntohl(ui);
     return un;
-}
\ No newline at end of file
+}
+
+uint16_t Payload::unpacku16(uint8_t *&buf) {
+    uint16_t i = (uint16_t) ((buf[0] << 8) | buf[1]);
+    buf += 2;
+    return i;
+}
+
+uint32_t Payload::packvarint(uint8_t *&buf, uint32_t i) {
+    uint32_t length = 1;
+
+    // 7 bits per byte, lowest first; the high bit is set on every byte but the last
+    for (; i >= 0x80; i >>= 7) {
+        *buf++ = (uint8_t) (i | 0x80);
+        length++;
+    }
+    *buf++ = (uint8_t) i;
+    return length;
+}
+
+bool Payload::unpackvarint(uint8_t *&buf, const uint8_t *end, uint32_t *i) {
+    *i = 0;
+    for (uint32_t shift = 0; shift < 7 * MAX_VARINT_LENGTH && buf < end; shift += 7) {
+        uint8_t byte = *buf++;
+        *i |= (uint32_t) (byte & 0x7F) << shift;
+        if ((byte & 0x80) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void Payload::PackAck(uint8_t *&buf) {
+    packu32(buf, ack_next_);
+    packu8(buf, ack_count_);
+    for (uint8_t i = 0; i < ack_count_; ++i) {
+        packu32(buf, ack_ranges_[i].start);
+        packu32(buf, ack_ranges_[i].end);
+    }
+}
+
+JamStatus Payload::UnpackAck(uint8_t *&buf, const uint8_t *end) {
+    // Type byte is already taken
+    ack_count_ = 0;
+    if (end - buf < ACK_MSG_LENGTH - 1) {
+        return DECODE_ERROR;
+    }
+    ack_next_ = unpacku32(buf);
+    uint8_t count = unpacku8(buf);
+    if (count > MAX_SACK_RANGES || end - buf < count * ACK_RANGE_LENGTH) {
+        return DECODE_ERROR;
+    }
+
+    for (uint8_t i = 0; i < count; ++i) {
+        ack_ranges_[i].start = unpacku32(buf);
+        ack_ranges_[i].end = unpacku32(buf);
+        // Serial order, a range may wrap around
+        if ((int32_t) (ack_ranges_[i].end - ack_ranges_[i].start) < 0) {
+            return DECODE_ERROR;
+        }
+    }
+    ack_count_ = count;
+    return SUCCESS;
+}
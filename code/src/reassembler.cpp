@@ -0,0 +1,104 @@
+/**
+ * Reassembler - puts messages sent as fragments back together.
+ */
+
+#include "../include/reassembler.h"
+
+#include <algorithm>
+#include <cstring>
+
+using namespace std;
+
+Reassembler::Reassembler(uint32_t max_messages, uint32_t timeout)
+        : max_messages_(max_messages > 0 ? max_messages : 1),
+          timeout_(timeout),
+          dropped_(0) {
+}
+
+bool Reassembler::Add(Payload &fragment, Payload *message, std::vector<uint32_t> *uids) {
+    chrono::steady_clock::time_point now = chrono::steady_clock::now();
+    uint8_t index = fragment.GetFragmentIndex();
+    uint8_t count = fragment.GetFragmentCount();
+    const sockaddr_in *addr = fragment.GetAddress();
+
+    // Give up on messages whose fragments stopped coming
+    auto expired = remove_if(partials_.begin(), partials_.end(), [&](const Partial &partial) {
+        return now - partial.started > timeout_;
+    });
+    if (expired != partials_.end()) {
+        dropped_ += partials_.end() - expired;
+        DCOUT("WARNING: Reassembler - Dropped " + to_string(partials_.end() - expired) + " timed out messages");
+        partials_.erase(expired, partials_.end());
+    }
+
+    // Every fragment but the last is full
+    string slice = fragment.GetMessage();
+    bool last = index == count - 1;
+    if (index >= count || count > (MAX_FRAGMENTED_LENGTH + FRAGMENT_LENGTH - 1) / FRAGMENT_LENGTH ||
+        slice.empty() || slice.size() > FRAGMENT_LENGTH || (!last && slice.size() != FRAGMENT_LENGTH)) {
+        DCOUT("WARNING: Reassembler - Invalid fragment");
+        return false;
+    }
+
+    auto search = find_if(partials_.begin(), partials_.end(), [&](const Partial &partial) {
+        return partial.id == fragment.GetFragmentId() && partial.addr.sin_addr.s_addr == addr->sin_addr.s_addr &&
+               partial.addr.sin_port == addr->sin_port;
+    });
+    if (search == partials_.end()) {
+        if (partials_.size() >= max_messages_) {
+            dropped_++;
+            DCOUT("WARNING: Reassembler - Too many partly received messages, dropped the oldest");
+            partials_.erase(partials_.begin());
+        }
+        Partial partial;
+        partial.addr = *addr;
+        partial.id = fragment.GetFragmentId();
+        partial.count = count;
+        partial.received = 0;
+        partial.length = 0;
+        partial.have.assign(count, false);
+        partial.uids.assign(count, 0);
+        partial.data.resize(count * FRAGMENT_LENGTH);
+        partial.first = fragment;
+        partial.started = now;
+        partials_.push_back(std::move(partial));
+        search = partials_.end() - 1;
+    }
+
+    if (count != search->count) {
+        DCOUT("WARNING: Reassembler - Fragment count does not match the message");
+        return false;
+    }
+    if (search->have[index]) {
+        DCOUT("INFO: Reassembler - Duplicate fragment");
+        return false;
+    }
+
+    memcpy(search->data.data() + index * FRAGMENT_LENGTH, slice.data(), slice.size());
+    search->have[index] = true;
+    search->uids[index] = fragment.GetUid();
+    search->received++;
+    if (last) {
+        search->length = index * FRAGMENT_LENGTH + (uint32_t) slice.size();
+    }
+    if (search->received < search->count) {
+        return false;
+    }
+
+    *message = search->first;
+    message->SetFragment(0, 0, 0);
+    JamStatus ret = message->SetMessage(search->data.data(), search->length);
+    if (uids != NULL) {
+        uids->swap(search->uids);
+    }
+    partials_.erase(search);
+    return ret == SUCCESS;
+}
+
+uint32_t Reassembler::size() const {
+    return (uint32_t) partials_.size();
+}
+
+uint64_t Reassembler::get_dropped() const {
+    return dropped_;
+}
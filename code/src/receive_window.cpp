@@ -0,0 +1,199 @@
+/**
+ * Thread-safe per-peer sliding window of received payload uids used to drop duplicates.
+ *
+ * Each peer keeps the lowest uid not received yet, the highest uid seen and a bitmap of the last
+ * window uids, so checking a payload and forgetting a peer are O(1) no matter how many peers send
+ * at the same time.
+ * Peers are spread over RECEIVE_WINDOW_SHARDS shards by address, each with its own lock, so
+ * readers of different sockets rarely wait for each other; one peer always uses one shard.
+ */
+
+#include "../include/receive_window.h"
+
+#include <algorithm>
+
+ReceiveWindow::ReceiveWindow(uint32_t window)
+        : window_(0),
+          shards_(new Shard[RECEIVE_WINDOW_SHARDS]) {
+    set_window(window);
+}
+
+ReceiveWindow::~ReceiveWindow() {
+
+}
+
+uint32_t ReceiveWindow::get_window() {
+    return window_;
+}
+
+void ReceiveWindow::set_window(uint32_t window) {
+    // Power of 2 keeps uid % window_ continuous when uids wrap around
+    window_ = 64;
+    while (window_ < window) {
+        window_ <<= 1;
+    }
+    for (uint32_t i = 0; i < RECEIVE_WINDOW_SHARDS; ++i) {
+        boost::mutex::scoped_lock lock(shards_[i].m_peers);
+        shards_[i].peers.clear();
+    }
+}
+
+bool ReceiveWindow::CheckAndMark(in_addr_t ip, in_port_t port, uint32_t uid) {
+    uint64_t key = PeerKey(ip, port);
+    Shard &shard = GetShard(key);
+    boost::mutex::scoped_lock lock(shard.m_peers);
+    auto search = shard.peers.find(key);
+
+    if (search == shard.peers.end() || Restarted(search->second, uid)) {
+        // First payload of this peer or of its new run. Senders start a receiver's uids at a
+        // multiple of the window, so lower uids of the run may still come but none below that.
+        Peer &peer = shard.peers[key];
+        peer.bits.assign(window_ / 64, 0);
+        peer.next = uid & ~(window_ - 1);
+        peer.high = uid;
+        SetBit(peer, uid);
+        Advance(peer);
+        return false;
+    }
+
+    Peer &peer = search->second;
+    if ((int32_t) (uid - peer.next) < 0) {              // Serial number arithmetic for wrap around
+        return true;
+    }
+
+    int32_t ahead = (int32_t) (uid - peer.high);
+    if (ahead > 0) {
+        // Slide window forward, forgetting uids that fall out of it
+        if ((uint32_t) ahead >= window_) {
+            std::fill(peer.bits.begin(), peer.bits.end(), 0);
+        } else {
+            for (uint32_t i = peer.high + 1; i != uid; ++i) {
+                ClearBit(peer, i);
+            }
+        }
+        peer.high = uid;
+        // Senders keep less than a window outstanding, so uids falling out of it were given up
+        if (uid - peer.next >= window_) {
+            peer.next = uid - (window_ - 1);
+        }
+    } else if (TestBit(peer, uid)) {
+        return true;
+    }
+
+    SetBit(peer, uid);
+    Advance(peer);
+    return false;
+}
+
+bool ReceiveWindow::Check(in_addr_t ip, in_port_t port, uint32_t uid) {
+    uint64_t key = PeerKey(ip, port);
+    Shard &shard = GetShard(key);
+    boost::mutex::scoped_lock lock(shard.m_peers);
+    auto search = shard.peers.find(key);
+
+    if (search == shard.peers.end()) {
+        return false;
+    }
+
+    const Peer &peer = search->second;
+    if (Restarted(peer, uid)) {
+        return false;
+    }
+    if ((int32_t) (uid - peer.next) < 0) {
+        return true;
+    }
+    return (int32_t) (uid - peer.high) <= 0 && TestBit(peer, uid);
+}
+
+bool ReceiveWindow::BuildAck(in_addr_t ip, in_port_t port, uint32_t *next, AckRange *ranges, uint8_t *count) {
+    uint64_t key = PeerKey(ip, port);
+    Shard &shard = GetShard(key);
+    boost::mutex::scoped_lock lock(shard.m_peers);
+    auto search = shard.peers.find(key);
+    uint8_t capacity = *count;
+
+    *count = 0;
+    if (search == shard.peers.end()) {
+        return false;
+    }
+
+    // Nothing is acknowledged cumulatively past the first missing uid, which is within the window
+    const Peer &peer = search->second;
+    uint32_t span = peer.high - peer.next + 1;
+    uint32_t bottom = peer.next;
+    uint32_t offset = 0;
+    *next = peer.next;
+
+    while (*count < capacity && offset < span) {
+        uint32_t start = offset + FindBit(peer, bottom + offset, span - offset, true);
+        if (start >= span) {
+            break;
+        }
+        uint32_t end = start + FindBit(peer, bottom + start, span - start, false);
+        ranges[*count].start = bottom + start;
+        ranges[*count].end = bottom + end - 1;
+        (*count)++;
+        offset = end;
+    }
+
+    return true;
+}
+
+void ReceiveWindow::Clear(in_addr_t ip, in_port_t port) {
+    uint64_t key = PeerKey(ip, port);
+    Shard &shard = GetShard(key);
+    boost::mutex::scoped_lock lock(shard.m_peers);
+    shard.peers.erase(key);
+}
+
+uint64_t ReceiveWindow::PeerKey(in_addr_t ip, in_port_t port) {
+    return ((uint64_t) ip << 16) | port;
+}
+
+ReceiveWindow::Shard &ReceiveWindow::GetShard(uint64_t key) {
+    // Peers on one host differ in the port only; mix so they spread too
+    key *= 0x9E3779B97F4A7C15ULL;
+    return shards_[(key >> 32) % RECEIVE_WINDOW_SHARDS];
+}
+
+bool ReceiveWindow::TestBit(const Peer &peer, uint32_t uid) {
+    uint32_t pos = uid % window_;
+    return (peer.bits[pos >> 6] >> (pos & 63)) & 1;
+}
+
+void ReceiveWindow::SetBit(Peer &peer, uint32_t uid) {
+    uint32_t pos = uid % window_;
+    peer.bits[pos >> 6] |= (uint64_t) 1 << (pos & 63);
+}
+
+void ReceiveWindow::ClearBit(Peer &peer, uint32_t uid) {
+    uint32_t pos = uid % window_;
+    peer.bits[pos >> 6] &= ~((uint64_t) 1 << (pos & 63));
+}
+
+bool ReceiveWindow::Restarted(const Peer &peer, uint32_t uid) {
+    // No retransmit is a window below next, so the peer numbers a new run from a new start
+    return (int32_t) (peer.next - uid) > (int32_t) window_;
+}
+
+void ReceiveWindow::Advance(Peer &peer) {
+    uint32_t pending = peer.high - peer.next + 1;       // Uids from next up to high, at most window
+    peer.next += FindBit(peer, peer.next, pending, false);
+}
+
+uint32_t ReceiveWindow::FindBit(const Peer &peer, uint32_t start, uint32_t limit, bool value) {
+    uint32_t offset = 0;
+
+    // Skip whole bitmap words at a time
+    while (offset < limit) {
+        uint32_t pos = (start + offset) % window_;
+        uint64_t word = value ? peer.bits[pos >> 6] : ~peer.bits[pos >> 6];
+        word >>= (pos & 63);
+        if (word != 0) {
+            return std::min(offset + __builtin_ctzll(word), limit);
+        }
+        offset += 64 - (pos & 63);
+    }
+
+    return limit;
+}
@@ -0,0 +1,401 @@
+/**
+ * Thread-safe hashed timing wheel for retransmission deadlines.
+ *
+ * Tickets are stored once in a slab and referenced by handle from the wheel buckets and from a
+ * (peer, uid) hash index, so arming, cancelling and firing are O(1), no payload is copied while
+ * waiting for the next deadline, and a steady send/ACK cycle does not touch the heap. Each peer
+ * also keeps its tickets in uid order so one cumulative/selective ACK retires every ticket it
+ * covers in a single pass. Held tickets trail the others in that order and are kept out of the
+ * buckets until the oldest ticket is within span of them.
+ */
+
+#include "../include/retransmit_wheel.h"
+
+using namespace std::chrono;
+
+RetransmitWheel::RetransmitWheel(uint32_t tick, uint32_t slots, uint32_t capacity)
+        : tick_(tick > 0 ? tick : 1),
+          span_(UDP_RECEIVE_WINDOW),
+          entries_(capacity),
+          count_(0),
+          wake_(milliseconds::max()),
+          stopped_(false) {
+    // Bucket count is a power of 2 and at least one bitmap word
+    uint32_t size = 64;
+    while (size < slots) {
+        size <<= 1;
+    }
+    mask_ = size - 1;
+    buckets_.assign(size, NIL);
+    occupied_.assign(size / 64, 0);
+
+    // One index chain per ticket of the first slab keeps chains short until the slab overflows
+    size = (uint32_t) entries_.GetStats().capacity;
+    index_mask_ = size - 1;
+    index_.assign(size, NIL);
+    current_tick_ = (uint64_t) Now().count() / tick_;
+}
+
+RetransmitWheel::~RetransmitWheel() {
+
+}
+
+milliseconds RetransmitWheel::Now() {
+    return duration_cast<milliseconds>(steady_clock::now().time_since_epoch());
+}
+
+size_t RetransmitWheel::size() {
+    boost::mutex::scoped_lock lock(m_wheel_);
+    return count_;
+}
+
+bool RetransmitWheel::is_empty() {
+    boost::mutex::scoped_lock lock(m_wheel_);
+    return count_ == 0;
+}
+
+void RetransmitWheel::set_span(uint32_t span) {
+    boost::mutex::scoped_lock lock(m_wheel_);
+    span_ = std::max(1u, span);
+}
+
+SlabStats RetransmitWheel::GetStats() {
+    boost::mutex::scoped_lock lock(m_wheel_);
+    return entries_.GetStats();
+}
+
+bool RetransmitWheel::Arm(uint32_t uid, uint8_t retries, milliseconds deadline, const Payload &payload,
+                          bool *held) {
+    boost::mutex::scoped_lock lock(m_wheel_);
+    uint64_t key = PeerKey(payload.GetAddress());
+    if (held != NULL) {
+        *held = false;
+    }
+    if (Find(key, uid) != NIL) {
+        return false;
+    }
+
+    // Held past the span, or past an older held ticket so they go out in order
+    Peer &peer = peers_[key];
+    bool hold = false;
+    if (held != NULL && peer.head != NIL) {
+        uint32_t oldest = entries_[peer.head].ticket.uid;
+        hold = !Before(uid, oldest) &&
+               (uid - oldest >= span_ || (peer.held != NIL && Before(entries_[peer.held].ticket.uid, uid)));
+        *held = hold;
+    }
+
+    uint32_t handle = entries_.Allocate();
+    Entry &entry = entries_[handle];
+    entry.ticket.uid = uid;
+    entry.ticket.retries = retries;
+    entry.ticket.resends = 0;
+    entry.ticket.unsent = hold;
+    entry.ticket.sent = Now();
+    entry.ticket.deadline = deadline;
+    entry.ticket.payload = payload;
+    entry.peer = key;
+    entry.tick = std::max((uint64_t) (deadline.count() + tick_ - 1) / tick_, current_tick_ + 1);
+    entry.in_use = true;
+    entry.held = hold;
+    LinkPeer(peer, handle);
+    uint32_t &chain = IndexChain(key, uid);
+    entry.index_next = chain;
+    chain = handle;
+    count_++;
+    if (hold) {
+        if (peer.held == NIL || Before(uid, entries_[peer.held].ticket.uid)) {
+            peer.held = handle;
+        }
+        return true;
+    }
+    Link(handle);
+
+    // Wake up monitor if it sleeps past the new deadline
+    if (deadline < wake_) {
+        lock.unlock();
+        cond_variable_.notify_all();
+    }
+
+    return true;
+}
+
+bool RetransmitWheel::Cancel(const sockaddr_in *addr, uint32_t uid) {
+    boost::mutex::scoped_lock lock(m_wheel_);
+    uint64_t key = PeerKey(addr);
+    uint32_t handle = Find(key, uid);
+    if (handle == NIL) {
+        return false;
+    }
+
+    if (!entries_[handle].held) {
+        Unlink(handle);
+    }
+    Release(handle);
+    if (Unhold(peers_[key], current_tick_ + 1)) {
+        lock.unlock();
+        cond_variable_.notify_all();
+    }
+    return true;
+}
+
+uint32_t RetransmitWheel::Retire(const sockaddr_in *addr, uint32_t next, const AckRange *ranges, uint8_t count,
+                                 milliseconds *sent) {
+    boost::mutex::scoped_lock lock(m_wheel_);
+    if (sent != NULL) {
+        *sent = milliseconds::zero();
+    }
+
+    auto peer = peers_.find(PeerKey(addr));
+    if (peer == peers_.end()) {
+        return 0;
+    }
+
+    // Walk tickets and ranges together, both in uid order
+    uint32_t retired = 0;
+    uint8_t range = 0;
+    uint32_t handle = peer->second.head;
+    while (handle != NIL) {
+        uint32_t following = entries_[handle].peer_next;
+        uint32_t uid = entries_[handle].ticket.uid;
+        bool covered = Before(uid, next);
+
+        if (!covered) {
+            while (range < count && Before(ranges[range].end, uid)) {
+                range++;
+            }
+            if (range == count) {
+                break;
+            }
+            covered = !Before(uid, ranges[range].start);
+        }
+
+        if (covered) {
+            // Resent tickets are ambiguous about which copy was acknowledged
+            if (sent != NULL && entries_[handle].ticket.resends == 0) {
+                *sent = std::max(*sent, entries_[handle].ticket.sent);
+            }
+
+            if (!entries_[handle].held) {
+                Unlink(handle);
+            }
+            Release(handle);
+            retired++;
+        }
+        handle = following;
+    }
+
+    if (Unhold(peer->second, current_tick_ + 1)) {
+        lock.unlock();
+        cond_variable_.notify_all();
+    }
+    return retired;
+}
+
+void RetransmitWheel::Advance(milliseconds now, ExpireHandler handler) {
+    boost::mutex::scoped_lock lock(m_wheel_);
+    uint64_t target = (uint64_t) now.count() / tick_;
+    if (target <= current_tick_) {
+        return;
+    }
+
+    // Visit every bucket at most once even after a long pause
+    uint64_t steps = std::min(target - current_tick_, (uint64_t) mask_ + 1);
+    for (uint64_t i = 1; i <= steps; ++i) {
+        uint32_t handle = buckets_[(current_tick_ + i) & mask_];
+        while (handle != NIL) {
+            uint32_t next = entries_[handle].next;
+            Entry &entry = entries_[handle];
+            if (entry.tick <= target) {
+                Unlink(handle);
+                if (handler(entry.ticket)) {
+                    // Re-armed tickets land after target so they cannot fire twice in this pass
+                    entry.tick = std::max((uint64_t) (entry.ticket.deadline.count() + tick_ - 1) / tick_,
+                                          target + 1);
+                    Link(handle);
+                } else {
+                    uint64_t key = entry.peer;
+                    Release(handle);
+                    Unhold(peers_[key], target + 1);
+                }
+            }
+            handle = next;
+        }
+    }
+    current_tick_ = target;
+}
+
+bool RetransmitWheel::Wait() {
+    boost::mutex::scoped_lock lock(m_wheel_);
+    for (; ;) {
+        if (stopped_) {
+            return false;
+        }
+
+        if (count_ == 0) {
+            wake_ = milliseconds::max();
+            cond_variable_.wait(lock);
+        } else {
+            milliseconds due(NextOccupiedTick() * tick_);
+            milliseconds now = Now();
+            if (due <= now) {
+                wake_ = milliseconds::max();
+                return true;
+            }
+            wake_ = due;
+            cond_variable_.wait_for(lock, boost::chrono::milliseconds((due - now).count()));
+        }
+    }
+}
+
+milliseconds RetransmitWheel::NextDeadline() {
+    boost::mutex::scoped_lock lock(m_wheel_);
+    return count_ == 0 ? milliseconds::max() : milliseconds(NextOccupiedTick() * tick_);
+}
+
+void RetransmitWheel::Stop() {
+    boost::mutex::scoped_lock lock(m_wheel_);
+    stopped_ = true;
+    lock.unlock();
+    cond_variable_.notify_all();
+}
+
+void RetransmitWheel::Link(uint32_t handle) {
+    Entry &entry = entries_[handle];
+    uint32_t bucket = (uint32_t) (entry.tick & mask_);
+
+    entry.prev = NIL;
+    entry.next = buckets_[bucket];
+    if (entry.next != NIL) {
+        entries_[entry.next].prev = handle;
+    }
+    buckets_[bucket] = handle;
+    occupied_[bucket >> 6] |= (uint64_t) 1 << (bucket & 63);
+}
+
+void RetransmitWheel::Unlink(uint32_t handle) {
+    Entry &entry = entries_[handle];
+    uint32_t bucket = (uint32_t) (entry.tick & mask_);
+
+    if (entry.prev != NIL) {
+        entries_[entry.prev].next = entry.next;
+    } else {
+        buckets_[bucket] = entry.next;
+    }
+    if (entry.next != NIL) {
+        entries_[entry.next].prev = entry.prev;
+    }
+    if (buckets_[bucket] == NIL) {
+        occupied_[bucket >> 6] &= ~((uint64_t) 1 << (bucket & 63));
+    }
+}
+
+void RetransmitWheel::LinkPeer(Peer &peer, uint32_t handle) {
+    Entry &entry = entries_[handle];
+
+    // Walk back from the newest ticket; uids normally increase so this stops right away
+    uint32_t prev = peer.tail;
+    while (prev != NIL && Before(entry.ticket.uid, entries_[prev].ticket.uid)) {
+        prev = entries_[prev].peer_prev;
+    }
+
+    entry.peer_prev = prev;
+    entry.peer_next = (prev != NIL) ? entries_[prev].peer_next : peer.head;
+    if (entry.peer_next != NIL) {
+        entries_[entry.peer_next].peer_prev = handle;
+    } else {
+        peer.tail = handle;
+    }
+    if (prev != NIL) {
+        entries_[prev].peer_next = handle;
+    } else {
+        peer.head = handle;
+    }
+}
+
+void RetransmitWheel::Release(uint32_t handle) {
+    Entry &entry = entries_[handle];
+    Peer &peer = peers_[entry.peer];
+
+    if (peer.held == handle) {
+        peer.held = entry.peer_next;
+    }
+
+    if (entry.peer_prev != NIL) {
+        entries_[entry.peer_prev].peer_next = entry.peer_next;
+    } else {
+        peer.head = entry.peer_next;
+    }
+    if (entry.peer_next != NIL) {
+        entries_[entry.peer_next].peer_prev = entry.peer_prev;
+    } else {
+        peer.tail = entry.peer_prev;
+    }
+
+    uint32_t *link = &IndexChain(entry.peer, entry.ticket.uid);
+    while (*link != handle) {
+        link = &entries_[*link].index_next;
+    }
+    *link = entry.index_next;
+
+    // Give the payload bytes back to their pool now rather than when the slot is reused
+    entry.ticket.payload.clear();
+    entry.in_use = false;
+    entries_.Free(handle);
+    count_--;
+}
+
+bool RetransmitWheel::Unhold(Peer &peer, uint64_t tick) {
+    bool released = false;
+
+    while (peer.held != NIL &&
+           entries_[peer.held].ticket.uid - entries_[peer.head].ticket.uid < span_) {
+        uint32_t handle = peer.held;
+        Entry &entry = entries_[handle];
+        peer.held = entry.peer_next;
+        entry.held = false;
+        entry.tick = tick;
+        entry.ticket.deadline = milliseconds(tick * tick_);
+        Link(handle);
+        released = true;
+    }
+
+    return released;
+}
+
+uint32_t RetransmitWheel::Find(uint64_t peer, uint32_t uid) {
+    uint32_t handle = IndexChain(peer, uid);
+    while (handle != NIL && (entries_[handle].peer != peer || entries_[handle].ticket.uid != uid)) {
+        handle = entries_[handle].index_next;
+    }
+    return handle;
+}
+
+uint32_t &RetransmitWheel::IndexChain(uint64_t peer, uint32_t uid) {
+    uint64_t hash = (peer * 0x9E3779B97F4A7C15ULL) ^ uid;
+    return index_[(uint32_t) (hash ^ (hash >> 32)) & index_mask_];
+}
+
+uint64_t RetransmitWheel::PeerKey(const sockaddr_in *addr) {
+    return ((uint64_t) addr->sin_addr.s_addr << 16) | addr->sin_port;
+}
+
+bool RetransmitWheel::Before(uint32_t a, uint32_t b) {
+    return (int32_t) (a - b) < 0;
+}
+
+uint64_t RetransmitWheel::NextOccupiedTick() {
+    uint32_t slots = mask_ + 1;
+    uint32_t start = (uint32_t) ((current_tick_ + 1) & mask_);
+
+    for (uint32_t distance = 0; distance < slots;) {
+        uint32_t bucket = (start + distance) & mask_;
+        uint64_t word = occupied_[bucket >> 6] >> (bucket & 63);
+        if (word != 0) {
+            return current_tick_ + 1 + distance + __builtin_ctzll(word);
+        }
+        distance += 64 - (bucket & 63);
+    }
+
+    return UINT64_MAX;
+}
@@ -0,0 +1,85 @@
+/**
+ * Thread-safe per-peer round trip time estimator (Jacobson/Karels).
+ *
+ * Keeps a smoothed RTT and its mean deviation for each receiver and derives the retransmission
+ * timeout from them, so a fast LAN peer is retried quickly while a slow link is not declared
+ * crashed by a timeout tuned for someone else.
+ */
+
+#include "../include/rtt_estimator.h"
+
+#include <algorithm>
+
+RttEstimator::RttEstimator(uint32_t initial, uint32_t min, uint32_t max)
+        : initial_(initial), min_(min), max_(std::max(min, max)) {
+}
+
+RttEstimator::~RttEstimator() {
+
+}
+
+void RttEstimator::Sample(const sockaddr_in *addr, uint32_t rtt) {
+    boost::mutex::scoped_lock lock(m_peers_);
+    auto search = peers_.find(PeerKey(addr));
+
+    if (search == peers_.end()) {
+        // First measurement: SRTT = R, RTTVAR = R / 2
+        Peer peer;
+        peer.stats.addr = *addr;
+        peer.stats.samples = 0;
+        peer.srtt8 = rtt << 3;
+        peer.rttvar4 = rtt << 1;
+        search = peers_.emplace(PeerKey(addr), peer).first;
+    } else {
+        // RTTVAR = 3/4 RTTVAR + 1/4 |SRTT - R|, then SRTT = 7/8 SRTT + 1/8 R (in scaled integers)
+        Peer &peer = search->second;
+        int32_t error = (int32_t) rtt - (int32_t) (peer.srtt8 >> 3);
+        peer.srtt8 += error;
+        if (error < 0) {
+            error = -error;
+        }
+        peer.rttvar4 += error - (int32_t) (peer.rttvar4 >> 2);
+    }
+
+    // RTO = SRTT + max(G, 4 * RTTVAR)
+    Peer &peer = search->second;
+    peer.stats.srtt = peer.srtt8 >> 3;
+    peer.stats.rttvar = peer.rttvar4 >> 2;
+    peer.stats.rto = std::min(std::max(peer.stats.srtt + std::max((uint32_t) CLOCK_GRANULARITY, peer.rttvar4),
+                                       min_), max_);
+    peer.stats.samples++;
+}
+
+uint32_t RttEstimator::GetRto(const sockaddr_in *addr, uint32_t resends) {
+    boost::mutex::scoped_lock lock(m_peers_);
+    auto search = peers_.find(PeerKey(addr));
+    uint64_t rto = (search == peers_.end()) ? initial_ : search->second.stats.rto;
+
+    // Back off exponentially; stop shifting once the cap is reached
+    for (uint32_t i = 0; i < resends && rto < max_; ++i) {
+        rto <<= 1;
+    }
+
+    return (uint32_t) std::min(rto, (uint64_t) max_);
+}
+
+void RttEstimator::Clear(const sockaddr_in *addr) {
+    boost::mutex::scoped_lock lock(m_peers_);
+    peers_.erase(PeerKey(addr));
+}
+
+std::vector<RttEstimator::PeerStats> RttEstimator::GetStats() {
+    boost::mutex::scoped_lock lock(m_peers_);
+    std::vector<PeerStats> stats;
+
+    stats.reserve(peers_.size());
+    for (auto &peer : peers_) {
+        stats.push_back(peer.second.stats);
+    }
+
+    return stats;
+}
+
+uint64_t RttEstimator::PeerKey(const sockaddr_in *addr) {
+    return ((uint64_t) addr->sin_addr.s_addr << 16) | addr->sin_port;
+}
@@ -0,0 +1,149 @@
+/**
+ * Sequencer batch - chat messages the leader packs into one ordered datagram.
+ */
+
+#include "../include/sequencer_batch.h"
+#include "../include/serializer_helper.h"
+
+#include <cstring>
+
+using namespace std;
+
+SequencerBatch::SequencerBatch(uint32_t max_count, uint32_t window)
+        : max_count_(max_count > 0 ? max_count : 1),
+          window_(window),
+          count_(0),
+          length_(0),
+          full_(false) {
+}
+
+bool SequencerBatch::Add(Payload &payload) {
+    if (full_) {
+        return false;
+    }
+
+    string username = payload.GetUsername();
+    string message = payload.GetMessage();
+    uint32_t entry = 2 + (uint32_t) username.size() + (uint32_t) message.size();
+    if (count_ > 0 && length_ + entry >= MAX_MESSAGE_LENGTH) {
+        full_ = true;
+        return false;
+    }
+
+    if (count_ == 0) {
+        first_ = payload;
+        due_ = chrono::steady_clock::now() + window_;
+    }
+    if (length_ + entry < MAX_MESSAGE_LENGTH) {
+        uint8_t *buffer = buffer_ + length_;
+        length_ += SerializerHelper::packu8(buffer, (uint8_t) username.size());
+        memcpy(buffer, username.data(), username.size());
+        buffer += username.size();
+        length_ += (uint32_t) username.size();
+        length_ += SerializerHelper::packu8(buffer, (uint8_t) message.size());
+        memcpy(buffer, message.data(), message.size());
+        length_ += (uint32_t) message.size();
+    } else {
+        // Too long to share a datagram, goes out on its own
+        full_ = true;
+    }
+
+    count_++;
+    if (count_ >= max_count_) {
+        full_ = true;
+    }
+    return true;
+}
+
+bool SequencerBatch::Due() const {
+    return count_ > 0 && (full_ || chrono::steady_clock::now() >= due_);
+}
+
+uint32_t SequencerBatch::GetTimeout(uint32_t max) const {
+    if (count_ == 0) {
+        return max;
+    }
+    if (full_) {
+        return 0;
+    }
+
+    auto left = chrono::duration_cast<chrono::milliseconds>(due_ - chrono::steady_clock::now()).count();
+    if (left <= 0) {
+        return 0;
+    }
+    return left < max ? (uint32_t) left : max;
+}
+
+uint32_t SequencerBatch::Take(int32_t first_order, Payload *payload) {
+    uint32_t count = count_;
+
+    if (count == 1) {
+        *payload = first_;
+    } else {
+        payload->clear();
+        payload->SetType(BATCH_MSG);
+        payload->SetMessage(buffer_, length_);
+    }
+    payload->SetOrder(first_order);
+
+    clear();
+    return count;
+}
+
+void SequencerBatch::clear() {
+    first_.clear();
+    count_ = 0;
+    length_ = 0;
+    full_ = false;
+}
+
+bool SequencerBatch::empty() const {
+    return count_ == 0;
+}
+
+uint32_t SequencerBatch::size() const {
+    return count_;
+}
+
+JamStatus SequencerBatch::Unpack(Payload &batch, vector<Payload> *payloads) {
+    string message = batch.GetMessage();
+    uint8_t *buffer = (uint8_t *) message.data();
+    uint8_t *end = buffer + message.size();
+    int32_t order = batch.GetOrder();
+    size_t first = payloads->size();
+    bool valid = buffer < end;
+
+    while (valid && buffer < end) {
+        uint8_t username_length = SerializerHelper::unpacku8(buffer);
+        if (end - buffer < username_length + 1) {
+            valid = false;
+            break;
+        }
+        string username(buffer, buffer + username_length);
+        buffer += username_length;
+
+        uint8_t message_length = SerializerHelper::unpacku8(buffer);
+        if (end - buffer < message_length) {
+            valid = false;
+            break;
+        }
+
+        Payload payload;
+        payload.SetType(CHAT_MSG);
+        payload.SetOrder(order++);
+        payload.SetAddress(batch.GetAddress());
+        if (payload.SetUsername(username) != SUCCESS || payload.SetMessage(buffer, message_length) != SUCCESS) {
+            valid = false;
+            break;
+        }
+        buffer += message_length;
+        payloads->push_back(payload);
+    }
+
+    if (!valid) {
+        // All or nothing
+        payloads->resize(first);
+        return DECODE_VALIDATION_FAILED;
+    }
+    return SUCCESS;
+}
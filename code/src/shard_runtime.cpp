@@ -0,0 +1,213 @@
+/**
+ * Shard runtime - many chat groups in one process, one pinned thread per core.
+ */
+
+#include "../include/shard_runtime.h"
+
+#include <algorithm>
+#include <memory>
+#include <pthread.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+
+ShardRuntime::ShardRuntime(uint32_t shards)
+        : shards_ready_(0) {
+    uint32_t cores = std::max(boost::thread::hardware_concurrency(), 1u);
+
+    if (shards == 0) {
+        shards = cores;
+    }
+    shards_.resize(shards);
+    for (uint32_t i = 0; i < shards; ++i) {
+        shards_[i].core = (int) (i % cores);
+        shards_[i].stop_fd = eventfd(0, EFD_NONBLOCK);
+        shards_[i].pinned = false;
+        if (shards_[i].stop_fd < 0) {
+            DCERR("ERROR: ShardRuntime - Failed to create stop event");
+        }
+    }
+}
+
+ShardRuntime::~ShardRuntime() {
+    Stop();
+    Join();
+
+    for (Shard &shard : shards_) {
+        if (shard.stop_fd >= 0) {
+            close(shard.stop_fd);
+        }
+    }
+}
+
+void ShardRuntime::set_cores(const std::vector<int> &cores) {
+    for (uint32_t i = 0; i < shards_.size(); ++i) {
+        shards_[i].core = cores.empty() ? UNPINNED : cores[i % cores.size()];
+    }
+}
+
+uint32_t ShardRuntime::AddGroup(const std::string &user_name, const std::string &user_interface,
+                                const std::string &user_port) {
+    uint32_t shard = (uint32_t) (groups_.size() % shards_.size());
+    Group group;
+
+    group.user_name = user_name;
+    group.user_interface = user_interface;
+    group.user_port = user_port;
+    group.addr = {};
+    group.started = false;
+    shards_[shard].groups.push_back((uint32_t) groups_.size());
+    groups_.push_back(group);
+    return shard;
+}
+
+uint32_t ShardRuntime::Start() {
+    uint32_t started = 0;
+
+    for (uint32_t i = 0; i < shards_.size(); ++i) {
+        threads_.create_thread(boost::bind(&ShardRuntime::RunShard, this, i));
+    }
+
+    boost::mutex::scoped_lock lock(m_start_);
+    while (shards_ready_ < shards_.size()) {
+        cv_started_.wait(lock);
+    }
+    for (const Group &group : groups_) {
+        started += group.started ? 1 : 0;
+    }
+    return started;
+}
+
+void ShardRuntime::Stop() {
+    uint64_t one = 1;
+
+    for (Shard &shard : shards_) {
+        if (shard.stop_fd >= 0) {
+            ssize_t ret = write(shard.stop_fd, &one, sizeof(one));
+            (void) ret;
+        }
+    }
+}
+
+void ShardRuntime::Join() {
+    threads_.join_all();
+}
+
+uint32_t ShardRuntime::size() const {
+    return (uint32_t) shards_.size();
+}
+
+bool ShardRuntime::get_group_address(uint32_t group, sockaddr_in *addr) {
+    boost::mutex::scoped_lock lock(m_start_);
+
+    if (group >= groups_.size() || !groups_[group].started) {
+        return false;
+    }
+    *addr = groups_[group].addr;
+    return true;
+}
+
+bool ShardRuntime::is_pinned(uint32_t shard) {
+    boost::mutex::scoped_lock lock(m_start_);
+    return shard < shards_.size() && shards_[shard].pinned;
+}
+
+void ShardRuntime::RunShard(uint32_t index) {
+    Shard &shard = shards_[index];
+    std::vector<std::unique_ptr<JAM>> jams;
+    epoll_event events[REACTOR_MAX_EVENTS];
+    epoll_event event = {};
+    bool pinned = false;
+
+    // Pin before the groups are created, so their memory is first touched from this core
+    if (shard.core != UNPINNED) {
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        CPU_SET(shard.core, &cpus);
+        pinned = pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus) == 0;
+        if (!pinned) {
+            DCERR(("ERROR: ShardRuntime - Failed to pin shard " + std::to_string(index) + " to core " +
+                   std::to_string(shard.core)).c_str());
+        }
+    }
+
+    int epoll_fd = epoll_create1(0);
+    event.events = EPOLLIN;
+    event.data.ptr = NULL;
+    if (epoll_fd < 0 || epoll_ctl(epoll_fd, EPOLL_CTL_ADD, shard.stop_fd, &event) != 0) {
+        DCERR("ERROR: ShardRuntime - Failed to start shard event loop");
+    } else {
+        for (uint32_t group : shard.groups) {
+            Group &spec = groups_[group];
+            std::unique_ptr<JAM> jam(new JAM());
+
+            jam->set_user_input(false);
+            if (!jam->InitLeader(spec.user_name.c_str(), spec.user_interface.c_str(), spec.user_port.c_str())) {
+                continue;
+            }
+
+            // A group's epoll instance turns readable whenever one of its own events is pending
+            event.data.ptr = jam.get();
+            if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, jam->get_event_fd(), &event) != 0) {
+                DCERR("ERROR: ShardRuntime - Failed to add group to shard event loop");
+                continue;
+            }
+            boost::mutex::scoped_lock lock(m_start_);
+            spec.addr = jam->get_self_address();
+            spec.started = true;
+            lock.unlock();
+
+            // First round arms the group's timer
+            jam->RunRound();
+            jams.push_back(std::move(jam));
+        }
+    }
+
+    {
+        boost::mutex::scoped_lock lock(m_start_);
+        shard.pinned = pinned;
+    }
+    MarkReady();
+
+    while (!jams.empty()) {
+        int count = epoll_wait(epoll_fd, events, REACTOR_MAX_EVENTS, -1);
+        if (count < 0 && errno != EINTR) {
+            DCERR("ERROR: ShardRuntime - Failed to wait for events");
+            break;
+        }
+
+        bool stop = false;
+        for (int i = 0; i < count; ++i) {
+            JAM *jam = (JAM *) events[i].data.ptr;
+            if (jam == NULL) {
+                stop = true;
+            } else if (!jam->RunRound()) {
+                // The group left; its epoll instance closes with it
+                for (auto it = jams.begin(); it != jams.end(); ++it) {
+                    if (it->get() == jam) {
+                        jams.erase(it);
+                        break;
+                    }
+                }
+            }
+        }
+
+        // Every group says goodbye to its clients before the shard returns
+        if (stop) {
+            for (std::unique_ptr<JAM> &jam : jams) {
+                jam->Terminate();
+                jam->RunRound();
+            }
+            jams.clear();
+        }
+    }
+
+    if (epoll_fd >= 0) {
+        close(epoll_fd);
+    }
+}
+
+void ShardRuntime::MarkReady() {
+    boost::mutex::scoped_lock lock(m_start_);
+    shards_ready_++;
+    cv_started_.notify_all();
+}
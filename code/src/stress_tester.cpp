@@ -8,7 +8,7 @@
 
 StressTester::StressTester(CentralQueues *queues, int millis, const std::string &fileName) :
         queues_(queues), delay_(millis), fileName_(fileName) {
-    boost::thread(boost::bind(StressTester::Run, this));
+    boost::thread(boost::bind(&StressTester::Run, this));
 }
 
 void StressTester::Run() {
@@ -0,0 +1,292 @@
+/**
+ * UDP backend - the system calls moving datagrams in and out of a socket.
+ */
+
+#include "../include/udp_backend.h"
+#include "../include/config.h"
+
+#include <algorithm>
+#include <string.h>
+#include <netinet/in.h>
+
+UdpBackend::UdpBackend(int fd, bool uring)
+        : fd_(fd)
+#ifdef HAVE_LIBURING
+          , uring_(false), recv_uring_(false), recv_fallback_(false), armed_(false),
+          buf_ring_(NULL), buffer_size_(0)
+#endif
+{
+#ifdef HAVE_LIBURING
+    timeval timeout = {};
+    socklen_t length = sizeof(timeout);
+    if (getsockopt(fd_, SOL_SOCKET, SO_RCVTIMEO, &timeout, &length) != 0) {
+        timeout = {};
+    }
+    timeout_.tv_sec = timeout.tv_sec;
+    timeout_.tv_nsec = timeout.tv_usec * 1000;
+
+    if (!uring) {
+        return;
+    }
+    uring_ = io_uring_queue_init(MAX_BATCH_SIZE, &send_ring_, 0) == 0;
+    if (!uring_) {
+        DCERR("ERROR: UdpBackend - io_uring unavailable, using blocking socket calls");
+    }
+#endif
+}
+
+UdpBackend::~UdpBackend() {
+#ifdef HAVE_LIBURING
+    if (recv_uring_) {
+        io_uring_free_buf_ring(&recv_ring_, buf_ring_, NUM_BUFFERS, BUFFER_GROUP);
+        io_uring_queue_exit(&recv_ring_);
+    }
+    if (uring_) {
+        io_uring_queue_exit(&send_ring_);
+    }
+#endif
+}
+
+int UdpBackend::Receive(msghdr *msgs, int *sizes, uint32_t count) {
+#ifdef HAVE_LIBURING
+    if (uring_ && !recv_fallback_ && (recv_uring_ || InitReceive())) {
+        return ReceiveUring(msgs, sizes, count);
+    }
+#endif
+    return ReceiveSocket(msgs, sizes, count);
+}
+
+uint32_t UdpBackend::Send(msghdr *msgs, bool *sent, uint32_t count) {
+#ifdef HAVE_LIBURING
+    if (uring_) {
+        return SendUring(msgs, sent, count);
+    }
+#endif
+    return SendSocket(msgs, sent, count);
+}
+
+bool UdpBackend::is_uring() const {
+#ifdef HAVE_LIBURING
+    return uring_;
+#else
+    return false;
+#endif
+}
+
+int UdpBackend::ReceiveSocket(msghdr *msgs, int *sizes, uint32_t count) {
+    int received = -1;
+
+#ifdef __linux__
+    if (count > 1) {
+        mmsghdr mmsgs[MAX_BATCH_SIZE];
+
+        memset(mmsgs, 0, sizeof(mmsgs));
+        for (uint32_t i = 0; i < count; ++i) {
+            mmsgs[i].msg_hdr = msgs[i];
+        }
+
+        // Block for the first datagram only, then drain what is already queued in the kernel
+        if ((received = recvmmsg(fd_, mmsgs, count, MSG_WAITFORONE, NULL)) > 0) {
+            for (int i = 0; i < received; ++i) {
+                msgs[i].msg_namelen = mmsgs[i].msg_hdr.msg_namelen;
+                sizes[i] = (int) mmsgs[i].msg_len;
+            }
+        }
+        return received;
+    }
+#endif
+
+    if ((sizes[0] = (int) recvmsg(fd_, &msgs[0], 0)) > 0) {
+        received = 1;
+    }
+    return received;
+}
+
+uint32_t UdpBackend::SendSocket(msghdr *msgs, bool *sent, uint32_t count) {
+    uint32_t calls = 0;
+    uint32_t i = 0;
+
+#ifdef __linux__
+    if (count > 1) {
+        mmsghdr mmsgs[MAX_BATCH_SIZE];
+
+        memset(mmsgs, 0, sizeof(mmsgs));
+        for (uint32_t j = 0; j < count; ++j) {
+            mmsgs[j].msg_hdr = msgs[j];
+        }
+
+        // sendmmsg may stop early; skip over a failing datagram and continue with the rest
+        while (i < count) {
+            uint32_t end = i;
+            while (end < count && mmsgs[end].msg_hdr.msg_iovlen > 0) {
+                end++;
+            }
+            if (end == i) {
+                sent[i++] = false;
+                continue;
+            }
+            int n = sendmmsg(fd_, &mmsgs[i], end - i, 0);
+            calls++;
+            if (n > 0) {
+                for (int j = 0; j < n; ++j) {
+                    sent[i++] = true;
+                }
+            } else {
+                sent[i++] = false;
+            }
+        }
+    }
+#endif
+
+    for (; i < count; ++i) {
+        if (msgs[i].msg_iovlen == 0) {
+            sent[i] = false;
+            continue;
+        }
+        sent[i] = sendmsg(fd_, &msgs[i], 0) >= 0;
+        calls++;
+    }
+    return calls;
+}
+
+#ifdef HAVE_LIBURING
+bool UdpBackend::InitReceive() {
+    int ret = 0;
+
+    // Each buffer gets the recvmsg header and the sender's address ahead of the datagram
+    memset(&recv_msg_, 0, sizeof(recv_msg_));
+    recv_msg_.msg_namelen = sizeof(sockaddr_in);
+    buffer_size_ = (uint32_t) (sizeof(io_uring_recvmsg_out) + sizeof(sockaddr_in) + MAX_BUFFER_LENGTH);
+
+    if (io_uring_queue_init(NUM_BUFFERS, &recv_ring_, 0) != 0) {
+        DCERR("ERROR: UdpBackend - Failed to set up receive ring, using recvmsg");
+        recv_fallback_ = true;
+        return false;
+    }
+    buf_ring_ = io_uring_setup_buf_ring(&recv_ring_, NUM_BUFFERS, BUFFER_GROUP, 0, &ret);
+    if (buf_ring_ == NULL) {
+        DCERR("ERROR: UdpBackend - Failed to register receive buffers, using recvmsg");
+        io_uring_queue_exit(&recv_ring_);
+        recv_fallback_ = true;
+        return false;
+    }
+
+    buffers_.resize((size_t) NUM_BUFFERS * buffer_size_);
+    for (uint16_t bid = 0; bid < NUM_BUFFERS; ++bid) {
+        io_uring_buf_ring_add(buf_ring_, &buffers_[(size_t) bid * buffer_size_], buffer_size_, bid,
+                              io_uring_buf_ring_mask(NUM_BUFFERS), bid);
+    }
+    io_uring_buf_ring_advance(buf_ring_, NUM_BUFFERS);
+    recv_uring_ = true;
+    return true;
+}
+
+bool UdpBackend::Arm() {
+    io_uring_sqe *sqe = io_uring_get_sqe(&recv_ring_);
+
+    if (sqe == NULL) {
+        return false;
+    }
+    io_uring_prep_recvmsg_multishot(sqe, fd_, &recv_msg_, 0);
+    sqe->flags |= IOSQE_BUFFER_SELECT;
+    sqe->buf_group = BUFFER_GROUP;
+    armed_ = io_uring_submit(&recv_ring_) == 1;
+    return armed_;
+}
+
+int UdpBackend::ReceiveUring(msghdr *msgs, int *sizes, uint32_t count) {
+    io_uring_cqe *cqe;
+    unsigned head, seen = 0;
+    uint32_t received = 0;
+    int ret;
+
+    if (!armed_ && !Arm()) {
+        return -1;
+    }
+
+    // Wait for the first completion only; the rest are read straight off the ring
+    if (timeout_.tv_sec > 0 || timeout_.tv_nsec > 0) {
+        ret = io_uring_wait_cqe_timeout(&recv_ring_, &cqe, &timeout_);
+    } else {
+        ret = io_uring_wait_cqe(&recv_ring_, &cqe);
+    }
+    if (ret < 0) {
+        errno = ret == -ETIME ? EAGAIN : -ret;
+        return -1;
+    }
+
+    io_uring_for_each_cqe(&recv_ring_, head, cqe) {
+        if (received == count) {
+            break;
+        }
+        seen++;
+        if (!(cqe->flags & IORING_CQE_F_MORE)) {
+            armed_ = false;                         // Out of buffers or failed; armed again next call
+        }
+        if (cqe->res == -EINVAL) {
+            DCERR("ERROR: UdpBackend - Multishot receive unsupported, using recvmsg");
+            recv_fallback_ = true;
+            continue;
+        }
+        if (cqe->res < 0 || !(cqe->flags & IORING_CQE_F_BUFFER)) {
+            continue;
+        }
+
+        uint16_t bid = (uint16_t) (cqe->flags >> IORING_CQE_BUFFER_SHIFT);
+        uint8_t *buffer = &buffers_[(size_t) bid * buffer_size_];
+        io_uring_recvmsg_out *out = io_uring_recvmsg_validate(buffer, cqe->res, &recv_msg_);
+        if (out != NULL && !(out->flags & MSG_TRUNC)) {
+            uint32_t length = io_uring_recvmsg_payload_length(out, cqe->res, &recv_msg_);
+            if (length <= msgs[received].msg_iov[0].iov_len) {
+                memcpy(msgs[received].msg_iov[0].iov_base, io_uring_recvmsg_payload(out, &recv_msg_), length);
+                msgs[received].msg_namelen = std::min(out->namelen, msgs[received].msg_namelen);
+                memcpy(msgs[received].msg_name, io_uring_recvmsg_name(out), msgs[received].msg_namelen);
+                sizes[received++] = (int) length;
+            }
+        }
+
+        // Give the buffer straight back to the ring
+        io_uring_buf_ring_add(buf_ring_, buffer, buffer_size_, bid, io_uring_buf_ring_mask(NUM_BUFFERS), 0);
+        io_uring_buf_ring_advance(buf_ring_, 1);
+    }
+    io_uring_cq_advance(&recv_ring_, seen);
+
+    if (received == 0) {
+        errno = EAGAIN;
+        return -1;
+    }
+    return (int) received;
+}
+
+uint32_t UdpBackend::SendUring(msghdr *msgs, bool *sent, uint32_t count) {
+    io_uring_cqe *cqe;
+    uint32_t queued = 0;
+
+    for (uint32_t i = 0; i < count; ++i) {
+        sent[i] = false;
+        if (msgs[i].msg_iovlen == 0) {
+            continue;
+        }
+        io_uring_sqe *sqe = io_uring_get_sqe(&send_ring_);
+        io_uring_prep_sendmsg(sqe, fd_, &msgs[i], 0);
+        sqe->user_data = i;
+        queued++;
+    }
+    if (queued == 0) {
+        return 0;
+    }
+
+    // One submission for the batch; the messages must stay put until every send completed
+    if (io_uring_submit_and_wait(&send_ring_, queued) < 0) {
+        return 1;
+    }
+    for (uint32_t done = 0; done < queued; ++done) {
+        if (io_uring_wait_cqe(&send_ring_, &cqe) != 0) {
+            break;
+        }
+        sent[cqe->user_data] = cqe->res >= 0;
+        io_uring_cqe_seen(&send_ring_, cqe);
+    }
+    return 1;
+}
+#endif
@@ -8,31 +8,147 @@
 
 #include "../include/udp_wrapper.h"
 
+#include <random>
+#include <fcntl.h>
+
 using namespace std::chrono;
 
+#if defined(SECURE) && SEAL_DATAGRAMS
+// Cipher contexts per thread; senders, readers and crypto workers each use their own
+static AesGcmCipher &Sealer() {
+    static thread_local AesGcmCipher cipher(aes_key);
+    return cipher;
+}
+
+#define SEAL_OVERHEAD       (AesGcmCipher::NONCE_LENGTH + AesGcmCipher::TAG_LENGTH)
+#endif
+
+// Bind a plain socket to see if anybody holds the port, SO_REUSEPORT groups included
+static bool IsPortFree(const addrinfo *info) {
+    int fd = socket(info->ai_family, info->ai_socktype, info->ai_protocol);
+    bool free = fd >= 0 && bind(fd, info->ai_addr, info->ai_addrlen) == 0;
+
+    if (fd >= 0) {
+        close(fd);
+    }
+    return free;
+}
+
+#ifdef SECURE
+// Workers only help on cores the reader and writer leave spare; a reactor keeps to its own thread
+static uint32_t CryptoWorkers() {
+#ifdef REACTOR
+    return 0;
+#else
+    uint32_t cores = boost::thread::hardware_concurrency();
+    return std::min<uint32_t>(CRYPTO_WORKERS, cores > 1 ? cores - 1 : 0);
+#endif
+}
+#endif
+
+#ifdef REACTOR
+static bool SetNonBlocking(int fd) {
+    int flags = fcntl(fd, F_GETFL);
+    return flags >= 0 && fcntl(fd, F_SETFL, flags | O_NONBLOCK) == 0;
+}
+#endif
+
 
 UdpWrapper::UdpWrapper(CentralQueues *queues)
-        : is_ready_(false), uid_(0), queues_(queues) {
+        : is_ready_(false), queues_(queues), sockfd_(-1), mcast_fd_(-1), mcast_stop_(false),
+          batch_size_(1), reader_count_(1), readers_stop_(false),
+          ack_delay_(ACK_DELAY), ack_threshold_(ACK_COALESCE_THRESHOLD),
+          ack_wheel_(RETRANSMIT_TICK, RETRANSMIT_WHEEL_SLOTS),
+          rtt_(UDP_TIMEOUT, UDP_MIN_TIMEOUT, UDP_MAX_TIMEOUT),
+          received_window_(UDP_RECEIVE_WINDOW),
+          mcast_reassembler_(MAX_REASSEMBLY_BUFFERS, REASSEMBLY_TIMEOUT),
+          pending_acks_(PENDING_ACK_CAPACITY),
+          recv_calls_(0), packets_received_(0),
+          send_calls_(0), packets_sent_(0), acks_sent_(0), acks_piggybacked_(0),
+          multicast_sent_(0), multicast_received_(0), fragments_sent_(0), fragments_received_(0),
+          next_fragment_id_(0), auth_failures_(0)
+#ifdef SECURE
+          , crypto_pool_(CryptoWorkers(), CRYPTO_MIN_BATCH)
+#endif
+#ifdef REACTOR
+          , reassembler_(MAX_REASSEMBLY_BUFFERS, REASSEMBLY_TIMEOUT)
+#endif
+{
+    set_batch_size(UDP_BATCH_SIZE);
+    set_reader_count(UDP_READERS);
+    uid_random_.seed(std::random_device()());
+#ifdef SECURE
+    // Nonces never repeat within a wrapper; the random start keeps wrappers apart
+    std::random_device random;
+    seal_salt_ = random();
+    seal_counter_ = ((uint64_t) random() << 32) | random();
+#endif
 }
 
 UdpWrapper::~UdpWrapper() {
     if (sockfd_ >= 0)
         close(sockfd_);
+    if (mcast_fd_ >= 0)
+        close(mcast_fd_);
+    for (int fd : reader_fds_)
+        close(fd);
 }
 
 JamStatus UdpWrapper::Start(const char *port, uint16_t *bport) {
     JamStatus ret = InitUdpSocket(port, bport);
 
     if (ret == SUCCESS) {
+#ifdef REACTOR
+        // No threads; the caller polls the socket and calls Receive(), Send() and RunTimers()
+        if (!SetNonBlocking(sockfd_)) {
+            DCERR("ERROR: UdpWrapper - Failed to make socket non-blocking");
+        }
+        io_.reset(new UdpBackend(sockfd_, false));
+        in_payloads_.resize(batch_size_);
+        out_payloads_.resize(batch_size_);
+        ack_payloads_.resize(batch_size_);
+        addrs_.resize(batch_size_);
+        sizes_.resize(batch_size_);
+#else
+        InitReaderSockets();
+
         // Start all task threads
-        t_reader_ = boost::thread(boost::bind(&UdpWrapper::RunReader, this));
+        t_reader_ = boost::thread(boost::bind(&UdpWrapper::RunReader, this, sockfd_));
+        for (int fd : reader_fds_) {
+            t_readers_.push_back(boost::thread(boost::bind(&UdpWrapper::RunReader, this, fd)));
+        }
         t_writer_ = boost::thread(boost::bind(&UdpWrapper::RunWriter, this));
         t_monitor_ = boost::thread(boost::bind(&UdpWrapper::RunMonitor, this));
+#endif
     }
 
     return ret;
 }
 
+JamStatus UdpWrapper::StartMulticast(const char *group, const char *port, const sockaddr_in *iface) {
+    JamStatus ret = UDP_NOT_INIT_ERROR;
+
+    if (is_ready_ && mcast_fd_ < 0) {
+        ret = InitMulticastSocket(group, port, iface);
+        if (ret == SUCCESS) {
+#ifdef REACTOR
+            if (!SetNonBlocking(mcast_fd_)) {
+                DCERR("ERROR: UdpWrapper - Failed to make multicast socket non-blocking");
+            }
+            mcast_io_.reset(new UdpBackend(mcast_fd_, false));
+#else
+            t_mcast_reader_ = boost::thread(boost::bind(&UdpWrapper::RunMulticastReader, this));
+#endif
+        }
+    }
+
+    return ret;
+}
+
+bool UdpWrapper::is_multicast_ready() {
+    return mcast_fd_ >= 0;
+}
+
 JamStatus UdpWrapper::Stop() {
     JamStatus ret = SUCCESS;
 
@@ -40,33 +156,77 @@ JamStatus UdpWrapper::Stop() {
         // TODO: properly handle termination
         DCOUT("INFO: UdpWrapper - Initiate termination");
 
+#ifdef REACTOR
+        // Payloads queued last, such as a leave notice, still go out; nothing waits for their ACKs
+        Send();
+        ack_wheel_.Stop();
+        DCOUT("INFO: UdpWrapper - Stopped");
+#else
         // Signal to stop reader/writer threads
         Payload terminate_payload;
-        terminate_payload.SetUid(uid_++);
+        terminate_payload.SetUid(0);
         terminate_payload.SetAddress(&this_addr_);
         terminate_payload.EncodeTerminatePayload();
         out_queue_.push(terminate_payload);
 
-        if (t_reader_.try_join_for(boost::chrono::seconds(TERMINATE_WAIT)) &&
+        mcast_stop_ = true;
+
+        // Whichever reader gets the terminate message stops the others sharing the port
+        bool readers_stopped = t_reader_.try_join_for(boost::chrono::seconds(TERMINATE_WAIT));
+        for (boost::thread &reader : t_readers_) {
+            readers_stopped = readers_stopped && reader.try_join_for(boost::chrono::seconds(TERMINATE_WAIT));
+        }
+
+        if (readers_stopped &&
             t_writer_.try_join_for(boost::chrono::seconds(TERMINATE_WAIT)) &&
-            t_monitor_.try_join_for(boost::chrono::seconds(TERMINATE_WAIT))) {
+            t_monitor_.try_join_for(boost::chrono::seconds(TERMINATE_WAIT)) &&
+            (!t_mcast_reader_.joinable() || t_mcast_reader_.try_join_for(boost::chrono::seconds(TERMINATE_WAIT)))) {
             DCOUT("INFO: UdpWrapper - Stopped");
         } else {
             DCOUT("INFO: UdpWrapper - Threads are still running; exit anyway");
         }
+#endif
+
+        UdpStats stats = GetStats();
+        DCOUT("INFO: UdpWrapper - Received " + std::to_string(stats.packets_received) + " packets in " +
+              std::to_string(stats.recv_calls) + " calls, sent " + std::to_string(stats.packets_sent) +
+              " packets (" + std::to_string(stats.acks_sent) + " ACKs) in " +
+              std::to_string(stats.send_calls) + " calls, piggybacked " +
+              std::to_string(stats.acks_piggybacked) + " ACKs, multicast " +
+              std::to_string(stats.multicast_sent) + " sent/" + std::to_string(stats.multicast_received) +
+              " received, fragments " + std::to_string(stats.fragments_sent) + " sent/" +
+              std::to_string(stats.fragments_received) + " received, " +
+              std::to_string(stats.auth_failures) + " failed verification");
+        for (RttEstimator::PeerStats &peer : GetRttStats()) {
+            DCOUT("INFO: UdpWrapper - Peer port " + u16_to_string(ntohs(peer.addr.sin_port)) +
+                  " srtt = " + u32_to_string(peer.srtt) + " ms, rttvar = " + u32_to_string(peer.rttvar) +
+                  " ms, rto = " + u32_to_string(peer.rto) + " ms");
+        }
     }
 
-    close(sockfd_);
+    if (sockfd_ >= 0) {
+        close(sockfd_);
+        sockfd_ = -1;
+    }
+    for (int fd : reader_fds_) {
+        close(fd);
+    }
+    reader_fds_.clear();
 
     return ret;
 }
 
 void UdpWrapper::Join() {
+#ifndef REACTOR
     if (is_ready_) {
         t_reader_.join();
         t_writer_.join();
         t_monitor_.join();
+        if (t_mcast_reader_.joinable()) {
+            t_mcast_reader_.join();
+        }
     }
+#endif
 }
 
 JamStatus UdpWrapper::SendPayloadSingle(Payload payload,
@@ -75,13 +235,20 @@ JamStatus UdpWrapper::SendPayloadSingle(Payload payload,
 
     if (is_ready_) {
         if (ntohs(addr->sin_port) >= MIN_PORT) {
-            payload.SetUid(uid_++);
-            payload.SetAddress(addr);
-            if (payload.EncodePayload() == SUCCESS) {
-                out_queue_.push(payload);
+            if (payload.NeedsFragments()) {
+                std::vector<Payload> fragments;
+                if ((ret = AddFragments(payload, addr, 1, &fragments)) == SUCCESS) {
+                    out_queue_.push_many(fragments.begin(), fragments.end());
+                }
             } else {
-                ret = ENCODE_VALIDATION_FAILED;
-                DCERR("ERROR: UdpWrapper - Encode validation failed");
+                payload.SetUid(NextUid(addr));
+                payload.SetAddress(addr);
+                if (payload.EncodePayload() == SUCCESS) {
+                    out_queue_.push(payload);
+                } else {
+                    ret = ENCODE_VALIDATION_FAILED;
+                    DCERR("ERROR: UdpWrapper - Encode validation failed");
+                }
             }
         } else {
             ret = ERROR_INVALID_PARAMETERS;
@@ -98,13 +265,20 @@ JamStatus UdpWrapper::SendPayloadSelf(Payload payload) {
     JamStatus ret = SUCCESS;
 
     if (is_ready_) {
-        payload.SetUid(uid_++);
-        payload.SetAddress(&this_addr_);
-        if (payload.EncodePayload() == SUCCESS) {
-            out_queue_.push(payload);
+        if (payload.NeedsFragments()) {
+            std::vector<Payload> fragments;
+            if ((ret = AddFragments(payload, &this_addr_, 1, &fragments)) == SUCCESS) {
+                out_queue_.push_many(fragments.begin(), fragments.end());
+            }
         } else {
-            ret = ENCODE_VALIDATION_FAILED;
-            DCERR("ERROR: UdpWrapper - Encode validation failed");
+            payload.SetUid(NextUid(&this_addr_));
+            payload.SetAddress(&this_addr_);
+            if (payload.EncodePayload() == SUCCESS) {
+                out_queue_.push(payload);
+            } else {
+                ret = ENCODE_VALIDATION_FAILED;
+                DCERR("ERROR: UdpWrapper - Encode validation failed");
+            }
         }
     } else {
         ret = UDP_NOT_INIT_ERROR;
@@ -118,10 +292,47 @@ JamStatus UdpWrapper::SendPayloadList(Payload payload,
     JamStatus ret = SUCCESS;
 
     if (is_ready_) {
+        std::vector<Payload> payloads;
+
         // TODO: port validation
-        for (sockaddr_in addr : *list) {
-            payload.SetUid(uid_++);
-            payload.SetAddress(&addr);
+        if (payload.NeedsFragments()) {
+            if ((ret = AddFragments(payload, list->data(), list->size(), &payloads)) == SUCCESS) {
+                out_queue_.push_many(payloads.begin(), payloads.end());
+            }
+        } else if (payload.EncodePayload() == SUCCESS) {
+            // Encode once; every receiver's copy shares the bytes and only differs in uid and address
+            payloads.reserve(list->size());
+            for (sockaddr_in addr : *list) {
+                payload.SetUid(NextUid(&addr));
+                payload.SetAddress(&addr);
+                payloads.push_back(payload);
+            }
+
+            // Hand the whole fan-out to the writer at once
+            out_queue_.push_many(payloads.begin(), payloads.end());
+        } else {
+            ret = ENCODE_VALIDATION_FAILED;
+            DCERR("ERROR: UdpWrapper - Encode validation failed");
+        }
+    } else {
+        ret = UDP_NOT_INIT_ERROR;
+    }
+
+    return ret;
+}
+
+JamStatus UdpWrapper::SendPayloadMulticast(Payload payload) {
+    JamStatus ret = SUCCESS;
+
+    if (is_ready_ && is_multicast_ready()) {
+        if (payload.NeedsFragments()) {
+            std::vector<Payload> fragments;
+            if ((ret = AddFragments(payload, &mcast_addr_, 1, &fragments)) == SUCCESS) {
+                out_queue_.push_many(fragments.begin(), fragments.end());
+            }
+        } else {
+            payload.SetUid(NextUid(&mcast_addr_));
+            payload.SetAddress(&mcast_addr_);
             if (payload.EncodePayload() == SUCCESS) {
                 out_queue_.push(payload);
             } else {
@@ -136,6 +347,43 @@ JamStatus UdpWrapper::SendPayloadList(Payload payload,
     return ret;
 }
 
+JamStatus UdpWrapper::SendPayloadBatch(std::vector<Payload> *payloads, const sockaddr_in *addr) {
+    JamStatus ret = SUCCESS;
+
+    if (is_ready_) {
+        if (ntohs(addr->sin_port) >= MIN_PORT) {
+            std::vector<Payload> out_payloads;
+
+            // Long messages go out as their fragments in the same place of the batch
+            out_payloads.reserve(payloads->size());
+            for (Payload &payload : *payloads) {
+                if (payload.NeedsFragments()) {
+                    if (AddFragments(payload, addr, 1, &out_payloads) != SUCCESS) {
+                        ret = ENCODE_VALIDATION_FAILED;
+                    }
+                    continue;
+                }
+                payload.SetUid(NextUid(addr));
+                payload.SetAddress(addr);
+                if (payload.EncodePayload() == SUCCESS) {
+                    out_payloads.push_back(payload);
+                } else {
+                    ret = ENCODE_VALIDATION_FAILED;
+                    DCERR("ERROR: UdpWrapper - Encode validation failed");
+                }
+            }
+            out_queue_.push_many(out_payloads.begin(), out_payloads.end());
+        } else {
+            ret = ERROR_INVALID_PARAMETERS;
+            DCERR("ERROR: UdpWrapper - Invalid payload parameters");
+        }
+    } else {
+        ret = UDP_NOT_INIT_ERROR;
+    }
+
+    return ret;
+}
+
 JamStatus UdpWrapper::GetAddressFromInfo(const char *addr,
                                          const char *port,
                                          sockaddr_in *sockaddr) {
@@ -164,12 +412,15 @@ JamStatus UdpWrapper::GetAddressFromInfo(const char *addr,
 }
 
 void UdpWrapper::LeaderRecover(const sockaddr_in *addr) {
-    Payload payload;
+    std::vector<Payload> payloads;
 
-    while (leader_failed_queue_.try_pop(payload)) {
-        DCOUT("INFO: UdpWrapper - Leader Recover for payload uid = " +
-              u32_to_string(payload.GetUid()));
-        SendPayloadSingle(payload, addr);
+    if (leader_failed_queue_.drain_into(payloads)) {
+        for (Payload &payload : payloads) {
+            DCOUT("INFO: UdpWrapper - Leader Recover for payload uid = " +
+                  u32_to_string(payload.GetUid()));
+        }
+        // Readdress everything that failed to the new leader and requeue it in one go
+        SendPayloadBatch(&payloads, addr);
     }
 }
 
@@ -178,16 +429,63 @@ void UdpWrapper::LeaderRecover() {
 }
 
 void UdpWrapper::ClearReceivedHistory(const sockaddr_in *addr) {
-    boost::mutex::scoped_lock lock(m_received_queue_);
-    in_addr_t ip = addr->sin_addr.s_addr;
-    in_port_t port = addr->sin_port;
+    received_window_.Clear(addr->sin_addr.s_addr, addr->sin_port);
+    rtt_.Clear(addr);
+}
 
-    for (auto i = received_queue_.begin(); i != received_queue_.end();) {
-        if (std::get<0>(*i) == ip && std::get<1>(*i) == port)
-            i = received_queue_.erase(i);
-        else
-            ++i;
-    }
+void UdpWrapper::set_batch_size(uint32_t size) {
+#ifdef __linux__
+    batch_size_ = std::max(1u, std::min(size, (uint32_t) MAX_UDP_BATCH_SIZE));
+#else
+    batch_size_ = 1;            // recvmmsg/sendmmsg are Linux only
+#endif
+}
+
+void UdpWrapper::set_reader_count(uint32_t count) {
+#if defined(SO_REUSEPORT) && !defined(REACTOR)
+    reader_count_ = std::max(1u, std::min(count, (uint32_t) MAX_UDP_READERS));
+#else
+    reader_count_ = 1;
+#endif
+}
+
+void UdpWrapper::set_receive_window(uint32_t window) {
+    received_window_.set_window(window);
+    ack_wheel_.set_span(received_window_.get_window());
+}
+
+void UdpWrapper::set_ack_delay(uint32_t delay) {
+    ack_delay_ = delay;
+}
+
+void UdpWrapper::set_ack_threshold(uint32_t count) {
+    ack_threshold_ = std::max(1u, count);
+}
+
+std::vector<RttEstimator::PeerStats> UdpWrapper::GetRttStats() {
+    return rtt_.GetStats();
+}
+
+UdpWrapper::UdpStats UdpWrapper::GetStats() {
+    UdpStats stats;
+    stats.recv_calls = recv_calls_;
+    stats.packets_received = packets_received_;
+    stats.send_calls = send_calls_;
+    stats.packets_sent = packets_sent_;
+    stats.acks_sent = acks_sent_;
+    stats.acks_piggybacked = acks_piggybacked_;
+    stats.multicast_sent = multicast_sent_;
+    stats.multicast_received = multicast_received_;
+    stats.fragments_sent = fragments_sent_;
+    stats.fragments_received = fragments_received_;
+    stats.auth_failures = auth_failures_;
+#ifdef SECURE
+    stats.crypto_batches = crypto_pool_.get_batches();
+#else
+    stats.crypto_batches = 0;
+#endif
+    stats.tickets_pending = ack_wheel_.GetStats().in_use;
+    return stats;
 }
 
 JamStatus UdpWrapper::InitUdpSocket(const char *port, uint16_t *bport) {
@@ -202,12 +500,25 @@ JamStatus UdpWrapper::InitUdpSocket(const char *port, uint16_t *bport) {
     if (getaddrinfo(NULL, port, &hints, &servinfo) == 0) {
         if ((sockfd_ = socket(servinfo->ai_family, servinfo->ai_socktype, servinfo->ai_protocol)) >= 0) {
             uint16_t bind_port = ntohs(((sockaddr_in *) servinfo->ai_addr)->sin_port);
+#ifdef SO_REUSEPORT
+            int on = 1;
+            if (reader_count_ > 1 && setsockopt(sockfd_, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on)) != 0) {
+                DCERR("ERROR: UdpWrapper - Failed to share port, using one reader");
+                reader_count_ = 1;
+            }
+#endif
             for (uint8_t retries = 0; retries < MAX_UDP_BIND_RETRIES; ++retries) {
                 ((sockaddr_in *) servinfo->ai_addr)->sin_port = htons(bind_port);
-                if (bind(sockfd_, servinfo->ai_addr, servinfo->ai_addrlen) == 0) {
+                // A shared port would also let in another wrapper of this user already there
+                if ((reader_count_ == 1 || IsPortFree(servinfo)) &&
+                    bind(sockfd_, servinfo->ai_addr, servinfo->ai_addrlen) == 0) {
                     DCOUT("INFO: UdpWrapper - Socket binds successful at port " +
                           u16_to_string(bind_port));
                     memcpy(&this_addr_, (sockaddr_in *) servinfo->ai_addr, servinfo->ai_addrlen);
+                    // Self payloads are acknowledged from loopback; use it so ACKs match the receiver
+                    if (this_addr_.sin_addr.s_addr == htonl(INADDR_ANY)) {
+                        this_addr_.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+                    }
                     freeaddrinfo(servinfo);
                     is_ready_ = true;
                     *bport = htons(bind_port);
@@ -232,130 +543,799 @@ JamStatus UdpWrapper::InitUdpSocket(const char *port, uint16_t *bport) {
     return ret;
 }
 
-void UdpWrapper::RunReader() {
-    sockaddr_storage clientaddr;
-    socklen_t addrlen = sizeof clientaddr;
-    int size = 0;
+void UdpWrapper::InitReaderSockets() {
+#ifdef SO_REUSEPORT
+    int on = 1;
+    timeval timeout;
+    sockaddr_in addr = this_addr_;
 
-    Payload in_payload;
-    Payload ack_payload;
+    if (reader_count_ == 1) {
+        return;
+    }
 
-    for (; ;) {
-        if ((size = (int) recvfrom(sockfd_, in_payload.payload(), MAX_BUFFER_LENGTH - 1, 0,
-                                   (sockaddr *) &clientaddr, &addrlen)) > 0) {
-            if (size == QUIT_MSG_LENGTH) {
-                break;
-            } else {
-                if (in_payload.DecodePayload() == SUCCESS) {
-                    if (in_payload.GetType() == ACK_MSG) {
-                        DCOUT("INFO: UdpReader - Received ACK message for uid = "
-                              + u32_to_string(in_payload.GetUid()));
-                        ack_tickets_.erase(in_payload.GetUid());
-                    } else {
-                        DCOUT("INFO: UdpReader - Received normal payload");
-                        ack_payload.EncodeAckPayload(in_payload.GetUid(), ACK_OK);
-                        if (sendto(sockfd_, ack_payload.payload(), ack_payload.GetLength(), 0,
-                                   (sockaddr *) &clientaddr, addrlen) < 0) {
-                            DCERR("ERROR: UdpReader - Failed to send ACK payload");
-                        }
-                        if (payload_already_received(((sockaddr_in *) &clientaddr)->sin_addr.s_addr,
-                                                     ((sockaddr_in *) &clientaddr)->sin_port,
-                                                     in_payload.GetUid())) {
-                            DCOUT("INFO: UdpReader - Duplicate payload occurred");
-                        } else {
-                            in_payload.SetAddress((sockaddr_in *) &clientaddr);
-                            in_payload.SetLength((uint32_t) size);
-                            (*queues_).push(CentralQueues::QueueType::UDP_IN, in_payload);
-                        }
-                    }
+    timeout.tv_sec = UDP_READER_TIMEOUT / 1000;
+    timeout.tv_usec = (UDP_READER_TIMEOUT % 1000) * 1000;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    while (reader_fds_.size() + 1 < reader_count_) {
+        int fd = socket(AF_INET, SOCK_DGRAM, 0);
+        if (fd < 0 || setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on)) != 0 ||
+            setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)) != 0 ||
+            bind(fd, (sockaddr *) &addr, sizeof(addr)) != 0) {
+            DCERR("ERROR: UdpWrapper - Failed to open reader socket");
+            if (fd >= 0) {
+                close(fd);
+            }
+            break;
+        }
+        reader_fds_.push_back(fd);
+    }
+
+    if (setsockopt(sockfd_, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)) != 0) {
+        DCERR("ERROR: UdpWrapper - Failed to set reader timeout");
+    }
+    DCOUT("INFO: UdpWrapper - " + std::to_string(reader_fds_.size() + 1) + " readers share port " +
+          u16_to_string(ntohs(this_addr_.sin_port)));
+#endif
+}
+
+JamStatus UdpWrapper::InitMulticastSocket(const char *group, const char *port, const sockaddr_in *iface) {
+    JamStatus ret = SUCCESS;
+    int on = 1;
+    uint8_t loop = 1;                   // Members on this host (including the sender) receive it too
+    uint8_t ttl = MULTICAST_TTL;
+    ip_mreq mreq;
+    timeval timeout;
+
+    memset(&mcast_addr_, 0, sizeof(mcast_addr_));
+    mcast_addr_.sin_family = AF_INET;
+    mcast_addr_.sin_port = htons((uint16_t) strtol(port, NULL, 0));
+    if (inet_pton(AF_INET, group, &mcast_addr_.sin_addr) != 1 || !IN_MULTICAST(ntohl(mcast_addr_.sin_addr.s_addr)) ||
+        ntohs(mcast_addr_.sin_port) < MIN_PORT) {
+        DCERR("ERROR: UdpWrapper - Invalid multicast group");
+        return ERROR_INVALID_PARAMETERS;
+    }
+
+    mreq.imr_multiaddr = mcast_addr_.sin_addr;
+    mreq.imr_interface = iface->sin_addr;
+    timeout.tv_sec = MULTICAST_READ_TIMEOUT / 1000;
+    timeout.tv_usec = (MULTICAST_READ_TIMEOUT % 1000) * 1000;
+
+    if ((mcast_fd_ = socket(AF_INET, SOCK_DGRAM, 0)) >= 0) {
+        // Every client on this host binds the same group port
+        if (setsockopt(mcast_fd_, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on)) == 0 &&
+            bind(mcast_fd_, (sockaddr *) &mcast_addr_, sizeof(mcast_addr_)) == 0 &&
+            setsockopt(mcast_fd_, IPPROTO_IP, IP_ADD_MEMBERSHIP, &mreq, sizeof(mreq)) == 0 &&
+            setsockopt(mcast_fd_, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)) == 0 &&
+            setsockopt(sockfd_, IPPROTO_IP, IP_MULTICAST_IF, &iface->sin_addr, sizeof(in_addr)) == 0 &&
+            setsockopt(sockfd_, IPPROTO_IP, IP_MULTICAST_LOOP, &loop, sizeof(loop)) == 0 &&
+            setsockopt(sockfd_, IPPROTO_IP, IP_MULTICAST_TTL, &ttl, sizeof(ttl)) == 0) {
+            DCOUT("INFO: UdpWrapper - Joined multicast group at port " + u16_to_string(ntohs(mcast_addr_.sin_port)));
+        } else {
+            DCERR("ERROR: UdpWrapper - Failed to join multicast group");
+            close(mcast_fd_);
+            mcast_fd_ = -1;
+            ret = UDP_MULTICAST_ERROR;
+        }
+    } else {
+        DCERR("ERROR: UdpWrapper - Failed to create multicast socket fd");
+        ret = UDP_GET_FD_ERROR;
+    }
+
+    return ret;
+}
+
+#ifndef REACTOR
+void UdpWrapper::RunReader(int fd) {
+    UdpBackend io(fd);
+    Reassembler reassembler(MAX_REASSEMBLY_BUFFERS, REASSEMBLY_TIMEOUT);
+    std::vector<Payload> in_payloads(batch_size_);
+    std::vector<Payload> ack_payloads(batch_size_);
+    std::vector<sockaddr_in> addrs(batch_size_);
+    std::vector<int> sizes(batch_size_);
+    bool terminate = false;
+
+    DCOUT(std::string("INFO: UdpReader - Receiving with ") + (io.is_uring() ? "io_uring" : "socket calls"));
+    while (!terminate && !readers_stop_) {
+        int count = ReceiveDatagrams(io, in_payloads.data(), addrs.data(), sizes.data(), batch_size_);
+        if (count <= 0) {
+            // Readers sharing the port time out to check for termination
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                DCERR("ERROR: UdpReader - Failed to receive packet");
+            }
+            continue;
+        }
+
+        terminate = HandleDatagrams(io, in_payloads.data(), addrs.data(), sizes.data(), (uint32_t) count,
+                                    reassembler, ack_payloads.data());
+    }
+    readers_stop_ = true;
+    if (terminate) {
+        DCOUT("INFO: UdpReader - Received terminate message");
+    }
+}
+
+void UdpWrapper::RunMulticastReader() {
+    UdpBackend io(mcast_fd_);
+    std::vector<Payload> in_payloads(batch_size_);
+    std::vector<sockaddr_in> addrs(batch_size_);
+    std::vector<int> sizes(batch_size_);
+
+    // Group datagrams come from any sender, so there is no self-terminate payload; time out instead
+    while (!mcast_stop_) {
+        int count = ReceiveDatagrams(io, in_payloads.data(), addrs.data(), sizes.data(), batch_size_);
+        if (count > 0) {
+            HandleMulticastDatagrams(in_payloads.data(), addrs.data(), sizes.data(), (uint32_t) count);
+        }
+    }
+    DCOUT("INFO: UdpMulticastReader - Stopped");
+}
+
+void UdpWrapper::RunWriter() {
+    UdpBackend io(sockfd_);
+    std::vector<Payload> payloads(batch_size_);
+    std::vector<Payload> ack_payloads(batch_size_);
+    bool sent[1];
+    Payload terminate_payload;
+    bool terminate = false;
+
+    while (!terminate) {
+        // Block for the first payload (or the next delayed ACK) then take whatever else is already queued
+        uint32_t count = 0;
+        Payload payload;
+        if (WaitForPayload(payload)) {
+            do {
+                if (payload.GetLength() == 0) {
+                    DCERR("ERROR: UdpWriter - Invalid payload");
+                } else if (payload.GetType() == NA && payload.GetLength() == QUIT_MSG_LENGTH) {
+                    terminate_payload = payload;
+                    terminate = true;
+                    break;
+                } else if (payload.GetType() == ACK_MSG) {
+                    // Wake-up from reader; delayed ACKs are flushed below
                 } else {
-                    DCERR("ERROR: UdpReader - Failed to decode payload");
+                    DCOUT("INFO: UdpWriter - Sending payload uid = " + u32_to_string(payload.GetUid()));
+                    payloads[count++] = payload;
                 }
+            } while (count < batch_size_ && out_queue_.try_pop(payload));
+        }
+
+        if (count > 0) {
+            SendPayloads(io, payloads.data(), count);
+        }
+
+        if (!terminate) {
+            FlushAcks(io, ack_payloads.data());
+        }
+    }
+
+    // Stop monitor and send self-terminate payload to reader
+    DCOUT("INFO: UdpWriter - Received terminate message");
+    ack_wheel_.Stop();
+    SendDatagrams(io, &terminate_payload, sent, 1);
+    if (!sent[0]) {
+        DCERR("ERROR: UdpWriter - Failed to send terminate payload");
+    }
+}
+
+void UdpWrapper::RunMonitor() {
+    std::vector<Payload> resend;
+    std::vector<Payload> failed;
+
+    while (ack_wheel_.Wait()) {
+        ExpireTickets(resend, failed);
+    }
+    DCOUT("INFO: UdpMonitor - Received terminate message");
+}
+
+bool UdpWrapper::WaitForPayload(Payload &payload) {
+    milliseconds due = NextAckDue();
+
+    if (due == milliseconds::max()) {
+        out_queue_.pop(payload);
+        return true;
+    }
+
+    milliseconds now = RetransmitWheel::Now();
+    if (due <= now) {
+        return out_queue_.try_pop(payload);
+    }
+    return out_queue_.pop_for(payload, (uint32_t) (due - now).count());
+}
+#else
+std::vector<int> UdpWrapper::get_fds() {
+    std::vector<int> fds;
+
+    if (is_ready_) {
+        fds.push_back(sockfd_);
+    }
+    if (mcast_fd_ >= 0) {
+        fds.push_back(mcast_fd_);
+    }
+    return fds;
+}
+
+void UdpWrapper::Receive(int fd) {
+    bool group = fd == mcast_fd_;
+    UdpBackend &io = group ? *mcast_io_ : *io_;
+
+    for (uint32_t i = 0; i < REACTOR_RECEIVE_BATCHES; ++i) {
+        int count = ReceiveDatagrams(io, in_payloads_.data(), addrs_.data(), sizes_.data(), batch_size_);
+        if (count <= 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                DCERR("ERROR: UdpReader - Failed to receive packet");
             }
+            break;
+        }
+
+        // Nobody sends the self-terminate payload here; Stop() does not need a reader to wake up
+        if (group) {
+            HandleMulticastDatagrams(in_payloads_.data(), addrs_.data(), sizes_.data(), (uint32_t) count);
         } else {
-            DCERR("ERROR: UdpReader - Failed to receive packet");
+            HandleDatagrams(io, in_payloads_.data(), addrs_.data(), sizes_.data(), (uint32_t) count, reassembler_,
+                            ack_payloads_.data());
+        }
+        if ((uint32_t) count < batch_size_) {
+            break;                                  // Socket is drained
         }
     }
-    DCOUT("INFO: UdpReader - Received terminate message");
 }
 
-void UdpWrapper::RunWriter() {
+void UdpWrapper::Send() {
     Payload payload;
+    uint32_t count = 0;
 
-    for (; ;) {
-        out_queue_.pop(payload);
+    if (!is_ready_) {
+        return;
+    }
+
+    while (out_queue_.try_pop(payload)) {
         if (payload.GetLength() == 0) {
             DCERR("ERROR: UdpWriter - Invalid payload");
-        } else if (payload.GetType() == NA && payload.GetLength() == QUIT_MSG_LENGTH) {
-            // Send self-terminate payload and add terminate flag into ack_tickets_
-            DCOUT("INFO: UdpWriter - Received terminate message");
-            ack_tickets_.insert(payload.GetUid(), NUM_UDP_TERMINATE_RETRIES,
-                                std::chrono::duration_cast<std::chrono::milliseconds>
-                                        (std::chrono::system_clock::now().time_since_epoch()),
-                                payload);
-            if (sendto(sockfd_, payload.payload(), payload.GetLength(), 0,
-                       (sockaddr *) payload.GetAddress(), sizeof(sockaddr_in)) < 0) {
-                DCERR("ERROR: UdpWriter - Failed to send terminate payload");
+            continue;
+        }
+        DCOUT("INFO: UdpWriter - Sending payload uid = " + u32_to_string(payload.GetUid()));
+        out_payloads_[count++] = payload;
+        if (count == batch_size_) {
+            SendPayloads(*io_, out_payloads_.data(), count);
+            count = 0;
+        }
+    }
+    if (count > 0) {
+        SendPayloads(*io_, out_payloads_.data(), count);
+    }
+
+    FlushAcks(*io_, ack_payloads_.data());
+}
+
+void UdpWrapper::RunTimers() {
+    std::vector<Payload> resend;
+    std::vector<Payload> failed;
+
+    ExpireTickets(resend, failed);
+}
+
+milliseconds UdpWrapper::NextDeadline() {
+    return std::min(ack_wheel_.NextDeadline(), NextAckDue());
+}
+#endif
+
+bool UdpWrapper::HandleDatagrams(UdpBackend &io, Payload *in_payloads, sockaddr_in *addrs, const int *sizes,
+                                 uint32_t count, Reassembler &reassembler, Payload *ack_payloads) {
+    bool decoded[MAX_UDP_BATCH_SIZE];
+    sockaddr_in ack_addrs[MAX_UDP_BATCH_SIZE];
+    uint32_t ack_counts[MAX_UDP_BATCH_SIZE];
+    uint32_t num_senders = 0;
+    bool terminate = false;
+
+    // Crypto of the whole batch may finish in any order; the rest goes on in arrival order
+    DecodeDatagrams(in_payloads, sizes, decoded, count);
+
+    // Handle the whole batch first then owe one ACK per sender covering all of it
+    for (uint32_t i = 0; i < count; ++i) {
+        if (sizes[i] == QUIT_MSG_LENGTH) {
+            terminate = true;
+        } else if (decoded[i] && ProcessDatagram(in_payloads[i], &addrs[i], reassembler)) {
+            uint32_t j = 0;
+            while (j < num_senders && (ack_addrs[j].sin_addr.s_addr != addrs[i].sin_addr.s_addr ||
+                                       ack_addrs[j].sin_port != addrs[i].sin_port)) {
+                j++;
             }
-            break;
-        } else {
-            DCOUT("INFO: UdpWriter - Sending payload uid = " + u32_to_string(payload.GetUid()));
-            if (sendto(sockfd_, payload.payload(), payload.GetLength(), 0,
-                       (sockaddr *) payload.GetAddress(), sizeof(sockaddr_in)) >= 0) {
-                ack_tickets_.insert(payload.GetUid(), (uint8_t) NUM_UDP_RETRIES,
-                                    duration_cast<milliseconds>(system_clock::now().time_since_epoch()),
-                                    payload);
+            if (j == num_senders) {
+                ack_addrs[num_senders] = addrs[i];
+                ack_counts[num_senders++] = 1;
             } else {
-                DCERR(std::string("ERROR: UdpWriter - Failed to send payload uid = " +
-                                  u32_to_string(payload.GetUid())).c_str());
+                ack_counts[j]++;
+            }
+        }
+    }
+
+    if (ack_delay_ == 0) {
+        SendAcks(io, ack_addrs, num_senders, ack_payloads);
+    } else {
+        for (uint32_t i = 0; i < num_senders; ++i) {
+            ScheduleAck(&ack_addrs[i], ack_counts[i]);
+        }
+    }
+    return terminate;
+}
+
+void UdpWrapper::HandleMulticastDatagrams(Payload *in_payloads, sockaddr_in *addrs, const int *sizes,
+                                          uint32_t count) {
+    bool decoded[MAX_UDP_BATCH_SIZE];
+
+    multicast_received_ += count;
+    DecodeDatagrams(in_payloads, sizes, decoded, count);
+    for (uint32_t i = 0; i < count; ++i) {
+        if (decoded[i]) {
+            ProcessMulticastDatagram(in_payloads[i], &addrs[i]);
+        }
+    }
+}
+
+void UdpWrapper::SendPayloads(UdpBackend &io, Payload *payloads, uint32_t count) {
+    bool sent[MAX_UDP_BATCH_SIZE];
+    bool armed[MAX_UDP_BATCH_SIZE];
+    bool group[MAX_UDP_BATCH_SIZE];
+    bool held;
 
-                // TODO: implement send error handler
+    // Tickets go in before sending so a fast ACK cannot arrive ahead of its ticket.
+    // Resent payloads are still armed by the monitor, so only new tickets are armed here.
+    // Held payloads wait in their tickets; the rest move up to keep the batch contiguous.
+    milliseconds now = RetransmitWheel::Now();
+    uint32_t sending = 0;
+    for (uint32_t i = 0; i < count; ++i) {
+        // Group datagrams are not acknowledged; members ask for lost orders instead
+        group[sending] = IN_MULTICAST(ntohl(payloads[i].GetAddress()->sin_addr.s_addr));
+        armed[sending] = false;
+        if (!group[sending]) {
+            milliseconds deadline = now + milliseconds(rtt_.GetRto(payloads[i].GetAddress(), 0));
+            armed[sending] = ack_wheel_.Arm(payloads[i].GetUid(), (uint8_t) NUM_UDP_RETRIES, deadline,
+                                            payloads[i], &held);
+            if (held) {
+                continue;
             }
+            Piggyback(payloads[i]);
+        }
+        if (sending != i) {
+            payloads[sending] = payloads[i];
+        }
+        sending++;
+    }
+    count = sending;
+    if (count == 0) {
+        return;
+    }
+    SendDatagrams(io, payloads, sent, count);
+    for (uint32_t i = 0; i < count; ++i) {
+        if (sent[i] && group[i]) {
+            multicast_sent_++;
+        } else if (!sent[i]) {
+            DCERR(std::string("ERROR: UdpWriter - Failed to send payload uid = " +
+                              u32_to_string(payloads[i].GetUid())).c_str());
+            if (armed[i]) {
+                ack_wheel_.Cancel(payloads[i].GetAddress(), payloads[i].GetUid());
+            }
+
+            // TODO: implement send error handler
         }
     }
 }
 
-void UdpWrapper::RunMonitor() {
-    for (; ;) {
-        if (!ack_tickets_.is_empty()) {
-            milliseconds current_time = duration_cast<milliseconds>(system_clock::now().time_since_epoch());
-            milliseconds timeout = milliseconds(UDP_TIMEOUT);
-            auto tickets = ack_tickets_.get_all();
-            for (auto ticket : tickets) {
-                if (std::get<1>(ticket) != NUM_UDP_TERMINATE_RETRIES) {
-                    errno = 0;
-                    uint32_t uid = std::get<0>(ticket);
-                    uint8_t num_retries = std::get<1>(ticket);
-                    milliseconds elapsed = current_time - std::get<2>(ticket);
-                    Payload payload = std::get<3>(ticket);
-                    milliseconds max_time = (NUM_UDP_RETRIES - num_retries + 1) * timeout;
-                    if (elapsed >= max_time) {
-                        // Handle timeout
-                        if (num_retries > 0) {
-                            DCERR(std::string("WARNING: UdpMonitor - Retrying for payload uid = " +
-                                              u32_to_string(uid)).c_str());
-                            out_queue_.push(payload);
-                            ack_tickets_.insert_or_assign(uid, --num_retries, std::get<2>(ticket), payload);
-                        } else {
-                            DCERR(std::string("ERROR: UdpMonitor - Timeout for payload uid = " +
-                                              u32_to_string(uid)).c_str());
-                            (*queues_).push(CentralQueues::QueueType::UDP_CRASH, *payload.GetAddress());
-                            ack_tickets_.erase(uid);
-                            // If this is payload that need to send to leader then push to queue for recovering
-                            if (payload.GetType() == CHAT_MSG && payload.GetOrder() == DEFAULT_NO_ORDER) {
-                                leader_failed_queue_.push(payload);
-                            }
-                        }
-                    }
-                } else {
-                    goto exit;
+void UdpWrapper::ExpireTickets(std::vector<Payload> &resend, std::vector<Payload> &failed) {
+    ack_wheel_.Advance(RetransmitWheel::Now(), [this, &resend, &failed](RetransmitWheel::Ticket &ticket) {
+        return HandleAckTimeout(ticket, &resend, &failed);
+    });
+
+    // Push outside of the wheel lock: a full queue must not stall the writer arming tickets
+    for (Payload &payload : resend) {
+        out_queue_.push(payload);
+    }
+    for (Payload &payload : failed) {
+        (*queues_).push(CentralQueues::QueueType::UDP_CRASH, *payload.GetAddress());
+        // If this is payload that need to send to leader then push to queue for recovering
+        if (payload.GetType() == CHAT_MSG && payload.GetOrder() == DEFAULT_NO_ORDER) {
+            leader_failed_queue_.push(payload);
+        }
+    }
+    resend.clear();
+    failed.clear();
+}
+
+bool UdpWrapper::HandleAckTimeout(RetransmitWheel::Ticket &ticket, std::vector<Payload> *resend,
+                                  std::vector<Payload> *failed) {
+    milliseconds now = RetransmitWheel::Now();
+
+    // Held until older payloads were acknowledged; this is its first send
+    if (ticket.unsent) {
+        resend->push_back(ticket.payload);
+        ticket.unsent = false;
+        ticket.sent = now;
+        ticket.deadline = now + milliseconds(rtt_.GetRto(ticket.payload.GetAddress(), 0));
+        return true;
+    }
+
+    // Keep resending with backoff until both the retries and the minimum crash timeout are used up,
+    // so a short RTT does not turn a brief stall into a crash
+    errno = 0;
+    if (ticket.retries > 0 || now - ticket.sent < milliseconds(UDP_MIN_CRASH_TIMEOUT)) {
+        DCERR(std::string("WARNING: UdpMonitor - Retrying for payload uid = " +
+                          u32_to_string(ticket.uid)).c_str());
+        resend->push_back(ticket.payload);
+        if (ticket.retries > 0) {
+            ticket.retries--;
+        }
+        ticket.resends++;
+        ticket.deadline = now + milliseconds(rtt_.GetRto(ticket.payload.GetAddress(), ticket.resends));
+        return true;
+    }
+
+    DCERR(std::string("ERROR: UdpMonitor - Timeout for payload uid = " +
+                      u32_to_string(ticket.uid)).c_str());
+    failed->push_back(ticket.payload);
+    return false;
+}
+
+int UdpWrapper::ReceiveDatagrams(UdpBackend &io, Payload *payloads, sockaddr_in *addrs, int *sizes,
+                                 uint32_t count) {
+    msghdr msgs[MAX_UDP_BATCH_SIZE];
+    iovec iovs[MAX_UDP_BATCH_SIZE];
+
+    memset(msgs, 0, sizeof(msghdr) * count);
+    for (uint32_t i = 0; i < count; ++i) {
+        iovs[i].iov_base = payloads[i].GetReceiveBuffer();
+        iovs[i].iov_len = payloads[i].GetCapacity();
+        msgs[i].msg_name = &addrs[i];
+        msgs[i].msg_namelen = sizeof(sockaddr_in);
+        msgs[i].msg_iov = &iovs[i];
+        msgs[i].msg_iovlen = 1;
+    }
+
+    int received = io.Receive(msgs, sizes, count);
+    if (received > 0) {
+        recv_calls_++;
+        packets_received_ += received;
+    }
+
+    return received;
+}
+
+void UdpWrapper::SendDatagrams(UdpBackend &io, Payload *payloads, bool *sent, uint32_t count) {
+    msghdr msgs[MAX_UDP_BATCH_SIZE];
+    iovec iovs[MAX_UDP_BATCH_SIZE * Payload::MAX_SEGMENTS];
+
+    // Sealed datagrams of this call (secure builds); the writer and a reader without ACK delay both send
+    static thread_local std::vector<uint8_t> buffers(MAX_UDP_BATCH_SIZE * MAX_BUFFER_LENGTH);
+    uint8_t *sealed = buffers.data();
+
+    // Shared payload bytes are gathered by the kernel, so fan-out copies are never flattened here
+    memset(msgs, 0, sizeof(msghdr) * count);
+    auto gather = [&](uint32_t i) {
+        iovec *iov = &iovs[i * Payload::MAX_SEGMENTS];
+        msgs[i].msg_name = payloads[i].GetAddress();
+        msgs[i].msg_namelen = sizeof(sockaddr_in);
+        msgs[i].msg_iov = iov;
+        msgs[i].msg_iovlen = (size_t) GetDatagramIovec(payloads[i], iov, sealed + i * MAX_BUFFER_LENGTH);
+    };
+    RunCrypto(count, std::ref(gather));
+
+    send_calls_ += io.Send(msgs, sent, count);
+    for (uint32_t i = 0; i < count; ++i) {
+        if (sent[i]) {
+            packets_sent_++;
+        }
+    }
+}
+
+int UdpWrapper::GetDatagramIovec(Payload &payload, iovec *iov, uint8_t *buffer) {
+#if defined(SECURE) && SEAL_DATAGRAMS
+    if (payload.GetType() == NA) {
+        return payload.GetIovec(iov);
+    }
+
+    uint8_t *data = buffer + AesGcmCipher::NONCE_LENGTH;
+    iovec segments[Payload::MAX_SEGMENTS];
+    int count = payload.GetIovec(segments);
+    size_t length = 0;
+    for (int i = 0; i < count; ++i) {
+        if (length + segments[i].iov_len + SEAL_OVERHEAD > MAX_BUFFER_LENGTH) {
+            DCERR("ERROR: UdpWriter - Payload too long to seal");
+            return 0;
+        }
+        memcpy(data + length, segments[i].iov_base, segments[i].iov_len);
+        length += segments[i].iov_len;
+    }
+
+    // Nonce is sent in the clear; the receiver only needs the key
+    uint64_t counter = seal_counter_++;
+    memcpy(buffer, &seal_salt_, sizeof(seal_salt_));
+    memcpy(buffer + sizeof(seal_salt_), &counter, sizeof(counter));
+    if (!Sealer().Seal(buffer, data, (uint32_t) length, data + length)) {
+        DCERR("ERROR: UdpWriter - Failed to seal payload");
+        return 0;
+    }
+    iov[0].iov_base = buffer;
+    iov[0].iov_len = length + SEAL_OVERHEAD;
+    return 1;
+#else
+    return payload.GetIovec(iov);
+#endif
+}
+
+bool UdpWrapper::OpenDatagram(Payload &in_payload, int *size) {
+#if defined(SECURE) && SEAL_DATAGRAMS
+    // Forged or corrupted datagrams go no further than here
+    uint8_t *bytes = in_payload.GetReceiveBuffer();
+    uint32_t length = (uint32_t) *size - SEAL_OVERHEAD;
+    if (*size <= SEAL_OVERHEAD ||
+        !Sealer().Open(bytes, bytes + AesGcmCipher::NONCE_LENGTH, length,
+                       bytes + AesGcmCipher::NONCE_LENGTH + length)) {
+        auth_failures_++;
+        DCOUT("WARNING: UdpWrapper - Dropped datagram failing verification");
+        return false;
+    }
+    memmove(bytes, bytes + AesGcmCipher::NONCE_LENGTH, length);
+    *size = (int) length;
+#endif
+    return true;
+}
+
+void UdpWrapper::RunCrypto(uint32_t count, const std::function<void(uint32_t)> &task) {
+#ifdef SECURE
+    crypto_pool_.Run(count, task);
+#else
+    for (uint32_t i = 0; i < count; ++i) {
+        task(i);
+    }
+#endif
+}
+
+void UdpWrapper::DecodeDatagrams(Payload *in_payloads, const int *sizes, bool *decoded, uint32_t count) {
+    auto open = [&](uint32_t i) {
+        int size = sizes[i];
+        decoded[i] = false;
+        if (size == QUIT_MSG_LENGTH || !OpenDatagram(in_payloads[i], &size)) {
+            return;
+        }
+        in_payloads[i].SetLength((uint32_t) size);
+        if (in_payloads[i].DecodePayload() != SUCCESS) {
+            DCERR("ERROR: UdpReader - Failed to decode payload");
+            return;
+        }
+        decoded[i] = true;
+    };
+    RunCrypto(count, std::ref(open));
+}
+
+bool UdpWrapper::ProcessDatagram(Payload &in_payload, sockaddr_in *addr, Reassembler &reassembler) {
+    if (in_payload.HasAck()) {
+        milliseconds sent;
+        uint32_t retired = ack_wheel_.Retire(addr, in_payload.GetAckNext(), in_payload.GetAckRanges(),
+                                             in_payload.GetAckRangeCount(), &sent);
+        if (sent > milliseconds::zero()) {
+            rtt_.Sample(addr, (uint32_t) (RetransmitWheel::Now() - sent).count());
+        }
+        DCOUT("INFO: UdpReader - Received ACK below uid = " + u32_to_string(in_payload.GetAckNext()) +
+              " retiring " + u32_to_string(retired) + " tickets");
+    }
+
+    if (in_payload.GetType() == ACK_MSG) {
+        return false;
+    }
+
+    DCOUT("INFO: UdpReader - Received normal payload");
+    // A fragment is marked, and so acknowledged, only with the rest of its message. Until then a
+    // partial message the reassembler gives up on is still resent.
+    bool fragment = in_payload.GetFragmentCount() != 0;
+    if (fragment ? received_window_.Check(addr->sin_addr.s_addr, addr->sin_port, in_payload.GetUid()) :
+        received_window_.CheckAndMark(addr->sin_addr.s_addr, addr->sin_port, in_payload.GetUid())) {
+        DCOUT("INFO: UdpReader - Duplicate payload occurred");
+    } else {
+        in_payload.SetAddress(addr);
+        if (!fragment) {
+            (*queues_).push(CentralQueues::QueueType::UDP_IN, in_payload);
+        } else {
+            Payload message;
+            std::vector<uint32_t> uids;
+            fragments_received_++;
+            if (reassembler.Add(in_payload, &message, &uids)) {
+                DCOUT("INFO: UdpReader - Reassembled message of " + u32_to_string(message.GetMessageLength()) +
+                      " bytes");
+                for (uint32_t uid : uids) {
+                    received_window_.CheckAndMark(addr->sin_addr.s_addr, addr->sin_port, uid);
                 }
+                (*queues_).push(CentralQueues::QueueType::UDP_IN, message);
             }
         }
-        boost::this_thread::sleep(boost::posix_time::seconds(ACK_MONITOR_INTERVAL));
+        // Hand the bytes over so JAM can modify them without a copy; the next receive takes new ones
+        in_payload.clear();
     }
-    exit:
-    DCOUT("INFO: UdpMonitor - Received terminate message");
+    return true;
+}
+
+void UdpWrapper::ProcessMulticastDatagram(Payload &in_payload, sockaddr_in *addr) {
+    if (in_payload.GetType() == ACK_MSG || in_payload.GetType() == NA) {
+        return;
+    }
+
+    DCOUT("INFO: UdpMulticastReader - Received group payload order = " + std::to_string(in_payload.GetOrder()));
+    in_payload.SetAddress(addr);
+    if (in_payload.GetFragmentCount() == 0) {
+        (*queues_).push(CentralQueues::QueueType::UDP_IN, in_payload);
+    } else {
+        Payload message;
+        fragments_received_++;
+        if (mcast_reassembler_.Add(in_payload, &message)) {
+            (*queues_).push(CentralQueues::QueueType::UDP_IN, message);
+        }
+    }
+    in_payload.clear();
+}
+
+uint32_t UdpWrapper::NextUid(const sockaddr_in *addr) {
+    uint64_t key = ((uint64_t) addr->sin_addr.s_addr << 16) | addr->sin_port;
+    boost::mutex::scoped_lock lock(m_next_uid_);
+    auto search = next_uid_.find(key);
+
+    if (search == next_uid_.end()) {
+        uint32_t start = (uint32_t) uid_random_() & ~(received_window_.get_window() - 1);
+        search = next_uid_.emplace(key, start).first;
+    }
+    return search->second++;
+}
+
+JamStatus UdpWrapper::AddFragments(Payload &payload, const sockaddr_in *addrs, size_t count,
+                                   std::vector<Payload> *out) {
+    std::vector<Payload> fragments;
+
+    if (payload.Fragment(next_fragment_id_++, &fragments) != SUCCESS) {
+        DCERR("ERROR: UdpWrapper - Encode validation failed");
+        return ENCODE_VALIDATION_FAILED;
+    }
+
+    // Fragments are encoded once; every receiver's copies share the bytes
+    out->reserve(out->size() + fragments.size() * count);
+    for (size_t i = 0; i < count; ++i) {
+        for (Payload &fragment : fragments) {
+            fragment.SetUid(NextUid(&addrs[i]));
+            fragment.SetAddress(&addrs[i]);
+            out->push_back(fragment);
+        }
+    }
+    fragments_sent_ += fragments.size() * count;
+    DCOUT("INFO: UdpWrapper - Split message into " + u32_to_string((uint32_t) fragments.size()) + " fragments");
+
+    return SUCCESS;
+}
+
+void UdpWrapper::SendAcks(UdpBackend &io, const sockaddr_in *addrs, uint32_t count, Payload *ack_payloads) {
+    AckRange ranges[MAX_SACK_RANGES];
+    bool sent[MAX_UDP_BATCH_SIZE];
+    uint32_t num_acks = 0;
+
+    for (uint32_t i = 0; i < count; ++i) {
+        uint32_t next;
+        uint8_t num_ranges = MAX_SACK_RANGES;
+        if (received_window_.BuildAck(addrs[i].sin_addr.s_addr, addrs[i].sin_port, &next, ranges, &num_ranges)) {
+            ack_payloads[num_acks].EncodeAckPayload(next, ranges, num_ranges);
+            ack_payloads[num_acks].SetAddress(&addrs[i]);
+            num_acks++;
+        }
+    }
+
+    if (num_acks > 0) {
+        SendDatagrams(io, ack_payloads, sent, num_acks);
+        for (uint32_t i = 0; i < num_acks; ++i) {
+            if (sent[i]) {
+                acks_sent_++;
+            } else {
+                DCERR("ERROR: UdpWrapper - Failed to send ACK payload");
+            }
+        }
+    }
+}
+
+void UdpWrapper::ScheduleAck(const sockaddr_in *addr, uint32_t count) {
+    boost::mutex::scoped_lock lock(m_pending_acks_);
+    bool wake = acks_owed_.empty();                 // Writer is blocked without deadline
+    uint64_t key = ((uint64_t) addr->sin_addr.s_addr << 16) | addr->sin_port;
+    auto search = pending_index_.find(key);
+
+    if (search == pending_index_.end()) {
+        // First ACK owed to this sender; its entry is reused from now on
+        uint32_t handle = pending_acks_.Allocate();
+        pending_acks_[handle].addr = *addr;
+        pending_acks_[handle].count = 0;
+        pending_acks_[handle].position = NOT_OWED;
+        search = pending_index_.emplace(key, handle).first;
+    }
+
+    PendingAck &pending = pending_acks_[search->second];
+    if (pending.position == NOT_OWED) {
+        pending.position = (uint32_t) acks_owed_.size();
+        acks_owed_.push_back(search->second);
+        pending.count = 0;
+        pending.due = RetransmitWheel::Now() + milliseconds(ack_delay_);
+    }
+    pending.count += count;
+    if (pending.count >= ack_threshold_ && pending.due > milliseconds::zero()) {
+        pending.due = milliseconds::zero();
+        wake = true;
+    }
+    lock.unlock();
+
+#ifndef REACTOR
+    if (wake) {
+        Payload wake_payload;
+        wake_payload.EncodeAckPayload(0, NULL, 0);
+        out_queue_.push(wake_payload);
+    }
+#endif
+}
+
+void UdpWrapper::Unowe(uint32_t handle) {
+    uint32_t position = pending_acks_[handle].position;
+    uint32_t last = acks_owed_.back();
+
+    acks_owed_[position] = last;
+    pending_acks_[last].position = position;
+    acks_owed_.pop_back();
+    pending_acks_[handle].position = NOT_OWED;
+}
+
+void UdpWrapper::Piggyback(Payload &payload) {
+    if (ack_delay_ == 0) {
+        return;
+    }
+
+    boost::mutex::scoped_lock lock(m_pending_acks_);
+    sockaddr_in *addr = payload.GetAddress();
+    auto search = pending_index_.find(((uint64_t) addr->sin_addr.s_addr << 16) | addr->sin_port);
+    if (search == pending_index_.end() || pending_acks_[search->second].position == NOT_OWED) {
+        return;
+    }
+    Unowe(search->second);
+    lock.unlock();
+
+    AckRange ranges[MAX_SACK_RANGES];
+    uint32_t next;
+    uint8_t num_ranges = MAX_SACK_RANGES;
+    if (received_window_.BuildAck(addr->sin_addr.s_addr, addr->sin_port, &next, ranges, &num_ranges) &&
+        payload.AttachAck(next, ranges, num_ranges) == SUCCESS) {
+        acks_piggybacked_++;
+    }
+}
+
+void UdpWrapper::FlushAcks(UdpBackend &io, Payload *ack_payloads) {
+    sockaddr_in addrs[MAX_UDP_BATCH_SIZE];
+    uint32_t count;
+
+    do {
+        boost::mutex::scoped_lock lock(m_pending_acks_);
+        milliseconds now = RetransmitWheel::Now();
+        count = 0;
+        for (size_t i = 0; i < acks_owed_.size() && count < batch_size_;) {
+            PendingAck &pending = pending_acks_[acks_owed_[i]];
+            if (pending.due <= now) {
+                addrs[count++] = pending.addr;
+                Unowe(acks_owed_[i]);               // Brings the last owed one to i
+            } else {
+                ++i;
+            }
+        }
+        lock.unlock();
+
+        SendAcks(io, addrs, count, ack_payloads);
+    } while (count == batch_size_);
+}
+
+milliseconds UdpWrapper::NextAckDue() {
+    milliseconds due = milliseconds::max();
+
+    boost::mutex::scoped_lock lock(m_pending_acks_);
+    for (uint32_t handle : acks_owed_) {
+        due = std::min(due, pending_acks_[handle].due);
+    }
+    return due;
 }
 
 std::string UdpWrapper::u16_to_string(uint16_t in) {
@@ -375,20 +1355,3 @@ std::string UdpWrapper::u32_to_string(uint32_t in) {
 
     return str;
 }
-
-bool UdpWrapper::payload_already_received(in_addr_t ip,
-                                          in_port_t port,
-                                          uint32_t uid) {
-    boost::mutex::scoped_lock lock(m_received_queue_);
-    for (auto log : received_queue_) {
-        if (std::get<0>(log) == ip && std::get<1>(log) == port && std::get<2>(log) == uid) {
-            return true;
-        }
-    }
-
-    // Entry is not exists in the log
-    received_queue_.push_front(std::make_tuple(ip, port, uid));
-    if (received_queue_.size() > UDP_RECEIVER_QUEUE_SIZE)
-        received_queue_.pop_back();
-    return false;
-}
\ No newline at end of file
@@ -10,34 +10,51 @@ UserHandler::UserHandler(CentralQueues *queues) :
     FD_ZERO(&activeFdSet_);
     FD_SET(STDIN_FILENO, &activeFdSet_);
 
+#ifndef REACTOR
     pipe(incomingFd_);
     FD_SET(incomingFd_[0], &activeFdSet_);
+#endif
 }
 
 
 UserHandler::~UserHandler() {
     FD_ZERO(&activeFdSet_);
 
+#ifndef REACTOR
     // Clean up the pipes
     close(incomingFd_[0]);
     close(incomingFd_[1]);
+#endif
 }
 
 void UserHandler::Start() {
+#ifndef REACTOR
     t_run_ = boost::thread(boost::bind(&UserHandler::HandleInput, this));
+#endif
 }
 
-int UserHandler::get_write_pipe() {
-    return incomingFd_[1];
+void UserHandler::set_input(bool enabled) {
+    if (enabled) {
+        FD_SET(STDIN_FILENO, &activeFdSet_);
+    } else {
+        FD_CLR(STDIN_FILENO, &activeFdSet_);
+    }
+}
+
+void UserHandler::Deliver(const std::string &sender, const std::string &message) {
+#ifdef REACTOR
+    incoming_.emplace_back(sender, message);
+#else
+    StreamCommunicator::SendMessage(incomingFd_[1], sender, message);
+#endif
 }
 
 void UserHandler::WaitOnEnd() {
     t_run_.join();
 }
 
+#ifndef REACTOR
 void UserHandler::HandleInput() {
-    std::string data;
-
     while (true) {
         readFdSet_ = activeFdSet_;
 
@@ -48,33 +65,58 @@ void UserHandler::HandleInput() {
 
         // Figure out which fd has been set
         if (FD_ISSET(STDIN_FILENO, &readFdSet_)) {
-
-            // grab the input from the command line and write it to the pipe
-            getline(std::cin, data);
-
-            if (std::cin.eof() || data == TERMINATE_MESSAGE) {
-                DCOUT("INFO: UserHandler - exit captured");
-                queues_->signal_terminate();
+            if (!HandleUserInput()) {
                 break;
             }
+        } else if (FD_ISSET(incomingFd_[0], &readFdSet_)) {
+            HandleIncoming();
+        }
+    }
+}
+#endif
 
-            if (data.length() < MAX_MESSAGE_LENGTH) {
-                Payload payload;
-                payload.SetType(MessageType::CHAT_MSG);
-                payload.SetMessage(data);
-                queues_->push(CentralQueues::QueueType::USER_OUT, payload);
-            } else {
-                std::cout << "NOTICE - Message length exceeds maximum. This message is discarded: " <<
-                data << std::endl;
-            }
+bool UserHandler::HandleUserInput() {
+    std::string data;
 
-        } else if (FD_ISSET(incomingFd_[0], &readFdSet_)) {
-            std::string username = StreamCommunicator::ListenForData(incomingFd_[0]);
-            std::string message = StreamCommunicator::ListenForData(incomingFd_[0]);
+    // grab the input from the command line and write it to the pipe
+    getline(std::cin, data);
 
-            PrintMessage(username, message);
-        }
+    if (std::cin.eof() || data == TERMINATE_MESSAGE) {
+        DCOUT("INFO: UserHandler - exit captured");
+        queues_->signal_terminate();
+        return false;
+    }
+
+    // Long messages are sent in fragments
+    if (data.length() <= MAX_FRAGMENTED_LENGTH) {
+        Payload payload;
+        payload.SetType(MessageType::CHAT_MSG);
+        payload.SetMessage(data);
+        queues_->push(CentralQueues::QueueType::USER_OUT, payload);
+    } else {
+        std::cout << "NOTICE - Message length exceeds maximum. This message is discarded: " <<
+        data << std::endl;
+    }
+    return true;
+}
+
+void UserHandler::HandleIncoming() {
+#ifdef REACTOR
+    for (const auto &incoming : incoming_) {
+        PrintMessage(incoming.first, incoming.second);
+    }
+    incoming_.clear();
+#else
+    pollfd fd = {incomingFd_[0], POLLIN, 0};
+
+    // Messages are written whole, so a readable pipe holds at least one
+    while (poll(&fd, 1, 0) > 0) {
+        std::string username = StreamCommunicator::ListenForData(incomingFd_[0]);
+        std::string message = StreamCommunicator::ListenForData(incomingFd_[0]);
+
+        PrintMessage(username, message);
     }
+#endif
 }
 
 void UserHandler::PrintMessage(const std::string &sender, const std::string &message) {
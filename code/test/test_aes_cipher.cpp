@@ -0,0 +1,275 @@
+/**
+ * Test program for AesCipher
+ *
+ * Checks the prepared cipher gives the same bytes as the AES_cbc_encrypt() code it replaces, so
+ * secure clients of either build still talk, then compares the per-packet cost of both. Also
+ * checks sealed datagrams: forged or altered ones never reach the queues, and sealing costs
+ * less than the secure payload encode it comes on top of.
+ */
+
+#define OPENSSL_SUPPRESS_DEPRECATED     // Legacy AES calls are kept here to compare against
+
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+
+#include <boost/thread.hpp>
+
+#include <arpa/inet.h>
+
+#include "../include/udp_wrapper.h"
+#include "../include/aes_cipher.h"
+#include "test_check.h"
+
+using namespace std;
+
+#define NUM_PACKETS         200000
+#define NUM_THREADS         4
+#define BENCH_LENGTH        64      // Typical chat message
+#define NUM_BURST           100
+
+// Per-packet code before AesCipher: key schedule, then the cipher
+static void LegacyEncrypt(const uint8_t *in, uint8_t *out, uint32_t length) {
+    unsigned char iv[AES_BLOCK_SIZE] = {};
+    AES_KEY enc_key;
+    AES_set_encrypt_key(aes_key, sizeof(aes_key) * 8, &enc_key);
+    AES_cbc_encrypt(in, out, length, &enc_key, iv, AES_ENCRYPT);
+}
+
+static void LegacyDecrypt(const uint8_t *in, uint8_t *out, uint32_t length) {
+    unsigned char iv[AES_BLOCK_SIZE] = {};
+    AES_KEY dec_key;
+    AES_set_decrypt_key(aes_key, sizeof(aes_key) * 8, &dec_key);
+    AES_cbc_encrypt(in, out, length, &dec_key, iv, AES_DECRYPT);
+}
+
+static uint32_t Blocks(uint32_t length) {
+    return (length + AES_BLOCK_SIZE - 1) / AES_BLOCK_SIZE * AES_BLOCK_SIZE;
+}
+
+// Wait for the next incoming payload of a wrapper
+static bool Receive(CentralQueues &queues, Payload *payload) {
+    for (int i = 0; i < 5; ++i) {
+        queues.take_ready();
+        if (queues.try_pop_udp_in(*payload)) {
+            return true;
+        }
+        queues.wait_for_data(100);
+    }
+    return false;
+}
+
+// Nanoseconds per call of f over NUM_PACKETS calls
+template<typename F>
+static double Time(F f) {
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    for (uint32_t i = 0; i < NUM_PACKETS; ++i) {
+        f(i);
+    }
+    return chrono::duration<double, nano>(chrono::steady_clock::now() - start).count() / NUM_PACKETS;
+}
+
+int main() {
+    AesCipher encryptor(aes_key, true), decryptor(aes_key, false);
+    uint8_t plain[MAX_MESSAGE_LENGTH], legacy[MAX_MESSAGE_LENGTH], cached[MAX_MESSAGE_LENGTH];
+    for (uint32_t i = 0; i < MAX_MESSAGE_LENGTH; ++i) {
+        plain[i] = (uint8_t) (i * 7 + 3);
+    }
+
+    // Same bytes as before for every message length, and back again
+    cout << "--- Compatibility test ---" << endl;
+    for (uint32_t length = 1; length < MAX_MESSAGE_LENGTH; ++length) {
+        uint32_t blocks = Blocks(length);
+        memset(legacy, 0, sizeof(legacy));
+        memset(cached, 0, sizeof(cached));
+        LegacyEncrypt(plain, legacy, length);
+        memcpy(cached, plain, length);
+        CHECK(encryptor.Process(cached, cached, blocks), "encrypt in place");
+        CHECK(memcmp(legacy, cached, blocks) == 0, "same ciphertext at length " + to_string(length));
+        CHECK(decryptor.Process(cached, legacy, blocks) && memcmp(legacy, plain, length) == 0,
+              "decrypt at length " + to_string(length));
+    }
+    CHECK(!encryptor.Process(plain, cached, 10), "partial block rejected");
+
+    // Payloads encrypt and decrypt from any thread, each with its own contexts
+    cout << "--- Payload test ---" << endl;
+    bool ok[NUM_THREADS];
+    boost::thread_group threads;
+    for (int t = 0; t < NUM_THREADS; ++t) {
+        ok[t] = true;
+        threads.create_thread([t, &ok]() {
+            Payload payload;
+            payload.SetType(CHAT_MSG);
+            payload.SetUsername("Dummy" + to_string(t));
+            for (uint32_t i = 0; i < 2000 && ok[t]; ++i) {
+                string message = "Message " + to_string(t) + " " + string(i % 200, 'x');
+                ok[t] = payload.SetMessage(message) == SUCCESS && payload.GetMessage() == message;
+            }
+        });
+    }
+    threads.join_all();
+    for (int t = 0; t < NUM_THREADS; ++t) {
+        CHECK(ok[t], "round trip in thread " + to_string(t));
+    }
+
+    // Per-packet cost with and without the key schedule
+    cout << "--- Benchmark ---" << endl;
+    uint32_t blocks = Blocks(BENCH_LENGTH);
+    double legacy_encrypt = Time([&](uint32_t i) {
+        plain[0] = (uint8_t) i;
+        LegacyEncrypt(plain, legacy, BENCH_LENGTH);
+    });
+    double legacy_decrypt = Time([&](uint32_t i) {
+        legacy[0] = (uint8_t) i;
+        LegacyDecrypt(legacy, cached, blocks);
+    });
+    double cached_encrypt = Time([&](uint32_t i) {
+        plain[0] = (uint8_t) i;
+        encryptor.Process(plain, legacy, blocks);
+    });
+    double cached_decrypt = Time([&](uint32_t i) {
+        legacy[0] = (uint8_t) i;
+        decryptor.Process(legacy, cached, blocks);
+    });
+    Payload payload;
+    payload.SetType(CHAT_MSG);
+    payload.SetUsername("Dummy1");
+    string message(BENCH_LENGTH, 'm');
+    double payload_round_trip = Time([&](uint32_t i) {
+        message[0] = (char) ('a' + i % 26);
+        payload.SetMessage(message);
+        payload.GetMessage();
+    });
+
+    cout << fixed << setprecision(1);
+    cout << "ns/packet (" << BENCH_LENGTH << " bytes)   Encrypt   Decrypt" << endl;
+    cout << "AES_cbc_encrypt        " << setw(10) << legacy_encrypt << setw(10) << legacy_decrypt << endl;
+    cout << "AesCipher              " << setw(10) << cached_encrypt << setw(10) << cached_decrypt << endl;
+    cout << "Payload set + get      " << setw(20) << payload_round_trip << endl;
+    CHECK(cached_encrypt + cached_decrypt < legacy_encrypt + legacy_decrypt, "prepared context is faster");
+
+    // Sealed datagrams open only unaltered and with the nonce they were sealed under
+    cout << "--- Seal test ---" << endl;
+    AesGcmCipher sealer(aes_key), opener(aes_key);
+    uint8_t nonce[AesGcmCipher::NONCE_LENGTH] = {1, 2, 3}, tag[AesGcmCipher::TAG_LENGTH];
+    uint8_t sealed[MAX_BUFFER_LENGTH];
+    for (uint32_t length = 0; length < MAX_MESSAGE_LENGTH; length += 17) {
+        memcpy(sealed, plain, length);
+        CHECK(sealer.Seal(nonce, sealed, length, tag), "seal at length " + to_string(length));
+        CHECK(length == 0 || memcmp(sealed, plain, length) != 0, "sealed bytes differ");
+        CHECK(opener.Open(nonce, sealed, length, tag) && memcmp(sealed, plain, length) == 0,
+              "open at length " + to_string(length));
+    }
+    // Open decrypts in place even when it fails, so each try gets a fresh copy
+    memcpy(legacy, plain, BENCH_LENGTH);
+    CHECK(sealer.Seal(nonce, legacy, BENCH_LENGTH, tag), "seal");
+    memcpy(sealed, legacy, BENCH_LENGTH);
+    sealed[5] ^= 1;
+    CHECK(!opener.Open(nonce, sealed, BENCH_LENGTH, tag), "altered byte rejected");
+    memcpy(sealed, legacy, BENCH_LENGTH);
+    nonce[0]++;
+    CHECK(!opener.Open(nonce, sealed, BENCH_LENGTH, tag), "other nonce rejected");
+    memcpy(sealed, legacy, BENCH_LENGTH);
+    nonce[0]--;
+    CHECK(opener.Open(nonce, sealed, BENCH_LENGTH, tag) && memcmp(sealed, plain, BENCH_LENGTH) == 0,
+          "unaltered opens");
+
+    // Only sealed datagrams from a key holder are queued
+    cout << "--- Datagram test ---" << endl;
+    CentralQueues sender_queues, receiver_queues;
+    UdpWrapper sender(&sender_queues), receiver(&receiver_queues);
+    uint16_t sender_port, receiver_port;
+    CHECK(sender.Start("9450", &sender_port) == SUCCESS && receiver.Start("9450", &receiver_port) == SUCCESS,
+          "start");
+    sockaddr_in receiver_addr = {};
+    receiver_addr.sin_family = AF_INET;
+    receiver_addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    receiver_addr.sin_port = receiver_port;
+
+    Payload chat, received;
+    chat.SetType(CHAT_MSG);
+    chat.SetUsername("Dummy1");
+    chat.SetMessage("Sealed message");
+    chat.SetOrder(5);
+    CHECK(chat.EncodePayload() == SUCCESS, "encode");
+    vector<sockaddr_in> list(1, receiver_addr);
+    CHECK(sender.SendPayloadList(chat, &list) == SUCCESS, "send");
+    CHECK(Receive(receiver_queues, &received) && received.GetMessage() == "Sealed message" &&
+          received.GetOrder() == 5, "sealed payload delivered");
+
+    // Copies for every receiver share the message encrypted once; only their seals differ
+    Payload copy = chat;
+    iovec chat_iov[Payload::MAX_SEGMENTS], copy_iov[Payload::MAX_SEGMENTS];
+    copy.SetUid(chat.GetUid() + 1);
+    chat.GetIovec(chat_iov);
+    copy.GetIovec(copy_iov);
+    CHECK(chat_iov[1].iov_base == copy_iov[1].iov_base, "fan-out copies share the ciphertext");
+
+    // Bursts are opened in batches, possibly on the crypto workers, and still arrive in order
+    for (uint32_t i = 0; i < NUM_BURST; ++i) {
+        chat.SetMessage("Burst " + to_string(i));
+        CHECK(sender.SendPayloadList(chat, &list) == SUCCESS, "send burst");
+    }
+    for (uint32_t i = 0; i < NUM_BURST; ++i) {
+        CHECK(Receive(receiver_queues, &received) && received.GetMessage() == "Burst " + to_string(i),
+              "burst payload " + to_string(i) + " in order");
+    }
+
+    // Raw datagrams: encoded but not sealed, sealed then altered, sealed under another key
+    iovec iov[Payload::MAX_SEGMENTS];
+    uint32_t length = 0;
+    for (int i = 0, count = chat.GetIovec(iov); i < count; ++i) {
+        memcpy(sealed + AesGcmCipher::NONCE_LENGTH + length, iov[i].iov_base, iov[i].iov_len);
+        length += (uint32_t) iov[i].iov_len;
+    }
+    memcpy(sealed, nonce, sizeof(nonce));
+    uint8_t *data = sealed + AesGcmCipher::NONCE_LENGTH;
+    uint32_t total = length + AesGcmCipher::NONCE_LENGTH + AesGcmCipher::TAG_LENGTH;
+    int sockfd = socket(AF_INET, SOCK_DGRAM, 0);
+    CHECK(sockfd >= 0, "raw socket");
+    CHECK(sendto(sockfd, data, length, 0, (sockaddr *) &receiver_addr, sizeof(receiver_addr)) == length,
+          "send unsealed");
+    CHECK(sealer.Seal(nonce, data, length, data + length), "seal raw");
+    sealed[AesGcmCipher::NONCE_LENGTH + 2] ^= 0x40;
+    CHECK(sendto(sockfd, sealed, total, 0, (sockaddr *) &receiver_addr, sizeof(receiver_addr)) == total,
+          "send altered");
+    unsigned char other_key[32] = {};
+    AesGcmCipher forger(other_key);
+    memcpy(data, chat.GetMessage().data(), 8);
+    CHECK(forger.Seal(nonce, data, length, data + length), "seal under other key");
+    CHECK(sendto(sockfd, sealed, total, 0, (sockaddr *) &receiver_addr, sizeof(receiver_addr)) == total,
+          "send forged");
+    close(sockfd);
+    CHECK(!Receive(receiver_queues, &received), "nothing queued");
+    UdpWrapper::UdpStats stats = receiver.GetStats();
+    cout << "Receiver dropped " << stats.auth_failures << " of " << stats.packets_received << " datagrams, " <<
+    stats.crypto_batches << " batches on crypto workers" << endl;
+    CHECK(stats.auth_failures == 3 && stats.packets_received == 4 + NUM_BURST, "failures counted");
+    sender.Stop();
+    receiver.Stop();
+
+    // Sealing comes on top of the secure encode of every datagram
+    cout << "--- Seal benchmark ---" << endl;
+    chat.SetMessage(message);
+    chat.EncodePayload();
+    length = (uint32_t) chat.GetLength();
+    double encode = Time([&](uint32_t i) {
+        message[0] = (char) ('a' + i % 26);
+        chat.SetMessage(message);
+        chat.EncodePayload();
+    });
+    double seal = Time([&](uint32_t i) {
+        memcpy(nonce, &i, sizeof(i));
+        sealer.Seal(nonce, sealed, length, tag);
+    });
+    double open = Time([&](uint32_t i) {
+        memcpy(nonce, &i, sizeof(i));
+        opener.Open(nonce, sealed, length, tag);
+    });
+    cout << "ns/datagram (" << length << " bytes)   Encode      Seal      Open" << endl;
+    cout << "Payload secure encode  " << setw(10) << encode << endl;
+    cout << "AesGcmCipher           " << setw(20) << seal << setw(10) << open << endl;
+
+    cout << "All tests passed" << endl;
+    return 0;
+}
@@ -0,0 +1,66 @@
+/**
+ * Test program for CentralQueues mailbox
+ */
+
+#include <iostream>
+#include <chrono>
+#include "boost/thread.hpp"
+
+#include "../include/central_queues.h"
+#include "test_check.h"
+
+using namespace std;
+
+int main() {
+    CentralQueues queues;
+    Payload payload;
+    sockaddr_in addr = {};
+
+    // Nothing pushed: wait honours its timeout
+    cout << "--- Timeout test ---" << endl;
+    auto start = chrono::steady_clock::now();
+    CHECK(!queues.wait_for_data(50), "empty mailbox times out");
+    CHECK(chrono::steady_clock::now() - start >= chrono::milliseconds(40), "waited for timeout");
+    CHECK(queues.take_ready() == 0, "nothing ready");
+
+    // Each push marks its own queue until taken
+    cout << "--- Ready mask test ---" << endl;
+    payload.SetType(CHAT_MSG);
+    queues.push(CentralQueues::QueueType::UDP_IN, payload);
+    queues.push(CentralQueues::QueueType::UDP_CRASH, addr);
+    CHECK(queues.wait_for_data(0), "ready without waiting");
+    uint32_t ready = queues.take_ready();
+    CHECK(ready == (CentralQueues::queue_bit(CentralQueues::QueueType::UDP_IN) |
+                    CentralQueues::queue_bit(CentralQueues::QueueType::UDP_CRASH)), "both queues marked");
+    CHECK(queues.take_ready() == 0, "take clears mask");
+
+    // A drain that hits its limit keeps the queue marked
+    cout << "--- Drain test ---" << endl;
+    std::vector<Payload> payloads;
+    std::vector<sockaddr_in> addrs;
+    queues.push(CentralQueues::QueueType::UDP_IN, payload);
+    queues.take_ready();
+    CHECK(queues.drain_udp_in(payloads, 1) && payloads.size() == 1, "drain bounded by max");
+    CHECK(queues.take_ready() == CentralQueues::queue_bit(CentralQueues::QueueType::UDP_IN), "remarked at max");
+    CHECK(queues.drain_udp_in(payloads, 8) && payloads.size() == 2, "drain rest");
+    CHECK(queues.take_ready() == 0, "not remarked below max");
+    CHECK(queues.drain_udp_crash(addrs, 8) && addrs.size() == 1, "drain crash");
+
+    // A push or terminate from another thread wakes the waiter early
+    cout << "--- Wake-up test ---" << endl;
+    boost::thread producer([&queues, &payload]() {
+        boost::this_thread::sleep_for(boost::chrono::milliseconds(20));
+        queues.push(CentralQueues::QueueType::LEADER_OUT, payload);
+        boost::this_thread::sleep_for(boost::chrono::milliseconds(20));
+        queues.signal_terminate();
+    });
+    start = chrono::steady_clock::now();
+    CHECK(queues.wait_for_data(5000), "woken by push");
+    CHECK(queues.take_ready() == CentralQueues::queue_bit(CentralQueues::QueueType::LEADER_OUT), "leader out marked");
+    CHECK(queues.wait_for_data(5000) && queues.is_terminate(), "woken by terminate");
+    CHECK(chrono::steady_clock::now() - start < chrono::milliseconds(1000), "woken early");
+    producer.join();
+
+    cout << "All tests passed" << endl;
+    return 0;
+}
@@ -0,0 +1,12 @@
+/**
+ * Check shared by the test programs: prints the failed check and makes main() return 1
+ */
+
+#ifndef JAM_TEST_CHECK_H
+#define JAM_TEST_CHECK_H
+
+#include <iostream>
+
+#define CHECK(cond, msg) do { if (!(cond)) { std::cout << "FAILED: " << msg << std::endl; return 1; } } while (false)
+
+#endif //JAM_TEST_CHECK_H
@@ -0,0 +1,128 @@
+/**
+ * Test program for CryptoPool
+ *
+ * Checks every index of a batch runs exactly once whichever thread takes it, that concurrent
+ * callers never mix their batches, then compares opening sealed datagrams inline and on the pool.
+ */
+
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <vector>
+
+#include <boost/thread.hpp>
+
+#include "../include/crypto_pool.h"
+#include "../include/payload_secure.h"
+#include "../include/aes_cipher.h"
+#include "test_check.h"
+
+using namespace std;
+
+#define BATCH_SIZE          64
+#define NUM_BATCHES         5000
+#define DATAGRAM_LENGTH     104     // Sealed chat payload of a short message
+
+static AesGcmCipher &Cipher() {
+    static thread_local AesGcmCipher cipher(aes_key);
+    return cipher;
+}
+
+// Run a batch writing each index into its own slot; TRUE if every slot was written once
+static bool RunBatch(CryptoPool &pool, uint32_t count) {
+    vector<uint32_t> slots(count, 0);
+    pool.Run(count, [&](uint32_t i) {
+        slots[i] += i + 1;
+    });
+    for (uint32_t i = 0; i < count; ++i) {
+        if (slots[i] != i + 1) {
+            return false;
+        }
+    }
+    return true;
+}
+
+int main() {
+    CryptoPool pool(3, 4), inline_pool(0, 4);
+
+    // Every index once, small batches stay with the caller
+    cout << "--- Batch test ---" << endl;
+    CHECK(pool.size() == 3 && inline_pool.size() == 0, "worker count");
+    for (uint32_t count : {0, 1, 3}) {
+        CHECK(RunBatch(pool, count), "small batch of " + to_string(count));
+    }
+    CHECK(pool.get_batches() == 0, "small batches run inline");
+    for (uint32_t count : {4, 64, 1000}) {
+        CHECK(RunBatch(pool, count), "batch of " + to_string(count));
+        CHECK(RunBatch(inline_pool, count), "inline batch of " + to_string(count));
+    }
+    CHECK(pool.get_batches() == 3 && inline_pool.get_batches() == 0, "shared batches counted");
+
+    // Batches handed out back to back never see each other's task
+    for (uint32_t i = 0; i < 2000; ++i) {
+        CHECK(RunBatch(pool, 4 + i % 60), "batch " + to_string(i));
+    }
+
+    // Two callers at once; whoever finds the workers busy runs inline
+    cout << "--- Concurrency test ---" << endl;
+    bool ok[2] = {true, true};
+    boost::thread_group callers;
+    for (int t = 0; t < 2; ++t) {
+        callers.create_thread([t, &ok, &pool]() {
+            for (uint32_t i = 0; i < 2000 && ok[t]; ++i) {
+                ok[t] = RunBatch(pool, 4 + (i * 7 + t) % 100);
+            }
+        });
+    }
+    callers.join_all();
+    CHECK(ok[0] && ok[1], "concurrent callers");
+
+    // Sealed datagrams opened on any thread come back in batch order
+    cout << "--- Open test ---" << endl;
+    vector<vector<uint8_t>> sealed(BATCH_SIZE, vector<uint8_t>(DATAGRAM_LENGTH + AesGcmCipher::TAG_LENGTH));
+    vector<vector<uint8_t>> opened(BATCH_SIZE);
+    uint8_t nonces[BATCH_SIZE][AesGcmCipher::NONCE_LENGTH] = {};
+    for (uint32_t i = 0; i < BATCH_SIZE; ++i) {
+        nonces[i][0] = (uint8_t) i;
+        for (uint32_t j = 0; j < DATAGRAM_LENGTH; ++j) {
+            sealed[i][j] = (uint8_t) (i + j);
+        }
+        CHECK(Cipher().Seal(nonces[i], sealed[i].data(), DATAGRAM_LENGTH, sealed[i].data() + DATAGRAM_LENGTH),
+              "seal");
+    }
+    bool authentic[BATCH_SIZE];
+    auto open = [&](uint32_t i) {
+        opened[i] = sealed[i];
+        authentic[i] = Cipher().Open(nonces[i], opened[i].data(), DATAGRAM_LENGTH,
+                                     opened[i].data() + DATAGRAM_LENGTH);
+    };
+    pool.Run(BATCH_SIZE, open);
+    for (uint32_t i = 0; i < BATCH_SIZE; ++i) {
+        CHECK(authentic[i] && opened[i][0] == (uint8_t) i && opened[i][1] == (uint8_t) (i + 1),
+              "datagram " + to_string(i) + " in place");
+    }
+
+    // Per datagram cost; the pool only pays off with spare cores
+    cout << "--- Benchmark ---" << endl;
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    for (uint32_t i = 0; i < NUM_BATCHES; ++i) {
+        inline_pool.Run(BATCH_SIZE, open);
+    }
+    double inline_cost = chrono::duration<double, nano>(chrono::steady_clock::now() - start).count() /
+                         (NUM_BATCHES * BATCH_SIZE);
+    start = chrono::steady_clock::now();
+    for (uint32_t i = 0; i < NUM_BATCHES; ++i) {
+        pool.Run(BATCH_SIZE, open);
+    }
+    double pool_cost = chrono::duration<double, nano>(chrono::steady_clock::now() - start).count() /
+                       (NUM_BATCHES * BATCH_SIZE);
+
+    cout << fixed << setprecision(1);
+    cout << "ns/datagram (" << BATCH_SIZE << " per batch, " << boost::thread::hardware_concurrency() <<
+    " cores)" << endl;
+    cout << "Open inline            " << setw(10) << inline_cost << endl;
+    cout << "Open on " << pool.size() << " workers + caller" << setw(9) << pool_cost << endl;
+
+    cout << "All tests passed" << endl;
+    return 0;
+}
@@ -13,7 +13,7 @@ int main() {
     HoldQueue holdQueue(&queues);
 
     userHandler.Start();
-    holdQueue.SetUserHandlerPipe(userHandler.get_write_pipe());
+    holdQueue.SetUserHandler(&userHandler);
 
     // Construct payload
     Payload payload;
@@ -138,5 +138,106 @@ int main() {
 
     // Wait
     getchar();
+
+    // Missing ranges test: 2 is already delivered above, 3-8 are missing, 15 is a gap of its own
+    cout << "--- Missing ranges test ---" << endl;
+
+    payload.SetUsername("Dummy16");
+    payload.SetMessage("Message 16");
+    payload.SetOrder(16);
+    holdQueue.AddMessageToQueue(payload);
+
+    OrderRange ranges[MAX_MISSING_RANGES];
+    size_t count = holdQueue.GetMissingRanges(ranges, MAX_MISSING_RANGES);
+    for (size_t i = 0; i < count; ++i) {
+        cout << "Missing " << ranges[i].start << " to " << ranges[i].end - 1 << endl;
+    }
+    if (count != 2 || ranges[0].start != 2 || ranges[0].end != 9 || ranges[1].start != 15 || ranges[1].end != 16) {
+        cout << "FAILED: missing ranges" << endl;
+        return 1;
+    }
+
+    // Old and duplicate payloads are ignored, history keeps only delivered orders
+    payload.SetOrder(1);
+    holdQueue.AddMessageToQueue(payload);
+    payload.SetOrder(16);
+    holdQueue.AddMessageToQueue(payload);
+    if (!holdQueue.GetPayloadInHistory(1, &lost_payload) || holdQueue.GetPayloadInHistory(16, &lost_payload)) {
+        cout << "FAILED: history lookup" << endl;
+        return 1;
+    }
+
+    // NACK test: ranges survive encoding and pick every delivered payload they cover
+    cout << "--- NACK test ---" << endl;
+
+    uint8_t buffer[MAX_MESSAGE_LENGTH];
+    OrderRange decoded[MAX_MISSING_RANGES];
+    size_t decoded_count;
+    uint32_t length = HoldQueue::EncodeRanges(buffer, ranges, count);
+    if (HoldQueue::DecodeRanges(buffer, length, decoded, MAX_MISSING_RANGES, &decoded_count) != SUCCESS ||
+        decoded_count != count || decoded[1].start != 15 || decoded[1].end != 16 ||
+        HoldQueue::DecodeRanges(buffer, length - 1, decoded, MAX_MISSING_RANGES, &decoded_count) == SUCCESS) {
+        cout << "FAILED: range encoding" << endl;
+        return 1;
+    }
+
+    std::vector<Payload> found;
+    OrderRange delivered = {0, 4};
+    if (holdQueue.GetPayloadsInHistory(&delivered, 1, &found) != 2 || found[1].GetOrder() != 1) {
+        cout << "FAILED: payloads in history" << endl;
+        return 1;
+    }
+    for (Payload &history : found) {
+        cout << "Replay " << history.GetOrder() << " " << history.GetUsername().c_str() << endl;
+    }
+
+    // Latest order test: a ping from the leader ahead of everything received reveals a lost tail
+    cout << "--- Latest order test ---" << endl;
+
+    std::vector<int32_t> requests;
+    queues.drain_history_request(requests, JAM_DRAIN_BATCH);
+    requests.clear();
+    holdQueue.NoteLatestOrder(18);
+    count = holdQueue.GetMissingRanges(ranges, MAX_MISSING_RANGES);
+    if (!queues.drain_history_request(requests, JAM_DRAIN_BATCH) || requests.size() != 1 || requests[0] != 2 ||
+        count != 3 || ranges[2].start != 17 || ranges[2].end != 19) {
+        cout << "FAILED: latest order" << endl;
+        return 1;
+    }
+    holdQueue.NoteLatestOrder(1);
+    if (queues.drain_history_request(requests, JAM_DRAIN_BATCH)) {
+        cout << "FAILED: old latest order" << endl;
+        return 1;
+    }
+
+    // Batch test: every message of a batch is held before any is delivered, filling the gap before 3
+    cout << "--- Batch test ---" << endl;
+
+    holdQueue.ClearQueue();
+    payload.SetUsername("Dummy4");
+    payload.SetMessage("Message 4");
+    payload.SetOrder(3);
+    holdQueue.AddMessageToQueue(payload);
+
+    SequencerBatch batch(SEQUENCER_BATCH_SIZE, 0);
+    for (int i = 1; i <= 3; ++i) {
+        payload.SetUsername("Dummy" + to_string(i));
+        payload.SetMessage("Message " + to_string(i));
+        payload.SetOrder(DEFAULT_NO_ORDER);
+        batch.Add(payload);
+    }
+    Payload batch_payload;
+    int32_t last_order = DEFAULT_NO_ORDER;
+    if (batch.Take(0, &batch_payload) != 3 || !holdQueue.AddBatchToQueue(batch_payload, &last_order) ||
+        last_order != 2 || !holdQueue.GetPayloadInHistory(3, &lost_payload) ||
+        !holdQueue.GetPayloadInHistory(1, &lost_payload) || lost_payload.GetUsername() != "Dummy2") {
+        cout << "FAILED: batch delivery" << endl;
+        return 1;
+    }
+    if (holdQueue.AddBatchToQueue(batch_payload, &last_order)) {
+        cout << "FAILED: duplicate batch" << endl;
+        return 1;
+    }
+
     return 0;
 }
\ No newline at end of file
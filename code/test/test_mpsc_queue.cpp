@@ -0,0 +1,126 @@
+/**
+ * Test program for MpscQueue (and the bulk API shared with ConcurrentQueue)
+ */
+
+#include <iostream>
+#include <atomic>
+#include <vector>
+#include "boost/thread.hpp"
+
+#include "../include/mpsc_queue.h"
+#include "test_check.h"
+
+using namespace std;
+
+#define NUM_PRODUCERS   4
+#define NUM_PER_PRODUCER 100000
+
+int main() {
+    // Values from each producer must arrive complete and in their push order
+    cout << "--- Multi-producer test ---" << endl;
+    {
+        MpscQueue<uint64_t> queue(64);
+        std::vector<boost::thread> producers;
+        for (uint64_t p = 0; p < NUM_PRODUCERS; ++p) {
+            producers.emplace_back([&queue, p]() {
+                for (uint64_t i = 0; i < NUM_PER_PRODUCER; ++i) {
+                    queue.push((p << 32) | i);
+                }
+            });
+        }
+
+        uint64_t next[NUM_PRODUCERS] = {0};
+        uint64_t batch[32];
+        uint64_t total = 0;
+        while (total < NUM_PRODUCERS * NUM_PER_PRODUCER) {
+            size_t count = queue.try_pop_many(batch, 32);
+            if (count == 0) {
+                CHECK(queue.pop_for(batch[0], 1000), "producers stalled");
+                count = 1;
+            }
+            for (size_t i = 0; i < count; ++i) {
+                uint64_t p = batch[i] >> 32;
+                CHECK(p < NUM_PRODUCERS && (batch[i] & 0xFFFFFFFF) == next[p], "order per producer");
+                next[p]++;
+            }
+            total += count;
+        }
+        for (boost::thread &producer : producers) {
+            producer.join();
+        }
+        CHECK(queue.is_empty(), "drained");
+    }
+
+    // Empty queue times out, and a blocked consumer is woken by a push
+    cout << "--- Blocking test ---" << endl;
+    {
+        MpscQueue<int> queue(8);
+        int value = 0;
+        CHECK(!queue.try_pop(value), "empty try_pop");
+        CHECK(!queue.pop_for(value, 20), "empty pop_for times out");
+
+        boost::thread producer([&queue]() {
+            boost::this_thread::sleep_for(boost::chrono::milliseconds(50));
+            queue.push(7);
+        });
+        queue.pop(value);
+        producer.join();
+        CHECK(value == 7, "pop woken by push");
+    }
+
+    // A full queue holds producers back until the consumer frees a slot
+    cout << "--- Full queue test ---" << endl;
+    {
+        MpscQueue<int> queue(4);
+        std::atomic<bool> pushed(false);
+        for (int i = 0; i < 4; ++i) {
+            queue.push(i);
+        }
+        CHECK(queue.size() == 4, "filled");
+
+        boost::thread producer([&queue, &pushed]() {
+            queue.push(4);
+            pushed = true;
+        });
+        boost::this_thread::sleep_for(boost::chrono::milliseconds(50));
+        CHECK(!pushed, "push waits while full");
+
+        int values[8];
+        size_t count = queue.try_pop_many(values, 2);
+        CHECK(count == 2 && values[0] == 0 && values[1] == 1, "try_pop_many returns oldest");
+        producer.join();
+        count = queue.try_pop_many(values, 8);
+        CHECK(count == 3 && values[0] == 2 && values[2] == 4, "waiting push completed");
+    }
+
+    // Bulk push and drain behave the same on both queue variants
+    cout << "--- Bulk test ---" << endl;
+    {
+        MpscQueue<int> queue(4);
+        ConcurrentQueue<int> locked_queue;
+        std::vector<int> in = {1, 2, 3, 4, 5, 6};
+        std::vector<int> out;
+
+        // More than the capacity: the producer must wake the consumer before waiting for space
+        boost::thread producer([&queue, &in]() {
+            queue.push_many(in.begin(), in.end());
+        });
+        while (out.size() < in.size()) {
+            int value;
+            CHECK(queue.pop_for(value, 1000), "bulk push wakes consumer");
+            out.push_back(value);
+            queue.drain_into(out);
+        }
+        producer.join();
+        CHECK(out == in, "bulk push keeps order");
+
+        out.clear();
+        locked_queue.push_many(in.begin(), in.end());
+        CHECK(locked_queue.drain_into(out, 4) == 4 && out.size() == 4 && out[3] == 4, "drain bounded by max");
+        CHECK(locked_queue.drain_into(out) == 2 && out == in, "drain the rest");
+        CHECK(locked_queue.is_empty(), "locked queue drained");
+    }
+
+    cout << "All tests passed" << endl;
+    return 0;
+}
@@ -0,0 +1,226 @@
+/**
+ * Test program for shared payload bytes (PayloadBuffer)
+ */
+
+#include <iostream>
+#include <cstring>
+#include <vector>
+#include "boost/thread.hpp"
+
+#ifdef SECURE
+#include "../include/payload_secure.h"
+#else
+#include "../include/payload.h"
+#include "test_check.h"
+#endif
+
+using namespace std;
+
+// Flatten payload segments into a received payload as the kernel would
+static size_t Transfer(Payload &from, Payload &to) {
+    iovec iov[Payload::MAX_SEGMENTS];
+    int count = from.GetIovec(iov);
+    uint8_t *bytes = to.GetReceiveBuffer();
+    size_t length = 0;
+    for (int i = 0; i < count; ++i) {
+        memcpy(bytes + length, iov[i].iov_base, iov[i].iov_len);
+        length += iov[i].iov_len;
+    }
+    to.SetLength((uint32_t) length);
+    return length;
+}
+
+// Shared body segment of an encoded normal payload (after type and uid)
+static const void *Body(Payload &payload) {
+    iovec iov[Payload::MAX_SEGMENTS];
+    return payload.GetIovec(iov) > 1 ? iov[1].iov_base : NULL;
+}
+
+int main() {
+    Payload payload;
+    payload.SetType(CHAT_MSG);
+    payload.SetMessage("Message 1");
+    payload.SetUsername("Dummy1");
+    payload.SetOrder(7);
+    CHECK(payload.GetUsername() == "Dummy1" && payload.GetMessage() == "Message 1", "message kept on rename");
+    CHECK(payload.EncodePayload() == SUCCESS, "encode");
+
+    // Copies share the encoded bytes
+    cout << "--- Sharing test ---" << endl;
+    size_t in_use = PayloadBuffer::GetPoolStats().in_use;
+    Payload copies[8];
+    for (uint32_t i = 0; i < 8; ++i) {
+        copies[i] = payload;
+        copies[i].SetUid(i);
+        CHECK(copies[i].EncodePayload() == SUCCESS, "encode copy");
+        CHECK(Body(copies[i]) == Body(payload), "copy shares bytes");
+    }
+    CHECK(PayloadBuffer::GetPoolStats().in_use == in_use, "no block for copies");
+
+    // Writing to a copy detaches it only
+    cout << "--- Copy-on-write test ---" << endl;
+    copies[0].SetMessage("Other");
+    CHECK(copies[0].EncodePayload() == SUCCESS, "encode changed copy");
+    CHECK(Body(copies[0]) != Body(payload), "changed copy has own bytes");
+    CHECK(payload.GetMessage() == "Message 1" && copies[1].GetMessage() == "Message 1", "others unchanged");
+    CHECK(copies[0].GetMessage() == "Other" && copies[0].GetUsername() == "Dummy1", "changed copy");
+
+    // Uid and ACK belong to a copy, body comes from the shared bytes
+    cout << "--- Round trip test ---" << endl;
+    AckRange range = {12, 14};
+    CHECK(copies[3].AttachAck(10, &range, 1) == SUCCESS, "attach ACK");
+    Payload received;
+    CHECK(Transfer(copies[3], received) == copies[3].GetLength(), "length matches segments");
+    CHECK(received.DecodePayload() == SUCCESS, "decode");
+    CHECK(received.GetType() == CHAT_MSG && received.GetUid() == 3 && received.GetOrder() == 7, "header");
+    CHECK(received.GetUsername() == "Dummy1" && received.GetMessage() == "Message 1", "body");
+    CHECK(received.HasAck() && received.GetAckNext() == 10 && received.GetAckRangeCount() == 1 &&
+          received.GetAckRanges()[0].start == 12 && received.GetAckRanges()[0].end == 14, "piggybacked ACK");
+    CHECK(Transfer(copies[4], received) == payload.GetLength(), "other copy has no ACK");
+    CHECK(received.DecodePayload() == SUCCESS && !received.HasAck() && received.GetUid() == 4, "decode other copy");
+
+    // ACK payloads carry no body
+    cout << "--- ACK test ---" << endl;
+    in_use = PayloadBuffer::GetPoolStats().in_use;
+    Payload ack(5, &range, 1);
+    CHECK(PayloadBuffer::GetPoolStats().in_use == in_use, "ACK takes no block");
+    CHECK(Transfer(ack, received) == ack.GetLength(), "ACK length");
+    CHECK(received.DecodePayload() == SUCCESS && received.GetType() == ACK_MSG && received.GetAckNext() == 5,
+          "decode ACK");
+
+    // ACK fields cut short or reversed are rejected, stale bytes after the datagram are never read
+    for (uint32_t length = 1; length < ack.GetLength(); ++length) {
+        Transfer(ack, received);
+        received.SetLength(length);
+        CHECK(received.DecodePayload() == DECODE_ERROR && received.GetAckRangeCount() == 0, "truncated ACK");
+    }
+    Transfer(copies[3], received);
+    received.SetLength((uint32_t) (copies[3].GetLength() - 1));
+    CHECK(received.DecodePayload() == DECODE_ERROR, "truncated piggybacked ACK");
+    uint32_t length = (uint32_t) Transfer(copies[3], received);
+    received.GetReceiveBuffer()[length - 9] = MAX_SACK_RANGES;     // Range count, one range follows
+    CHECK(received.DecodePayload() == DECODE_ERROR, "ranges past the datagram");
+    AckRange reversed = {14, 12};
+    Payload reversed_ack(5, &reversed, 1);
+    Transfer(reversed_ack, received);
+    CHECK(received.DecodePayload() == DECODE_ERROR, "reversed ACK range");
+    AckRange wrapped = {0xFFFFFFFE, 1};
+    Payload wrapped_ack(5, &wrapped, 1);
+    Transfer(wrapped_ack, received);
+    CHECK(received.DecodePayload() == SUCCESS && received.GetAckRanges()[0].end == 1, "ACK range wrapping around");
+
+    // Truncated datagram is rejected
+    CHECK(Transfer(payload, received) > 0, "transfer");
+    received.SetLength((uint32_t) (payload.GetLength() - 1));
+    CHECK(received.DecodePayload() == DECODE_ERROR, "truncated body");
+
+    // Compact header packs the fields as varints and may carry a session user id for the name
+    cout << "--- Compact header test ---" << endl;
+    Payload fixed, compact;
+    fixed.SetType(CHAT_MSG);
+    fixed.SetUsername("Dummy1");
+    fixed.SetMessage("hi");
+    fixed.SetOrder(1000);
+    fixed.SetUid(5000);
+    compact = fixed;
+    compact.SetHeaderVersion(COMPACT_HEADER);
+    compact.SetUserId(0x1234);
+    CHECK(fixed.EncodePayload() == SUCCESS && compact.EncodePayload() == SUCCESS, "encode both headers");
+    cout << "Chat datagram: " << fixed.GetLength() << " bytes fixed, " << compact.GetLength() << " bytes compact" <<
+    endl;
+    CHECK(fixed.GetLength() - compact.GetLength() >= 15, "compact header and user id are smaller");
+    CHECK(compact.GetUsername().empty() && compact.GetUserId() == 0x1234, "user id replaces name");
+
+    CHECK(Transfer(compact, received) == compact.GetLength() && received.DecodePayload() == SUCCESS, "decode compact");
+    CHECK(received.GetHeaderVersion() == COMPACT_HEADER && received.GetType() == CHAT_MSG &&
+          received.GetUid() == 5000 && received.GetOrder() == 1000 && received.GetUserId() == 0x1234 &&
+          received.GetUsername().empty() && received.GetMessage() == "hi", "compact fields");
+    CHECK(Transfer(fixed, received) == fixed.GetLength() && received.DecodePayload() == SUCCESS &&
+          received.GetHeaderVersion() == FIXED_HEADER && received.GetUserId() == 0 &&
+          received.GetUsername() == "Dummy1" && received.GetMessage() == "hi", "fixed header still decoded");
+
+    // A relay sends the bytes as received, only the uid in front changes
+    Transfer(compact, received);
+    received.DecodePayload();
+    Payload relayed = received;
+    relayed.SetUid(7);
+    CHECK(relayed.EncodePayload() == SUCCESS && Body(relayed) == Body(received) &&
+          relayed.GetLength() == compact.GetLength() - 1, "relayed bytes reused");
+    CHECK(Transfer(relayed, received) == relayed.GetLength() && received.DecodePayload() == SUCCESS &&
+          received.GetUid() == 7 && received.GetUserId() == 0x1234 && received.GetMessage() == "hi", "relayed copy");
+
+    // Name put back in place of the id, no order, piggybacked ACK
+    received.SetUsername("Dummy1");
+    received.SetOrder(DEFAULT_NO_ORDER);
+    CHECK(received.EncodePayload() == SUCCESS && received.AttachAck(10, &range, 1) == SUCCESS, "encode resolved");
+    CHECK(Transfer(received, relayed) == received.GetLength() && relayed.DecodePayload() == SUCCESS &&
+          relayed.GetUserId() == 0 && relayed.GetUsername() == "Dummy1" && relayed.GetOrder() == DEFAULT_NO_ORDER &&
+          relayed.HasAck() && relayed.GetAckNext() == 10 && relayed.GetMessage() == "hi", "resolved round trip");
+
+    // Fragments of a long message keep the header version
+    vector<Payload> fragments;
+    compact.SetUsername("Dummy3");
+    CHECK(compact.SetMessage(string(600, 'z')) == SUCCESS && compact.Fragment(3, &fragments) == SUCCESS &&
+          fragments.size() == 3, "fragment compact");
+    CHECK(fragments[1].AttachAck(11, &range, 1) == SUCCESS && Transfer(fragments[1], received) > 0 &&
+          received.DecodePayload() == SUCCESS, "decode compact fragment");
+    CHECK(received.GetHeaderVersion() == COMPACT_HEADER && received.GetFragmentIndex() == 1 &&
+          received.GetFragmentCount() == 3 && received.GetUsername() == "Dummy3" && received.HasAck() &&
+          received.GetAckNext() == 11 && received.GetMessage() == string(FRAGMENT_LENGTH, 'z'), "compact fragment");
+
+    // Truncated varints are rejected
+    Transfer(relayed, received);
+    received.SetLength(4);
+    CHECK(received.DecodePayload() == DECODE_ERROR, "truncated compact header");
+
+    // Released blocks are reused
+    cout << "--- Pool test ---" << endl;
+    for (Payload &copy : copies) {
+        copy.clear();
+    }
+    for (Payload &fragment : fragments) {
+        fragment.clear();
+    }
+    payload.clear();
+    received.clear();
+    fixed.clear();
+    compact.clear();
+    relayed.clear();
+    SlabStats stats = PayloadBuffer::GetPoolStats();
+    CHECK(stats.in_use == 0 && stats.free == stats.capacity, "every block back in pool");
+    CHECK(stats.high_water >= 2 && stats.slabs == 1, "high-water mark within one slab");
+    payload.SetType(CHAT_MSG);
+    payload.SetUsername("Dummy2");
+    payload.SetMessage("Message 2");
+    CHECK(PayloadBuffer::GetPoolStats().in_use == 1, "block reused");
+
+    // Blocks let go by another thread go back to the pool they came from
+    cout << "--- Cross-thread pool test ---" << endl;
+    Payload shared = payload;
+    Payload made;
+    boost::thread dropper([&shared]() { shared.clear(); });
+    dropper.join();
+    payload.clear();
+    CHECK(PayloadBuffer::GetPoolStats().in_use == 0, "block returned by another thread");
+    boost::thread maker([&made]() {
+        made.SetType(CHAT_MSG);
+        made.SetUsername("Dummy3");
+        made.SetMessage("Message 3");
+        made.SetUid(3);
+    });
+    maker.join();
+    made.clear();
+    boost::thread reuser([]() {
+        Payload again;
+        again.SetType(CHAT_MSG);
+        again.SetMessage("Message 4");
+        again.SetUid(4);
+        again.clear();
+    });
+    reuser.join();
+    stats = PayloadBuffer::GetPoolStats();
+    CHECK(stats.in_use == 0 && stats.slabs == 1, "own pool untouched by other threads");
+
+    cout << "All tests passed" << endl;
+    return 0;
+}
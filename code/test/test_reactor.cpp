@@ -0,0 +1,118 @@
+/**
+ * Test program for the REACTOR build of UdpWrapper
+ *
+ * Drives two wrappers by hand the way the event loop does: poll their sockets, receive, send and
+ * run the timers when their deadline says so.
+ */
+
+#include <iostream>
+#include <chrono>
+#include <poll.h>
+#include <unistd.h>
+
+#include <arpa/inet.h>
+
+#include "../include/udp_wrapper.h"
+#include "test_check.h"
+
+using namespace std;
+
+#define POLL_TIMEOUT        1000    // in miliseconds
+
+// Wait for the sockets of a wrapper and receive whatever came in
+static bool Poll(UdpWrapper &wrapper) {
+    vector<int> fds = wrapper.get_fds();
+    vector<pollfd> polls(fds.size());
+    for (size_t i = 0; i < fds.size(); ++i) {
+        polls[i].fd = fds[i];
+        polls[i].events = POLLIN;
+    }
+
+    if (poll(polls.data(), polls.size(), POLL_TIMEOUT) <= 0) {
+        return false;
+    }
+    for (size_t i = 0; i < polls.size(); ++i) {
+        if (polls[i].revents & POLLIN) {
+            wrapper.Receive(polls[i].fd);
+        }
+    }
+    return true;
+}
+
+// Sleep until the wrapper's next deadline passed
+static void SleepUntil(chrono::milliseconds deadline) {
+    chrono::milliseconds now = RetransmitWheel::Now();
+    if (deadline > now) {
+        usleep((useconds_t) (deadline - now).count() * 1000 + 1000);
+    }
+}
+
+int main() {
+    CentralQueues sender_queues, receiver_queues;
+    UdpWrapper sender(&sender_queues), receiver(&receiver_queues);
+    uint16_t sender_port, receiver_port;
+
+    CHECK(sender.Start("9490", &sender_port) == SUCCESS && receiver.Start("9490", &receiver_port) == SUCCESS,
+          "start");
+    CHECK(sender.get_fds().size() == 1 && receiver.get_fds().size() == 1, "one socket each");
+    CHECK(sender.NextDeadline() == chrono::milliseconds::max(), "nothing due while idle");
+
+    sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = receiver_port;
+
+    // Nothing leaves before Send(), which arms the retransmission
+    cout << "--- Delivery test ---" << endl;
+    Payload payload, received;
+    payload.SetType(CHAT_MSG);
+    payload.SetUsername("Dummy1");
+    payload.SetMessage("Message 1");
+    CHECK(payload.EncodePayload() == SUCCESS, "encode");
+    CHECK(sender.SendPayloadSingle(payload, &addr) == SUCCESS, "queue payload");
+    CHECK(sender.NextDeadline() == chrono::milliseconds::max(), "not armed before Send()");
+    sender.Send();
+    CHECK(sender.NextDeadline() < chrono::milliseconds::max(), "retransmission armed");
+
+    CHECK(Poll(receiver), "receiver socket readable");
+    CHECK(receiver_queues.has_data(), "payload queued without a reader thread");
+    receiver_queues.take_ready();
+    CHECK(receiver_queues.try_pop_udp_in(received) && received.GetMessage() == "Message 1" &&
+          received.GetAddress()->sin_port == sender_port, "payload received");
+
+    // The delayed ACK is due within ACK_DELAY and goes out with the next Send() after that
+    CHECK(receiver.NextDeadline() <= RetransmitWheel::Now() + chrono::milliseconds(ACK_DELAY), "ACK scheduled");
+    SleepUntil(receiver.NextDeadline());
+    receiver.Send();
+    CHECK(receiver.NextDeadline() == chrono::milliseconds::max(), "ACK sent");
+    CHECK(Poll(sender), "sender socket readable");
+    CHECK(sender.NextDeadline() == chrono::milliseconds::max(), "retransmission retired by ACK");
+
+    // A payload nobody acknowledges is resent once its deadline passed and RunTimers() ran
+    cout << "--- Retransmission test ---" << endl;
+    sockaddr_in silent = addr;
+    CentralQueues silent_queues;
+    UdpWrapper *closed = new UdpWrapper(&silent_queues);
+    CHECK(closed->Start("9495", &silent.sin_port) == SUCCESS, "start silent peer");
+    closed->Stop();
+    delete closed;
+
+    CHECK(sender.SendPayloadSingle(payload, &silent) == SUCCESS, "queue unacknowledged payload");
+    sender.Send();
+    uint64_t sent = sender.GetStats().packets_sent;
+    chrono::milliseconds deadline = sender.NextDeadline();
+    CHECK(deadline < chrono::milliseconds::max(), "armed");
+    sender.RunTimers();
+    sender.Send();
+    CHECK(sender.GetStats().packets_sent == sent, "not resent early");
+    SleepUntil(deadline);
+    sender.RunTimers();
+    sender.Send();
+    CHECK(sender.GetStats().packets_sent == sent + 1 && sender.NextDeadline() > deadline, "resent and re-armed");
+
+    sender.Stop();
+    receiver.Stop();
+
+    cout << "All tests passed" << endl;
+    return 0;
+}
@@ -0,0 +1,234 @@
+/**
+ * Test program for message fragmentation and Reassembler
+ *
+ * Splits long messages into fragments, puts them back together in any order, checks the
+ * reassembly bounds, then sends a long chat message and a large client list over loopback.
+ */
+
+#include <iostream>
+#include <algorithm>
+
+#include <arpa/inet.h>
+
+#include "../include/udp_wrapper.h"
+#include "../include/client_manager.h"
+#include "test_check.h"
+
+using namespace std;
+
+#define NUM_LIST_CLIENTS    60
+
+// Flatten payload segments into a received payload as the kernel would
+static void Transfer(Payload &from, Payload &to, const sockaddr_in *addr) {
+    iovec iov[Payload::MAX_SEGMENTS];
+    int count = from.GetIovec(iov);
+    uint8_t *bytes = to.GetReceiveBuffer();
+    size_t length = 0;
+    for (int i = 0; i < count; ++i) {
+        memcpy(bytes + length, iov[i].iov_base, iov[i].iov_len);
+        length += iov[i].iov_len;
+    }
+    to.SetLength((uint32_t) length);
+    to.SetAddress(addr);
+}
+
+// Encoded fragments of a chat message as received from addr
+static bool Split(const string &message, uint16_t id, const sockaddr_in *addr, vector<Payload> *received) {
+    Payload payload;
+    vector<Payload> fragments;
+    payload.SetType(CHAT_MSG);
+    payload.SetUsername("Dummy1");
+    payload.SetMessage(message);
+    payload.SetOrder(5);
+    if (!payload.NeedsFragments() || payload.Fragment(id, &fragments) != SUCCESS) {
+        return false;
+    }
+    for (Payload &fragment : fragments) {
+        Payload in;
+        Transfer(fragment, in, addr);
+        if (in.DecodePayload() != SUCCESS) {
+            return false;
+        }
+        received->push_back(in);
+    }
+    return true;
+}
+
+// Wait for the next incoming payload of a wrapper
+static bool Receive(CentralQueues &queues, Payload *payload) {
+    for (int i = 0; i < 20; ++i) {
+        // Fragments wake the queue only once the whole message is there
+        queues.take_ready();
+        if (queues.try_pop_udp_in(*payload)) {
+            return true;
+        }
+        queues.wait_for_data(100);
+    }
+    return false;
+}
+
+static string Pattern(uint32_t length) {
+    string message(length, ' ');
+    for (uint32_t i = 0; i < length; ++i) {
+        message[i] = (char) ('a' + i % 26);
+    }
+    return message;
+}
+
+int main() {
+    sockaddr_in sender = {};
+    sender.sin_family = AF_INET;
+    sender.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    sender.sin_port = htons(9100);
+    sockaddr_in other = sender;
+    other.sin_port = htons(9101);
+
+    // Every fragment fits one packet and carries its index and the count
+    cout << "--- Split test ---" << endl;
+    Payload payload;
+    payload.SetMessage(string(MAX_MESSAGE_LENGTH - 1, 'x'));
+    CHECK(!payload.NeedsFragments(), "short message sent whole");
+    CHECK(payload.SetMessage(string(MAX_FRAGMENTED_LENGTH + 1, 'x')) == ERROR_INVALID_PARAMETERS,
+          "longer than fragmented limit");
+
+    string message = Pattern(1000);
+    vector<Payload> fragments;
+    CHECK(Split(message, 7, &sender, &fragments) && fragments.size() == 5, "split into fragments");
+    for (uint8_t i = 0; i < fragments.size(); ++i) {
+        CHECK(fragments[i].GetType() == CHAT_MSG && fragments[i].GetOrder() == 5 &&
+              fragments[i].GetUsername() == "Dummy1" && fragments[i].GetFragmentId() == 7 &&
+              fragments[i].GetFragmentIndex() == i && fragments[i].GetFragmentCount() == 5 &&
+              fragments[i].GetMessage() == message.substr(i * FRAGMENT_LENGTH, FRAGMENT_LENGTH),
+              "fragment fields");
+        CHECK(fragments[i].GetLength() < MAX_BUFFER_LENGTH, "fragment fits a packet");
+    }
+
+    // Fragments arrive in any order and more than once; the message is whole again at the end
+    cout << "--- Reassembly test ---" << endl;
+    Reassembler reassembler(4, 1000);
+    Payload whole;
+    vector<uint32_t> uids;
+    vector<uint8_t> orders = {4, 1, 1, 0, 3};
+    for (uint8_t i = 0; i < fragments.size(); ++i) {
+        fragments[i].SetUid(100u + i);
+    }
+    for (uint8_t i : orders) {
+        CHECK(!reassembler.Add(fragments[i], &whole, &uids) && uids.empty(), "incomplete");
+    }
+    CHECK(reassembler.size() == 1, "one message waiting");
+    CHECK(reassembler.Add(fragments[2], &whole, &uids) && reassembler.size() == 0, "complete");
+    CHECK(uids.size() == 5 && uids[0] == 100 && uids[4] == 104, "fragment uids to acknowledge");
+    CHECK(whole.GetType() == CHAT_MSG && whole.GetOrder() == 5 && whole.GetUsername() == "Dummy1" &&
+          whole.GetMessage() == message && whole.GetFragmentCount() == 0 &&
+          whole.GetAddress()->sin_port == sender.sin_port, "reassembled message");
+    CHECK(whole.NeedsFragments(), "reassembled message is sent in fragments again");
+
+    // Same fragment id from another sender is another message
+    vector<Payload> other_fragments;
+    string other_message = Pattern(MAX_FRAGMENTED_LENGTH).substr(3, 500);
+    CHECK(Split(other_message, 7, &other, &other_fragments), "split other");
+    for (size_t i = 0; i + 1 < fragments.size(); ++i) {
+        reassembler.Add(fragments[i], &whole);
+    }
+    for (size_t i = 0; i + 1 < other_fragments.size(); ++i) {
+        reassembler.Add(other_fragments[i], &whole);
+    }
+    CHECK(reassembler.size() == 2, "two senders");
+    CHECK(reassembler.Add(other_fragments.back(), &whole) && whole.GetMessage() == other_message, "other sender");
+    CHECK(reassembler.Add(fragments.back(), &whole) && whole.GetMessage() == message, "first sender");
+
+    // The longest message round trips
+    vector<Payload> longest;
+    string longest_message = Pattern(MAX_FRAGMENTED_LENGTH);
+    CHECK(Split(longest_message, 8, &sender, &longest), "split longest");
+    reverse(longest.begin(), longest.end());
+    bool complete = false;
+    for (Payload &fragment : longest) {
+        complete = reassembler.Add(fragment, &whole);
+    }
+    CHECK(complete && whole.GetMessage() == longest_message, "longest message");
+
+    // A fragment that disagrees with the others is ignored
+    cout << "--- Bounds test ---" << endl;
+    fragments.clear();
+    CHECK(Split(message, 9, &sender, &fragments), "split");
+    reassembler.Add(fragments[0], &whole);
+    fragments[1].SetFragment(9, 1, 6);
+    CHECK(!reassembler.Add(fragments[1], &whole) && reassembler.size() == 1, "count mismatch ignored");
+
+    // Oldest message is dropped when too many are waiting
+    for (uint16_t id = 10; id < 14; ++id) {
+        vector<Payload> waiting;
+        CHECK(Split(message, id, &sender, &waiting), "split waiting");
+        reassembler.Add(waiting[0], &whole);
+    }
+    CHECK(reassembler.size() == 4 && reassembler.get_dropped() == 1, "oldest dropped");
+    for (size_t i = 1; i < fragments.size(); ++i) {
+        CHECK(!reassembler.Add(fragments[i], &whole), "dropped message never completes");
+    }
+
+    // A message whose fragments stopped coming is dropped after the timeout
+    Reassembler timed(4, 50);
+    timed.Add(fragments[0], &whole);
+    boost::this_thread::sleep_for(boost::chrono::milliseconds(60));
+    for (size_t i = 1; i < fragments.size(); ++i) {
+        CHECK(!timed.Add(fragments[i], &whole), "timed out message never completes");
+    }
+    CHECK(timed.get_dropped() == 1, "timed out");
+
+    // Long user line and large client list across real sockets
+    cout << "--- Loopback test ---" << endl;
+    CentralQueues sender_queues, receiver_queues;
+    UdpWrapper udp_sender(&sender_queues), udp_receiver(&receiver_queues);
+    uint16_t sender_port, receiver_port;
+    CHECK(udp_sender.Start("9580", &sender_port) == SUCCESS && udp_receiver.Start("9580", &receiver_port) == SUCCESS,
+          "start");
+    sockaddr_in receiver = sender;
+    receiver.sin_port = receiver_port;
+
+    payload.clear();
+    payload.SetType(CHAT_MSG);
+    payload.SetUsername("Dummy1");
+    payload.SetMessage(longest_message);
+    payload.SetOrder(1);
+    CHECK(payload.EncodePayload() == SUCCESS && udp_sender.SendPayloadSingle(payload, &receiver) == SUCCESS,
+          "send long message");
+    CHECK(Receive(receiver_queues, &whole) && whole.GetMessage() == longest_message && whole.GetOrder() == 1 &&
+          whole.GetAddress()->sin_port == sender_port, "long message received");
+
+    ClientManager clients;
+    for (uint16_t i = 0; i < NUM_LIST_CLIENTS; ++i) {
+        clients.AddClient(sender, "client" + to_string(i), i == 0);
+        sender.sin_port = htons((uint16_t) (ntohs(sender.sin_port) + 1));
+    }
+    CHECK(clients.GetPayloadSize() >= MAX_MESSAGE_LENGTH, "client list needs fragments");
+    payload.clear();
+    payload.SetType(STATUS_MSG);
+    payload.SetStatus(CLIENT_JOIN_ACK);
+    CHECK(payload.SetMessage(clients.GetPayload(), clients.GetPayloadSize()) == SUCCESS, "set client list");
+    vector<sockaddr_in> list(1, receiver);
+    CHECK(udp_sender.SendPayloadList(payload, &list) == SUCCESS, "send client list");
+    ClientManager received_clients;
+    CHECK(Receive(receiver_queues, &whole) && whole.GetStatus() == CLIENT_JOIN_ACK &&
+          received_clients.DecodeBufferToClientList((uint8_t *) whole.GetMessage().c_str(),
+                                                    whole.GetMessageLength()) == SUCCESS, "client list received");
+    CHECK(received_clients.GetAllClientSockAddress().size() == NUM_LIST_CLIENTS, "every client listed");
+
+    // Fragments are acknowledged with their whole message, so nothing is left to resend
+    boost::this_thread::sleep_for(boost::chrono::milliseconds(200));
+    UdpWrapper::UdpStats sender_stats = udp_sender.GetStats();
+    UdpWrapper::UdpStats receiver_stats = udp_receiver.GetStats();
+    uint64_t expected = (MAX_FRAGMENTED_LENGTH + FRAGMENT_LENGTH - 1) / FRAGMENT_LENGTH +
+                        (clients.GetPayloadSize() + FRAGMENT_LENGTH - 1) / FRAGMENT_LENGTH;
+    CHECK(sender_stats.fragments_sent == expected && receiver_stats.fragments_received == expected,
+          "fragment counters");
+    CHECK(sender_stats.tickets_pending == 0, "fragments acknowledged once reassembled");
+    cout << "Sent " << sender_stats.fragments_sent << " fragments in " << sender_stats.packets_sent -
+                                                                          sender_stats.acks_sent << " packets" << endl;
+
+    udp_sender.Stop();
+    udp_receiver.Stop();
+
+    cout << "All tests passed" << endl;
+    return 0;
+}
@@ -0,0 +1,135 @@
+/**
+ * Test program for ReceiveWindow
+ */
+
+#include <iostream>
+
+#include <boost/thread.hpp>
+
+#include "../include/receive_window.h"
+#include "test_check.h"
+
+using namespace std;
+
+int main() {
+    ReceiveWindow window(100);
+    in_addr_t ip = htonl(INADDR_LOOPBACK);
+
+    CHECK(window.get_window() == 128, "window rounded up to power of 2");
+
+    // Duplicates are tracked per peer
+    cout << "--- Per-peer test ---" << endl;
+    CHECK(!window.CheckAndMark(ip, 9000, 5), "peer 1 uid 5");
+    CHECK(!window.CheckAndMark(ip, 9001, 5), "peer 2 uid 5");
+    CHECK(window.CheckAndMark(ip, 9000, 5), "peer 1 uid 5 duplicate");
+    CHECK(!window.CheckAndMark(ip, 9000, 3), "peer 1 late uid 3");
+    CHECK(window.CheckAndMark(ip, 9000, 3), "peer 1 late uid 3 duplicate");
+
+    // Traffic from other peers does not push a late retransmit out of the window
+    cout << "--- Load test ---" << endl;
+    for (uint32_t uid = 0; uid < 1000; ++uid) {
+        window.CheckAndMark(ip, 9001, uid + 10);
+    }
+    CHECK(window.CheckAndMark(ip, 9000, 5), "peer 1 uid 5 still duplicate");
+
+    // Sliding forward forgets old uids and reuses their bits
+    cout << "--- Slide test ---" << endl;
+    CHECK(!window.CheckAndMark(ip, 9000, 5 + 128), "uid sharing a bit with 5");
+    CHECK(window.CheckAndMark(ip, 9000, 5), "uid 5 out of the window still duplicate");
+    CHECK(!window.CheckAndMark(ip, 9000, 100), "uid 100 inside window");
+
+    // Uids below the first missing one are duplicates; it moves up with the window, as the sender
+    // gave up on whatever falls out of it
+    cout << "--- Cumulative test ---" << endl;
+    for (uint32_t uid = 0; uid < 3; ++uid) {
+        window.CheckAndMark(ip, 9005, uid);
+    }
+    CHECK(!window.CheckAndMark(ip, 9005, 100), "uid ahead within the window");
+    CHECK(window.CheckAndMark(ip, 9005, 1), "uid below first missing duplicate");
+    CHECK(!window.CheckAndMark(ip, 9005, 3) && window.CheckAndMark(ip, 9005, 3), "late retransmit delivered once");
+    CHECK(!window.CheckAndMark(ip, 9005, 140), "uid a window past the first missing");
+    CHECK(window.CheckAndMark(ip, 9005, 12), "uid out of the window duplicate");
+    CHECK(!window.CheckAndMark(ip, 9005, 13) && window.CheckAndMark(ip, 9005, 13), "oldest uid of the window");
+
+    // Fragments are checked first and marked once their message is whole
+    CHECK(!window.Check(ip, 9005, 139) && !window.Check(ip, 9005, 139), "check does not mark");
+    CHECK(window.Check(ip, 9005, 140) && window.Check(ip, 9005, 2), "check finds duplicates");
+    CHECK(!window.Check(ip, 9006, 0), "check unknown peer");
+
+    // A peer restarted on the same address starts a new run of uids
+    cout << "--- Restart test ---" << endl;
+    for (uint32_t uid = 5120; uid < 5130; ++uid) {
+        window.CheckAndMark(ip, 9007, uid);
+    }
+    CHECK(window.CheckAndMark(ip, 9007, 5010), "retransmit within a window below duplicate");
+    CHECK(!window.Check(ip, 9007, 256), "check sees the new run");
+    CHECK(!window.CheckAndMark(ip, 9007, 257), "uid of the new run, received out of order");
+    CHECK(!window.CheckAndMark(ip, 9007, 256) && window.CheckAndMark(ip, 9007, 257), "new run tracked");
+
+    // Wrap around
+    cout << "--- Wrap test ---" << endl;
+    CHECK(!window.CheckAndMark(ip, 9002, 0xFFFFFFFE), "uid before wrap");
+    CHECK(!window.CheckAndMark(ip, 9002, 1), "uid after wrap");
+    CHECK(window.CheckAndMark(ip, 9002, 0xFFFFFFFE), "uid before wrap duplicate");
+    CHECK(!window.CheckAndMark(ip, 9002, 0xFFFFFFFF), "skipped uid before wrap");
+
+    // ACK summary: cumulative uid plus ranges received out of order
+    cout << "--- ACK test ---" << endl;
+    AckRange ranges[4];
+    uint32_t next;
+    uint8_t count = 4;
+    for (uint32_t uid : {0, 1, 2, 4, 5, 7, 9, 11, 13}) {
+        window.CheckAndMark(ip, 9003, uid);
+    }
+    CHECK(window.BuildAck(ip, 9003, &next, ranges, &count), "peer known");
+    CHECK(next == 3, "cumulative ACK stops at first gap");
+    CHECK(count == 4 && ranges[0].start == 4 && ranges[0].end == 5 &&
+          ranges[1].start == 7 && ranges[1].end == 7 && ranges[3].start == 11, "ranges capped at capacity");
+    window.CheckAndMark(ip, 9003, 3);
+    window.CheckAndMark(ip, 9003, 6);
+    count = 4;
+    window.BuildAck(ip, 9003, &next, ranges, &count);
+    CHECK(next == 8 && count == 3 && ranges[2].end == 13, "gaps filled");
+    count = 4;
+    CHECK(!window.BuildAck(ip, 9004, &next, ranges, &count) && count == 0, "unknown peer");
+
+    // The cumulative ACK waits for a hole within the window
+    count = 4;
+    window.CheckAndMark(ip, 9003, 130);
+    window.BuildAck(ip, 9003, &next, ranges, &count);
+    CHECK(next == 8 && count == 4 && ranges[3].start == 130 && ranges[3].end == 130, "selective past a hole");
+    count = 4;
+    window.CheckAndMark(ip, 9003, 8);
+    window.BuildAck(ip, 9003, &next, ranges, &count);
+    CHECK(next == 10 && count == 3, "retransmit of the hole moves cumulative ACK");
+
+    // A run starting at a window multiple is acknowledged cumulatively from its first uid
+    count = 4;
+    window.CheckAndMark(ip, 9007, 258);
+    window.BuildAck(ip, 9007, &next, ranges, &count);
+    CHECK(next == 259 && count == 0, "new run acknowledged cumulatively");
+
+    // Clear forgets a peer
+    cout << "--- Clear test ---" << endl;
+    window.Clear(ip, 9000);
+    CHECK(!window.CheckAndMark(ip, 9000, 5), "uid 5 after clear");
+
+    // Readers of different sockets check their own peers at the same time
+    cout << "--- Concurrency test ---" << endl;
+    bool ok[4];
+    boost::thread_group readers;
+    for (int t = 0; t < 4; ++t) {
+        ok[t] = true;
+        readers.create_thread([t, ip, &ok, &window]() {
+            for (uint32_t uid = 0; uid < 5000 && ok[t]; ++uid) {
+                in_port_t port = (in_port_t) (10000 + t * 16 + uid % 16);
+                ok[t] = !window.CheckAndMark(ip, port, uid / 16) && window.CheckAndMark(ip, port, uid / 16);
+            }
+        });
+    }
+    readers.join_all();
+    CHECK(ok[0] && ok[1] && ok[2] && ok[3], "each peer's history kept apart");
+
+    cout << "All tests passed" << endl;
+    return 0;
+}
@@ -0,0 +1,228 @@
+/**
+ * Test program for relay tree fan-out
+ *
+ * Checks that the tree derived from the client list reaches every client exactly once, then
+ * forks one process per client on loopback and measures delivery latency of ordered messages
+ * for several relay degrees (0 is the leader sending to every client directly).
+ */
+
+#include <iostream>
+#include <iomanip>
+#include <algorithm>
+
+#include <sys/wait.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+
+#include "../include/udp_wrapper.h"
+#include "../include/client_manager.h"
+#include "test_check.h"
+
+using namespace std;
+
+#define NUM_CLIENTS         14
+#define NUM_MESSAGES        100
+#define MESSAGE_INTERVAL    2       // in miliseconds
+#define DELIVERY_TIMEOUT    5000    // in miliseconds
+
+// Delivery report of a client process
+struct Report {
+    uint32_t received;
+    uint64_t total_latency;         // in microseconds
+    uint64_t max_latency;
+};
+
+static uint64_t NowMicros() {
+    return (uint64_t) chrono::duration_cast<chrono::microseconds>(
+            chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static sockaddr_in Loopback(uint16_t port) {
+    sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = port;
+    return addr;
+}
+
+// Client process: learn the group from the leader, then deliver and relay ordered messages
+static void RunClient(int port_pipe, int report_pipe) {
+    CentralQueues queues;
+    UdpWrapper udp(&queues);
+    ClientManager clients;
+    Report report = {0, 0, 0};
+    uint16_t port;
+    Payload payload;
+
+    if (udp.Start("9560", &port) != SUCCESS) {
+        _exit(1);
+    }
+    sockaddr_in self = Loopback(port);
+    clients.set_self_address(self);
+    write(port_pipe, &port, sizeof(port));
+
+    vector<bool> seen(NUM_MESSAGES, false);
+    uint64_t deadline = NowMicros() + DELIVERY_TIMEOUT * 1000;
+    while (report.received < NUM_MESSAGES && NowMicros() < deadline) {
+        if (!queues.try_pop_udp_in(payload)) {
+            queues.wait_for_data(10);
+            continue;
+        }
+        if (payload.GetType() == STATUS_MSG && payload.GetStatus() == CLIENT_JOIN_ACK) {
+            clients.DecodeBufferToClientList((uint8_t *) payload.GetMessage().c_str(), payload.GetMessageLength());
+        } else if (payload.GetType() == CHAT_MSG && !seen[payload.GetOrder()]) {
+            // Relay first, as JAM does for a message seen for the first time
+            if (payload.GetRelayDegree() > 0) {
+                vector<sockaddr_in> children = clients.GetRelayChildren(self, payload.GetRelayDegree());
+                if (!children.empty()) {
+                    udp.SendPayloadList(payload, &children);
+                }
+            }
+            uint64_t latency = NowMicros() - strtoull(payload.GetMessage().c_str(), NULL, 10);
+            report.received++;
+            report.total_latency += latency;
+            report.max_latency = max(report.max_latency, latency);
+            seen[payload.GetOrder()] = true;
+        }
+    }
+
+    // Stay around so late ACKs to our relayed copies arrive before the socket closes
+    boost::this_thread::sleep_for(boost::chrono::milliseconds(200));
+    write(report_pipe, &report, sizeof(report));
+    udp.Stop();
+    _exit(0);
+}
+
+// Leader: fork clients, send them the list, stream ordered messages and collect reports
+static bool RunRound(uint8_t degree, Report *result, uint64_t *leader_packets) {
+    int port_pipe[2], report_pipe[2];
+    pid_t pids[NUM_CLIENTS];
+
+    if (pipe(port_pipe) != 0 || pipe(report_pipe) != 0) {
+        return false;
+    }
+    for (int i = 0; i < NUM_CLIENTS; ++i) {
+        if ((pids[i] = fork()) == 0) {
+            RunClient(port_pipe[1], report_pipe[1]);
+        }
+    }
+    // Reads fail instead of blocking once every client is gone
+    close(port_pipe[1]);
+    close(report_pipe[1]);
+
+    CentralQueues queues;
+    UdpWrapper udp(&queues);
+    ClientManager clients;
+    uint16_t port;
+    bool ok = udp.Start("9550", &port) == SUCCESS;
+
+    sockaddr_in self = Loopback(port);
+    clients.set_self_address(self);
+    clients.AddClient(self, "L", true);
+    for (int i = 0; i < NUM_CLIENTS && ok; ++i) {
+        ok = read(port_pipe[0], &port, sizeof(port)) == sizeof(port);
+        clients.AddClient(Loopback(port), "c" + to_string(i), false);
+    }
+
+    if (ok) {
+        Payload payload;
+        payload.SetType(STATUS_MSG);
+        payload.SetStatus(CLIENT_JOIN_ACK);
+        payload.SetMessage(clients.GetPayload(), clients.GetPayloadSize());
+        vector<sockaddr_in> all = clients.GetAllClientSockAddressWithoutMe();
+        udp.SendPayloadList(payload, &all);
+        boost::this_thread::sleep_for(boost::chrono::milliseconds(300));
+
+        uint64_t before = udp.GetStats().packets_sent;
+        vector<sockaddr_in> targets = degree > 0 ? clients.GetRelayChildren(self, degree) : all;
+        for (int32_t order = 0; order < NUM_MESSAGES; ++order) {
+            payload.clear();
+            payload.SetType(CHAT_MSG);
+            payload.SetUsername("L");
+            payload.SetMessage(to_string(NowMicros()));
+            payload.SetOrder(order);
+            payload.SetRelayDegree(degree);
+            udp.SendPayloadList(payload, &targets);
+            boost::this_thread::sleep_for(boost::chrono::milliseconds(MESSAGE_INTERVAL));
+        }
+        *leader_packets = udp.GetStats().packets_sent - before;
+    }
+
+    *result = {0, 0, 0};
+    for (int i = 0; i < NUM_CLIENTS; ++i) {
+        Report report;
+        if (ok && read(report_pipe[0], &report, sizeof(report)) == sizeof(report)) {
+            result->received += report.received;
+            result->total_latency += report.total_latency;
+            result->max_latency = max(result->max_latency, report.max_latency);
+        } else {
+            ok = false;
+        }
+    }
+    for (int i = 0; i < NUM_CLIENTS; ++i) {
+        int status;
+        waitpid(pids[i], &status, 0);
+    }
+    udp.Stop();
+    close(port_pipe[0]);
+    close(report_pipe[0]);
+
+    return ok;
+}
+
+int main() {
+    // Every client is reached exactly once, whichever client computes the tree
+    cout << "--- Tree test ---" << endl;
+    ClientManager clients;
+    sockaddr_in leader = Loopback(htons(9100));
+    clients.AddClient(leader, "L", true);
+    for (uint16_t i = 0; i < 16; ++i) {
+        clients.AddClient(Loopback(htons((uint16_t) (9120 - i))), "c" + to_string(i), false);
+    }
+    for (uint32_t degree = 1; degree <= 4; ++degree) {
+        vector<sockaddr_in> frontier = clients.GetRelayChildren(leader, degree);
+        vector<uint16_t> reached;
+        uint32_t depth = 0;
+        CHECK(frontier.size() == degree, "leader sends to degree clients");
+        while (!frontier.empty()) {
+            vector<sockaddr_in> next;
+            for (sockaddr_in &addr : frontier) {
+                reached.push_back(addr.sin_port);
+                vector<sockaddr_in> children = clients.GetRelayChildren(addr, degree);
+                CHECK(children.size() <= degree, "at most degree children");
+                next.insert(next.end(), children.begin(), children.end());
+            }
+            frontier.swap(next);
+            depth++;
+        }
+        sort(reached.begin(), reached.end());
+        CHECK(reached.size() == 16 && unique(reached.begin(), reached.end()) == reached.end(),
+              "every client reached once");
+        cout << "Degree " << degree << ": depth " << depth << endl;
+    }
+    CHECK(clients.GetRelayChildren(Loopback(htons(9000)), 2).empty(), "unknown client relays nothing");
+
+    // Leader egress shrinks to the degree; latency grows with the tree depth
+    cout << "--- Latency test ---" << endl;
+    uint8_t degrees[] = {0, 4, 2, 1};
+    vector<string> rows;
+    for (uint8_t degree : degrees) {
+        Report result;
+        uint64_t leader_packets = 0;
+        CHECK(RunRound(degree, &result, &leader_packets), "round with degree " + to_string(degree));
+        CHECK(result.received == NUM_CLIENTS * NUM_MESSAGES, "every message delivered with degree " +
+                                                             to_string(degree));
+        stringstream row;
+        row << setw(6) << (int) degree << setw(16) << fixed << setprecision(1) <<
+        (double) leader_packets / NUM_MESSAGES << setw(14) << result.total_latency / result.received <<
+        setw(14) << result.max_latency;
+        rows.push_back(row.str());
+    }
+    cout << "Degree  Leader pkt/msg  Avg lat (us)  Max lat (us)" << endl;
+    for (string &row : rows) {
+        cout << row << endl;
+    }
+
+    cout << "All tests passed" << endl;
+    return 0;
+}
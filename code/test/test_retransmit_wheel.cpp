@@ -0,0 +1,158 @@
+/**
+ * Test program for RetransmitWheel
+ */
+
+#include <algorithm>
+#include <iostream>
+
+#include "../include/retransmit_wheel.h"
+#include "test_check.h"
+
+using namespace std;
+using namespace std::chrono;
+
+static vector<uint32_t> fired;
+
+static bool Record(RetransmitWheel::Ticket &ticket) {
+    fired.push_back(ticket.uid);
+    return false;
+}
+
+static bool Resend(RetransmitWheel::Ticket &ticket) {
+    fired.push_back(ticket.uid);
+    if (ticket.retries > 0) {
+        ticket.retries--;
+        ticket.deadline += milliseconds(10);
+        return true;
+    }
+    return false;
+}
+
+static vector<uint32_t> unsent;
+
+static bool Send(RetransmitWheel::Ticket &ticket) {
+    if (ticket.unsent) {
+        unsent.push_back(ticket.uid);
+    }
+    return false;
+}
+
+int main() {
+    RetransmitWheel wheel(1, 64);
+    Payload payload;
+    sockaddr_in addr;
+    milliseconds now = RetransmitWheel::Now();
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(9000);
+    payload.SetAddress(&addr);
+
+    // Arm/cancel
+    cout << "--- Arm/cancel test ---" << endl;
+    CHECK(wheel.Arm(1, 0, now + milliseconds(5), payload), "arm 1");
+    CHECK(!wheel.Arm(1, 0, now + milliseconds(5), payload), "duplicate arm 1");
+    CHECK(wheel.Arm(2, 0, now + milliseconds(20), payload), "arm 2");
+    CHECK(wheel.Arm(3, 0, now + milliseconds(500), payload), "arm 3 (beyond one lap)");
+    CHECK(wheel.Cancel(&addr, 2), "cancel 2");
+    CHECK(!wheel.Cancel(&addr, 2), "cancel 2 twice");
+    CHECK(wheel.size() == 2, "size after cancel");
+
+    // Only expired tickets fire, including the one more than a lap away
+    cout << "--- Expiry test ---" << endl;
+    wheel.Advance(now + milliseconds(4), Record);
+    CHECK(fired.empty(), "nothing expired yet");
+    wheel.Advance(now + milliseconds(6), Record);
+    CHECK(fired.size() == 1 && fired[0] == 1, "ticket 1 fired");
+    wheel.Advance(now + milliseconds(200), Record);
+    CHECK(fired.size() == 1, "ticket 3 not fired after one lap");
+    wheel.Advance(now + milliseconds(501), Record);
+    CHECK(fired.size() == 2 && fired[1] == 3, "ticket 3 fired");
+    CHECK(wheel.is_empty(), "wheel empty");
+
+    // Re-arm from handler
+    cout << "--- Re-arm test ---" << endl;
+    fired.clear();
+    now += milliseconds(1000);
+    wheel.Arm(4, 2, now + milliseconds(10), payload);
+    wheel.Advance(now + milliseconds(10), Resend);
+    wheel.Advance(now + milliseconds(20), Resend);
+    wheel.Advance(now + milliseconds(30), Resend);
+    CHECK(fired.size() == 3 && wheel.is_empty(), "ticket 4 fired three times then released");
+
+    // Cumulative and selective ACKs retire tickets of one peer only
+    cout << "--- Retire test ---" << endl;
+    sockaddr_in other = addr;
+    Payload other_payload;
+    other.sin_port = htons(9001);
+    other_payload.SetAddress(&other);
+    for (uint32_t uid = 19; uid >= 10; --uid) {
+        wheel.Arm(uid, 0, now + milliseconds(100), payload);
+    }
+    for (uint32_t uid = 10; uid < 13; ++uid) {
+        wheel.Arm(uid, 0, now + milliseconds(100), other_payload);
+    }
+    CHECK(!wheel.Arm(10, 0, now + milliseconds(100), payload), "duplicate arm for same peer");
+    AckRange ranges[] = {{15, 16}, {18, 18}, {30, 40}};
+    milliseconds sent;
+    CHECK(wheel.Retire(&addr, 13, ranges, 3, &sent) == 6, "retired 10-12, 15, 16, 18");
+    CHECK(sent > milliseconds::zero(), "send time of fresh tickets reported");
+    CHECK(wheel.size() == 7, "size after retire");
+    CHECK(wheel.Retire(&addr, 13, ranges, 3, NULL) == 0, "same ACK twice");
+    CHECK(wheel.Cancel(&addr, 13) && !wheel.Cancel(&addr, 15), "cancel after retire");
+    CHECK(wheel.Retire(&addr, 20, NULL, 0, NULL) == 3, "cumulative ACK retires the rest");
+    CHECK(wheel.Retire(&other, 0xFFFFFFF0, NULL, 0, NULL) == 0, "ACK from before wrap");
+    CHECK(wheel.Retire(&other, 13, NULL, 0, NULL) == 3 && wheel.is_empty(), "other peer retired");
+
+    // Resent tickets give no round trip sample (Karn)
+    wheel.Arm(20, 1, now + milliseconds(1100), payload);
+    wheel.Advance(now + milliseconds(1100), [](RetransmitWheel::Ticket &ticket) {
+        ticket.resends++;
+        ticket.deadline += milliseconds(100);
+        return true;
+    });
+    CHECK(wheel.Retire(&addr, 21, NULL, 0, &sent) == 1 && sent == milliseconds::zero(), "no sample after resend");
+
+    // One lost payload and a window of newer ones within a timeout: the rest waits for the hole
+    cout << "--- Span test ---" << endl;
+    RetransmitWheel spanned(1, 64);
+    bool held = true;
+    spanned.set_span(64);
+    now = RetransmitWheel::Now();
+    CHECK(spanned.Arm(100, 0, now + milliseconds(1000), payload, &held) && !held, "lost ticket sent");
+    for (uint32_t uid = 101; uid < 164; ++uid) {
+        CHECK(spanned.Arm(uid, 0, now + milliseconds(1000), payload, &held) && !held, "ticket within span sent");
+    }
+    CHECK(spanned.Arm(164, 0, now + milliseconds(1000), payload, &held) && held, "ticket a span ahead held");
+    CHECK(spanned.Arm(166, 0, now + milliseconds(1000), payload, &held) && held, "newer ticket held");
+    CHECK(spanned.Arm(165, 0, now + milliseconds(1000), payload, &held) && held, "reordered ticket held");
+    CHECK(spanned.Arm(10, 0, now + milliseconds(1000), other_payload, &held) && !held, "other peer unaffected");
+    CHECK(!spanned.Arm(164, 0, now + milliseconds(1000), payload, &held) && !held, "held uid already armed");
+    AckRange above = {101, 163};
+    CHECK(spanned.Retire(&addr, 100, &above, 1, NULL) == 63, "everything past the hole acknowledged");
+    spanned.Advance(now + milliseconds(10), Send);
+    CHECK(unsent.empty() && spanned.size() == 5, "held until the hole is acknowledged");
+    CHECK(spanned.Retire(&addr, 101, NULL, 0, NULL) == 1, "hole acknowledged");
+    CHECK(spanned.NextDeadline() == now + milliseconds(11), "held tickets due on the next tick");
+    spanned.Advance(now + milliseconds(11), Send);
+    CHECK(unsent.size() == 3 && spanned.size() == 1, "held tickets fire unsent");
+    CHECK(find(unsent.begin(), unsent.end(), 165) != unsent.end(), "reordered ticket fires too");
+
+    // Wait wakes up for the next deadline
+    cout << "--- Wait test ---" << endl;
+    fired.clear();
+    RetransmitWheel waiter(1, 64);
+    CHECK(waiter.NextDeadline() == milliseconds::max(), "no deadline while empty");
+    now = RetransmitWheel::Now();
+    waiter.Arm(5, 0, now + milliseconds(30), payload);
+    CHECK(waiter.NextDeadline() == now + milliseconds(30), "next deadline of the armed ticket");
+    CHECK(waiter.Wait(), "wait returns while running");
+    milliseconds woke = RetransmitWheel::Now();
+    waiter.Advance(woke, Record);
+    CHECK(fired.size() == 1 && woke >= now + milliseconds(29), "woke at deadline");
+    waiter.Stop();
+    CHECK(!waiter.Wait(), "wait returns FALSE once stopped");
+
+    cout << "All tests passed" << endl;
+    return 0;
+}
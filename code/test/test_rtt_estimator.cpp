@@ -0,0 +1,60 @@
+/**
+ * Test program for RttEstimator
+ */
+
+#include <iostream>
+#include <cstring>
+#include <arpa/inet.h>
+
+#include "../include/rtt_estimator.h"
+#include "test_check.h"
+
+using namespace std;
+
+int main() {
+    RttEstimator estimator(1000, 100, 8000);
+    sockaddr_in lan, wan;
+
+    memset(&lan, 0, sizeof(lan));
+    lan.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    lan.sin_port = htons(9000);
+    wan = lan;
+    wan.sin_port = htons(9001);
+
+    // Unknown peers use the initial timeout and back off from it
+    cout << "--- Initial test ---" << endl;
+    CHECK(estimator.GetRto(&lan, 0) == 1000, "initial timeout");
+    CHECK(estimator.GetRto(&lan, 2) == 4000, "initial timeout backs off");
+    CHECK(estimator.GetRto(&lan, 10) == 8000, "backoff capped");
+
+    // First sample: SRTT = R, RTTVAR = R / 2, RTO = SRTT + 4 * RTTVAR
+    cout << "--- Sample test ---" << endl;
+    estimator.Sample(&wan, 400);
+    CHECK(estimator.GetRto(&wan, 0) == 400 + 4 * 200, "first sample");
+
+    // Steady samples shrink the deviation towards the measured RTT
+    for (int i = 0; i < 50; ++i) {
+        estimator.Sample(&wan, 400);
+    }
+    CHECK(estimator.GetRto(&wan, 0) < 450, "converged to steady RTT");
+    CHECK(estimator.GetRto(&wan, 1) == 2 * estimator.GetRto(&wan, 0), "backoff doubles");
+
+    // A sudden delay raises the timeout through the deviation term
+    uint32_t before = estimator.GetRto(&wan, 0);
+    estimator.Sample(&wan, 1200);
+    CHECK(estimator.GetRto(&wan, 0) > before + 500, "deviation reacts to spike");
+
+    // Fast peers are clamped to the lower bound and kept apart from slow ones
+    cout << "--- Per-peer test ---" << endl;
+    for (int i = 0; i < 10; ++i) {
+        estimator.Sample(&lan, 1);
+    }
+    CHECK(estimator.GetRto(&lan, 0) == 100, "clamped to lower bound");
+    CHECK(estimator.GetStats().size() == 2, "stats for both peers");
+
+    estimator.Clear(&lan);
+    CHECK(estimator.GetRto(&lan, 0) == 1000, "cleared peer uses initial timeout");
+
+    cout << "All tests passed" << endl;
+    return 0;
+}
@@ -0,0 +1,186 @@
+/**
+ * Test program for SequencerBatch
+ *
+ * Checks packing limits, the window and unpacking, then streams ordered messages from a leader
+ * to clients on loopback and compares leader throughput for several batch sizes.
+ */
+
+#include <iostream>
+#include <iomanip>
+
+#include <arpa/inet.h>
+
+#include "../include/udp_wrapper.h"
+#include "../include/sequencer_batch.h"
+#include "test_check.h"
+
+using namespace std;
+
+#define NUM_CLIENTS         4
+#define NUM_MESSAGES        2000
+#define DELIVERY_TIMEOUT    10000   // in miliseconds
+#define BURST_PAYLOADS      32      // Payloads sent before giving the readers a moment
+
+static Payload Chat(const string &username, const string &message) {
+    Payload payload;
+    payload.SetType(CHAT_MSG);
+    payload.SetUsername(username);
+    payload.SetMessage(message);
+    return payload;
+}
+
+// Leader: sequence and send messages in batches of up to size, clients count deliveries
+static bool RunRound(uint32_t size, double *rate, double *packets) {
+    CentralQueues leader_queues, client_queues[NUM_CLIENTS];
+    UdpWrapper leader(&leader_queues);
+    vector<UdpWrapper *> clients;
+    vector<sockaddr_in> addrs;
+    uint32_t received[NUM_CLIENTS] = {};
+    uint16_t port;
+    bool ok = leader.Start("9570", &port) == SUCCESS;
+
+    sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    for (int i = 0; i < NUM_CLIENTS; ++i) {
+        clients.push_back(new UdpWrapper(&client_queues[i]));
+        ok = ok && clients[i]->Start("9570", &port) == SUCCESS;
+        addr.sin_port = port;
+        addrs.push_back(addr);
+    }
+
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    uint64_t before = leader.GetStats().packets_sent;
+    SequencerBatch batch(size, 0);
+    Payload payload;
+    vector<Payload> payloads;
+    int32_t order = 0, sent = 0;
+    for (uint32_t i = 0; i <= NUM_MESSAGES && ok; ++i) {
+        // As JAM does, a full batch goes out before the message that did not fit and the rest at the end
+        Payload chat = Chat("user" + to_string(i % 10), "message " + to_string(i));
+        if (i == NUM_MESSAGES || !batch.Add(chat)) {
+            order += batch.Take(order, &payload);
+            ok = payload.EncodePayload() == SUCCESS && leader.SendPayloadList(payload, &addrs) == SUCCESS;
+            // Loopback drops an unpaced burst of single messages, and the retries would count as leader egress
+            if (++sent % BURST_PAYLOADS == 0) {
+                boost::this_thread::sleep_for(boost::chrono::milliseconds(1));
+            }
+            if (i < NUM_MESSAGES) {
+                batch.Add(chat);
+            }
+        }
+    }
+
+    // Count every message each client gets
+    uint32_t total = 0;
+    while (ok && total < NUM_CLIENTS * NUM_MESSAGES) {
+        ok = chrono::steady_clock::now() - start < chrono::milliseconds(DELIVERY_TIMEOUT);
+        bool idle = true;
+        for (int i = 0; i < NUM_CLIENTS; ++i) {
+            while (client_queues[i].try_pop_udp_in(payload)) {
+                idle = false;
+                uint32_t count = 1;
+                if (payload.GetType() == BATCH_MSG) {
+                    payloads.clear();
+                    ok = ok && SequencerBatch::Unpack(payload, &payloads) == SUCCESS;
+                    count = (uint32_t) payloads.size();
+                }
+                received[i] += count;
+                total += count;
+            }
+        }
+        if (idle) {
+            client_queues[0].wait_for_data(1);
+        }
+    }
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    *rate = NUM_MESSAGES / seconds;
+    *packets = (double) (leader.GetStats().packets_sent - before) / NUM_MESSAGES;
+
+    leader.Stop();
+    for (int i = 0; i < NUM_CLIENTS; ++i) {
+        clients[i]->Stop();
+        ok = ok && received[i] == NUM_MESSAGES;
+        delete clients[i];
+    }
+    return ok;
+}
+
+int main() {
+    // A batch is full at its size or once the next message would not fit one payload
+    cout << "--- Packing test ---" << endl;
+    SequencerBatch batch(3, 0);
+    Payload chat = Chat("Dummy1", "Message 1");
+    Payload payload;
+    CHECK(batch.empty() && !batch.Due(), "empty batch not due");
+    CHECK(batch.Add(chat) && batch.Due(), "zero window due at once");
+    CHECK(batch.Take(7, &payload) == 1 && payload.GetType() == CHAT_MSG && payload.GetOrder() == 7 &&
+          payload.GetMessage() == "Message 1", "single message sent as is");
+
+    CHECK(batch.Add(chat) && batch.Add(chat) && batch.Add(chat) && !batch.Add(chat), "full at size");
+    CHECK(batch.Take(10, &payload) == 3 && payload.GetType() == BATCH_MSG && batch.empty(), "batch taken");
+
+    SequencerBatch large(SEQUENCER_BATCH_SIZE, 0);
+    Payload long_chat = Chat("Dummy2", string(110, 'x'));
+    CHECK(large.Add(long_chat) && large.Add(long_chat) && !large.Add(long_chat) && large.size() == 2,
+          "full at payload length");
+    large.clear();
+    CHECK(large.Add(long_chat) && large.Add(chat) && large.size() == 2, "short message still fits");
+    large.clear();
+    Payload longest = Chat("Dummy3", string(MAX_MESSAGE_LENGTH - 1, 'y'));
+    CHECK(large.Add(longest) && !large.Add(chat) && large.Take(0, &payload) == 1 &&
+          payload.GetType() == CHAT_MSG, "message too long to pack goes alone");
+
+    // Messages come back with consecutive orders, the sender's address and their own user names
+    cout << "--- Unpack test ---" << endl;
+    sockaddr_in leader = {};
+    leader.sin_family = AF_INET;
+    leader.sin_port = htons(9100);
+    batch.Add(chat);
+    Payload chat2 = Chat("Dummy2", "Message 2");
+    batch.Add(chat2);
+    batch.Take(10, &payload);
+    payload.SetAddress(&leader);
+    CHECK(payload.EncodePayload() == SUCCESS, "encode batch");
+    vector<Payload> payloads;
+    CHECK(SequencerBatch::Unpack(payload, &payloads) == SUCCESS && payloads.size() == 2, "unpack");
+    CHECK(payloads[0].GetOrder() == 10 && payloads[1].GetOrder() == 11 && payloads[1].GetUsername() == "Dummy2" &&
+          payloads[1].GetMessage() == "Message 2" && payloads[1].GetAddress()->sin_port == leader.sin_port,
+          "unpacked messages");
+
+    uint8_t broken[] = {6, 'D', 'u', 'm', 'm', 'y', '1', 9, 'M'};
+    payload.SetMessage(broken, sizeof(broken));
+    CHECK(SequencerBatch::Unpack(payload, &payloads) == DECODE_VALIDATION_FAILED && payloads.size() == 2,
+          "truncated batch rejected whole");
+
+    // The first message waits at most the window
+    cout << "--- Window test ---" << endl;
+    SequencerBatch windowed(SEQUENCER_BATCH_SIZE, 50);
+    CHECK(windowed.GetTimeout(JAM_CENTRAL_TIMEOUT) == JAM_CENTRAL_TIMEOUT, "no wait while empty");
+    windowed.Add(chat);
+    CHECK(!windowed.Due() && windowed.GetTimeout(JAM_CENTRAL_TIMEOUT) <= 50 &&
+          windowed.GetTimeout(10) == 10, "waiting within window");
+    boost::this_thread::sleep_for(boost::chrono::milliseconds(windowed.GetTimeout(JAM_CENTRAL_TIMEOUT) + 1));
+    CHECK(windowed.Due() && windowed.GetTimeout(JAM_CENTRAL_TIMEOUT) == 0, "due after window");
+
+    // Leader egress drops with the batch size, so more messages get through per second
+    cout << "--- Throughput test ---" << endl;
+    uint32_t sizes[] = {1, 4, SEQUENCER_BATCH_SIZE};
+    vector<string> rows;
+    for (uint32_t size : sizes) {
+        double rate, packets;
+        CHECK(RunRound(size, &rate, &packets), "round with batch size " + to_string(size));
+        CHECK(packets <= (double) NUM_CLIENTS / size * 1.1, "leader packets with batch size " + to_string(size));
+        stringstream row;
+        row << setw(10) << size << setw(16) << fixed << setprecision(2) << packets << setw(12) <<
+        setprecision(0) << rate;
+        rows.push_back(row.str());
+    }
+    cout << "Batch size  Leader pkt/msg   Messages/s" << endl;
+    for (string &row : rows) {
+        cout << row << endl;
+    }
+
+    cout << "All tests passed" << endl;
+    return 0;
+}
@@ -0,0 +1,110 @@
+/**
+ * Test program for ShardRuntime
+ *
+ * Leads three groups on two shards, joins each of them from one client and has one order a chat
+ * message, then stops the runtime and waits for the leader's goodbye.
+ */
+
+#include <iostream>
+#include <chrono>
+#include <poll.h>
+
+#include "../include/shard_runtime.h"
+#include "test_check.h"
+
+using namespace std;
+
+#define TEST_INTERFACE      "lo"
+#define NUM_GROUPS          3
+#define NUM_SHARDS          2
+#define RECEIVE_TIMEOUT     5000    // in miliseconds
+
+// Run the client until a payload of the given type comes in from addr; status -1 takes any
+static bool Receive(UdpWrapper &client, CentralQueues &queues, const sockaddr_in &addr, MessageType type,
+                    int status, Payload *payload) {
+    chrono::steady_clock::time_point end = chrono::steady_clock::now() + chrono::milliseconds(RECEIVE_TIMEOUT);
+    pollfd fd = {client.get_fds()[0], POLLIN, 0};
+
+    while (chrono::steady_clock::now() < end) {
+        client.Send();
+        if (poll(&fd, 1, 10) > 0) {
+            client.Receive(fd.fd);
+        }
+        client.RunTimers();
+        queues.take_ready();
+        while (queues.try_pop_udp_in(*payload)) {
+            if (payload->GetType() == type && (status < 0 || payload->GetStatus() == status) &&
+                payload->GetAddress()->sin_port == addr.sin_port) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+int main() {
+    ShardRuntime runtime(NUM_SHARDS);
+    sockaddr_in addrs[NUM_GROUPS];
+
+    // Groups go round the shards; core 0 exists everywhere
+    cout << "--- Start test ---" << endl;
+    runtime.set_cores(vector<int>(1, 0));
+    for (uint32_t i = 0; i < NUM_GROUPS; ++i) {
+        CHECK(runtime.AddGroup("Leader" + to_string(i), TEST_INTERFACE, "9500") == i % NUM_SHARDS, "shard of group");
+    }
+    CHECK(runtime.size() == NUM_SHARDS && runtime.Start() == NUM_GROUPS, "every group started");
+    CHECK(runtime.is_pinned(0) && runtime.is_pinned(1), "shards pinned");
+    for (uint32_t i = 0; i < NUM_GROUPS; ++i) {
+        CHECK(runtime.get_group_address(i, &addrs[i]), "group address");
+        CHECK(i == 0 || addrs[i].sin_port != addrs[i - 1].sin_port, "a socket per group");
+    }
+    CHECK(!runtime.get_group_address(NUM_GROUPS, &addrs[0]), "no such group");
+
+    CentralQueues queues;
+    UdpWrapper client(&queues);
+    uint16_t client_port;
+    CHECK(client.Start("9510", &client_port) == SUCCESS, "start client");
+
+    // Every group answers a join, whichever shard hosts it
+    cout << "--- Join test ---" << endl;
+    Payload payload, received;
+    for (uint32_t i = 0; i < NUM_GROUPS; ++i) {
+        payload.clear();
+        payload.SetType(STATUS_MSG);
+        payload.SetStatus(CLIENT_JOIN);
+        payload.SetUsername("Client");
+        CHECK(client.SendPayloadSingle(payload, &addrs[i]) == SUCCESS, "send join");
+        CHECK(Receive(client, queues, addrs[i], STATUS_MSG, CLIENT_JOIN_ACK, &received),
+              "join acknowledged by group " + to_string(i));
+    }
+
+    // Once a member, a chat message comes back with its order
+    cout << "--- Chat test ---" << endl;
+    uint8_t version = PAYLOAD_HEADER_VERSION;
+    payload.clear();
+    payload.SetType(STATUS_MSG);
+    payload.SetStatus(CLIENT_JOIN_MULTICAST);
+    payload.SetUsername("Client");
+    payload.SetOrder(DEFAULT_NO_ORDER);
+    payload.SetMessage(&version, 1);
+    CHECK(client.SendPayloadSingle(payload, &addrs[1]) == SUCCESS, "announce client");
+    payload.clear();
+    payload.SetType(CHAT_MSG);
+    payload.SetUsername("Client");
+    payload.SetOrder(DEFAULT_NO_ORDER);
+    payload.SetMessage("Message 1");
+    CHECK(client.SendPayloadSingle(payload, &addrs[1]) == SUCCESS, "send chat message");
+    CHECK(Receive(client, queues, addrs[1], CHAT_MSG, -1, &received) &&
+          received.GetOrder() == DEFAULT_FIRST_ORDER && received.GetMessage() == "Message 1", "ordered message");
+
+    // Stopping makes each group say goodbye to its members
+    cout << "--- Stop test ---" << endl;
+    runtime.Stop();
+    runtime.Join();
+    CHECK(Receive(client, queues, addrs[1], STATUS_MSG, LEADER_LEAVE, &received), "leader left");
+
+    client.Stop();
+
+    cout << "All tests passed" << endl;
+    return 0;
+}
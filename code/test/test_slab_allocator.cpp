@@ -0,0 +1,117 @@
+/**
+ * Test program for SlabAllocator and heap use of the send/ACK cycle
+ */
+
+#include <iostream>
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+#include "../include/udp_wrapper.h"
+#include "test_check.h"
+
+using namespace std;
+
+// Every heap allocation of the program, from any thread, goes through here
+static atomic<size_t> allocations(0);
+
+void *operator new(size_t size) {
+    allocations++;
+    void *p = malloc(size);
+    if (p == NULL) {
+        throw bad_alloc();
+    }
+    return p;
+}
+
+void operator delete(void *p) noexcept {
+    free(p);
+}
+
+int main() {
+    // Handles are reused from the free list and a full allocator grows by one slab
+    cout << "--- Slab test ---" << endl;
+    SlabAllocator<int> slab(3);
+    SlabStats stats = slab.GetStats();
+    CHECK(stats.capacity == 4 && stats.free == 4 && stats.slabs == 1, "capacity rounded up");
+    uint32_t handles[5];
+    for (uint32_t i = 0; i < 4; ++i) {
+        handles[i] = slab.Allocate();
+        slab[handles[i]] = (int) i;
+    }
+    int *first = &slab[handles[0]];
+    slab.Free(handles[2]);
+    CHECK(slab.Allocate() == handles[2], "freed handle reused first");
+    stats = slab.GetStats();
+    CHECK(stats.in_use == 4 && stats.free == 0 && stats.high_water == 4, "all in use");
+    handles[4] = slab.Allocate();
+    stats = slab.GetStats();
+    CHECK(stats.slabs == 2 && stats.capacity == 8 && stats.high_water == 5, "slab added when full");
+    CHECK(&slab[handles[0]] == first && slab[handles[3]] == 3, "objects stay in place");
+    for (uint32_t handle : handles) {
+        slab.Free(handle);
+    }
+    CHECK(slab.GetStats().in_use == 0 && slab.GetStats().high_water == 5, "high-water mark kept");
+
+    // Send a window of payloads between two wrappers on loopback and wait for every ACK, over and over
+    cout << "--- Send/ACK cycle test ---" << endl;
+    CentralQueues sender_queues, receiver_queues;
+    UdpWrapper sender(&sender_queues);
+    UdpWrapper receiver(&receiver_queues);
+    uint16_t port;
+    CHECK(sender.Start("9580", &port) == SUCCESS, "start sender");
+    CHECK(receiver.Start("9580", &port) == SUCCESS, "start receiver");
+    sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_port = port;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    Payload payload;
+    payload.SetType(CHAT_MSG);
+    payload.SetUsername("Dummy1");
+    payload.SetMessage("Message 1");
+    payload.SetOrder(0);
+    CHECK(payload.EncodePayload() == SUCCESS, "encode");
+
+    const uint32_t window = 64;
+    Payload received;
+    size_t before = 0;
+    bool ok = true;
+    for (uint32_t round = 0; round < 20 && ok; ++round) {
+        // First round warms up the pools, queues, wheel and peer entries
+        if (round == 1) {
+            before = allocations;
+        }
+
+        for (uint32_t i = 0; i < window; ++i) {
+            ok = ok && sender.SendPayloadSingle(payload, &addr) == SUCCESS;
+        }
+
+        // Receiver hands every payload to JAM and the sender retires every ticket on its ACKs
+        chrono::steady_clock::time_point until = chrono::steady_clock::now() + chrono::milliseconds(UDP_TIMEOUT);
+        uint32_t count = 0;
+        while (ok && (count < window || sender.GetStats().tickets_pending > 0)) {
+            ok = chrono::steady_clock::now() < until;
+            while (receiver_queues.try_pop_udp_in(received)) {
+                count++;
+            }
+            receiver_queues.wait_for_data(1);
+        }
+        ok = ok && count == window;
+    }
+    size_t steady = allocations - before;
+    UdpWrapper::UdpStats udp_stats = sender.GetStats();
+    sender.Stop();
+    receiver.Stop();
+    CHECK(ok, "every payload delivered and acknowledged");
+    cout << "Heap allocations in steady state: " << steady << endl;
+    CHECK(steady == 0, "no heap allocation per message");
+    CHECK(receiver.GetStats().acks_sent > 0 && udp_stats.packets_sent == 20 * window, "delayed ACKs, no resends");
+
+    stats = PayloadBuffer::GetPoolStats();
+    cout << "Payload pool high-water mark: " << stats.high_water << endl;
+    CHECK(stats.slabs == 1, "payload pool statistics");
+
+    cout << "All tests passed" << endl;
+    return 0;
+}
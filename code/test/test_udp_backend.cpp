@@ -0,0 +1,151 @@
+/**
+ * Test program for UdpBackend
+ *
+ * Sends batches between two loopback sockets through whichever backend the build has, then
+ * checks a receive times out like the socket does.
+ */
+
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+
+#include "../include/udp_backend.h"
+#include "test_check.h"
+
+using namespace std;
+
+#define BATCH_SIZE          16
+#define NUM_BATCHES         2000
+#define DATAGRAM_LENGTH     100
+
+static int OpenSocket(sockaddr_in *addr) {
+    socklen_t length = sizeof(sockaddr_in);
+    int fd = socket(AF_INET, SOCK_DGRAM, 0);
+
+    memset(addr, 0, sizeof(sockaddr_in));
+    addr->sin_family = AF_INET;
+    addr->sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (fd < 0 || bind(fd, (sockaddr *) addr, sizeof(sockaddr_in)) != 0 ||
+        getsockname(fd, (sockaddr *) addr, &length) != 0) {
+        return -1;
+    }
+    return fd;
+}
+
+// Describe count datagrams of buffers, to or from addrs
+static void SetMessages(msghdr *msgs, iovec *iovs, uint8_t (*buffers)[DATAGRAM_LENGTH], sockaddr_in *addrs,
+                        uint32_t count) {
+    memset(msgs, 0, sizeof(msghdr) * count);
+    for (uint32_t i = 0; i < count; ++i) {
+        iovs[i].iov_base = buffers[i];
+        iovs[i].iov_len = DATAGRAM_LENGTH;
+        msgs[i].msg_name = &addrs[i];
+        msgs[i].msg_namelen = sizeof(sockaddr_in);
+        msgs[i].msg_iov = &iovs[i];
+        msgs[i].msg_iovlen = 1;
+    }
+}
+
+// Receive until count datagrams arrived or the receive fails
+static uint32_t ReceiveAll(UdpBackend &io, uint8_t (*buffers)[DATAGRAM_LENGTH], sockaddr_in *addrs, int *sizes,
+                           uint32_t count) {
+    msghdr msgs[BATCH_SIZE];
+    iovec iovs[BATCH_SIZE];
+    uint32_t received = 0;
+
+    while (received < count) {
+        SetMessages(msgs, iovs, buffers + received, addrs + received, count - received);
+        int n = io.Receive(msgs, sizes + received, count - received);
+        if (n <= 0) {
+            break;
+        }
+        received += n;
+    }
+    return received;
+}
+
+int main() {
+    sockaddr_in tx_addr, rx_addr;
+    int tx_fd = OpenSocket(&tx_addr), rx_fd = OpenSocket(&rx_addr);
+    CHECK(tx_fd >= 0 && rx_fd >= 0, "loopback sockets");
+
+    // Generous timeout so a lost datagram fails the test instead of hanging it
+    timeval timeout = {2, 0};
+    CHECK(setsockopt(rx_fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)) == 0, "receive timeout");
+
+    UdpBackend tx(tx_fd), rx(rx_fd);
+    cout << "Backend: " << (tx.is_uring() ? "io_uring" : "socket calls") << endl;
+
+    // A batch arrives whole and in order; a message without iovec is skipped
+    cout << "--- Batch test ---" << endl;
+    uint8_t out[BATCH_SIZE][DATAGRAM_LENGTH], in[BATCH_SIZE][DATAGRAM_LENGTH];
+    sockaddr_in to[BATCH_SIZE], from[BATCH_SIZE];
+    msghdr msgs[BATCH_SIZE];
+    iovec iovs[BATCH_SIZE];
+    bool sent[BATCH_SIZE];
+    int sizes[BATCH_SIZE];
+    for (uint32_t i = 0; i < BATCH_SIZE; ++i) {
+        memset(out[i], (int) i, DATAGRAM_LENGTH);
+        to[i] = rx_addr;
+    }
+    SetMessages(msgs, iovs, out, to, BATCH_SIZE);
+    for (uint32_t i = 0; i < BATCH_SIZE; ++i) {
+        iovs[i].iov_len = DATAGRAM_LENGTH - i;
+    }
+    msgs[3].msg_iovlen = 0;
+    CHECK(tx.Send(msgs, sent, BATCH_SIZE) > 0, "batch sent");
+    for (uint32_t i = 0; i < BATCH_SIZE; ++i) {
+        CHECK(sent[i] == (i != 3), "sent flag " + to_string(i));
+    }
+    CHECK(ReceiveAll(rx, in, from, sizes, BATCH_SIZE - 1) == BATCH_SIZE - 1, "batch received");
+    for (uint32_t i = 0, j = 0; i < BATCH_SIZE; ++i) {
+        if (i == 3) {
+            continue;
+        }
+        CHECK(sizes[j] == (int) (DATAGRAM_LENGTH - i) && in[j][0] == i && in[j][sizes[j] - 1] == i,
+              "datagram " + to_string(i));
+        CHECK(from[j].sin_addr.s_addr == tx_addr.sin_addr.s_addr && from[j].sin_port == tx_addr.sin_port,
+              "sender of datagram " + to_string(i));
+        j++;
+    }
+
+    // Single datagrams go through the same way
+    SetMessages(msgs, iovs, out, to, 1);
+    CHECK(tx.Send(msgs, sent, 1) == 1 && sent[0], "single sent");
+    CHECK(ReceiveAll(rx, in, from, sizes, 1) == 1 && sizes[0] == DATAGRAM_LENGTH, "single received");
+
+    // Nothing to receive gives EAGAIN once SO_RCVTIMEO passes
+    cout << "--- Timeout test ---" << endl;
+    sockaddr_in idle_addr;
+    int idle_fd = OpenSocket(&idle_addr);
+    timeval short_timeout = {0, 50000};
+    CHECK(idle_fd >= 0 && setsockopt(idle_fd, SOL_SOCKET, SO_RCVTIMEO, &short_timeout,
+                                     sizeof(short_timeout)) == 0, "idle socket");
+    UdpBackend idle(idle_fd);
+    SetMessages(msgs, iovs, in, from, BATCH_SIZE);
+    CHECK(idle.Receive(msgs, sizes, BATCH_SIZE) == -1 && errno == EAGAIN, "receive timed out");
+
+    // Datagrams moved per second in whole batches
+    cout << "--- Benchmark ---" << endl;
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    uint32_t total = 0;
+    for (uint32_t i = 0; i < NUM_BATCHES; ++i) {
+        SetMessages(msgs, iovs, out, to, BATCH_SIZE);
+        tx.Send(msgs, sent, BATCH_SIZE);
+        total += ReceiveAll(rx, in, from, sizes, BATCH_SIZE);
+    }
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    CHECK(total == NUM_BATCHES * BATCH_SIZE, "every datagram of the benchmark");
+    cout << fixed << setprecision(0) << "Datagrams/s in batches of " << BATCH_SIZE << ": " << total / seconds <<
+    endl;
+
+    close(idle_fd);
+    close(tx_fd);
+    close(rx_fd);
+
+    cout << "All tests passed" << endl;
+    return 0;
+}
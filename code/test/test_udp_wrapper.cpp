@@ -6,15 +6,370 @@
  */
 
 #include <iostream>
+#include <iomanip>
+#include <chrono>
 
 #include <ifaddrs.h>
 #include <arpa/inet.h>
 
 #include "../include/udp_wrapper.h"
+#include "test_check.h"
 
 using namespace std;
 
+#define TEST_MULTICAST_GROUP    "239.255.46.2"
+#define TEST_MULTICAST_PORT     "9445"
+
+#define NUM_SENDERS             8
+#define NUM_SENDER_PAYLOADS     100
+#define DELIVERY_TIMEOUT        10000   // in miliseconds
+#define BATCH_TEST_PAYLOADS     64
+#define ACK_TEST_ROUNDS         200
+#define ACK_TEST_DELAY          60      // in miliseconds, below UDP_MIN_TIMEOUT so nothing is resent
+
+// Wait for the next incoming payload of a wrapper
+static bool Receive(CentralQueues &queues, Payload *payload) {
+    for (int i = 0; i < 10; ++i) {
+        queues.take_ready();
+        if (queues.try_pop_udp_in(*payload)) {
+            return true;
+        }
+        queues.wait_for_data(100);
+    }
+    return false;
+}
+
+// Senders on their own ports blast one receiver; every payload must arrive exactly once
+static bool RunSharedPort(uint32_t readers, double *rate) {
+    CentralQueues queues, sender_queues[NUM_SENDERS];
+    UdpWrapper receiver(&queues);
+    vector<UdpWrapper *> senders;
+    uint16_t port, sender_port;
+
+    receiver.set_reader_count(readers);
+    bool ok = receiver.Start("9460", &port) == SUCCESS;
+    sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = port;
+    vector<sockaddr_in> list(1, addr);
+    for (int i = 0; i < NUM_SENDERS; ++i) {
+        senders.push_back(new UdpWrapper(&sender_queues[i]));
+        ok = ok && senders[i]->Start("9470", &sender_port) == SUCCESS;
+    }
+
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    Payload payload, received;
+    payload.SetType(CHAT_MSG);
+    payload.SetMessage("Shared port");
+    vector<vector<bool>> seen(NUM_SENDERS, vector<bool>(NUM_SENDER_PAYLOADS, false));
+    uint32_t total = 0, sent = 0;
+    while (ok && total < NUM_SENDERS * NUM_SENDER_PAYLOADS) {
+        ok = chrono::steady_clock::now() - start < chrono::milliseconds(DELIVERY_TIMEOUT);
+
+        // A round from every sender, then drain what came in
+        for (int i = 0; i < NUM_SENDERS && ok && sent < NUM_SENDER_PAYLOADS; ++i) {
+            payload.SetUsername("Sender" + to_string(i));
+            payload.SetOrder(sent);
+            ok = payload.EncodePayload() == SUCCESS && senders[i]->SendPayloadList(payload, &list) == SUCCESS;
+        }
+        sent++;
+        queues.take_ready();
+        while (ok && queues.try_pop_udp_in(received)) {
+            uint32_t sender = (uint32_t) stoi(received.GetUsername().substr(6));
+            int32_t order = received.GetOrder();
+            ok = sender < NUM_SENDERS && order >= 0 && order < NUM_SENDER_PAYLOADS && !seen[sender][order];
+            if (ok) {
+                seen[sender][order] = true;
+                total++;
+            }
+        }
+        if (sent >= NUM_SENDER_PAYLOADS) {
+            queues.wait_for_data(10);
+        }
+    }
+    *rate = total / chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    receiver.Stop();
+    for (int i = 0; i < NUM_SENDERS; ++i) {
+        senders[i]->Stop();
+        delete senders[i];
+    }
+    return ok;
+}
+
+// Wait for every payload a wrapper sent to be acknowledged
+static bool WaitAcked(UdpWrapper &sender) {
+    for (int i = 0; i < 100 && sender.GetStats().tickets_pending > 0; ++i) {
+        boost::this_thread::sleep_for(boost::chrono::milliseconds(10));
+    }
+    return sender.GetStats().tickets_pending == 0;
+}
+
+// Send count payloads and wait for every one to arrive and be acknowledged
+static bool Exchange(UdpWrapper &sender, CentralQueues &receiver_queues, const sockaddr_in *addr, uint32_t count) {
+    Payload payload, received;
+    payload.SetType(CHAT_MSG);
+    payload.SetUsername("Dummy1");
+    for (uint32_t i = 0; i < count; ++i) {
+        payload.SetOrder(i);
+        payload.SetMessage("Message " + to_string(i));
+        if (payload.EncodePayload() != SUCCESS || sender.SendPayloadSingle(payload, addr) != SUCCESS) {
+            return false;
+        }
+    }
+    for (uint32_t i = 0; i < count; ++i) {
+        if (!Receive(receiver_queues, &received) || received.GetOrder() != (int32_t) i) {
+            return false;
+        }
+    }
+    return WaitAcked(sender);
+}
+
+// A sender stops and a new one binds its port while the receiver keeps running
+static bool RunRestart() {
+    CentralQueues receiver_queues, first_queues, second_queues;
+    UdpWrapper receiver(&receiver_queues);
+    uint16_t receiver_port, first_port, second_port;
+
+    bool ok = receiver.Start("9490", &receiver_port) == SUCCESS;
+    sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = receiver_port;
+
+    UdpWrapper *first = new UdpWrapper(&first_queues);
+    ok = ok && first->Start("9495", &first_port) == SUCCESS && Exchange(*first, receiver_queues, &addr, 3);
+    first->Stop();
+    delete first;
+
+    UdpWrapper second(&second_queues);
+    ok = ok && second.Start("9495", &second_port) == SUCCESS && second_port == first_port &&
+         Exchange(second, receiver_queues, &addr, 3);
+    second.Stop();
+    receiver.Stop();
+    return ok;
+}
+
+// Send a payload numbered order and wait for it to arrive
+static bool SendOne(UdpWrapper &sender, CentralQueues &receiver_queues, const sockaddr_in *addr, int32_t order) {
+    Payload payload, received;
+    payload.SetType(CHAT_MSG);
+    payload.SetUsername("Dummy1");
+    payload.SetOrder(order);
+    payload.SetMessage("Message " + to_string(order));
+    return payload.EncodePayload() == SUCCESS && sender.SendPayloadSingle(payload, addr) == SUCCESS &&
+           Receive(receiver_queues, &received) && received.GetOrder() == order;
+}
+
+// Client and server take turns sending ACK_TEST_ROUNDS payloads each; counts are of both wrappers
+static bool RunRequestReply(uint32_t ack_delay, uint64_t *packets, uint64_t *piggybacked) {
+    CentralQueues client_queues, server_queues;
+    UdpWrapper client(&client_queues), server(&server_queues);
+    uint16_t client_port, server_port;
+
+    client.set_ack_delay(ack_delay);
+    server.set_ack_delay(ack_delay);
+    bool ok = client.Start("9500", &client_port) == SUCCESS && server.Start("9500", &server_port) == SUCCESS;
+    sockaddr_in client_addr = {};
+    client_addr.sin_family = AF_INET;
+    client_addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    client_addr.sin_port = client_port;
+    sockaddr_in server_addr = client_addr;
+    server_addr.sin_port = server_port;
+
+    for (int32_t i = 0; ok && i < ACK_TEST_ROUNDS; ++i) {
+        ok = SendOne(client, server_queues, &server_addr, i) && SendOne(server, client_queues, &client_addr, i);
+    }
+    // The ACK of the last reply has nothing to ride on
+    ok = ok && WaitAcked(client) && WaitAcked(server);
+
+    UdpWrapper::UdpStats client_stats = client.GetStats();
+    UdpWrapper::UdpStats server_stats = server.GetStats();
+    *packets = client_stats.packets_sent + server_stats.packets_sent;
+    *piggybacked = client_stats.acks_piggybacked + server_stats.acks_piggybacked;
+    client.Stop();
+    server.Stop();
+    return ok;
+}
+
+// A sender's ACK_COALESCE_THRESHOLD-th payload flushes its delayed ACK, fewer wait out the delay
+static bool RunCoalesce() {
+    CentralQueues sender_queues, receiver_queues;
+    UdpWrapper sender(&sender_queues), receiver(&receiver_queues);
+    uint16_t sender_port, receiver_port;
+
+    receiver.set_ack_delay(ACK_TEST_DELAY);
+    bool ok = sender.Start("9510", &sender_port) == SUCCESS && receiver.Start("9510", &receiver_port) == SUCCESS;
+    sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = receiver_port;
+
+    for (int32_t i = 0; ok && i < ACK_COALESCE_THRESHOLD; ++i) {
+        ok = SendOne(sender, receiver_queues, &addr, i);
+    }
+    boost::this_thread::sleep_for(boost::chrono::milliseconds(ACK_TEST_DELAY / 3));
+    ok = ok && sender.GetStats().tickets_pending == 0 && receiver.GetStats().acks_sent == 1;
+
+    ok = ok && SendOne(sender, receiver_queues, &addr, ACK_COALESCE_THRESHOLD) &&
+         SendOne(sender, receiver_queues, &addr, ACK_COALESCE_THRESHOLD + 1);
+    boost::this_thread::sleep_for(boost::chrono::milliseconds(ACK_TEST_DELAY / 3));
+    ok = ok && sender.GetStats().tickets_pending == 2 && receiver.GetStats().acks_sent == 1;
+
+    // FlushAcks() sends it alone once due
+    ok = ok && WaitAcked(sender) && receiver.GetStats().acks_sent == 2;
+    sender.Stop();
+    receiver.Stop();
+    return ok;
+}
+
+// One sender hands a burst to one receiver over loopback; both use batch_size
+static bool RunBatching(uint32_t batch_size, UdpWrapper::UdpStats *sender_stats,
+                        UdpWrapper::UdpStats *receiver_stats) {
+    CentralQueues sender_queues, receiver_queues;
+    UdpWrapper sender(&sender_queues), receiver(&receiver_queues);
+    uint16_t sender_port, receiver_port;
+
+    sender.set_batch_size(batch_size);
+    receiver.set_batch_size(batch_size);
+    bool ok = sender.Start("9520", &sender_port) == SUCCESS && receiver.Start("9520", &receiver_port) == SUCCESS;
+    sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = receiver_port;
+
+    // The whole list reaches the writer at once
+    Payload payload, received;
+    payload.SetType(CHAT_MSG);
+    payload.SetUsername("Dummy1");
+    payload.SetMessage("Message 1");
+    vector<sockaddr_in> list(BATCH_TEST_PAYLOADS, addr);
+    ok = ok && sender.SendPayloadList(payload, &list) == SUCCESS;
+    for (uint32_t i = 0; ok && i < BATCH_TEST_PAYLOADS; ++i) {
+        ok = Receive(receiver_queues, &received);
+    }
+    ok = ok && WaitAcked(sender);
+
+    *sender_stats = sender.GetStats();
+    *receiver_stats = receiver.GetStats();
+    sender.Stop();
+    receiver.Stop();
+    return ok;
+}
+
 int main() {
+    CentralQueues leader_queues, member_queues, unicast_queues;
+    UdpWrapper leader(&leader_queues), member(&member_queues), unicast(&unicast_queues);
+    uint16_t leader_port, member_port, unicast_port;
+
+    CHECK(leader.Start("9440", &leader_port) == SUCCESS && member.Start("9440", &member_port) == SUCCESS &&
+          unicast.Start("9440", &unicast_port) == SUCCESS, "start");
+
+    sockaddr_in loopback = {};
+    loopback.sin_family = AF_INET;
+    loopback.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    sockaddr_in unicast_addr = loopback;
+    unicast_addr.sin_port = unicast_port;
+
+    // Readers sharing the port together get every payload once, as a single reader does
+    cout << "--- Shared port test ---" << endl;
+    double single_rate, shared_rate;
+    CHECK(RunSharedPort(1, &single_rate), "single reader");
+    CHECK(RunSharedPort(4, &shared_rate), "four readers sharing the port");
+    cout << fixed << setprecision(0) << "Payloads/s with 1 reader: " << single_rate << ", with 4 readers: " <<
+    shared_rate << " (" << boost::thread::hardware_concurrency() << " cores)" << endl;
+
+    // Another wrapper sharing its port would take some of its payloads, so it gets its own
+    CentralQueues shared_queues, other_queues;
+    UdpWrapper shared(&shared_queues), other(&other_queues);
+    uint16_t shared_port, other_port;
+    shared.set_reader_count(4);
+    other.set_reader_count(4);
+    CHECK(shared.Start("9480", &shared_port) == SUCCESS && other.Start("9480", &other_port) == SUCCESS &&
+          shared_port != other_port, "port not shared with another wrapper");
+    shared.Stop();
+    other.Stop();
+
+    // A sender restarted on the same port has its payloads delivered, not taken for duplicates
+    cout << "--- Restart test ---" << endl;
+    CHECK(RunRestart(), "restarted sender delivered");
+
+    // Bursts move several datagrams per system call unless batching is off
+    cout << "--- Batching test ---" << endl;
+    UdpWrapper::UdpStats sender_stats, receiver_stats;
+    CHECK(RunBatching(UDP_BATCH_SIZE, &sender_stats, &receiver_stats), "batched burst");
+    cout << "Batched: " << sender_stats.packets_sent << " packets in " << sender_stats.send_calls <<
+    " send calls, " << receiver_stats.packets_received << " in " << receiver_stats.recv_calls << " receive calls" <<
+    endl;
+    CHECK(sender_stats.packets_sent == BATCH_TEST_PAYLOADS && sender_stats.send_calls < sender_stats.packets_sent &&
+          receiver_stats.packets_received == BATCH_TEST_PAYLOADS &&
+          receiver_stats.recv_calls < receiver_stats.packets_received, "several datagrams per call");
+    CHECK(RunBatching(1, &sender_stats, &receiver_stats), "unbatched burst");
+    CHECK(sender_stats.send_calls == sender_stats.packets_sent &&
+          sender_stats.recv_calls == sender_stats.packets_received &&
+          receiver_stats.send_calls == receiver_stats.packets_sent &&
+          receiver_stats.recv_calls == receiver_stats.packets_received, "one datagram per call");
+
+    // Each payload carries the ACK of the one before it; only the last ACK goes alone
+    cout << "--- Delayed ACK test ---" << endl;
+    uint64_t delayed_packets, delayed_piggybacked, immediate_packets, immediate_piggybacked;
+    CHECK(RunRequestReply(ACK_TEST_DELAY, &delayed_packets, &delayed_piggybacked), "delayed ACK rounds");
+    CHECK(RunRequestReply(0, &immediate_packets, &immediate_piggybacked), "immediate ACK rounds");
+    cout << "Datagrams for " << ACK_TEST_ROUNDS << " rounds: " << delayed_packets << " with delayed ACKs, " <<
+    immediate_packets << " without" << endl;
+    // A payload may leave before the reader owes the ACK it would carry; the next one covers both
+    CHECK(delayed_piggybacked > 0 && delayed_piggybacked < 2 * ACK_TEST_ROUNDS &&
+          delayed_packets == 2 * ACK_TEST_ROUNDS + 1, "ACKs piggybacked");
+    CHECK(immediate_piggybacked == 0 && immediate_packets == 4 * ACK_TEST_ROUNDS, "ACKs sent at once");
+    CHECK(RunCoalesce(), "ACKs coalesced");
+
+    // Joining needs a multicast route on loopback (e.g. "ip link set lo multicast on")
+    cout << "--- Multicast test ---" << endl;
+    CHECK(member.SendPayloadMulticast(Payload()) == UDP_NOT_INIT_ERROR, "send before joining");
+    if (leader.StartMulticast(TEST_MULTICAST_GROUP, TEST_MULTICAST_PORT, &loopback) != SUCCESS ||
+        member.StartMulticast(TEST_MULTICAST_GROUP, TEST_MULTICAST_PORT, &loopback) != SUCCESS) {
+        cout << "SKIPPED: multicast group unavailable" << endl;
+        leader.Stop();
+        member.Stop();
+        unicast.Stop();
+        return 0;
+    }
+    CHECK(leader.is_multicast_ready() && !unicast.is_multicast_ready(), "joined");
+
+    // One group datagram reaches every member, the unicast fallback gets its own copy
+    Payload payload;
+    payload.SetType(CHAT_MSG);
+    payload.SetUsername("Dummy1");
+    payload.SetMessage("Message 1");
+    payload.SetOrder(3);
+    CHECK(payload.EncodePayload() == SUCCESS, "encode");
+    CHECK(leader.SendPayloadMulticast(payload) == SUCCESS, "send to group");
+    vector<sockaddr_in> list(1, unicast_addr);
+    CHECK(leader.SendPayloadList(payload, &list) == SUCCESS, "send to unicast client");
+
+    Payload received;
+    CHECK(Receive(member_queues, &received), "member receives");
+    CHECK(received.GetOrder() == 3 && received.GetMessage() == "Message 1" &&
+          received.GetAddress()->sin_port == leader_port, "member payload from leader's address");
+    CHECK(Receive(leader_queues, &received) && received.GetOrder() == 3, "leader receives own group datagram");
+    CHECK(Receive(unicast_queues, &received) && received.GetOrder() == 3, "unicast client receives");
+
+    // Group datagrams are not acknowledged, so only the unicast copy was
+    boost::this_thread::sleep_for(boost::chrono::milliseconds(100));
+    UdpWrapper::UdpStats leader_stats = leader.GetStats();
+    UdpWrapper::UdpStats member_stats = member.GetStats();
+    cout << "Leader sent " << leader_stats.packets_sent << " packets (" << leader_stats.multicast_sent <<
+    " multicast), member sent " << member_stats.packets_sent << endl;
+    CHECK(leader_stats.multicast_sent == 1 && leader_stats.multicast_received == 1, "leader counters");
+    CHECK(member_stats.multicast_received == 1 && member_stats.packets_sent == 0, "member sends no ACK");
+    CHECK(leader.GetRttStats().size() == 1 && leader.GetRttStats()[0].addr.sin_port == unicast_port,
+          "only unicast copy acknowledged");
+
+    leader.Stop();
+    member.Stop();
+    unicast.Stop();
 
+    cout << "All tests passed" << endl;
     return 0;
 }